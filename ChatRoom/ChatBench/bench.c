@@ -0,0 +1,413 @@
+/*
+ bench.c - 聊天服务器的负载生成器和扇出延迟测试
+ 打开大量连接（JOIN 后全部订阅同一个频道），其中一部分作为发布者按固定速率发消息，所有连接都接收
+ 每条消息的内容以本次运行的标记和发送时刻开头，接收方据此算出从发布到送达的端到端延迟
+ 接收由完成端口和工作线程完成，每个工作线程有自己的延迟直方图，结束时合并，热路径上没有锁
+ 结果：延迟的 p50/p99/p999/最大值、送达吞吐率、送达比例和被服务器断开的连接数，写入 CSV 的一行并在终端输出
+ */
+
+#define _CRT_SECURE_NO_WARNINGS
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Common/protocol.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define MAX_WORKERS 64
+#define STOP_KEY 1                 // 通知工作线程退出的完成键
+#define TAG_LEN 8                  // 消息内容开头：8 位十六进制的运行标记、'|'、16 位十六进制的发送时刻、'|'
+#define STAMP_LEN (TAG_LEN + 1 + 16 + 1)
+#define LOBBY_LABEL "lobby"          // 没有指定频道时 CSV 中写的频道名
+
+// 延迟直方图（微秒）：128 以下每个值一格，之后每个 2 的幂区间分成 64 格，相对误差不超过约 1.6%
+#define HIST_LINEAR 128
+#define HIST_SUB 64
+#define HIST_BUCKETS (HIST_LINEAR + 57 * HIST_SUB)
+
+// --- 配置 ---
+typedef struct {
+    const char* host;
+    int port;
+    int clients;           // 连接总数，每个连接都接收
+    int ramp;              // 每秒建立的连接数：每个 JOIN 都会向频道里所有人广播一条系统消息，建得太快会把慢的连接挤掉
+    int publishers;        // 其中发消息的连接数
+    double rate;           // 每个发布者每秒发的消息数
+    int size;              // 每条消息内容的字节数
+    double duration_s;     // 测量时间
+    int warmup_ms;         // 连接全部建立后等待的时间：JOIN、历史回放等在这段时间内完成
+    int drain_ms;          // 停止发布后等待最后的消息送达的时间
+    const char* channel;   // 订阅的频道，空表示大厅
+    const char* out_path;  // 结果 CSV，追加写入
+    const char* label;     // 写进 CSV 的标签，用来区分不同的服务器版本
+} BenchConfig;
+
+// --- 连接和统计 ---
+typedef struct {
+    OVERLAPPED overlapped; // 必须是第一个成员：完成包中的 OVERLAPPED* 就是 Connection*
+    WSABUF bufs[2];
+    SOCKET sock;
+    volatile LONG dropped; // 接收或发送失败过，只计一次断开
+    RecvRing ring;
+} Connection;
+
+// 一个工作线程的统计，只由这个线程修改
+typedef struct {
+    long long histogram[HIST_BUCKETS];
+    long long delivered;   // 测量期间发布的消息送达的次数
+    long long max_us;
+} WorkerStats;
+
+HANDLE iocp = NULL;
+char run_tag[TAG_LEN + 1];             // 本次运行的标记，过滤掉历史回放中以前运行的消息
+volatile LONGLONG measure_start = 0;   // 测量开始的时刻（QPC），之前发布的消息不计入
+volatile LONG stopping = 0;
+volatile LONG disconnects = 0;         // 测试期间被关闭的连接数（例如被服务器当作慢速连接断开）
+LARGE_INTEGER qpc_frequency;
+
+long long now_ticks(void) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+// 测试期间第一次发现连接失效时计数
+void mark_dropped(Connection* conn) {
+    if (!stopping && InterlockedExchange(&conn->dropped, 1) == 0) {
+        InterlockedIncrement(&disconnects);
+    }
+}
+
+// --- 延迟直方图 ---
+int msb64(unsigned long long value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+}
+
+int histogram_bucket(unsigned long long us) {
+    if (us < HIST_LINEAR) return (int)us;
+    int shift = msb64(us) - 6;
+    int bucket = HIST_LINEAR + (shift - 1) * HIST_SUB + (int)((us >> shift) - HIST_SUB);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+// 一格代表的延迟：区间的中点
+double histogram_value(int bucket) {
+    if (bucket < HIST_LINEAR) return bucket;
+    int shift = (bucket - HIST_LINEAR) / HIST_SUB + 1;
+    unsigned long long low = (unsigned long long)((bucket - HIST_LINEAR) % HIST_SUB + HIST_SUB) << shift;
+    return (double)low + (double)(1ULL << shift) / 2;
+}
+
+// 第 q 分位（0 < q <= 1）的延迟，没有样本时返回 0
+double histogram_percentile(const long long* histogram, long long total, double q) {
+    long long rank = (long long)(q * total + 0.999999);
+    long long seen = 0;
+    if (total == 0) return 0;
+    if (rank < 1) rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank) return histogram_value(i);
+    }
+    return histogram_value(HIST_BUCKETS - 1);
+}
+
+// --- 接收 ---
+unsigned long long parse_hex(const char* text, int len) {
+    unsigned long long value = 0;
+    for (int i = 0; i < len; i++) {
+        char c = text[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (digit < 0) return 0;
+        value = (value << 4) | (unsigned long long)digit;
+    }
+    return value;
+}
+
+// 记录一个收到的帧：只统计本次运行、测量开始之后发布的聊天消息
+void record_frame(WorkerStats* stats, const Frame* frame) {
+    if (frame->type != FRAME_MSG || frame->content_len < STAMP_LEN || memcmp(frame->content, run_tag, TAG_LEN) != 0) return;
+    long long sent = (long long)parse_hex(frame->content + TAG_LEN + 1, 16);
+    long long start = measure_start;
+    if (start == 0 || sent < start) return;
+    long long elapsed = now_ticks() - sent;
+    unsigned long long us = elapsed > 0 ? (unsigned long long)(elapsed * 1000000.0 / qpc_frequency.QuadPart) : 0;
+    stats->histogram[histogram_bucket(us)]++;
+    stats->delivered++;
+    if ((long long)us > stats->max_us) stats->max_us = (long long)us;
+}
+
+int post_recv(Connection* conn) {
+    DWORD flags = 0;
+    int count = ring_free_bufs(&conn->ring, conn->bufs);
+    if (count == 0) return 0;
+    memset(&conn->overlapped, 0, sizeof(conn->overlapped));
+    if (WSARecv(conn->sock, conn->bufs, count, NULL, &flags, &conn->overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING) {
+        return 0;
+    }
+    return 1;
+}
+
+// 工作线程：切出收到的帧并记录延迟，直到收到 STOP_KEY
+DWORD WINAPI worker_thread(LPVOID arg) {
+    WorkerStats* stats = (WorkerStats*)arg;
+    char scratch[MAX_FRAME_SIZE];
+    while (1) {
+        DWORD len = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = NULL;
+        BOOL ok = GetQueuedCompletionStatus(iocp, &len, &key, &overlapped, INFINITE);
+        if (overlapped == NULL) {
+            if (key == STOP_KEY) break;
+            continue;
+        }
+        Connection* conn = (Connection*)overlapped;
+        int alive = ok && len > 0;
+        if (alive) {
+            Frame frame;
+            int parsed;
+            ring_commit(&conn->ring, len);
+            while ((parsed = frame_next(&conn->ring, scratch, &frame)) == 1) {
+                record_frame(stats, &frame);
+            }
+            alive = parsed == 0 && post_recv(conn);
+        }
+        if (!alive) {
+            mark_dropped(conn);
+        }
+    }
+    return 0;
+}
+
+// --- 连接和发布 ---
+int send_frame(SOCKET sock, int type, const char* sender, const char* target, const char* content, int content_len) {
+    char frame[MAX_FRAME_SIZE];
+    int len = frame_encode(frame, sizeof(frame), type, sender, (int)strlen(sender), target, (int)strlen(target), content, content_len);
+    return len > 0 && send(sock, frame, len, 0) == len;
+}
+
+// 建立一个连接：发 JOIN（和频道的 CHANNEL_JOIN）后关联到完成端口，投递第一个接收请求
+int open_connection(const BenchConfig* config, const struct sockaddr_in* addr, int index, Connection* conn) {
+    char name[32];
+    snprintf(name, sizeof(name), "bench%d", index);
+    conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->sock == INVALID_SOCKET) return 0;
+    if (connect(conn->sock, (const struct sockaddr*)addr, sizeof(*addr)) == SOCKET_ERROR ||
+        !send_frame(conn->sock, FRAME_JOIN, name, "", "", 0) ||
+        (config->channel[0] != '\0' && !send_frame(conn->sock, FRAME_CHANNEL_JOIN, name, config->channel, "", 0)) ||
+        CreateIoCompletionPort((HANDLE)conn->sock, iocp, 0, 0) == NULL || !post_recv(conn)) {
+        closesocket(conn->sock);
+        conn->sock = INVALID_SOCKET;
+        return 0;
+    }
+    return 1;
+}
+
+// 按总速率发布消息，直到测量时间结束；返回成功发出的消息数，已断开的发布者轮到时跳过，不计入
+long long publish(const BenchConfig* config, Connection* conns) {
+    char content[MAX_FRAME_SIZE];
+    char name[32];
+    long long start = now_ticks();
+    long long end = start + (long long)(config->duration_s * qpc_frequency.QuadPart);
+    double total_rate = config->rate * config->publishers;
+    long long scheduled = 0;
+    long long sent = 0;
+
+    memset(content, 'x', sizeof(content));
+    measure_start = start;
+    while (1) {
+        long long now = now_ticks();
+        if (now >= end) break;
+        long long due = (long long)((double)(now - start) * total_rate / qpc_frequency.QuadPart);
+        while (scheduled < due) {
+            int publisher = (int)(scheduled++ % config->publishers);
+            if (conns[publisher].dropped) continue;
+            snprintf(name, sizeof(name), "bench%d", publisher);
+            snprintf(content, STAMP_LEN + 1, "%s|%016llx|", run_tag, (unsigned long long)now_ticks());
+            content[STAMP_LEN] = 'x'; // snprintf 写的 '\0' 换回填充字符
+            if (send_frame(conns[publisher].sock, FRAME_MSG, name, config->channel, content, config->size)) {
+                sent++;
+            }
+            else {
+                mark_dropped(&conns[publisher]);
+            }
+        }
+        Sleep(1);
+    }
+    return sent;
+}
+
+// --- 结果 ---
+void write_csv(const BenchConfig* config, long long published, long long delivered, long long expected,
+    double p50, double p99, double p999, long long max_us) {
+    FILE* file = fopen(config->out_path, "a");
+    if (file == NULL) {
+        printf("Could not open %s\n", config->out_path);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        fprintf(file, "label,clients,publishers,rate_per_publisher,message_bytes,channel,duration_s,published,delivered,expected,"
+            "delivery_ratio,deliveries_per_s,p50_us,p99_us,p999_us,max_us,disconnects\n");
+    }
+    fprintf(file, "%s,%d,%d,%.2f,%d,%s,%.2f,%lld,%lld,%lld,%.4f,%.1f,%.1f,%.1f,%.1f,%lld,%ld\n",
+        config->label, config->clients, config->publishers, config->rate, config->size,
+        config->channel[0] != '\0' ? config->channel : LOBBY_LABEL, config->duration_s, published, delivered, expected,
+        expected > 0 ? (double)delivered / expected : 0, delivered / config->duration_s, p50, p99, p999, max_us, disconnects);
+    fclose(file);
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [--host=127.0.0.1] [--port=8888] [--clients=100] [--ramp=1000] [--publishers=10]\n"
+        "       [--rate=10] [--size=64] [--duration=10] [--warmup=1000] [--drain=1000] [--channel=<name>]\n"
+        "       [--out=chat_bench.csv] [--label=<text>]\n", program);
+}
+
+/*
+ @param argv 可选参数：
+             --host/--port 服务器地址；--clients 连接数；--ramp 每秒建立的连接数（0 表示不限）；--publishers 发布者数；--rate 每个发布者每秒的消息数；
+             --size 消息内容字节数；--duration 测量秒数；--warmup/--drain 测量前后等待的毫秒数；
+             --channel 订阅的频道（默认大厅）；--out 结果 CSV（追加）；--label CSV 中的标签
+ 流程：
+    1. 按 ramp 的速率建立所有连接并发 JOIN，等待 warmup
+    2. 发布 duration 秒，再等待 drain 让最后的消息送达
+    3. 合并各工作线程的直方图，输出并追加一行 CSV
+ */
+int main(int argc, char* argv[]) {
+    BenchConfig config = { "127.0.0.1", 8888, 100, 1000, 10, 10, 64, 10, 1000, 1000, "", "chat_bench.csv", "" };
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--host=", 7) == 0) config.host = arg + 7;
+        else if (strncmp(arg, "--port=", 7) == 0) config.port = atoi(arg + 7);
+        else if (strncmp(arg, "--clients=", 10) == 0) config.clients = atoi(arg + 10);
+        else if (strncmp(arg, "--ramp=", 7) == 0) config.ramp = atoi(arg + 7);
+        else if (strncmp(arg, "--publishers=", 13) == 0) config.publishers = atoi(arg + 13);
+        else if (strncmp(arg, "--rate=", 7) == 0) config.rate = atof(arg + 7);
+        else if (strncmp(arg, "--size=", 7) == 0) config.size = atoi(arg + 7);
+        else if (strncmp(arg, "--duration=", 11) == 0) config.duration_s = atof(arg + 11);
+        else if (strncmp(arg, "--warmup=", 9) == 0) config.warmup_ms = atoi(arg + 9);
+        else if (strncmp(arg, "--drain=", 8) == 0) config.drain_ms = atoi(arg + 8);
+        else if (strncmp(arg, "--channel=", 10) == 0) config.channel = arg + 10;
+        else if (strncmp(arg, "--out=", 6) == 0) config.out_path = arg + 6;
+        else if (strncmp(arg, "--label=", 8) == 0) config.label = arg + 8;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    int max_size = MAX_FRAME_SIZE - FRAME_HEADER_SIZE - 16 - (int)strlen(config.channel);
+    if (config.clients < 1 || config.publishers < 1 || config.publishers > config.clients || config.ramp < 0 || config.rate <= 0 ||
+        config.size < STAMP_LEN || config.size > max_size || config.duration_s <= 0 || strlen(config.channel) > MAX_CHANNEL_LEN) {
+        printf("Invalid options: need 1 <= publishers <= clients, ramp >= 0, rate > 0, duration > 0, %d <= size <= %d, channel <= %d bytes\n",
+            STAMP_LEN, max_size, MAX_CHANNEL_LEN);
+        return 1;
+    }
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("WSAStartup failed.\n");
+        return 1;
+    }
+    QueryPerformanceFrequency(&qpc_frequency);
+    snprintf(run_tag, sizeof(run_tag), "%08lx", (unsigned long)((now_ticks() ^ GetTickCount()) & 0xFFFFFFFF));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons((u_short)config.port);
+    if (inet_pton(AF_INET, config.host, &server_addr.sin_addr) != 1) {
+        printf("Invalid host address %s\n", config.host);
+        return 1;
+    }
+
+    // 完成端口和工作线程：每个线程一份统计
+    iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int worker_count = (int)info.dwNumberOfProcessors;
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > MAX_WORKERS) worker_count = MAX_WORKERS;
+    WorkerStats* stats = (WorkerStats*)calloc(worker_count, sizeof(WorkerStats));
+    Connection* conns = (Connection*)calloc(config.clients, sizeof(Connection));
+    HANDLE workers[MAX_WORKERS];
+    if (iocp == NULL || stats == NULL || conns == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        workers[i] = CreateThread(NULL, 0, worker_thread, &stats[i], 0, NULL);
+        if (workers[i] == NULL) {
+            printf("CreateThread failed.\n");
+            return 1;
+        }
+    }
+
+    // 1. 建立连接
+    long long connect_start = now_ticks();
+    for (int i = 0; i < config.clients; i++) {
+        if (config.ramp > 0) {
+            long long due = connect_start + (long long)i * qpc_frequency.QuadPart / config.ramp;
+            long long now = now_ticks();
+            if (due > now) Sleep((DWORD)((due - now) * 1000 / qpc_frequency.QuadPart));
+        }
+        if (!open_connection(&config, &server_addr, i, &conns[i])) {
+            printf("Connection %d to %s:%d failed (error %d)\n", i, config.host, config.port, WSAGetLastError());
+            return 1;
+        }
+    }
+    printf("Connected %d clients in %.2f s, run %s\n", config.clients,
+        (double)(now_ticks() - connect_start) / qpc_frequency.QuadPart, run_tag);
+    fflush(stdout);
+    Sleep(config.warmup_ms);
+
+    // 2. 发布并等待送达
+    long long published = publish(&config, conns);
+    Sleep(config.drain_ms);
+
+    // 3. 停止工作线程后合并统计，再关闭连接
+    InterlockedExchange(&stopping, 1);
+    for (int i = 0; i < worker_count; i++) {
+        PostQueuedCompletionStatus(iocp, 0, STOP_KEY, NULL);
+    }
+    WaitForMultipleObjects(worker_count, workers, TRUE, INFINITE);
+    long long* histogram = (long long*)calloc(HIST_BUCKETS, sizeof(long long));
+    long long delivered = 0;
+    long long max_us = 0;
+    if (histogram == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        for (int b = 0; b < HIST_BUCKETS; b++) histogram[b] += stats[i].histogram[b];
+        delivered += stats[i].delivered;
+        if (stats[i].max_us > max_us) max_us = stats[i].max_us;
+    }
+    for (int i = 0; i < config.clients; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench%d", i);
+        send_frame(conns[i].sock, FRAME_QUIT, name, "", "", 0);
+        closesocket(conns[i].sock);
+    }
+
+    long long expected = published * (config.clients - 1); // 每条消息发给频道里除发布者以外的所有连接
+    double p50 = histogram_percentile(histogram, delivered, 0.50);
+    double p99 = histogram_percentile(histogram, delivered, 0.99);
+    double p999 = histogram_percentile(histogram, delivered, 0.999);
+    printf("Published %lld messages (%.1f/s), delivered %lld of %lld (%.2f%%), %.1f deliveries/s\n",
+        published, published / config.duration_s, delivered, expected,
+        expected > 0 ? 100.0 * delivered / expected : 0, delivered / config.duration_s);
+    printf("Fan-out latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %lld us; %ld connections dropped\n",
+        p50, p99, p999, max_us, disconnects);
+    write_csv(&config, published, delivered, expected, p50, p99, p999, max_us);
+    printf("Results appended to %s\n", config.out_path);
+
+    CloseHandle(iocp);
+    WSACleanup();
+    return 0;
+}
@@ -6,14 +6,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../Common/protocol.h"
+#include "../../cn_lab2/rdt/rdt_api.h"
 
 #pragma comment(lib, "ws2_32.lib")
 
 #define PORT 8888
 #define BUF_SIZE 1024
+#define RDT_CONNECT_TIMEOUT_MS 5000  // 可靠 UDP 握手的最长等待时间
+#define RDT_FLUSH_TIMEOUT_MS 5000    // JOIN 之后、QUIT 之前等待已发出的帧全部送达的最长时间
 
 SOCKET sock;
-char name[50];
+rdt_endpoint* rdt_ep = NULL;  // 使用 --rdt 启动时的可靠 UDP 端点，NULL 表示使用 TCP
+rdt_handle rdt_conn = 0;
+volatile LONG quitting = 0;   // 用户输入了 /quit，连接关闭不再提示断开
+char name[MAX_NAME_LEN + 1];
+char channel[MAX_CHANNEL_LEN + 1]; // 当前频道，普通输入发到这里；空表示大厅
 
 // 统一的输出函数，直接使用 printf，依赖用户设置 chcp 65001
 void safe_print(const char* str) {
@@ -21,55 +29,71 @@ void safe_print(const char* str) {
     fflush(stdout);
 }
 
-DWORD WINAPI recv_handler(LPVOID arg) {
-    char buffer[BUF_SIZE];
-    char type[5], sender[50], content[BUF_SIZE];
-
-    while (1) {
-        int len = recv(sock, buffer, BUF_SIZE - 1, 0);
-        if (len <= 0) break;
-        buffer[len] = '\0';
-
-        // 解析消息
-        char* token_ctx = NULL;
-        char temp_buffer[BUF_SIZE];
-        strncpy(temp_buffer, buffer, BUF_SIZE);
-        temp_buffer[BUF_SIZE - 1] = '\0';
-
-        char* msg_type = strtok_s(temp_buffer, "|", &token_ctx);
-        if (msg_type == NULL) goto skip_print;
-
-        char* msg_sender = strtok_s(NULL, "|", &token_ctx);
-        if (msg_sender == NULL) goto skip_print;
-
-        char* msg_content = strtok_s(NULL, "\n", &token_ctx);
-        if (msg_content == NULL) goto skip_print;
-
-        strncpy(type, msg_type, sizeof(type) - 1);
-        type[sizeof(type) - 1] = '\0';
-
-        strncpy(sender, msg_sender, sizeof(sender) - 1);
-        sender[sizeof(sender) - 1] = '\0';
+// 打印一个帧：昵称和内容直接指向接收缓冲区，用 %.*s 按长度输出，不复制
+void print_frame(const Frame* frame) {
+    if (frame->type == FRAME_SYS) {
+        printf("[系统消息] %.*s\n", frame->content_len, frame->content);
+    }
+    else if (frame->type == FRAME_MSG && (frame->target_len == 0 || (frame->target_len == 5 && memcmp(frame->target, "lobby", 5) == 0))) {
+        printf("[%.*s]: %.*s\n", frame->sender_len, frame->sender, frame->content_len, frame->content);
+    }
+    else if (frame->type == FRAME_MSG) {
+        printf("[#%.*s] [%.*s]: %.*s\n", frame->target_len, frame->target, frame->sender_len, frame->sender, frame->content_len, frame->content);
+    }
+    else if (frame->type == FRAME_DIRECT) {
+        printf("[私信] [%.*s]: %.*s\n", frame->sender_len, frame->sender, frame->content_len, frame->content);
+    }
+    else {
+        printf("Unknown frame type %d\n", frame->type);
+    }
+    fflush(stdout);
+}
 
-        strncpy(content, msg_content, sizeof(content) - 1);
-        content[sizeof(content) - 1] = '\0';
+// RDT 的接收：传输层按消息交付，每条消息恰好是一个帧，不需要环形缓冲区
+void rdt_recv_loop(void) {
+    char data[MAX_FRAME_SIZE];
+    Frame frame;
 
-        // 打印消息
-        if (strcmp(type, "SYS") == 0) {
-            printf("[系统消息] %s\n", content);
+    while (1) {
+        rdt_event ev;
+        int type = rdt_recv(rdt_ep, &ev, data, sizeof(data), -1);
+        if (type == RDT_CLOSED) break;
+        if (type != RDT_MESSAGE) continue;
+        if (ev.len == 0 || ev.len > (int)sizeof(data) || frame_parse(data, ev.len, &frame) != ev.len) {
+            safe_print("收到格式错误的数据\n");
+            break;
         }
-        else if (strcmp(type, "MSG") == 0) {
-            printf("[%s]: %s\n", sender, content);
+        print_frame(&frame);
+    }
+}
+
+// 接收线程：收到的字节放进环形缓冲区，每次接收后切出所有完整的帧，半个帧留到下次
+DWORD WINAPI recv_handler(LPVOID arg) {
+    static RecvRing ring;
+    char scratch[MAX_FRAME_SIZE];
+    WSABUF bufs[2];
+    Frame frame;
+
+    while (rdt_ep == NULL) {
+        DWORD len = 0;
+        DWORD flags = 0;
+        int count = ring_free_bufs(&ring, bufs);
+        if (count == 0 || WSARecv(sock, bufs, count, &len, &flags, NULL, NULL) == SOCKET_ERROR || len == 0) break;
+        ring_commit(&ring, len);
+
+        int parsed;
+        while ((parsed = frame_next(&ring, scratch, &frame)) == 1) {
+            print_frame(&frame);
         }
-        else {
-            printf("Raw: %s\n", buffer);
+        if (parsed < 0) {
+            safe_print("收到格式错误的数据\n");
+            break;
         }
-        fflush(stdout);
-        continue;
+    }
 
-    skip_print:
-        printf("Unparsed: %s\n", buffer);
-        fflush(stdout);
+    if (rdt_ep != NULL) {
+        rdt_recv_loop();
+        if (quitting) return 0;
     }
 
     // 退出提示：使用 printf
@@ -77,7 +101,26 @@ DWORD WINAPI recv_handler(LPVOID arg) {
     exit(0);
 }
 
-int main() {
+// 编码并发送一个帧，发送者是自己的昵称；target 是频道名或私信接收者的昵称
+void send_frame(int type, const char* target, const char* content) {
+    char frame[MAX_FRAME_SIZE];
+    int len = frame_encode(frame, sizeof(frame), type, name, (int)strlen(name), target, (int)strlen(target), content, (int)strlen(content));
+    if (len > 0 && rdt_ep != NULL) {
+        // 每个频道和私信各走一个有序流，/join 和之后发到这个频道的消息在同一个流中不会颠倒；
+        // JOIN 要在所有帧之前、QUIT 要在所有帧之后处理，所以 JOIN 发出后、QUIT 发出前等已发出的帧都被服务器收到
+        if (type == FRAME_QUIT) rdt_flush(rdt_ep, rdt_conn, RDT_FLUSH_TIMEOUT_MS);
+        rdt_send(rdt_ep, rdt_conn, frame, len, frame_stream(frame, RDT_STREAMS));
+        if (type == FRAME_JOIN) rdt_flush(rdt_ep, rdt_conn, RDT_FLUSH_TIMEOUT_MS);
+    }
+    else if (len > 0) {
+        send(sock, frame, len, 0);
+    }
+}
+
+// 使用 --rdt 启动时通过可靠 UDP 传输（cn_lab2/rdt）连接服务器，否则使用 TCP
+int main(int argc, char* argv[]) {
+    int use_rdt = argc > 1 && strcmp(argv[1], "--rdt") == 0;
+
     // 设置控制台编码为UTF-8 (必需)
     SetConsoleOutputCP(CP_UTF8);
     SetConsoleCP(CP_UTF8);
@@ -96,29 +139,38 @@ int main() {
         return 1;
     }
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == INVALID_SOCKET) {
-        safe_print("创建socket失败\n");
-        WSACleanup();
-        return 1;
+    if (use_rdt) {
+        rdt_ep = rdt_open(0);
+        rdt_conn = rdt_ep != NULL ? rdt_connect(rdt_ep, "127.0.0.1", PORT, RDT_CONNECT_TIMEOUT_MS) : 0;
+        if (rdt_conn == 0) {
+            safe_print("连接服务器失败\n");
+            if (rdt_ep != NULL) rdt_destroy(rdt_ep);
+            WSACleanup();
+            return 1;
+        }
     }
+    else {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == INVALID_SOCKET) {
+            safe_print("创建socket失败\n");
+            WSACleanup();
+            return 1;
+        }
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    InetPton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+        struct sockaddr_in server_addr;
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(PORT);
+        InetPton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
 
-    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-        safe_print("连接服务器失败\n");
-        closesocket(sock);
-        WSACleanup();
-        return 1;
+        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+            safe_print("连接服务器失败\n");
+            closesocket(sock);
+            WSACleanup();
+            return 1;
+        }
     }
 
-    // --- 协议修复：JOIN 消息必须以 \n 结束 ---
-    char msg[BUF_SIZE];
-    snprintf(msg, sizeof(msg), "JOIN|%s|\n", name); // 加上 \n
-    send(sock, msg, (int)strlen(msg), 0);
+    send_frame(FRAME_JOIN, "", "");
 
     HANDLE hThread = CreateThread(NULL, 0, recv_handler, NULL, 0, NULL);
     if (hThread == NULL) {
@@ -127,9 +179,9 @@ int main() {
         WSACleanup();
         return 1;
     }
-    CloseHandle(hThread);
 
     safe_print("已连接服务器，可输入消息\n");
+    safe_print("命令：/join 频道  /leave [频道]  /msg 昵称 内容  /quit\n");
 
     // 消息发送循环
     while (1) {
@@ -141,18 +193,56 @@ int main() {
         content[strcspn(content, "\n")] = '\0';
 
         if (strcmp(content, "/quit") == 0) {
-            // --- 协议修复：QUIT 消息必须以 \n 结束 ---
-            snprintf(msg, sizeof(msg), "QUIT|%s|\n", name); // 加上 \n
-            send(sock, msg, (int)strlen(msg), 0);
+            InterlockedExchange(&quitting, 1); // 服务器收到 QUIT 后关闭连接，接收线程不再提示断开
+            send_frame(FRAME_QUIT, "", "");
             break;
         }
 
-        // MSG 协议已包含 \n
-        snprintf(msg, sizeof(msg), "MSG|%s|%s\n", name, content);
-        send(sock, msg, (int)strlen(msg), 0);
+        // /join 频道：加入并切换到这个频道
+        if (strncmp(content, "/join ", 6) == 0) {
+            strncpy(channel, content + 6, MAX_CHANNEL_LEN);
+            channel[MAX_CHANNEL_LEN] = '\0';
+            send_frame(FRAME_CHANNEL_JOIN, channel, "");
+            continue;
+        }
+
+        // /leave [频道]：离开指定的频道（默认当前频道），离开当前频道后回到大厅
+        if (strcmp(content, "/leave") == 0 || strncmp(content, "/leave ", 7) == 0) {
+            const char* target = content[6] == ' ' ? content + 7 : channel;
+            send_frame(FRAME_CHANNEL_LEAVE, target, "");
+            if (strcmp(target, channel) == 0) channel[0] = '\0';
+            continue;
+        }
+
+        // /msg 昵称 内容：私信
+        if (strncmp(content, "/msg ", 5) == 0) {
+            char* target = content + 5;
+            char* text = strchr(target, ' ');
+            if (text == NULL) {
+                safe_print("用法：/msg 昵称 内容\n");
+                continue;
+            }
+            *text++ = '\0';
+            send_frame(FRAME_DIRECT, target, text);
+            continue;
+        }
+
+        send_frame(FRAME_MSG, channel, content);
     }
 
-    closesocket(sock);
+    if (rdt_ep != NULL) {
+        // 关闭之前已经发出的 QUIT 仍会送达；等接收线程看到连接关闭再释放端点
+        // 传输层保证 rdt_close 之后一定会交付 RDT_CLOSED（对端不响应时由空闲超时关闭），接收线程一定会退出；
+        // 限时等待可能在接收线程仍在 rdt_recv 中时销毁端点
+        InterlockedExchange(&quitting, 1);
+        rdt_close(rdt_ep, rdt_conn);
+        WaitForSingleObject(hThread, INFINITE);
+        rdt_destroy(rdt_ep);
+    }
+    else {
+        closesocket(sock);
+    }
+    CloseHandle(hThread);
     WSACleanup();
     // 退出提示：使用 printf
     safe_print("已退出聊天\n");
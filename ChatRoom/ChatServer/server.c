@@ -6,12 +6,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../Common/protocol.h"
+#include "../../cn_lab2/rdt/rdt_api.h"
 
 #pragma comment(lib, "ws2_32.lib")
 
-#define PORT 8888
-#define MAX_CLIENTS 100
+#define PORT 8888                  // TCP 监听端口，可靠 UDP 传输（cn_lab2/rdt）使用同一个 UDP 端口
 #define BUF_SIZE 1024
+#define INITIAL_NAME_BUCKETS 64    // 昵称索引的初始桶数，之后按需翻倍
+#define INITIAL_CHANNEL_MEMBERS 8  // 频道成员数组的初始容量，之后按需翻倍
+#define CHANNEL_BUCKETS 256        // 频道表的桶数
+#define MAX_CHANNELS 1024          // 最多创建的频道数
+#define CLIENT_CHANNELS 16         // 一个连接最多同时加入的频道数（含大厅）
+#define HISTORY_SIZE 50            // 每个频道保留的最近消息数，加入频道时回放
+#define HISTORY_LOG_FILE "chat_history.log" // 历史日志：追加写入的原始帧，启动时读回
+#define HISTORY_LOG_COMPACT_SIZE (64 << 20) // 历史日志超过这个大小、且达到上次压缩后的两倍时，后台线程用各频道的最近消息重写
+#define HISTORY_LOG_TEMP HISTORY_LOG_FILE ".tmp" // 重写时的临时文件，写完后替换历史日志
+#define HISTORY_LOAD_CHUNK (1 << 20)        // 启动时每次读入的历史日志字节数
+#define MAX_WORKERS 64             // 工作线程数上限（默认与CPU核数相同）
+#define SEND_QUEUE_LIMIT 256       // 每个连接最多排队的消息数，超过说明对方长时间不读
+#define SEND_BATCH 64              // 一个 WSASend 请求最多合并的消息数，不少于 HISTORY_SIZE + 1，历史回放一次发完
+#define SLOW_CLIENT_DISCONNECT 1   // 队列满时：1 断开这个连接，0 丢弃发给它的新消息
 
 // --- 全局控制台句柄和辅助函数 ---
 HANDLE hConsole = NULL;
@@ -42,30 +57,920 @@ void write_wconsole(const char* utf8_str) {
 
 
 // --- 结构体和全局变量 ---
+// 一条要转发的消息：只编码一次，所有接收者的发送队列共享同一块缓冲区，不再逐个复制
+// 放进队列后内容不再修改；引用计数降到 0 时释放
 typedef struct {
+    volatile LONG refs;
+    int log_generation; // 压缩时写进了第几代历史日志，之后不再重复追加；只在持有 history_log_lock 时访问
+    int len;
+    char data[1]; // 实际长度为 len
+} Message;
+
+typedef struct Channel Channel;
+
+// 每个连接一个 Client，接收缓冲区和发送队列都内嵌在结构体中，每个连接的内存固定为 sizeof(Client)（约 7.5KB），不再占用线程栈
+typedef struct Client {
+    OVERLAPPED recv_overlapped;
+    OVERLAPPED send_overlapped;
+    WSABUF recv_bufs[2];
+    WSABUF send_bufs[SEND_BATCH];
     SOCKET sock;
-    char name[50]; // 存储 UTF-8 编码的昵称
+    rdt_handle rdt;        // 可靠 UDP 连接的句柄，0 表示 TCP 连接（这时 sock 有效）
+    int joined;            // 已经收到 JOIN，登记在昵称索引中
+    struct Client* name_next; // 昵称索引中同一个桶的下一个连接（由 names_lock 保护）
+    volatile LONG refs;    // 接收一方持有一个引用，发送请求未完成时再持有一个，降到 0 时释放
+    char name[MAX_NAME_LEN + 1]; // 存储 UTF-8 编码的昵称，同时登记的昵称各不相同
+    RecvRing ring;         // 接收环形缓冲区，同一时刻每个连接只有一个接收请求，收到的字节在这里切成帧
+
+    // 加入的频道：只由这个连接的接收一方修改，空位为 NULL
+    Channel* channels[CLIENT_CHANNELS];
+    int member_index[CLIENT_CHANNELS]; // 在对应频道成员数组中的下标（由那个频道的锁保护）
+
+    // 发送队列（由 send_lock 保护）：环形数组，同一时刻最多一个 WSASend 请求
+    SRWLOCK send_lock;
+    Message* queue[SEND_QUEUE_LIMIT];
+    int queue_head;
+    int queue_count;
+    int send_offset;       // 队首消息已经发出的字节数
+    int sending;           // 未完成的 WSASend 包含的消息数，0 表示空闲
+    int closing;           // 已经要关闭，不再排队新消息
+    int too_slow;          // 因为队列满被断开
+    int dropped;           // 队列满时丢弃的消息数
 } Client;
 
-Client clients[MAX_CLIENTS];
+// 频道里的一个成员：slot 是这个频道在 client->channels 中的位置
+typedef struct {
+    Client* client;
+    int slot;
+} Member;
+
+// 一个频道和它的订阅者集合。成员数组由频道自己的锁保护，加入和离开只锁这一个频道
+// 最近的消息留在 history 环形数组中，引用计数共享的 Message 直接留下，不复制
+struct Channel {
+    Channel* next;         // 频道表中同一个桶的下一个频道
+    char name[MAX_CHANNEL_LEN + 1];
+    SRWLOCK lock;          // 向频道广播持共享锁，加入和离开持独占锁
+    Member* members;       // 按需翻倍，离开时用最后一个成员填补空位
+    int member_count;
+    int member_capacity;
+    SRWLOCK history_lock;  // 同时广播的线程之间保护 history（持有 lock 的共享锁时再取独占锁）
+    Message* history[HISTORY_SIZE];
+    int history_head;      // 最早的一条
+    int history_count;
+};
+
+// 昵称索引：按昵称哈希的链表桶，也是在线连接的登记表。查找持共享锁，登记和注销持独占锁
+Client** name_buckets = NULL;
+int name_bucket_count = 0; // 2 的幂，连接数超过桶数时翻倍
 int client_count = 0;
-CRITICAL_SECTION cs; // 线程同步
+SRWLOCK names_lock = SRWLOCK_INIT;
+
+// 频道表：频道创建后一直保留。查找持共享锁，创建持独占锁
+Channel* channel_buckets[CHANNEL_BUCKETS];
+int channel_count = 0;
+SRWLOCK channels_lock = SRWLOCK_INIT;
+Channel* lobby = NULL;     // 大厅：每个连接加入后自动订阅，目标为空的消息发到这里
+
+// 历史日志：只追加，频道里的每条聊天消息都原样写入一个帧；以下变量都只在持有 history_log_lock 时访问
+HANDLE history_log = INVALID_HANDLE_VALUE;
+SRWLOCK history_log_lock = SRWLOCK_INIT;
+long long history_log_size = 0;      // 日志当前的字节数
+long long history_log_compacted = 0; // 上次压缩（或启动）后的字节数
+int history_log_generation = 0;      // 压缩成功的次数，每次压缩后的日志是新的一代
+// 运行中的压缩由 history_compactor 线程完成：快照各频道的最近消息后在锁外重写，期间追加的消息另记在 history_tail 中，替换前补写
+HANDLE history_compact_event = NULL; // 需要压缩时唤醒压缩线程；创建失败时运行中不压缩
+int history_compact_state = 0;       // 0 空闲，1 已唤醒压缩线程，2 正在重写（追加的消息同时记进 history_tail）
+Message** history_tail = NULL;       // 重写期间追加、不在快照中的消息，各持有一个引用
+int history_tail_count = 0;
+int history_tail_capacity = 0;
+int history_tail_lost = 0;           // 内存不足，有消息没能记进 history_tail，这次压缩作废
+
+HANDLE iocp = NULL; // 所有客户端套接字关联到同一个完成端口，完成键就是 Client*
+rdt_endpoint* rdt_ep = NULL; // 可靠 UDP 传输的端点，所有 RDT 连接共用；打开失败时只接受 TCP 连接
 
 // --- 函数声明 ---
-DWORD WINAPI handle_client(LPVOID arg);
+DWORD WINAPI worker_thread(LPVOID arg);
+DWORD WINAPI rdt_thread(LPVOID arg);
+DWORD WINAPI history_compactor(LPVOID arg);
+
+// --- 共享消息缓冲区 ---
+// 复制一段已经编码好的帧，引用计数为 1
+Message* message_create(const char* data, int len) {
+    Message* message = (Message*)malloc(sizeof(Message) + len);
+    if (message == NULL) return NULL;
+    message->refs = 1;
+    message->log_generation = 0;
+    message->len = len;
+    memcpy(message->data, data, len);
+    return message;
+}
+
+// 把一个帧直接编码进新的 Message，引用计数为 1；帧太长或内存不足时返回 NULL
+Message* message_frame(int type, const char* sender, const char* target, int target_len, const char* content, int content_len) {
+    int size = FRAME_HEADER_SIZE + (int)strlen(sender) + target_len + content_len;
+    Message* message = (Message*)malloc(sizeof(Message) + size);
+    if (message == NULL) return NULL;
+    message->refs = 1;
+    message->log_generation = 0;
+    message->len = frame_encode(message->data, size, type, sender, (int)strlen(sender), target, target_len, content, content_len);
+    if (message->len < 0) {
+        free(message);
+        return NULL;
+    }
+    return message;
+}
+
+void message_release(Message* message) {
+    if (InterlockedDecrement(&message->refs) == 0) {
+        free(message);
+    }
+}
+
+// 释放对连接的一个引用，最后一个引用释放时丢弃队列中剩余的消息
+void client_release(Client* client) {
+    if (InterlockedDecrement(&client->refs) != 0) return;
+    while (client->queue_count > 0) {
+        message_release(client->queue[client->queue_head]);
+        client->queue_head = (client->queue_head + 1) % SEND_QUEUE_LIMIT;
+        client->queue_count--;
+    }
+    free(client);
+}
+
+// --- 发送队列 ---
+// 把队首的若干条消息合并进一个 WSASend 请求；调用时持有 send_lock，且没有未完成的发送请求
+void start_send(Client* client) {
+    int count = client->queue_count < SEND_BATCH ? client->queue_count : SEND_BATCH;
+    for (int i = 0; i < count; i++) {
+        Message* message = client->queue[(client->queue_head + i) % SEND_QUEUE_LIMIT];
+        int offset = i == 0 ? client->send_offset : 0;
+        client->send_bufs[i].buf = message->data + offset;
+        client->send_bufs[i].len = message->len - offset;
+    }
+    memset(&client->send_overlapped, 0, sizeof(client->send_overlapped));
+    client->sending = count;
+    InterlockedIncrement(&client->refs); // 调用者也持有引用，这里不会降到 0
+    if (WSASend(client->sock, client->send_bufs, count, NULL, 0, &client->send_overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING) {
+        client->sending = 0;
+        client->closing = 1;
+        InterlockedDecrement(&client->refs);
+        CancelIoEx((HANDLE)client->sock, NULL); // 让接收请求出错返回，由接收一方关闭连接
+    }
+}
+
+// RDT 连接：每条消息交给传输层作为一条消息发出，传输层自己排队和重传；发送队列满同样按 SLOW_CLIENT_DISCONNECT 处理
+// 每个频道和私信各走一个有序流（frame_stream）：历史回放在之后的新消息之前、同一频道的消息不颠倒，一个丢包不耽误其他频道
+// 调用时持有 send_lock
+void rdt_enqueue(Client* client, Message** messages, int count) {
+    for (int i = 0; i < count; i++) {
+        int result = rdt_send(rdt_ep, client->rdt, messages[i]->data, messages[i]->len, frame_stream(messages[i]->data, RDT_STREAMS));
+        if (result == RDT_CONN_CLOSED) {
+            client->closing = 1; // 连接已经断开，随后的 RDT_CLOSED 事件由 rdt_thread 关闭它
+            return;
+        }
+        if (result != RDT_OK) {
+            if (SLOW_CLIENT_DISCONNECT) {
+                client->closing = 1;
+                client->too_slow = 1;
+                rdt_close(rdt_ep, client->rdt);
+            }
+            else {
+                client->dropped += count - i;
+            }
+            return;
+        }
+    }
+}
+
+// 把一批消息放进一个连接的发送队列，不等待网络；队列空闲时这一批合并在一个 WSASend 请求中发出
+// 队列已满说明对方长时间不读，按 SLOW_CLIENT_DISCONNECT 处理
+void enqueue_messages(Client* client, Message** messages, int count) {
+    int slow = 0;
+    AcquireSRWLockExclusive(&client->send_lock);
+    if (client->closing) {
+        ReleaseSRWLockExclusive(&client->send_lock);
+        return;
+    }
+    if (client->rdt != 0) {
+        rdt_enqueue(client, messages, count);
+        ReleaseSRWLockExclusive(&client->send_lock);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (client->queue_count == SEND_QUEUE_LIMIT) {
+            if (SLOW_CLIENT_DISCONNECT) {
+                client->closing = 1;
+                client->too_slow = 1;
+                slow = 1;
+            }
+            else {
+                client->dropped += count - i;
+            }
+            break;
+        }
+        InterlockedIncrement(&messages[i]->refs);
+        client->queue[(client->queue_head + client->queue_count) % SEND_QUEUE_LIMIT] = messages[i];
+        client->queue_count++;
+    }
+    if (!client->sending && !client->closing && client->queue_count > 0) {
+        start_send(client);
+    }
+    ReleaseSRWLockExclusive(&client->send_lock);
+    if (slow) {
+        CancelIoEx((HANDLE)client->sock, NULL);
+    }
+}
+
+void enqueue_message(Client* client, Message* message) {
+    enqueue_messages(client, &message, 1);
+}
+
+// 发送请求完成：移出已经发完的消息，队列里还有消息时接着发
+void send_completed(Client* client, BOOL ok, DWORD len) {
+    Message* done[SEND_BATCH];
+    int done_count = 0;
+    AcquireSRWLockExclusive(&client->send_lock);
+    if (!ok) {
+        client->closing = 1;
+    }
+    else {
+        while (len > 0 && client->queue_count > 0) {
+            Message* message = client->queue[client->queue_head];
+            DWORD remaining = (DWORD)(message->len - client->send_offset);
+            if (len < remaining) {
+                client->send_offset += (int)len; // 只发出了一部分，剩下的下次从这里接着发
+                break;
+            }
+            len -= remaining;
+            done[done_count++] = message;
+            client->queue_head = (client->queue_head + 1) % SEND_QUEUE_LIMIT;
+            client->queue_count--;
+            client->send_offset = 0;
+        }
+    }
+    client->sending = 0;
+    if (!client->closing && client->queue_count > 0) {
+        start_send(client);
+    }
+    ReleaseSRWLockExclusive(&client->send_lock);
+
+    for (int i = 0; i < done_count; i++) {
+        message_release(done[i]);
+    }
+    if (!ok) {
+        CancelIoEx((HANDLE)client->sock, NULL);
+    }
+    client_release(client); // 这个发送请求持有的引用
+}
+
+// 给一个连接发一条系统消息
+void send_system(Client* client, const char* channel, int channel_len, const char* text) {
+    Message* message = message_frame(FRAME_SYS, "Server", channel, channel_len, text, (int)strlen(text));
+    if (message == NULL) return;
+    enqueue_message(client, message);
+    message_release(message);
+}
+
+// --- 昵称索引 ---
+unsigned int name_hash(const char* name, int len) {
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// 按昵称查找在线的连接；调用时持有 names_lock
+Client* find_client_locked(const char* name, int len) {
+    if (name_bucket_count == 0) return NULL;
+    for (Client* client = name_buckets[name_hash(name, len) & (name_bucket_count - 1)]; client != NULL; client = client->name_next) {
+        if ((int)strlen(client->name) == len && memcmp(client->name, name, len) == 0) return client;
+    }
+    return NULL;
+}
+
+// 登记到昵称索引，昵称已被占用时在后面加序号；连接数超过桶数时桶数翻倍。内存不足时返回 0
+int add_client(Client* client) {
+    char base[MAX_NAME_LEN + 1];
+    strcpy(base, client->name);
+    AcquireSRWLockExclusive(&names_lock);
+    if (client_count >= name_bucket_count) {
+        int count = name_bucket_count > 0 ? name_bucket_count * 2 : INITIAL_NAME_BUCKETS;
+        Client** buckets = (Client**)calloc(count, sizeof(Client*));
+        if (buckets == NULL) {
+            ReleaseSRWLockExclusive(&names_lock);
+            return 0;
+        }
+        for (int i = 0; i < name_bucket_count; i++) {
+            Client* next;
+            for (Client* moved = name_buckets[i]; moved != NULL; moved = next) {
+                unsigned int bucket = name_hash(moved->name, (int)strlen(moved->name)) & (count - 1);
+                next = moved->name_next;
+                moved->name_next = buckets[bucket];
+                buckets[bucket] = moved;
+            }
+        }
+        free(name_buckets);
+        name_buckets = buckets;
+        name_bucket_count = count;
+    }
+    for (int n = 2; find_client_locked(client->name, (int)strlen(client->name)) != NULL; n++) {
+        char suffix[16];
+        int suffix_len = snprintf(suffix, sizeof(suffix), "(%d)", n);
+        int base_len = (int)strlen(base);
+        if (base_len > MAX_NAME_LEN - suffix_len) base_len = MAX_NAME_LEN - suffix_len;
+        memcpy(client->name, base, base_len);
+        strcpy(client->name + base_len, suffix);
+    }
+    unsigned int bucket = name_hash(client->name, (int)strlen(client->name)) & (name_bucket_count - 1);
+    client->name_next = name_buckets[bucket];
+    name_buckets[bucket] = client;
+    client_count++;
+    client->joined = 1;
+    ReleaseSRWLockExclusive(&names_lock);
+    return 1;
+}
+
+// 从昵称索引中注销。返回后不会再有私信发给这个连接
+void remove_client(Client* client) {
+    AcquireSRWLockExclusive(&names_lock);
+    if (client->joined) {
+        Client** link = &name_buckets[name_hash(client->name, (int)strlen(client->name)) & (name_bucket_count - 1)];
+        while (*link != client) link = &(*link)->name_next;
+        *link = client->name_next;
+        client_count--;
+        client->joined = 0;
+    }
+    ReleaseSRWLockExclusive(&names_lock);
+}
+
+// --- 频道 ---
+// 调用时持有 channels_lock
+Channel* find_channel_locked(unsigned int bucket, const char* name, int len) {
+    for (Channel* channel = channel_buckets[bucket]; channel != NULL; channel = channel->next) {
+        if ((int)strlen(channel->name) == len && memcmp(channel->name, name, len) == 0) return channel;
+    }
+    return NULL;
+}
+
+// 查找频道，create 为真且频道不存在时创建；频道数达到 MAX_CHANNELS 或内存不足时返回 NULL
+Channel* find_channel(const char* name, int len, int create) {
+    unsigned int bucket = name_hash(name, len) % CHANNEL_BUCKETS;
+    Channel* channel;
+    AcquireSRWLockShared(&channels_lock);
+    channel = find_channel_locked(bucket, name, len);
+    ReleaseSRWLockShared(&channels_lock);
+    if (channel != NULL || !create) return channel;
+
+    AcquireSRWLockExclusive(&channels_lock);
+    channel = find_channel_locked(bucket, name, len); // 其他线程可能刚刚创建了同名频道
+    if (channel == NULL && channel_count < MAX_CHANNELS) {
+        channel = (Channel*)calloc(1, sizeof(Channel));
+        if (channel != NULL) {
+            memcpy(channel->name, name, len);
+            InitializeSRWLock(&channel->lock);
+            channel->next = channel_buckets[bucket];
+            channel_buckets[bucket] = channel;
+            channel_count++;
+        }
+    }
+    ReleaseSRWLockExclusive(&channels_lock);
+    return channel;
+}
+
+// 频道在 client->channels 中的位置，不是成员时返回 -1；channel 为 NULL 时找一个空位
+int channel_slot(Client* client, Channel* channel) {
+    for (int i = 0; i < CLIENT_CHANNELS; i++) {
+        if (client->channels[i] == channel) return i;
+    }
+    return -1;
+}
+
+// 把一条消息留进频道的最近消息，挤掉最早的一条；调用时持有频道的锁（启动时读回日志除外）
+void history_record(Channel* channel, Message* message) {
+    Message* evicted = NULL;
+    InterlockedIncrement(&message->refs);
+    AcquireSRWLockExclusive(&channel->history_lock);
+    if (channel->history_count == HISTORY_SIZE) {
+        evicted = channel->history[channel->history_head];
+        channel->history[channel->history_head] = message;
+        channel->history_head = (channel->history_head + 1) % HISTORY_SIZE;
+    }
+    else {
+        channel->history[(channel->history_head + channel->history_count) % HISTORY_SIZE] = message;
+        channel->history_count++;
+    }
+    ReleaseSRWLockExclusive(&channel->history_lock);
+    if (evicted != NULL) {
+        message_release(evicted);
+    }
+}
+
+// 把重写期间追加的一条消息记进 history_tail；调用时持有 history_log_lock
+void history_tail_push(Message* message) {
+    if (history_tail_count == history_tail_capacity) {
+        int capacity = history_tail_capacity > 0 ? history_tail_capacity * 2 : HISTORY_SIZE;
+        Message** grown = (Message**)realloc(history_tail, capacity * sizeof(Message*));
+        if (grown == NULL) {
+            history_tail_lost = 1;
+            return;
+        }
+        history_tail = grown;
+        history_tail_capacity = capacity;
+    }
+    InterlockedIncrement(&message->refs);
+    history_tail[history_tail_count++] = message;
+}
+
+// 把一条消息追加到历史日志。WriteFile 写进系统缓存，不等待磁盘
+// 压缩已经把这条消息写进了当前这一代日志时跳过（压缩快照发生在它留进最近消息之后、追加之前）
+// 日志超过 HISTORY_LOG_COMPACT_SIZE 且达到上次压缩后的两倍时唤醒压缩线程，这里只多记一个引用，不等待重写
+void history_log_append(Message* message) {
+    DWORD written = 0;
+    AcquireSRWLockExclusive(&history_log_lock);
+    if (history_log != INVALID_HANDLE_VALUE && (message->log_generation == 0 || message->log_generation != history_log_generation)) {
+        WriteFile(history_log, message->data, message->len, &written, NULL);
+        history_log_size += written;
+        if (history_compact_state == 2 && message->log_generation != history_log_generation + 1) {
+            history_tail_push(message); // 不在快照中，替换前补写进新日志
+        }
+        else if (history_compact_state == 0 && history_compact_event != NULL &&
+            history_log_size > HISTORY_LOG_COMPACT_SIZE && history_log_size > 2 * history_log_compacted) {
+            history_compact_state = 1;
+            SetEvent(history_compact_event);
+        }
+    }
+    ReleaseSRWLockExclusive(&history_log_lock);
+}
+
+// 加入频道，只锁这一个频道。返回 1 表示加入，0 表示已经是成员，-1 表示加入的频道太多或内存不足
+// 加入的同时把频道的最近消息作为一批排进这个连接的发送队列：在同一个独占锁内完成，回放和之后的新消息不重复、不颠倒
+// 只是排队引用计数的 Message，不复制也不等待网络，其他频道的广播不受影响
+int channel_join(Channel* channel, Client* client) {
+    Message* replay[HISTORY_SIZE + 1];
+    int replay_count = 0;
+    char text[MAX_CHANNEL_LEN + 32];
+
+    if (channel_slot(client, channel) >= 0) return 0;
+    int slot = channel_slot(client, NULL);
+    if (slot < 0) return -1;
+    snprintf(text, sizeof(text), "Recent messages in #%s:", channel->name);
+    Message* heading = message_frame(FRAME_SYS, "Server", channel->name, (int)strlen(channel->name), text, (int)strlen(text));
+
+    AcquireSRWLockExclusive(&channel->lock);
+    if (channel->member_count == channel->member_capacity) {
+        int capacity = channel->member_capacity > 0 ? channel->member_capacity * 2 : INITIAL_CHANNEL_MEMBERS;
+        Member* grown = (Member*)realloc(channel->members, capacity * sizeof(Member));
+        if (grown == NULL) {
+            ReleaseSRWLockExclusive(&channel->lock);
+            if (heading != NULL) {
+                message_release(heading);
+            }
+            return -1;
+        }
+        channel->members = grown;
+        channel->member_capacity = capacity;
+    }
+    channel->members[channel->member_count].client = client;
+    channel->members[channel->member_count].slot = slot;
+    client->member_index[slot] = channel->member_count++;
+    if (heading != NULL && channel->history_count > 0) {
+        replay[replay_count++] = heading;
+        for (int i = 0; i < channel->history_count; i++) {
+            replay[replay_count++] = channel->history[(channel->history_head + i) % HISTORY_SIZE];
+        }
+        enqueue_messages(client, replay, replay_count);
+    }
+    ReleaseSRWLockExclusive(&channel->lock);
+    client->channels[slot] = channel;
+    if (heading != NULL) {
+        message_release(heading);
+    }
+    return 1;
+}
+
+// 离开频道：O(1)，最后一个成员搬到空位。返回 0 表示不是成员
+int channel_leave(Channel* channel, Client* client) {
+    int slot = channel_slot(client, channel);
+    if (slot < 0) return 0;
+
+    AcquireSRWLockExclusive(&channel->lock);
+    int index = client->member_index[slot];
+    Member last = channel->members[--channel->member_count];
+    channel->members[index] = last;
+    last.client->member_index[last.slot] = index;
+    ReleaseSRWLockExclusive(&channel->lock);
+    client->channels[slot] = NULL;
+    return 1;
+}
+
+// 向频道的订阅者排队一条消息（exclude 除外）。消息只编码一次，开销只与这个频道的成员数有关
+void channel_broadcast(Channel* channel, Message* message, Client* exclude) {
+    AcquireSRWLockShared(&channel->lock);
+    for (int i = 0; i < channel->member_count; i++) {
+        if (channel->members[i].client != exclude) {
+            enqueue_message(channel->members[i].client, message);
+        }
+    }
+    ReleaseSRWLockShared(&channel->lock);
+}
+
+// 发布一条聊天消息：广播给订阅者，留进最近消息，并写进历史日志
+void channel_publish(Channel* channel, Message* message, Client* exclude) {
+    AcquireSRWLockShared(&channel->lock);
+    history_record(channel, message);
+    for (int i = 0; i < channel->member_count; i++) {
+        if (channel->members[i].client != exclude) {
+            enqueue_message(channel->members[i].client, message);
+        }
+    }
+    ReleaseSRWLockShared(&channel->lock);
+    history_log_append(message);
+}
+
+// 向频道广播一条系统消息
+void channel_system(Channel* channel, const char* text, Client* exclude) {
+    Message* message = message_frame(FRAME_SYS, "Server", channel->name, (int)strlen(channel->name), text, (int)strlen(text));
+    if (message == NULL) return;
+    channel_broadcast(channel, message, exclude);
+    message_release(message);
+}
+
+// --- 历史日志 ---
+// 取各频道保留的最近消息，每条加一个引用并标记为下一代日志的内容。返回的数组由 history_release 释放，内存不足时返回 NULL
+// 调用时持有 history_log_lock（启动时没有并发）；标记在替换成功后才算数
+Message** history_snapshot(int* count) {
+    int total = 0;
+    AcquireSRWLockShared(&channels_lock);
+    for (int b = 0; b < CHANNEL_BUCKETS; b++) {
+        for (Channel* channel = channel_buckets[b]; channel != NULL; channel = channel->next) {
+            total += HISTORY_SIZE;
+        }
+    }
+    Message** messages = (Message**)malloc((total > 0 ? total : 1) * sizeof(Message*));
+    *count = 0;
+    for (int b = 0; messages != NULL && b < CHANNEL_BUCKETS; b++) {
+        for (Channel* channel = channel_buckets[b]; channel != NULL; channel = channel->next) {
+            AcquireSRWLockShared(&channel->history_lock);
+            for (int i = 0; i < channel->history_count; i++) {
+                Message* message = channel->history[(channel->history_head + i) % HISTORY_SIZE];
+                InterlockedIncrement(&message->refs);
+                message->log_generation = history_log_generation + 1;
+                messages[(*count)++] = message;
+            }
+            ReleaseSRWLockShared(&channel->history_lock);
+        }
+    }
+    ReleaseSRWLockShared(&channels_lock);
+    return messages;
+}
+
+// 释放一组消息的引用和数组本身
+void history_release(Message** messages, int count) {
+    for (int i = 0; i < count; i++) {
+        message_release(messages[i]);
+    }
+    free(messages);
+}
+
+// 依次写入一组消息，写入的字节数累加到 size。返回 1 表示全部写入
+int history_write(HANDLE file, Message** messages, int count, long long* size) {
+    for (int i = 0; i < count; i++) {
+        DWORD written = 0;
+        if (!WriteFile(file, messages[i]->data, messages[i]->len, &written, NULL) || written != (DWORD)messages[i]->len) return 0;
+        *size += written;
+    }
+    return 1;
+}
+
+// 用各频道保留的最近消息重写历史日志：先写临时文件再替换，中途失败时原来的日志不受影响。返回重写后的字节数，失败时返回 -1
+// 只在启动时调用，没有并发，日志还没有以追加方式打开；运行中的压缩由 history_compactor 完成
+long long history_rewrite(void) {
+    int count = 0;
+    long long size = 0;
+    Message** snapshot = history_snapshot(&count);
+    HANDLE file = CreateFileA(HISTORY_LOG_TEMP, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    int ok = snapshot != NULL && file != INVALID_HANDLE_VALUE && history_write(file, snapshot, count, &size);
+    if (snapshot != NULL) history_release(snapshot, count);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    if (!ok || !MoveFileExA(HISTORY_LOG_TEMP, HISTORY_LOG_FILE, MOVEFILE_REPLACE_EXISTING)) return -1;
+    history_log_generation++;
+    return size;
+}
+
+// 以追加方式打开历史日志，记下它的大小；打不开时 history_log 为 INVALID_HANDLE_VALUE，之后不再保存历史
+void history_log_open(void) {
+    LARGE_INTEGER size;
+    history_log = CreateFileA(HISTORY_LOG_FILE, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    history_log_size = history_log != INVALID_HANDLE_VALUE && GetFileSizeEx(history_log, &size) ? size.QuadPart : 0;
+    history_log_compacted = history_log_size;
+}
+
+// 压缩线程：被 history_log_append 唤醒后压缩一次历史日志，工作线程从不等待重写
+// 只在取快照和最后替换文件时持有 history_log_lock：快照只是给最近消息加引用，替换时补写的只是重写期间追加的消息
+// 压缩失败时原来的日志照常追加，等它再长到两倍时重试
+DWORD WINAPI history_compactor(LPVOID arg) {
+    char log_buf[BUF_SIZE];
+    (void)arg;
+    while (WaitForSingleObject(history_compact_event, INFINITE) == WAIT_OBJECT_0) {
+        int count = 0;
+        long long size = 0;
+        AcquireSRWLockExclusive(&history_log_lock);
+        long long before = history_log_size;
+        Message** snapshot = history_snapshot(&count);
+        history_compact_state = 2;
+        ReleaseSRWLockExclusive(&history_log_lock);
+
+        HANDLE file = CreateFileA(HISTORY_LOG_TEMP, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        int ok = snapshot != NULL && file != INVALID_HANDLE_VALUE && history_write(file, snapshot, count, &size);
+        if (snapshot != NULL) history_release(snapshot, count);
+
+        AcquireSRWLockExclusive(&history_log_lock);
+        ok = ok && !history_tail_lost && history_write(file, history_tail, history_tail_count, &size);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        if (ok) {
+            // 替换文件前先关闭自己的句柄
+            CloseHandle(history_log);
+            ok = MoveFileExA(HISTORY_LOG_TEMP, HISTORY_LOG_FILE, MOVEFILE_REPLACE_EXISTING);
+            if (ok) history_log_generation++;
+            history_log_open();
+        }
+        else {
+            DeleteFileA(HISTORY_LOG_TEMP);
+            history_log_compacted = history_log_size;
+        }
+        history_release(history_tail, history_tail_count);
+        history_tail = NULL;
+        history_tail_count = history_tail_capacity = history_tail_lost = 0;
+        history_compact_state = 0;
+        int reopened = history_log != INVALID_HANDLE_VALUE;
+        ReleaseSRWLockExclusive(&history_log_lock);
+
+        if (!reopened) {
+            write_wconsole("Could not reopen the history log, history will not be saved.\n");
+        }
+        else if (!ok) {
+            write_wconsole("Could not compact the history log.\n");
+        }
+        else {
+            snprintf(log_buf, sizeof(log_buf), "Compacted %s from %lld to %lld bytes\n", HISTORY_LOG_FILE, before, size);
+            write_wconsole(log_buf);
+        }
+    }
+    return 0;
+}
+
+// 启动时读回历史日志：按块顺序读入、逐帧解析，各频道留下最近 HISTORY_SIZE 条，不需要重放整个数据库，内存占用与日志大小无关
+// 末尾不完整的帧（上次异常退出时只写了一半）被丢弃；日志中的帧比留下的多时用留下的重写，日志不会无限增长
+// 读取出错时只用已经读到的消息，不重写，日志原样保留
+void history_load(void) {
+    char log_buf[BUF_SIZE];
+    HANDLE file = CreateFileA(HISTORY_LOG_FILE, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return; // 第一次启动，还没有日志
+
+    // 一块数据接在上一块剩下的不完整帧后面，剩下的不超过一个帧
+    char* buf = (char*)malloc(HISTORY_LOAD_CHUNK + MAX_FRAME_SIZE);
+    if (buf == NULL) {
+        CloseHandle(file);
+        write_wconsole("Out of memory, the history log was not loaded.\n");
+        return;
+    }
+    unsigned int pending = 0;
+    int loaded = 0;
+    int truncated = 0;   // 有格式错误或末尾不完整的帧
+    int read_error = 0;
+    Frame frame;
+    int parsed = 0;
+    while (1) {
+        DWORD got = 0;
+        if (!ReadFile(file, buf + pending, HISTORY_LOAD_CHUNK, &got, NULL)) {
+            read_error = 1;
+            break;
+        }
+        if (got == 0) break;
+        unsigned int length = pending + got;
+        unsigned int offset = 0;
+        while ((parsed = frame_parse(buf + offset, length - offset, &frame)) > 0) {
+            offset += parsed;
+            if (frame.type != FRAME_MSG || frame.target_len == 0 || frame.target_len > MAX_CHANNEL_LEN) continue;
+            Channel* channel = find_channel(frame.target, frame.target_len, 1);
+            Message* message = channel != NULL ? message_create(frame.raw, frame.raw_len) : NULL;
+            if (message != NULL) {
+                history_record(channel, message);
+                message_release(message);
+                loaded++;
+            }
+        }
+        pending = length - offset;
+        if (parsed < 0) break; // 格式错误，之后的内容无法再分帧
+        memmove(buf, buf + offset, pending);
+    }
+    free(buf);
+    CloseHandle(file);
+    truncated = parsed < 0 || pending > 0;
+
+    int kept = 0;
+    for (int b = 0; b < CHANNEL_BUCKETS; b++) {
+        for (Channel* channel = channel_buckets[b]; channel != NULL; channel = channel->next) {
+            kept += channel->history_count;
+        }
+    }
+    if (read_error) {
+        snprintf(log_buf, sizeof(log_buf), "Could not read all of %s, using the %d messages read so far\n", HISTORY_LOG_FILE, loaded);
+        write_wconsole(log_buf);
+    }
+    else if ((kept < loaded || truncated) && history_rewrite() < 0) {
+        write_wconsole("Could not compact the history log.\n");
+    }
+    snprintf(log_buf, sizeof(log_buf), "Loaded %d recent messages in %d channels from %s\n", kept, channel_count, HISTORY_LOG_FILE);
+    write_wconsole(log_buf);
+}
+
+// 投递一个异步接收请求，收到的字节接在环形缓冲区中未解析的数据后面，完成时由任意一个工作线程处理
+int post_recv(Client* client) {
+    DWORD flags = 0;
+    int count = ring_free_bufs(&client->ring, client->recv_bufs);
+    if (count == 0) return 0; // 不会发生：完整的帧都已切走，剩下的不足一个帧
+    memset(&client->recv_overlapped, 0, sizeof(client->recv_overlapped));
+    if (WSARecv(client->sock, client->recv_bufs, count, NULL, &flags, &client->recv_overlapped, NULL) == SOCKET_ERROR &&
+        WSAGetLastError() != WSA_IO_PENDING) {
+        return 0;
+    }
+    return 1;
+}
+
+// 处理第一个帧：从 JOIN 帧中取出 UTF-8 昵称，登记并加入大厅后广播加入消息
+int handle_join(Client* client, const Frame* frame) {
+    char log_buf[BUF_SIZE]; // 用于构造日志信息的缓冲区
+    char* name = client->name;
+
+    if (frame->type == FRAME_JOIN && frame->sender_len > 0) {
+        memcpy(name, frame->sender, frame->sender_len); // 帧解析时已经检查过不超过 MAX_NAME_LEN
+        name[frame->sender_len] = '\0';
+    }
+    else {
+        strcpy(name, "Unknown");
+    }
+
+    if (!add_client(client) || channel_join(lobby, client) < 0) {
+        return 0;
+    }
+
+    // --- 日志打印 (使用 WriteConsoleW) ---
+    snprintf(log_buf, sizeof(log_buf), "%s joined the chat\n", name);
+    write_wconsole(log_buf);
+
+    if (frame->type == FRAME_JOIN && ((int)strlen(name) != frame->sender_len || memcmp(name, frame->sender, frame->sender_len) != 0)) {
+        snprintf(log_buf, sizeof(log_buf), "Nickname taken, you are now %s.", name);
+        send_system(client, lobby->name, (int)strlen(lobby->name), log_buf);
+    }
+
+    // 构造系统消息 (仍然使用 UTF-8 编码)
+    snprintf(log_buf, sizeof(log_buf), "%s joined the chat.", name);
+    // 广播消息 (发送 UTF-8 字节流)
+    channel_system(lobby, log_buf, client);
+    return 1;
+}
+
+// 加入或离开频道：频道名是帧的目标，成员变化通知这个频道的所有成员（包括自己）
+void handle_channel(Client* client, const Frame* frame) {
+    char log_buf[BUF_SIZE];
+    int joining = frame->type == FRAME_CHANNEL_JOIN;
+
+    if (frame->target_len == 0 || frame->target_len > MAX_CHANNEL_LEN) {
+        send_system(client, "", 0, "Channel names are 1-32 bytes.");
+        return;
+    }
+    Channel* channel = find_channel(frame->target, frame->target_len, joining);
+    if (channel == lobby && !joining) {
+        send_system(client, lobby->name, (int)strlen(lobby->name), "You cannot leave the lobby.");
+        return;
+    }
+    int changed = channel == NULL ? -1 : joining ? channel_join(channel, client) : channel_leave(channel, client);
+    if (changed < 0) {
+        send_system(client, frame->target, frame->target_len, joining ? "Cannot join this channel." : "You are not in this channel.");
+        return;
+    }
+    if (changed == 0) {
+        send_system(client, channel->name, (int)strlen(channel->name), joining ? "You are already in this channel." : "You are not in this channel.");
+        return;
+    }
+    snprintf(log_buf, sizeof(log_buf), "%s %s #%s.", client->name, joining ? "joined" : "left", channel->name);
+    channel_system(channel, log_buf, NULL);
+    if (!joining) {
+        send_system(client, channel->name, (int)strlen(channel->name), log_buf); // 已经不是成员，单独通知
+    }
+}
 
-// 广播函数：发送指定长度的原始数据
-void broadcast_raw(const char* data, int len, SOCKET exclude_sock) {
-    if (len <= 0) return;
-    EnterCriticalSection(&cs);
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].sock != exclude_sock) {
-            send(clients[i].sock, data, len, 0);
+// 私信：在昵称索引中查找接收者，只发给这一个连接
+void handle_direct(Client* client, const Frame* frame) {
+    int found = 0;
+    AcquireSRWLockShared(&names_lock);
+    Client* target = find_client_locked(frame->target, frame->target_len);
+    if (target != NULL) {
+        Message* message = message_frame(FRAME_DIRECT, client->name, target->name, (int)strlen(target->name), frame->content, frame->content_len);
+        if (message != NULL) {
+            enqueue_message(target, message);
+            message_release(message);
+        }
+        found = 1;
+    }
+    ReleaseSRWLockShared(&names_lock);
+    if (!found) {
+        send_system(client, "", 0, "No such user.");
+    }
+}
+
+// 处理 JOIN 之后的帧：聊天消息发到目标频道（空表示大厅）；收到 QUIT 时返回 0
+// 转发的帧用服务器登记的昵称重新编码，发送者无法冒充别人
+int handle_message(Client* client, const Frame* frame) {
+    switch (frame->type) {
+    case FRAME_QUIT:
+        return 0;
+    case FRAME_MSG: {
+        Channel* channel = frame->target_len == 0 ? lobby : find_channel(frame->target, frame->target_len, 0);
+        if (channel == NULL || channel_slot(client, channel) < 0) {
+            send_system(client, frame->target, frame->target_len, "You are not in this channel.");
+            break;
+        }
+        Message* message = message_frame(FRAME_MSG, client->name, channel->name, (int)strlen(channel->name), frame->content, frame->content_len);
+        if (message != NULL) {
+            channel_publish(channel, message, client);
+            message_release(message);
         }
+        break;
+    }
+    case FRAME_CHANNEL_JOIN:
+    case FRAME_CHANNEL_LEAVE:
+        handle_channel(client, frame);
+        break;
+    case FRAME_DIRECT:
+        handle_direct(client, frame);
+        break;
+    default:
+        break; // 客户端不应该发 JOIN 以外的其他类型，忽略
     }
-    LeaveCriticalSection(&cs);
+    return 1;
 }
 
+// 处理一次接收：把收到的字节切成帧逐个处理，不完整的帧留在环形缓冲区中等下次接收；返回 0 表示要关闭连接
+int handle_received(Client* client, DWORD len) {
+    char scratch[MAX_FRAME_SIZE]; // 跨过缓冲区末尾的帧复制到这里
+    Frame frame;
+    int parsed;
+
+    ring_commit(&client->ring, len);
+    while ((parsed = frame_next(&client->ring, scratch, &frame)) == 1) {
+        int keep = !client->joined ? handle_join(client, &frame) : handle_message(client, &frame);
+        if (!keep) return 0;
+    }
+    return parsed == 0; // -1：格式错误，无法再找到下一个帧的开头
+}
+
+// 关闭连接：离开所有频道、注销昵称后关闭套接字并广播离开消息。接收一方调用，这时这个连接没有未完成的接收请求
+// 未完成的发送请求随套接字关闭出错返回，最后一个引用释放时 Client 才被释放
+// RDT 连接在收到传输层的关闭事件后调用，连接已经不存在，没有套接字要关
+void close_client(Client* client) {
+    char log_buf[BUF_SIZE];
+    int joined = client->joined;
+    int slow = 0;
+    int dropped = 0;
+
+    for (int i = 0; i < CLIENT_CHANNELS; i++) {
+        if (client->channels[i] != NULL) {
+            channel_leave(client->channels[i], client);
+        }
+    }
+    remove_client(client);
+    AcquireSRWLockExclusive(&client->send_lock);
+    slow = client->too_slow;
+    dropped = client->dropped;
+    client->closing = 1;
+    ReleaseSRWLockExclusive(&client->send_lock);
+    if (client->rdt == 0) {
+        closesocket(client->sock);
+    }
+
+    if (joined) {
+        // 构造和广播离开系统消息 (仍然使用 UTF-8 编码)
+        snprintf(log_buf, sizeof(log_buf), "%s left the chat.", client->name);
+        channel_system(lobby, log_buf, NULL);
+
+        // --- 退出日志打印 (使用 WriteConsoleW) ---
+        if (slow) {
+            snprintf(log_buf, sizeof(log_buf), "%s disconnected (too slow, %d messages queued)\n", client->name, SEND_QUEUE_LIMIT);
+        }
+        else if (dropped > 0) {
+            snprintf(log_buf, sizeof(log_buf), "%s disconnected (%d messages dropped)\n", client->name, dropped);
+        }
+        else {
+            snprintf(log_buf, sizeof(log_buf), "%s disconnected\n", client->name);
+        }
+        write_wconsole(log_buf);
+    }
+    client_release(client); // 接收一方的引用
+}
 
 int main() {
     // 关键步骤: 设置控制台为 UTF-8
@@ -81,8 +986,6 @@ int main() {
         return 1;
     }
 
-    InitializeCriticalSection(&cs);
-
     SOCKET server_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (server_sock == INVALID_SOCKET) {
         printf("socket failed.\n");
@@ -99,14 +1002,76 @@ int main() {
         return 1;
     }
 
-    if (listen(server_sock, 10) == SOCKET_ERROR) {
+    if (listen(server_sock, SOMAXCONN) == SOCKET_ERROR) {
         printf("listen failed.\n");
         return 1;
     }
 
+    // 完成端口和工作线程池：线程数与 CPU 核数相同，连接数再多也只有这么多线程
+    iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (iocp == NULL) {
+        printf("CreateIoCompletionPort failed.\n");
+        return 1;
+    }
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int worker_count = (int)info.dwNumberOfProcessors;
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > MAX_WORKERS) worker_count = MAX_WORKERS;
+    for (int i = 0; i < worker_count; i++) {
+        HANDLE thread = CreateThread(NULL, 0, worker_thread, NULL, 0, NULL);
+        if (thread == NULL) {
+            printf("CreateThread failed.\n");
+            return 1;
+        }
+        CloseHandle(thread); // 工作线程一直运行，不需要句柄
+    }
+
+    lobby = find_channel(LOBBY_NAME, (int)strlen(LOBBY_NAME), 1);
+    if (lobby == NULL) {
+        printf("out of memory.\n");
+        return 1;
+    }
+
+    // 可靠 UDP 传输：同一个端口号的 UDP 端口，连接和消息都由 rdt_thread 处理
+    rdt_ep = rdt_open(PORT);
+    if (rdt_ep == NULL) {
+        printf("Could not open UDP port %d, RDT clients will not be accepted.\n", PORT);
+    }
+    else {
+        HANDLE thread = CreateThread(NULL, 0, rdt_thread, NULL, 0, NULL);
+        if (thread == NULL) {
+            printf("CreateThread failed.\n");
+            return 1;
+        }
+        CloseHandle(thread);
+    }
+
+    // 先读回历史日志，再以追加方式打开；打不开时照常运行，只是不保存历史
+    history_load();
+    history_log_open();
+    if (history_log == INVALID_HANDLE_VALUE) {
+        printf("Could not open %s, history will not be saved.\n", HISTORY_LOG_FILE);
+    }
+    history_compact_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    HANDLE compactor = history_compact_event != NULL ? CreateThread(NULL, 0, history_compactor, NULL, 0, NULL) : NULL;
+    if (compactor == NULL) {
+        printf("Could not start the history compactor, the history log will only be compacted at startup.\n");
+        if (history_compact_event != NULL) {
+            CloseHandle(history_compact_event);
+            history_compact_event = NULL;
+        }
+    }
+    else {
+        CloseHandle(compactor);
+    }
+
     // 初始启动消息使用 WriteConsoleW 确保能正常显示
-    write_wconsole("Chat server started on port 8888...\n");
+    char start_buf[128];
+    snprintf(start_buf, sizeof(start_buf), "Chat server started on port %d (%d workers%s)...\n", PORT, worker_count, rdt_ep != NULL ? ", RDT on UDP" : "");
+    write_wconsole(start_buf);
 
+    // 主线程只负责接受连接，之后的收发都由工作线程完成
     while (1) {
         struct sockaddr_in client_addr;
         int addr_len = sizeof(client_addr);
@@ -116,95 +1081,88 @@ int main() {
             continue;
         }
 
-        SOCKET* pclient = malloc(sizeof(SOCKET));
-        *pclient = client_sock;
-        CreateThread(NULL, 0, handle_client, pclient, 0, NULL);
+        Client* client = (Client*)calloc(1, sizeof(Client));
+        if (client == NULL) {
+            closesocket(client_sock);
+            continue;
+        }
+        client->sock = client_sock;
+        client->refs = 1;
+        InitializeSRWLock(&client->send_lock);
+        if (CreateIoCompletionPort((HANDLE)client_sock, iocp, (ULONG_PTR)client, 0) == NULL || !post_recv(client)) {
+            closesocket(client_sock);
+            free(client);
+        }
     }
 
     closesocket(server_sock);
-    DeleteCriticalSection(&cs);
+    CloseHandle(iocp);
     WSACleanup();
     return 0;
 }
 
-DWORD WINAPI handle_client(LPVOID arg) {
-    SOCKET sock = *((SOCKET*)arg);
-    free(arg);
-    char name[50], buffer[BUF_SIZE]; // name 存储 UTF-8 昵称
-    char log_buf[BUF_SIZE]; // 用于构造日志信息的缓冲区
-
-    // 接收 JOIN 消息
-    int len = recv(sock, buffer, BUF_SIZE - 1, 0);
-    if (len <= 0) {
-        closesocket(sock);
-        return 0;
-    }
-    buffer[len] = '\0';
-
-    // 安全解析 JOIN 协议并存储 UTF-8 昵称
-    if (strncmp(buffer, "JOIN|", 5) == 0) {
-        const char* start = buffer + 5;
-        const char* end = strchr(start, '|');
-        if (end != NULL) {
-            int name_len = (int)(end - start);
-            if (name_len >= sizeof(name)) name_len = sizeof(name) - 1;
-            strncpy(name, start, name_len);
-            name[name_len] = '\0';
+// 工作线程：取出完成的请求。接收完成时处理后投递下一个接收请求，发送完成时接着发队列中的消息
+DWORD WINAPI worker_thread(LPVOID arg) {
+    (void)arg;
+    while (1) {
+        DWORD len = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = NULL;
+        BOOL ok = GetQueuedCompletionStatus(iocp, &len, &key, &overlapped, INFINITE);
+        if (overlapped == NULL) {
+            continue; // 完成端口本身出错，没有对应的连接
         }
-        else {
-            strcpy(name, "Unknown");
+        Client* client = (Client*)key;
+        if (overlapped == &client->send_overlapped) {
+            send_completed(client, ok, len);
+            continue;
+        }
+        if (!ok || len == 0) {
+            close_client(client); // 连接出错或对方关闭
+            continue;
+        }
+        if (!handle_received(client, len) || !post_recv(client)) {
+            close_client(client);
         }
     }
-    else {
-        strcpy(name, "Unknown");
-    }
-
-    EnterCriticalSection(&cs);
-    strcpy(clients[client_count].name, name); // 存储 UTF-8 昵称
-    clients[client_count].sock = sock;
-    client_count++;
-    LeaveCriticalSection(&cs);
-
-    // --- 日志打印 (使用 WriteConsoleW) ---
-    snprintf(log_buf, sizeof(log_buf), "%s joined the chat\n", name);
-    write_wconsole(log_buf);
-
-    // 构造系统消息 (仍然使用 UTF-8 编码)
-    snprintf(buffer, sizeof(buffer), "SYS|Server|%s joined the chat.\n", name);
-    // 广播消息 (发送 UTF-8 字节流)
-    broadcast_raw(buffer, (int)strlen(buffer), sock);
-
+    return 0;
+}
 
-    // 聊天循环：接收并广播原始的 UTF-8 消息字节
+// RDT 线程：取出可靠 UDP 传输的事件。新连接创建 Client，每条消息恰好是一个帧，按 TCP 连接相同的方式处理，
+// 传输层报告关闭时关闭 Client；QUIT 或格式错误的帧让传输层关闭连接，之后同样会收到关闭事件
+DWORD WINAPI rdt_thread(LPVOID arg) {
+    char data[MAX_FRAME_SIZE];
+    (void)arg;
     while (1) {
-        len = recv(sock, buffer, BUF_SIZE - 1, 0);
-        if (len <= 0) break;
-
-        if (len >= 4 && strncmp(buffer, "QUIT", 4) == 0) break;
-
-        // 广播接收到的实际长度 len
-        broadcast_raw(buffer, len, sock);
-    }
-
-    closesocket(sock);
-
-    EnterCriticalSection(&cs);
-    for (int i = 0; i < client_count; i++) {
-        if (clients[i].sock == sock) {
-            clients[i] = clients[client_count - 1];
-            client_count--;
-            break;
+        rdt_event ev;
+        Frame frame;
+        int type = rdt_recv(rdt_ep, &ev, data, sizeof(data), -1);
+        Client* client = (Client*)ev.context;
+        if (type == RDT_ACCEPTED) {
+            client = (Client*)calloc(1, sizeof(Client));
+            if (client == NULL) {
+                rdt_close(rdt_ep, ev.handle);
+                continue;
+            }
+            client->sock = INVALID_SOCKET;
+            client->rdt = ev.handle;
+            client->refs = 1;
+            InitializeSRWLock(&client->send_lock);
+            rdt_set_context(rdt_ep, ev.handle, client);
+        }
+        else if (type == RDT_MESSAGE && client != NULL) {
+            if (ev.len == 0 || ev.len > (int)sizeof(data) || frame_parse(data, ev.len, &frame) != ev.len) {
+                rdt_close(rdt_ep, ev.handle);
+                continue;
+            }
+            int keep = !client->joined ? handle_join(client, &frame) : handle_message(client, &frame);
+            if (!keep) {
+                rdt_close(rdt_ep, ev.handle);
+            }
+        }
+        else if (type == RDT_CLOSED && client != NULL) {
+            close_client(client);
         }
     }
-    LeaveCriticalSection(&cs);
-
-    // 构造和广播离开系统消息 (仍然使用 UTF-8 编码)
-    snprintf(buffer, sizeof(buffer), "SYS|Server|%s left the chat.\n", name);
-    broadcast_raw(buffer, (int)strlen(buffer), INVALID_SOCKET);
-
-    // --- 退出日志打印 (使用 WriteConsoleW) ---
-    snprintf(log_buf, sizeof(log_buf), "%s disconnected\n", name);
-    write_wconsole(log_buf);
-
     return 0;
-}
\ No newline at end of file
+}
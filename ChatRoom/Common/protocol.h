@@ -0,0 +1,197 @@
+/*
+ protocol.h - 聊天协议的帧格式和接收环形缓冲区，ChatServer、ChatClient 和 ChatBench 共用这一份
+ TCP 是字节流，一次 recv 可能收到半条消息或好几条消息，所以每条消息都带长度：
+   字节 0-1  帧头之后的字节数（网络字节序）
+   字节 2    帧类型 FRAME_*
+   字节 3    发送者昵称的字节数
+   字节 4    目标的字节数：频道名，私信时是接收者的昵称，空表示大厅
+   之后依次是昵称、目标和内容（UTF-8，不带 '\0'）
+ 接收方把收到的字节放进环形缓冲区，frame_next() 每次切出一个完整的帧，不完整的帧留到下次接收后再解析
+ */
+
+#pragma once
+
+#include <winsock2.h>
+#include <string.h>
+
+// --- 帧格式 ---
+#define FRAME_HEADER_SIZE 5
+#define MAX_FRAME_SIZE 2048            // 一个帧（含帧头）的最大字节数，超过视为格式错误
+#define MAX_NAME_LEN 49                // 昵称的最大字节数
+#define MAX_CHANNEL_LEN 32             // 频道名的最大字节数
+#define RECV_RING_SIZE 4096            // 接收环形缓冲区的大小，必须是 2 的幂且不小于 MAX_FRAME_SIZE
+#define LOBBY_NAME "lobby"             // 大厅的频道名，目标为空的帧发到大厅
+
+#define FRAME_JOIN 1                   // 加入：昵称，内容为空
+#define FRAME_MSG 2                    // 聊天消息，发到目标频道
+#define FRAME_QUIT 3                   // 退出
+#define FRAME_SYS 4                    // 服务器发出的系统消息，目标是相关的频道
+#define FRAME_CHANNEL_JOIN 5           // 加入目标频道，频道不存在时创建
+#define FRAME_CHANNEL_LEAVE 6          // 离开目标频道
+#define FRAME_DIRECT 7                 // 私信，目标是接收者的昵称
+
+// 解析出的一个帧。指针指向接收缓冲区（帧跨过缓冲区末尾时指向调用者给的 scratch），下次接收之前有效
+typedef struct {
+    const char* raw;       // 整个帧（含帧头），转发时原样使用
+    int raw_len;
+    int type;
+    const char* sender;
+    int sender_len;
+    const char* target;
+    int target_len;
+    const char* content;
+    int content_len;
+} Frame;
+
+/*
+ frame_encode - 编码一个帧
+ @param out 输出缓冲区，至少 FRAME_HEADER_SIZE + sender_len + target_len + content_len 字节
+ @param cap out 的大小
+ @param target 频道名或接收者的昵称，可以为空
+ @return 帧的字节数；超过 cap 或 MAX_FRAME_SIZE、昵称或目标太长时返回 -1
+ */
+static __inline int frame_encode(char* out, int cap, int type, const char* sender, int sender_len,
+    const char* target, int target_len, const char* content, int content_len) {
+    int payload = sender_len + target_len + content_len;
+    int size = FRAME_HEADER_SIZE + payload;
+    if (sender_len < 0 || sender_len > MAX_NAME_LEN || target_len < 0 || target_len > MAX_NAME_LEN ||
+        content_len < 0 || size > cap || size > MAX_FRAME_SIZE) return -1;
+    out[0] = (char)(payload >> 8);
+    out[1] = (char)(payload & 0xFF);
+    out[2] = (char)type;
+    out[3] = (char)sender_len;
+    out[4] = (char)target_len;
+    memcpy(out + FRAME_HEADER_SIZE, sender, sender_len);
+    memcpy(out + FRAME_HEADER_SIZE + sender_len, target, target_len);
+    memcpy(out + FRAME_HEADER_SIZE + sender_len + target_len, content, content_len);
+    return size;
+}
+
+/*
+ frame_stream - 帧在可靠 UDP 传输（cn_lab2/rdt）中使用的有序流
+ 同一个频道的帧（聊天、加入和离开、历史回放、系统消息）在同一个流中按顺序交付，不同的频道和私信互不等待，
+ 一个丢包只耽误它所在的流。私信都用流 0；频道按名字的哈希分到其余的流，目标为空等同大厅，哈希相同的频道共用一个流
+ @param raw 编码好的帧
+ @param streams 可用的流数，至少为 2
+ */
+static __inline int frame_stream(const char* raw, int streams) {
+    const unsigned char* header = (const unsigned char*)raw;
+    const char* target = raw + FRAME_HEADER_SIZE + header[3];
+    int target_len = header[4];
+    unsigned int hash = 2166136261u; // FNV-1a
+    if (header[2] == FRAME_DIRECT) return 0;
+    if (target_len == 0) {
+        target = LOBBY_NAME;
+        target_len = (int)strlen(LOBBY_NAME);
+    }
+    for (int i = 0; i < target_len; i++) {
+        hash = (hash ^ (unsigned char)target[i]) * 16777619u;
+    }
+    return 1 + (int)(hash % (unsigned int)(streams - 1));
+}
+
+// --- 接收环形缓冲区 ---
+// head 和 tail 是一直增长的字节计数，取模后才是下标；tail - head 就是还没解析的字节数
+typedef struct {
+    char data[RECV_RING_SIZE];
+    unsigned int head;     // 下一个要解析的字节
+    unsigned int tail;     // 下一个接收的字节写到这里
+} RecvRing;
+
+/*
+ ring_free_bufs - 空闲空间对应的接收缓冲区，空闲空间跨过末尾时分成两段，一次 WSARecv 就能填满
+ @return 缓冲区个数，0 表示没有空闲空间
+ */
+static __inline int ring_free_bufs(RecvRing* ring, WSABUF bufs[2]) {
+    unsigned int space = RECV_RING_SIZE - (ring->tail - ring->head);
+    unsigned int start = ring->tail & (RECV_RING_SIZE - 1);
+    unsigned int first = RECV_RING_SIZE - start;
+    if (space == 0) return 0;
+    if (first >= space) {
+        bufs[0].buf = ring->data + start;
+        bufs[0].len = space;
+        return 1;
+    }
+    bufs[0].buf = ring->data + start;
+    bufs[0].len = first;
+    bufs[1].buf = ring->data;
+    bufs[1].len = space - first;
+    return 2;
+}
+
+// 接收完成后调用：收到的 len 个字节已经写进 ring_free_bufs() 给出的缓冲区
+static __inline void ring_commit(RecvRing* ring, unsigned int len) {
+    ring->tail += len;
+}
+
+// 从 head 之后 offset 处复制 len 个字节，处理跨过末尾的情况
+static __inline void ring_copy(const RecvRing* ring, unsigned int offset, char* out, unsigned int len) {
+    unsigned int start = (ring->head + offset) & (RECV_RING_SIZE - 1);
+    unsigned int first = RECV_RING_SIZE - start;
+    if (first >= len) {
+        memcpy(out, ring->data + start, len);
+    }
+    else {
+        memcpy(out, ring->data + start, first);
+        memcpy(out + first, ring->data, len - first);
+    }
+}
+
+// 检查帧头，返回整个帧（含帧头）的字节数；格式错误时返回 -1
+static __inline int frame_size(const unsigned char* header) {
+    unsigned int payload = ((unsigned int)header[0] << 8) | header[1];
+    unsigned int size = FRAME_HEADER_SIZE + payload;
+    if (size > MAX_FRAME_SIZE || header[3] > MAX_NAME_LEN || header[4] > MAX_NAME_LEN ||
+        (unsigned int)header[3] + header[4] > payload) return -1;
+    return (int)size;
+}
+
+/*
+ frame_parse - 解析一段连续内存开头的帧，字段直接指向这段内存
+ @param len 这段内存中可用的字节数
+ @return 帧的字节数；0 表示帧不完整；-1 表示格式错误
+ */
+static __inline int frame_parse(const char* data, unsigned int len, Frame* frame) {
+    const unsigned char* header = (const unsigned char*)data;
+    if (len < FRAME_HEADER_SIZE) return 0;
+    int size = frame_size(header);
+    if (size < 0) return -1;
+    if (len < (unsigned int)size) return 0;
+    frame->raw = data;
+    frame->raw_len = size;
+    frame->type = header[2];
+    frame->sender = data + FRAME_HEADER_SIZE;
+    frame->sender_len = header[3];
+    frame->target = frame->sender + frame->sender_len;
+    frame->target_len = header[4];
+    frame->content = frame->target + frame->target_len;
+    frame->content_len = size - FRAME_HEADER_SIZE - header[3] - header[4];
+    return size;
+}
+
+/*
+ frame_next - 切出下一个完整的帧
+ 帧在缓冲区中连续时直接指向缓冲区，不复制；只有跨过末尾的帧才复制到 scratch
+ @param scratch 至少 MAX_FRAME_SIZE 字节
+ @return 1 表示切出了一个帧；0 表示还需要更多数据；-1 表示格式错误，连接无法继续
+ */
+static __inline int frame_next(RecvRing* ring, char* scratch, Frame* frame) {
+    unsigned int available = ring->tail - ring->head;
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (available < FRAME_HEADER_SIZE) return 0;
+    ring_copy(ring, 0, (char*)header, FRAME_HEADER_SIZE);
+
+    int size = frame_size(header);
+    if (size < 0) return -1;
+    if (available < (unsigned int)size) return 0;
+
+    unsigned int start = ring->head & (RECV_RING_SIZE - 1);
+    const char* raw = ring->data + start;
+    if (start + size > RECV_RING_SIZE) {
+        ring_copy(ring, 0, scratch, size);
+        raw = scratch;
+    }
+    frame_parse(raw, size, frame);
+    ring->head += size;
+    return 1;
+}
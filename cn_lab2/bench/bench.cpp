@@ -0,0 +1,582 @@
+﻿/*
+ bench.cpp - 吞吐率基准测试程序
+
+ 功能：在一个程序里运行服务器、客户端和进程内的损伤模拟代理（impairment.h），按场景脚本批量测试
+ 特性：
+ 1. 代理代替外部Router监听ROUTER_PORT，施加丢包、延迟、抖动、乱序、带宽限制、损坏和路径MTU
+ 2. 场景脚本中的参数可以列出多个取值，按所有取值的组合展开，每个组合在每种文件大小上各运行repeat次
+ 3. 每次运行启动一个只接受一个会话的服务器，计时客户端从启动到退出的时间，并校验收到的文件
+ 4. 结果逐行写入CSV：完成时间、吞吐率、代理统计的数据包数和重传数、各类丢弃数，便于比较不同版本
+ */
+
+#include "impairment.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <climits>
+#endif
+
+// ========== 基准测试常量 ==========
+const int SERVER_STARTUP_MS = 200;     // 启动服务器后等待它绑定端口的时间
+const int SERVER_EXIT_TIMEOUT_MS = 10000; // 客户端退出后等待服务器结束会话并退出的时间
+const char* const OUTPUT_FILE = "received_file_1";  // 新启动的服务器的第一个会话写入的文件（不续传时）
+
+// 一个场景展开后的一次测试配置
+struct Scenario {
+    std::string name;
+    ImpairmentConfig config;
+    std::vector<std::string> client_args;  // 附加的客户端参数（拥塞控制算法、--streams等）
+};
+
+// 场景脚本和命令行给出的全部设置
+struct BenchPlan {
+    std::vector<Scenario> scenarios;
+    std::vector<uint64_t> sizes;  // 文件大小（字节）
+    int repeat = 1;               // 每个组合的运行次数
+    int timeout_s = 300;          // 单次运行的超时时间
+};
+
+// 单次运行的结果
+struct RunResult {
+    std::string status;    // ok / mismatch / failed / timeout
+    double seconds = 0;
+    ImpairmentStats stats;
+};
+
+// ========== 场景脚本解析 ==========
+
+/*
+ parse_size - 解析文件大小，可以带K/M/G后缀（1024进制）
+ @return false表示格式错误
+ */
+bool parse_size(const std::string& text, uint64_t& size) {
+    char* end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") {
+        value *= 1024;
+    }
+    else if (suffix == "M" || suffix == "m") {
+        value *= 1024 * 1024;
+    }
+    else if (suffix == "G" || suffix == "g") {
+        value *= 1024.0 * 1024 * 1024;
+    }
+    else if (!suffix.empty()) {
+        return false;
+    }
+    size = (uint64_t)value;
+    return true;
+}
+
+/*
+ set_parameter - 设置一个损伤参数
+ @param config 损伤参数
+ @param key 参数名：loss/corrupt/reorder/reorder_delay/delay/jitter/rate/queue/mtu/seed
+ @param value 参数值
+ @return false表示参数名未知或值不合法
+ */
+bool set_parameter(ImpairmentConfig& config, const std::string& key, const std::string& value) {
+    char* end = nullptr;
+    double v = strtod(value.c_str(), &end);
+    if (end == value.c_str() || *end != '\0' || v < 0) {
+        return false;
+    }
+    if (key == "loss" && v <= 1) config.loss = v;
+    else if (key == "corrupt" && v <= 1) config.corrupt = v;
+    else if (key == "reorder" && v <= 1) config.reorder = v;
+    else if (key == "reorder_delay") config.reorder_delay_ms = v;
+    else if (key == "delay") config.delay_ms = v;
+    else if (key == "jitter") config.jitter_ms = v;
+    else if (key == "rate") config.rate_mbps = v;
+    else if (key == "queue" && v >= 1) config.queue_kb = (uint32_t)v;
+    else if (key == "mtu" && (v == 0 || v >= 576)) config.mtu = (uint32_t)v;
+    else if (key == "seed") config.seed = (uint32_t)v;
+    else return false;
+    return true;
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+/*
+ parse_scenario - 解析一行scenario，按参数取值的所有组合展开
+ 格式：scenario <名称> [参数=值[,值...]]... [-- 客户端参数...]
+ @param words 这一行按空白切分后的单词（words[0]为"scenario"）
+ @param scenarios 输出：展开得到的场景追加到末尾
+ @return false表示格式错误
+ */
+bool parse_scenario(const std::vector<std::string>& words, std::vector<Scenario>& scenarios) {
+    if (words.size() < 2) {
+        return false;
+    }
+    std::vector<Scenario> expanded(1);
+    expanded[0].name = words[1];
+    size_t i = 2;
+    for (; i < words.size() && words[i] != "--"; i++) {
+        size_t eq = words[i].find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = words[i].substr(0, eq);
+        std::vector<std::string> values = split(words[i].substr(eq + 1), ',');
+        if (values.empty()) {
+            return false;
+        }
+        // 已有的每个组合都和这个参数的每个取值组合一次
+        std::vector<Scenario> next;
+        for (const Scenario& base : expanded) {
+            for (const std::string& value : values) {
+                Scenario scenario = base;
+                if (!set_parameter(scenario.config, key, value)) {
+                    return false;
+                }
+                next.push_back(scenario);
+            }
+        }
+        expanded.swap(next);
+    }
+    for (i++; i < words.size(); i++) {
+        for (Scenario& scenario : expanded) {
+            scenario.client_args.push_back(words[i]);
+        }
+    }
+    scenarios.insert(scenarios.end(), expanded.begin(), expanded.end());
+    return true;
+}
+
+/*
+ load_plan - 读取场景脚本
+ 每行一条指令，#之后为注释：
+    sizes <大小>...          测试的文件大小，例如 sizes 1M 16M
+    repeat <n>               每个组合运行的次数
+    timeout <秒>             单次运行的超时时间
+    scenario ...             见parse_scenario
+ @return false表示文件无法打开或有格式错误（已输出出错的行）
+ */
+bool load_plan(const char* path, BenchPlan& plan) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open scenario file: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::vector<std::string> words;
+        std::istringstream stream(line);
+        std::string word;
+        while (stream >> word) {
+            words.push_back(word);
+        }
+        if (words.empty()) {
+            continue;
+        }
+        bool ok = true;
+        if (words[0] == "sizes" && words.size() > 1) {
+            plan.sizes.clear();
+            for (size_t i = 1; i < words.size() && ok; i++) {
+                uint64_t size;
+                ok = parse_size(words[i], size);
+                plan.sizes.push_back(size);
+            }
+        }
+        else if (words[0] == "repeat" && words.size() == 2) {
+            plan.repeat = atoi(words[1].c_str());
+            ok = plan.repeat > 0;
+        }
+        else if (words[0] == "timeout" && words.size() == 2) {
+            plan.timeout_s = atoi(words[1].c_str());
+            ok = plan.timeout_s > 0;
+        }
+        else if (words[0] == "scenario") {
+            ok = parse_scenario(words, plan.scenarios);
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << path << ":" << line_number << ": invalid line: " << line << std::endl;
+            return false;
+        }
+    }
+    if (plan.sizes.empty() || plan.scenarios.empty()) {
+        std::cerr << path << ": need at least one size and one scenario" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ========== 文件与进程工具 ==========
+
+// 转换为绝对路径：子进程在工作目录中运行，相对路径会失效
+std::string absolute_path(const std::string& path) {
+#ifdef _WIN32
+    char full[_MAX_PATH];
+    return _fullpath(full, path.c_str(), sizeof(full)) ? std::string(full) : path;
+#else
+    char full[PATH_MAX];
+    return realpath(path.c_str(), full) ? std::string(full) : path;
+#endif
+}
+
+void make_directory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+/*
+ make_input_file - 生成指定大小的测试文件，内容为伪随机数据（不可压缩）
+ 文件已经存在且大小相同时直接使用
+ @return false表示无法写入
+ */
+bool make_input_file(const std::string& path, uint64_t size) {
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (existing && (uint64_t)existing.tellg() == size) {
+        return true;
+    }
+    existing.close();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::vector<uint64_t> chunk(128 * 1024);
+    uint64_t state = 0x9E3779B97F4A7C15ull ^ size;
+    for (uint64_t written = 0; written < size && file; ) {
+        for (uint64_t& word : chunk) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            word = state;
+        }
+        size_t len = (size_t)(std::min)((uint64_t)(chunk.size() * sizeof(uint64_t)), size - written);
+        file.write(reinterpret_cast<const char*>(chunk.data()), len);
+        written += len;
+    }
+    return (bool)file;
+}
+
+// 比较两个文件的内容
+bool files_equal(const std::string& a, const std::string& b) {
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    if (!fa || !fb) {
+        return false;
+    }
+    std::vector<char> ba(1 << 20), bb(1 << 20);
+    while (fa && fb) {
+        fa.read(ba.data(), ba.size());
+        fb.read(bb.data(), bb.size());
+        if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), (size_t)fa.gcount()) != 0) {
+            return false;
+        }
+    }
+    return fa.eof() && fb.eof();
+}
+
+// 子进程句柄
+struct ChildProcess {
+#ifdef _WIN32
+    HANDLE handle = NULL;
+#else
+    pid_t pid = -1;
+#endif
+};
+
+/*
+ start_process - 在指定目录中启动子进程，标准输出和标准错误写入日志文件
+ @param child 输出：子进程句柄
+ @param exe 可执行文件的绝对路径
+ @param args 参数（不含argv[0]）
+ @param dir 工作目录
+ @param log_name 日志文件名（相对于工作目录）
+ @return false表示无法启动
+ */
+bool start_process(ChildProcess& child, const std::string& exe, const std::vector<std::string>& args,
+    const std::string& dir, const std::string& log_name) {
+#ifdef _WIN32
+    std::string command_line = "\"" + exe + "\"";
+    for (const std::string& arg : args) {
+        command_line += " \"" + arg + "\"";
+    }
+    SECURITY_ATTRIBUTES inherit = { sizeof(inherit), NULL, TRUE };
+    HANDLE log = CreateFileA((dir + "\\" + log_name).c_str(), GENERIC_WRITE, FILE_SHARE_READ, &inherit,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (log == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    STARTUPINFOA startup = { sizeof(startup) };
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = log;
+    startup.hStdError = log;
+    PROCESS_INFORMATION info;
+    BOOL started = CreateProcessA(NULL, &command_line[0], NULL, NULL, TRUE, 0, NULL, dir.c_str(), &startup, &info);
+    CloseHandle(log);
+    if (!started) {
+        return false;
+    }
+    CloseHandle(info.hThread);
+    child.handle = info.hProcess;
+    return true;
+#else
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(exe.c_str()));
+    for (const std::string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    child.pid = fork();
+    if (child.pid < 0) {
+        return false;
+    }
+    if (child.pid == 0) {
+        int log = -1;
+        if (chdir(dir.c_str()) == 0) {
+            log = open(log_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (log >= 0) {
+            dup2(log, 1);
+            dup2(log, 2);
+            execv(exe.c_str(), argv.data());
+        }
+        _exit(127);
+    }
+    return true;
+#endif
+}
+
+/*
+ wait_process - 等待子进程退出，超时后强制结束它
+ @param child 子进程句柄
+ @param timeout_ms 超时时间
+ @param exit_code 输出：退出码
+ @return false表示超时（子进程已被结束）
+ */
+bool wait_process(ChildProcess& child, int timeout_ms, int& exit_code) {
+#ifdef _WIN32
+    bool exited = WaitForSingleObject(child.handle, (DWORD)timeout_ms) == WAIT_OBJECT_0;
+    if (!exited) {
+        TerminateProcess(child.handle, 1);
+        WaitForSingleObject(child.handle, INFINITE);
+    }
+    DWORD code = 1;
+    GetExitCodeProcess(child.handle, &code);
+    exit_code = (int)code;
+    CloseHandle(child.handle);
+    child.handle = NULL;
+    return exited;
+#else
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    int status = 0;
+    while (waitpid(child.pid, &status, WNOHANG) == 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            kill(child.pid, SIGKILL);
+            waitpid(child.pid, &status, 0);
+            child.pid = -1;
+            exit_code = 1;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    child.pid = -1;
+    exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    return true;
+#endif
+}
+
+// ========== 运行与结果 ==========
+
+/*
+ run_once - 运行一次传输：启动代理和服务器，计时客户端，校验收到的文件
+ @param client_exe 客户端程序的绝对路径
+ @param server_exe 服务器程序的绝对路径
+ @param work_dir 工作目录（绝对路径），测试文件、输出文件和日志都在这里
+ @param input_name 测试文件名（相对于工作目录）
+ @param scenario 场景
+ @param timeout_s 超时时间
+ @param log_prefix 日志文件名前缀，成功的运行删除日志
+ */
+RunResult run_once(const std::string& client_exe, const std::string& server_exe, const std::string& work_dir,
+    const std::string& input_name, const Scenario& scenario, int timeout_s, const std::string& log_prefix) {
+    RunResult result;
+    std::string output_path = work_dir + "/" + OUTPUT_FILE;
+    remove(output_path.c_str());
+
+    ImpairmentProxy proxy;
+    if (!proxy.start(ROUTER_PORT, SERVER_PORT, scenario.config)) {
+        result.status = "failed";
+        std::cerr << "Could not bind the proxy to port " << ROUTER_PORT << std::endl;
+        return result;
+    }
+    ChildProcess server, client;
+    if (!start_process(server, server_exe, { "--sessions=1" }, work_dir, log_prefix + "server.log")) {
+        result.status = "failed";
+        return result;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_STARTUP_MS));
+
+    // 不续传：每次运行都是完整的一次传输，输出文件名也固定为第一个会话的编号
+    std::vector<std::string> args = { "127.0.0.1", input_name };
+    args.insert(args.end(), scenario.client_args.begin(), scenario.client_args.end());
+    args.push_back("--no-resume");
+    auto start_time = std::chrono::steady_clock::now();
+    int client_code = 1, server_code = 1;
+    bool client_started = start_process(client, client_exe, args, work_dir, log_prefix + "client.log");
+    bool client_finished = client_started && wait_process(client, timeout_s * 1000, client_code);
+    result.seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count() / 1e6;
+    bool server_finished = wait_process(server, client_finished ? SERVER_EXIT_TIMEOUT_MS : 0, server_code);
+    proxy.stop();
+    result.stats = proxy.stats();
+
+    if (client_started && !client_finished) {
+        result.status = "timeout";
+    }
+    else if (!client_started || client_code != 0 || !server_finished) {
+        result.status = "failed";
+    }
+    else if (!files_equal(work_dir + "/" + input_name, output_path)) {
+        result.status = "mismatch";
+    }
+    else {
+        result.status = "ok";
+        remove((work_dir + "/" + log_prefix + "client.log").c_str());
+        remove((work_dir + "/" + log_prefix + "server.log").c_str());
+    }
+    remove(output_path.c_str());
+    return result;
+}
+
+std::string join(const std::vector<std::string>& words) {
+    std::string text;
+    for (const std::string& word : words) {
+        text += (text.empty() ? "" : " ") + word;
+    }
+    return text;
+}
+
+void write_csv_header(std::ostream& csv) {
+    csv << "scenario,run,file_bytes,loss,corrupt,reorder,delay_ms,jitter_ms,rate_mbps,queue_kb,mtu,client_args,"
+        << "status,seconds,throughput_mbps,data_packets,retransmissions,retransmit_ratio,parity_packets,"
+        << "dropped_loss,dropped_queue,dropped_mtu,corrupted,reordered\n";
+}
+
+void write_csv_row(std::ostream& csv, const Scenario& s, int run, uint64_t size, const RunResult& r) {
+    const ImpairmentConfig& c = s.config;
+    double throughput_mbps = r.seconds > 0 ? size * 8 / r.seconds / 1e6 : 0;
+    double retransmit_ratio = r.stats.data_packets > 0 ? (double)r.stats.retransmissions / r.stats.data_packets : 0;
+    csv << s.name << "," << run << "," << size << "," << c.loss << "," << c.corrupt << "," << c.reorder << ","
+        << c.delay_ms << "," << c.jitter_ms << "," << c.rate_mbps << "," << c.queue_kb << "," << c.mtu << ",\""
+        << join(s.client_args) << "\"," << r.status << "," << r.seconds << "," << throughput_mbps << ","
+        << r.stats.data_packets << "," << r.stats.retransmissions << "," << retransmit_ratio << ","
+        << r.stats.parity_packets << "," << r.stats.dropped_loss << "," << r.stats.dropped_queue << ","
+        << r.stats.dropped_mtu << "," << r.stats.corrupted << "," << r.stats.reordered << "\n";
+    csv.flush();  // 中途停止时已经完成的运行不丢失
+}
+
+/*
+ @param argc 命令行参数个数
+ @param argv 命令行参数数组：argv[1]=客户端程序, argv[2]=服务器程序, argv[3]=场景脚本, 之后为可选参数：
+             --out=<file>（结果CSV，默认bench_results.csv），
+             --work=<dir>（工作目录，默认bench_work；测试文件保留在这里供下次使用）
+ 流程：
+    1. 读取场景脚本，生成各种大小的测试文件
+    2. 对每个场景组合、每种文件大小运行repeat次：启动代理和服务器，运行客户端，校验输出
+    3. 每次运行的结果写入CSV的一行，并在终端输出一行摘要
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <client_exe> <server_exe> <scenario_file> [--out=<csv>] [--work=<dir>]" << std::endl;
+        return 1;
+    }
+    std::string client_exe = absolute_path(argv[1]);
+    std::string server_exe = absolute_path(argv[2]);
+    std::string out_path = "bench_results.csv";
+    std::string work_dir = "bench_work";
+    for (int i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_path = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "--work=", 7) == 0) {
+            work_dir = argv[i] + 7;
+        }
+        else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    BenchPlan plan;
+    if (!load_plan(argv[3], plan)) {
+        return 1;
+    }
+    make_directory(work_dir);
+    work_dir = absolute_path(work_dir);
+    std::ofstream csv(out_path, std::ios::trunc);
+    if (!csv) {
+        std::cerr << "Could not create " << out_path << std::endl;
+        return 1;
+    }
+    write_csv_header(csv);
+    if (!initialize_winsock()) {
+        return 1;
+    }
+
+    size_t total_runs = plan.scenarios.size() * plan.sizes.size() * plan.repeat;
+    size_t run_index = 0, failures = 0;
+    for (uint64_t size : plan.sizes) {
+        std::string input_name = "input_" + std::to_string(size) + ".bin";
+        if (!make_input_file(work_dir + "/" + input_name, size)) {
+            std::cerr << "Could not create test file " << input_name << std::endl;
+            return 1;
+        }
+        for (const Scenario& base : plan.scenarios) {
+            for (int run = 0; run < plan.repeat; run++) {
+                Scenario scenario = base;
+                scenario.config.seed = base.config.seed + run;  // 重复运行使用不同的丢包序列
+                run_index++;
+                char log_prefix[32];
+                snprintf(log_prefix, sizeof(log_prefix), "run_%04zu_", run_index);
+                RunResult result = run_once(client_exe, server_exe, work_dir, input_name, scenario, plan.timeout_s, log_prefix);
+                write_csv_row(csv, scenario, run, size, result);
+                if (result.status != "ok") {
+                    failures++;
+                }
+                double mbps = result.seconds > 0 ? size * 8 / result.seconds / 1e6 : 0;
+                printf("[%zu/%zu] %-12s %10llu bytes  %-8s %8.2f s %9.2f Mbit/s  %llu retransmissions\n",
+                    run_index, total_runs, scenario.name.c_str(), (unsigned long long)size, result.status.c_str(),
+                    result.seconds, mbps, (unsigned long long)result.stats.retransmissions);
+                fflush(stdout);
+            }
+        }
+    }
+    cleanup_winsock();
+    std::cout << "Results written to " << out_path;
+    if (failures > 0) {
+        std::cout << " (" << failures << " runs failed, logs kept in " << work_dir << ")";
+    }
+    std::cout << std::endl;
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+﻿/*
+ impairment.h - 进程内的网络损伤模拟代理
+ 代替外部的Router程序：在ROUTER_PORT上接收客户端的数据报转发给SERVER_PORT上的服务器，再把服务器的回复转回客户端
+ 两个方向分别按同一份配置施加路径MTU、丢包、损坏、带宽限制（带尾部丢弃的瓶颈队列）、固定延迟、抖动和乱序
+ 握手的SYN、SYN-ACK和JOIN与数据包一样会被丢弃：客户端超时重发SYN和JOIN，丢失一个握手包使这次运行多用一个超时（约1秒），
+ 不会一直等到场景的timeout；小文件的吞吐率因此受握手丢包影响较大
+ 转发时顺便解析客户端发出的数据包头部，按(流, 序列号)统计重传次数
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+// ========== 代理常量 ==========
+const int PROXY_RECV_BURST = 64;  // 每个套接字每轮最多取的数据报数，持续到达的数据报不会推迟到期数据报的发出
+
+// ========== 损伤参数 ==========
+struct ImpairmentConfig {
+    double loss = 0;              // 丢包率
+    double corrupt = 0;           // 损坏率：被选中的数据报随机翻转一个比特
+    double reorder = 0;           // 乱序率：被选中的数据报额外推迟reorder_delay_ms，排到后面的数据报之后
+    double reorder_delay_ms = 10; // 乱序数据报额外的延迟（毫秒）
+    double delay_ms = 0;          // 单向固定延迟（毫秒）
+    double jitter_ms = 0;         // 单向抖动：在[0, jitter_ms]内均匀分布的附加延迟
+    double rate_mbps = 0;         // 单向瓶颈带宽（Mbit/s），0表示不限
+    uint32_t queue_kb = 256;      // 瓶颈队列容量（KB），排队超过它的数据报被丢弃；只在限制带宽时使用
+    uint32_t mtu = 0;             // 路径MTU（字节，含IP/UDP头部），更大的数据报被丢弃，0表示不限
+    uint32_t seed = 1;            // 随机数种子，同一个种子得到同样的丢包序列（对同样的数据报序列而言）
+};
+
+// ========== 代理统计 ==========
+struct ImpairmentStats {
+    uint64_t forward_datagrams = 0;  // 客户端发往服务器的数据报
+    uint64_t forward_bytes = 0;
+    uint64_t reverse_datagrams = 0;  // 服务器发往客户端的数据报
+    uint64_t data_packets = 0;       // 其中的数据包（不含握手、FIN、探测和校验包）
+    uint64_t retransmissions = 0;    // 同一个(流, 序列号)第二次及以后出现的数据包
+    uint64_t parity_packets = 0;     // FEC校验包
+    uint64_t dropped_loss = 0;       // 随机丢弃
+    uint64_t dropped_queue = 0;      // 瓶颈队列溢出丢弃
+    uint64_t dropped_mtu = 0;        // 超过路径MTU丢弃
+    uint64_t corrupted = 0;
+    uint64_t reordered = 0;
+};
+
+/*
+ ImpairmentProxy - 损伤模拟代理
+ start()之后在后台线程中转发，stop()之后stats()有效；每个客户端地址（即每个流的套接字和探测套接字）
+ 在代理上对应一个上游套接字，服务器看到的对端地址就是这个套接字
+ */
+class ImpairmentProxy {
+public:
+    ImpairmentProxy() = default;
+    ~ImpairmentProxy() { stop(); }
+
+    ImpairmentProxy(const ImpairmentProxy&) = delete;
+    ImpairmentProxy& operator=(const ImpairmentProxy&) = delete;
+
+    /*
+     start - 绑定监听端口并启动转发线程
+     @param listen_port 客户端连接的端口（ROUTER_PORT）
+     @param server_port 服务器端口，服务器在本机
+     @param config 损伤参数
+     @return false表示端口无法绑定
+     */
+    bool start(int listen_port, int server_port, const ImpairmentConfig& config) {
+        config_ = config;
+        stats_ = ImpairmentStats();
+        random_.seed(config.seed);
+        memset(&server_addr_, 0, sizeof(server_addr_));
+        server_addr_.sin_family = AF_INET;
+        server_addr_.sin_port = htons((u_short)server_port);
+        inet_pton(AF_INET, "127.0.0.1", &server_addr_.sin_addr);
+
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons((u_short)listen_port);
+        inet_pton(AF_INET, "127.0.0.1", &local.sin_addr);
+        front_ = open_socket(local);
+        if (front_ == INVALID_SOCKET) {
+            return false;
+        }
+        stop_ = false;
+        thread_ = std::thread(&ImpairmentProxy::run, this);
+        return true;
+    }
+
+    // 停止转发并关闭所有套接字，还在延迟队列里的数据报一起丢弃
+    void stop() {
+        stop_ = true;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        for (auto& upstream : upstreams_) {
+            closesocket(upstream.second);
+        }
+        upstreams_.clear();
+        clients_.clear();
+        if (front_ != INVALID_SOCKET) {
+            closesocket(front_);
+            front_ = INVALID_SOCKET;
+        }
+        pending_ = std::priority_queue<Pending, std::vector<Pending>, Later>();
+        links_[0] = links_[1] = Link();
+        seen_.clear();
+    }
+
+    const ImpairmentStats& stats() const { return stats_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // 一个方向的瓶颈链路：排队的数据报依次发出，busy_until为发完已排队数据报的时刻
+    struct Link {
+        Clock::time_point busy_until;
+    };
+
+    // 延迟队列中等待发出的数据报
+    struct Pending {
+        Clock::time_point release;
+        uint64_t order;     // 同一时刻发出的数据报保持到达顺序
+        SOCKET out;
+        sockaddr_in to;
+        std::vector<char> bytes;
+    };
+
+    struct Later {
+        bool operator()(const Pending& a, const Pending& b) const {
+            return a.release != b.release ? a.release > b.release : a.order > b.order;
+        }
+    };
+
+    static SOCKET open_socket(const sockaddr_in& local) {
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == INVALID_SOCKET) {
+            return s;
+        }
+        // 代理一次取一个数据报，突发期间靠接收缓冲区吸收，不能让代理自己成为丢包来源
+        int buffer_size = 8 * 1024 * 1024;
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer_size, sizeof(buffer_size));
+        setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&buffer_size, sizeof(buffer_size));
+        if (bind(s, (const sockaddr*)&local, sizeof(local)) == SOCKET_ERROR) {
+            closesocket(s);
+            return INVALID_SOCKET;
+        }
+#ifdef _WIN32
+        u_long nonblocking = 1;
+        ioctlsocket(s, FIONBIO, &nonblocking);
+#else
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+        return s;
+    }
+
+    static uint64_t address_key(const sockaddr_in& addr) {
+        return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+    }
+
+    double uniform() { return std::uniform_real_distribution<double>(0.0, 1.0)(random_); }
+
+    // 转发线程：发出到期的数据报，在所有套接字上等待新的数据报或下一个到期时刻
+    void run() {
+        std::vector<char> buffer(65536);
+        while (!stop_) {
+            Clock::time_point now = Clock::now();
+            while (!pending_.empty() && pending_.top().release <= now) {
+                const Pending& p = pending_.top();
+                sendto(p.out, p.bytes.data(), (int)p.bytes.size(), 0, (const sockaddr*)&p.to, sizeof(p.to));
+                pending_.pop();
+            }
+
+            long long wait_us = 20000;  // 至少每20毫秒检查一次停止标志
+            if (!pending_.empty()) {
+                long long due_us = std::chrono::duration_cast<std::chrono::microseconds>(pending_.top().release - now).count();
+                wait_us = (std::min)(wait_us, (std::max)(due_us, 0LL));
+            }
+            fd_set read_set;
+            FD_ZERO(&read_set);
+            FD_SET(front_, &read_set);
+            SOCKET max_socket = front_;
+            for (auto& upstream : upstreams_) {
+                FD_SET(upstream.second, &read_set);
+                max_socket = (std::max)(max_socket, upstream.second);
+            }
+            timeval tv = { (long)(wait_us / 1000000), (long)(wait_us % 1000000) };
+            if (select((int)max_socket + 1, &read_set, NULL, NULL, &tv) <= 0) {
+                continue;
+            }
+
+            if (FD_ISSET(front_, &read_set)) {
+                sockaddr_in from;
+                socklen_t from_len = sizeof(from);
+                int n;
+                for (int i = 0; i < PROXY_RECV_BURST && (n = recvfrom(front_, buffer.data(), (int)buffer.size(), 0, (sockaddr*)&from, &from_len)) >= 0; i++) {
+                    SOCKET upstream = upstream_for(from);
+                    if (upstream != INVALID_SOCKET) {
+                        count_forward(buffer.data(), n);
+                        impair(0, buffer.data(), n, upstream, server_addr_);
+                    }
+                    from_len = sizeof(from);
+                }
+            }
+            for (auto& upstream : upstreams_) {
+                if (!FD_ISSET(upstream.second, &read_set)) {
+                    continue;
+                }
+                int n;
+                for (int i = 0; i < PROXY_RECV_BURST && (n = recvfrom(upstream.second, buffer.data(), (int)buffer.size(), 0, NULL, NULL)) >= 0; i++) {
+                    stats_.reverse_datagrams++;
+                    impair(1, buffer.data(), n, front_, clients_[upstream.first]);
+                }
+            }
+        }
+    }
+
+    // 找到客户端地址对应的上游套接字，新的客户端地址打开一个新的
+    SOCKET upstream_for(const sockaddr_in& client) {
+        uint64_t key = address_key(client);
+        auto it = upstreams_.find(key);
+        if (it != upstreams_.end()) {
+            return it->second;
+        }
+        if (upstreams_.size() + 1 >= FD_SETSIZE) {
+            return INVALID_SOCKET;
+        }
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &local.sin_addr);
+        SOCKET s = open_socket(local);
+        if (s != INVALID_SOCKET) {
+            upstreams_[key] = s;
+            clients_[key] = client;
+        }
+        return s;
+    }
+
+    // 统计客户端发出的数据报：数据包按(流, 序列号)去重，重复出现的就是重传
+    void count_forward(const char* data, int len) {
+        stats_.forward_datagrams++;
+        stats_.forward_bytes += len;
+        if (len < HEADER_SIZE) {
+            return;
+        }
+        Packet header;
+        memcpy(&header, data, HEADER_SIZE);
+        if (header.flags & PARITY) {
+            stats_.parity_packets++;
+            return;
+        }
+        if ((header.flags & ~BLOCK_START) != 0 || header.data_len == 0) {
+            return;  // 握手、ACK、FIN和探测包
+        }
+        stats_.data_packets++;
+        std::vector<bool>& seen = seen_[header.stream_id];
+        if (header.seq_num >= seen.size()) {
+            seen.resize((std::max)((size_t)header.seq_num + 1, seen.size() * 2));
+        }
+        if (seen[header.seq_num]) {
+            stats_.retransmissions++;
+        }
+        seen[header.seq_num] = true;
+    }
+
+    /*
+     impair - 对一个数据报施加损伤，没被丢弃的放进延迟队列
+     @param direction 0为客户端到服务器，1为服务器到客户端
+     @param data 数据报
+     @param len 数据报长度
+     @param out 发出数据报的套接字
+     @param to 目的地址
+     */
+    void impair(int direction, const char* data, int len, SOCKET out, const sockaddr_in& to) {
+        if (config_.mtu != 0 && (uint32_t)len + IP_UDP_HEADER_SIZE > config_.mtu) {
+            stats_.dropped_mtu++;
+            return;
+        }
+        if (config_.loss > 0 && uniform() < config_.loss) {
+            stats_.dropped_loss++;
+            return;
+        }
+
+        Clock::time_point now = Clock::now();
+        Clock::time_point depart = now;
+        if (config_.rate_mbps > 0) {
+            // 瓶颈链路：排队中的字节数由busy_until换算，超过队列容量就尾部丢弃
+            Link& link = links_[direction];
+            double bytes_per_us = config_.rate_mbps / 8.0;
+            double backlog_us = (double)std::chrono::duration_cast<std::chrono::microseconds>(link.busy_until - now).count();
+            if (backlog_us > 0 && backlog_us * bytes_per_us + len > config_.queue_kb * 1024.0) {
+                stats_.dropped_queue++;
+                return;
+            }
+            link.busy_until = (std::max)(link.busy_until, now) + std::chrono::microseconds((long long)(len / bytes_per_us));
+            depart = link.busy_until;
+        }
+        double delay_ms = config_.delay_ms + config_.jitter_ms * uniform();
+        if (config_.reorder > 0 && uniform() < config_.reorder) {
+            delay_ms += config_.reorder_delay_ms;
+            stats_.reordered++;
+        }
+
+        Pending p;
+        p.release = depart + std::chrono::microseconds((long long)(delay_ms * 1000));
+        p.order = next_order_++;
+        p.out = out;
+        p.to = to;
+        p.bytes.assign(data, data + len);
+        if (len > 0 && config_.corrupt > 0 && uniform() < config_.corrupt) {
+            size_t bit = (size_t)(uniform() * len * 8) % ((size_t)len * 8);
+            p.bytes[bit / 8] ^= (char)(1 << (bit % 8));
+            stats_.corrupted++;
+        }
+        pending_.push(std::move(p));
+    }
+
+    ImpairmentConfig config_;
+    ImpairmentStats stats_;
+    std::mt19937 random_;
+    sockaddr_in server_addr_;
+    SOCKET front_ = INVALID_SOCKET;
+    std::map<uint64_t, SOCKET> upstreams_;      // 客户端地址 -> 上游套接字
+    std::map<uint64_t, sockaddr_in> clients_;   // 客户端地址 -> 地址本身，回复按它转回
+    std::priority_queue<Pending, std::vector<Pending>, Later> pending_;
+    Link links_[2];
+    uint64_t next_order_ = 0;
+    std::map<uint8_t, std::vector<bool>> seen_;  // 每个流见过的序列号
+    std::thread thread_;
+    std::atomic<bool> stop_{ false };
+};
@@ -0,0 +1,192 @@
+﻿/*
+ block_compressor.h - 发送前的分块压缩
+ 后台压缩线程在发送窗口前面把一个流的文件区间按COMPRESS_BLOCK_SIZE切块压缩，
+ 每个块（块头 + 压缩数据）依次占用若干个连续的序列号
+ 事件循环只取已经压缩好的数据包，压缩跟不上时不等待，稍后再询问，
+ 因此压缩不会推迟重传和ACK处理；块一直保留到其中的数据包全部被累计确认，重传直接使用保留的数据
+ 文件数据读取失败时压缩线程停止，事件循环通过failed()发现后中止传输
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include "file_source.h"
+#include "../rdt/lz_block.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ========== 压缩常量 ==========
+const uint32_t COMPRESS_AHEAD_PACKETS = 4096;  // 压缩线程最多领先发送位置的数据包数（约6MB）
+
+/*
+ BlockCompressor - 一个流的压缩流水线
+ start()之后，事件循环按序列号询问ready()并用payload()取得载荷；
+ ACK推进窗口后调用release_before()释放已确认的块
+ */
+class BlockCompressor {
+public:
+    BlockCompressor() = default;
+    ~BlockCompressor() { stop(); }
+
+    BlockCompressor(const BlockCompressor&) = delete;
+    BlockCompressor& operator=(const BlockCompressor&) = delete;
+
+    /*
+     start - 打开文件并启动压缩线程
+     @param layout 数据源的组成（单个文件，或批量传输的清单和文件），压缩线程使用自己的映射
+     @param begin 区间起点（文件偏移）
+     @param end 区间终点（不含）
+     @param segment_size 分段大小：块按这个长度切成数据包
+     @return false表示文件无法打开
+     */
+    bool start(const SourceLayout& layout, uint64_t begin, uint64_t end, uint16_t segment_size) {
+        if (!source_.open(layout)) {
+            return false;
+        }
+        begin_ = begin;
+        end_ = end;
+        segment_size_ = segment_size;
+        thread_ = std::thread(&BlockCompressor::run, this);
+        return true;
+    }
+
+    // 停止压缩线程，未发送的块一起丢弃
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        space_cv_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        source_.close();
+    }
+
+    /*
+     ready - 序列号seq的数据包是否已经压缩好
+     同时把seq记为发送位置，压缩线程据此决定还要领先多少
+     */
+    bool ready(uint32_t seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (seq > send_seq_) {
+            send_seq_ = seq;
+            space_cv_.notify_one();
+        }
+        return seq < next_seq_;
+    }
+
+    // 区间已经全部压缩完，且seq及之后没有数据包
+    bool exhausted(uint32_t seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return done_ && seq >= next_seq_;
+    }
+
+    /*
+     payload - 取得数据包的载荷
+     只能用于ready()返回过true且还没有释放的序列号；返回的指针在release_before()释放所在的块之前有效
+     @param seq 序列号
+     @param len 输出：载荷长度
+     @param block_start 输出：是否为块的第一个数据包
+     */
+    const char* payload(uint32_t seq, uint16_t& len, bool& block_start) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::upper_bound(blocks_.begin(), blocks_.end(), seq,
+            [](uint32_t s, const Block& block) { return s < block.first_seq; });
+        const Block& block = *(it - 1);
+        size_t offset = (size_t)(seq - block.first_seq) * segment_size_;
+        len = (uint16_t)(std::min)((size_t)segment_size_, block.bytes.size() - offset);
+        block_start = seq == block.first_seq;
+        return block.bytes.data() + offset;
+    }
+
+    // 释放所有数据包都在seq之前的块
+    void release_before(uint32_t seq) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!blocks_.empty() && blocks_.front().first_seq + blocks_.front().packet_count <= seq) {
+            blocks_.pop_front();
+        }
+    }
+
+    // 压缩线程读不出文件数据而停止；之后不会再有新的块
+    bool failed() const { return failed_; }
+
+    uint64_t raw_bytes() const { return raw_bytes_; }
+    uint64_t stored_bytes() const { return stored_bytes_; }
+
+private:
+    struct Block {
+        uint32_t first_seq = 0;      // 块的第一个数据包的序列号
+        uint32_t packet_count = 0;
+        std::vector<char> bytes;     // 块头 + 块数据
+    };
+
+    // 压缩线程：逐块压缩，领先发送位置太多时等待
+    void run() {
+        std::vector<char> compressed(lz_compress_bound(COMPRESS_BLOCK_SIZE));
+        for (uint64_t offset = begin_; offset < end_; offset += COMPRESS_BLOCK_SIZE) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                space_cv_.wait(lock, [this] { return stop_ || next_seq_ - send_seq_ < COMPRESS_AHEAD_PACKETS; });
+                if (stop_) {
+                    return;
+                }
+            }
+            size_t raw_len = (size_t)(std::min)((uint64_t)COMPRESS_BLOCK_SIZE, end_ - offset);
+            const char* raw = source_.data(offset, raw_len);
+            if (raw == nullptr) {
+                failed_ = true;
+                break;
+            }
+            size_t compressed_len = lz_compress(raw, raw_len, compressed.data(), compressed.size());
+
+            // 压缩后不比原始数据小的块原样发送
+            CompressedBlockHeader header;
+            header.raw_offset = offset;
+            header.raw_length = (uint32_t)raw_len;
+            header.method = compressed_len > 0 && compressed_len < raw_len ? COMPRESS_LZ : COMPRESS_STORED;
+            header.stored_length = (uint32_t)(header.method == COMPRESS_LZ ? compressed_len : raw_len);
+            Block block;
+            block.bytes.resize(sizeof(header) + header.stored_length);
+            memcpy(block.bytes.data(), &header, sizeof(header));
+            memcpy(block.bytes.data() + sizeof(header), header.method == COMPRESS_LZ ? compressed.data() : raw, header.stored_length);
+            block.packet_count = (uint32_t)((block.bytes.size() + segment_size_ - 1) / segment_size_);
+            raw_bytes_ += raw_len;
+            stored_bytes_ += block.bytes.size();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                block.first_seq = next_seq_;
+                next_seq_ += block.packet_count;
+                blocks_.push_back(std::move(block));
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+
+    FileSource source_;
+    uint64_t begin_ = 0;
+    uint64_t end_ = 0;
+    uint16_t segment_size_ = DEFAULT_SEGMENT_SIZE;
+    std::thread thread_;
+
+    // ========== 与事件循环共享（由mutex_保护）==========
+    std::mutex mutex_;
+    std::condition_variable space_cv_;  // 发送位置前进或停止时唤醒压缩线程
+    std::deque<Block> blocks_;          // 已压缩、还没被确认的块，按序列号排序
+    uint32_t next_seq_ = 1;             // 下一个块的起始序列号
+    uint32_t send_seq_ = 1;             // 事件循环询问过的最大序列号
+    bool done_ = false;
+    bool stop_ = false;
+
+    std::atomic<bool> failed_{ false };
+    std::atomic<uint64_t> raw_bytes_{ 0 };     // 已压缩的原始字节数
+    std::atomic<uint64_t> stored_bytes_{ 0 };  // 压缩结果（含块头）的字节数
+};
@@ -5,173 +5,1121 @@
  特性：
  1. 连接管理：三次握手建立连接
  2. 差错检测：校验和机制
- 3. 确认重传：选择确认(SACK) + 超时重传
- 4. 流量控制：固定窗口大小
- 5. 拥塞控制：TCP RENO算法（慢启动、拥塞避免、快速恢复）
+ 3. 确认重传：选择确认(SACK) + 自适应超时重传
+ 4. 流量控制：接收方通告窗口（握手协商窗口缩放），发送窗口 = min(rwnd, cwnd)
+ 5. 拥塞控制：可插拔的拥塞控制器（RENO / CUBIC / BBR），命令行选择
+ 6. 批量收发：一次系统调用发出一批数据包、取回一批ACK
+ 7. 日志：逐包日志写入异步日志缓冲区，由后台线程输出，默认只输出INFO及以上
+ 8. 条带传输：文件切分为N个字节区间，由N个流在各自的套接字上并行发送，每个流有独立的窗口和拥塞控制
+ 9. 断点续传：SYN携带传输ID，服务器有上次的接收进度时，每个流从第一个缺失的数据包开始发送
+ 10. 速率平滑：按拥塞控制器给出的速率用令牌桶均匀发送，避免整窗突发挤爆路由器队列
+ 11. 压缩传输：服务器同意时，每个流的压缩线程在发送窗口前面分块压缩文件，数据包携带压缩块
+ 12. 前向纠错：每组数据包之后发送一个异或校验包，服务器可以直接恢复组内丢失的一个包；组大小固定或按丢包率自适应
+ 13. 路径MTU探测：握手前用带DF位的探测包找出不分片的最大数据报，分段大小在握手中协商，巨帧网络可用约9000字节的分段
+ 14. 遥测：按固定间隔采样每个流的拥塞窗口、RTT、在途包数、重传和goodput，写入CSV/JSON轨迹文件并通过HTTP统计端点提供
+ 15. 事件驱动：每个流由一个线程的事件循环驱动，在套接字上等到ACK到达、最早的重传定时器到期或下一个令牌可用，发送窗口不需要加锁
+ 16. 文件元数据：SYN携带文件名和大小，服务器据此预分配文件、收齐最后一个字节即完成；整个文件的CRC32C在后台线程中
+     与发送并行计算，随FIN发出，服务器收到后核对内容；
+     0号流握手后立即开始发送，附加的流在各自的线程中加入连接，不再逐个等待JOIN-ACK
+ 17. 批量传输：--batch时文件路径是一个文件列表，列表中的文件连同清单作为一个字节流在同一个连接中发送，
+     只握手一次，拥塞窗口跨文件保持，小文件共用数据包；服务器收齐后按清单拆分成独立的文件
  */
 
-#include "common.h"
+#include "../rdt/common.h"
+#include "../rdt/rto.h"
+#include "../rdt/congestion.h"
+#include "../rdt/batch_io.h"
+#include "../rdt/log.h"
+#include "../rdt/fec.h"
+#include "../rdt/telemetry.h"
+#include "file_source.h"
+#include "send_ring.h"
+#include "pacer.h"
+#include "block_compressor.h"
 #include <vector>
-#include <fstream>
 #include <thread>
-#include <mutex>
-#include <map>
 #include <atomic>
-#include <condition_variable>
 #include <algorithm> 
+#include <fstream>
+#include <random>
+#include <future>
+#include <set>
+#include <string>
+
+#ifdef _WIN32
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")  // timeBeginPeriod
+#endif
+
+// ========== 连接级状态（握手时确定，之后只读）==========
+uint8_t window_scale = 0;         // 握手协商的窗口缩放因子
+ChecksumMode checksum_mode = CHECKSUM_INTERNET;  // 握手协商的校验和模式，握手包本身总是使用Internet校验和
+uint16_t segment_size = DEFAULT_SEGMENT_SIZE;  // 握手协商的分段大小（数据包载荷字节数）
+bool pacing_enabled = true;       // 是否平滑发送，--no-pacing关闭
+bool compression_enabled = false; // 握手协商的压缩传输，--compress请求
+bool fec_enabled = false;         // 握手协商的FEC，--fec请求
+uint32_t fec_group_size = 0;      // 固定的校验组大小（--fec=<n>），0表示按丢包率自适应（--fec=auto）
+std::atomic<bool> transfer_failed(false);  // 某个流读不出文件数据时置位，所有流停止发送，不发送FIN
+uint32_t file_crc = 0;                     // 整个文件的CRC32C，由后台线程写入，file_crc_ready就绪之后才能读取
+std::shared_future<bool> file_crc_ready;   // 后台计算的结果，false表示文件读取失败
+std::atomic<bool> copy_corrupt(false);     // 服务器核对出它收到的文件与本地的不一致（FIN-ACK中的FIN_CORRUPT）
+sockaddr_in server_addr;   // 服务器地址结构
 
-// ========== 拥塞控制状态定义 ==========
-enum CongestionState {
-    SLOW_START,           // 慢启动：指数增长cwnd
-    CONGESTION_AVOIDANCE, // 拥塞避免：线性增长cwnd
-    FAST_RECOVERY         // 快速恢复：收到3个重复ACK后进入
+/*
+ FlowGauges - 一个流发布给遥测的状态
+ 事件循环每轮结束时写入，采样线程只读，都是原子量，双方都不需要加锁
+ */
+struct FlowGauges {
+    std::atomic<const char*> state{ "" };  // 拥塞控制状态名
+    std::atomic<double> cwnd{ 0 };
+    std::atomic<double> ssthresh{ 0 };
+    std::atomic<double> srtt_ms{ 0 };
+    std::atomic<double> rttvar_ms{ 0 };
+    std::atomic<double> rto_ms{ 0 };
+    std::atomic<double> pacing_rate{ 0 };
+    std::atomic<uint32_t> in_flight{ 0 };
+    std::atomic<uint32_t> receive_window{ 0 };
+    std::atomic<uint64_t> delivered{ 0 };
 };
 
-// ========== 发送窗口中数据包的状态 ==========
-struct PacketState {
-    Packet packet;        // 数据包内容
-    std::chrono::steady_clock::time_point send_time;  // 发送时间用于超时判断
-    bool acked = false;   // 是否已被确认
+/*
+ Flow - 条带传输中的一个流
+ 每个流负责文件的一个字节区间，拥有自己的套接字、发送窗口、RTT估计和拥塞控制器，
+ 由一个线程的事件循环驱动（发送、接收ACK和重传都在这个线程中）；流之间除了只读的连接级状态外不共享任何数据
+ 不使用条带传输时只有0号流，负责整个文件
+ */
+struct Flow {
+    uint8_t index = 0;          // 流编号，即数据包中的stream_id
+    uint64_t begin = 0;         // 本流负责的文件区间[begin, end)
+    uint64_t end = 0;
+    uint32_t first_seq = 1;     // 起始序列号：续传时为服务器报告的第一个缺失的数据包
+    uint32_t skip_to_seq = 0;   // 续传时ACK越过了发送位置：服务器已有这之前的数据包，新数据从这里继续
+    SOCKET socket = INVALID_SOCKET;  // 本流的UDP套接字
+    FileSource source;          // 本流自己的文件映射：映射视图会随偏移移动，不能在流之间共享
+    BatchSocket batch_io;       // 握手之后的批量收发，只在事件循环中使用
+
+    // ========== 发送状态（只在事件循环中使用）==========
+    SendRing send_window;     // 发送窗口：[base, next)区间内在途数据包的描述符
+    uint32_t receive_window = FLOW_CONTROL_WINDOW_SIZE;  // 接收方通告的窗口（数据包数）
+    uint32_t highest_sacked = 0;      // SACK块报告过的最大已收到序列号，它之前未确认的包就是空洞
+    RttEstimator rtt_estimator;       // RTT估计器，首个样本之前使用PACKET_TIMEOUT_MS
+    TimerQueue retransmit_timers;     // 重传定时器：按截止时间排序
+    Pacer pacer;                      // 令牌桶：新数据包按拥塞控制器给出的速率发出
+    BlockCompressor compressor;       // 压缩传输时新数据包的载荷来源（自带锁）
+    ParityAccumulator parity;         // FEC：当前校验组的异或累加
+    uint32_t parity_group_size = 0;   // 当前校验组的数据包数
+
+    // ========== 拥塞控制 ==========
+    std::unique_ptr<CongestionController> congestion;  // 拥塞控制器，由命令行选择
+    int duplicate_ack_count = 0;    // 重复ACK计数（收到3个触发快速重传）
+    uint32_t recovery_point = 0;    // 上次拥塞事件时已发送的最大序列号，窗口基序号越过它之前不再报告新的拥塞事件
+    uint32_t retransmit_cursor = 0; // 快速重传下一个要检查的序列号，0表示没有待重传的空洞
+    uint64_t delivered = 0;         // 累计交付（累计确认或SACK确认）的数据包数
+    std::chrono::steady_clock::time_point delivered_time;  // 最近一次交付的时间
+
+    // ========== 统计信息 ==========
+    std::atomic<uint32_t> total_packets_sent{ 0 };      // 总发送包数
+    std::atomic<uint32_t> total_retransmissions{ 0 };   // 总重传次数
+    std::atomic<uint32_t> total_acks_received{ 0 };     // 总接收ACK数
+    std::atomic<uint32_t> total_parity_sent{ 0 };       // 总FEC校验包数
+    std::atomic<uint32_t> total_duplicate_acks{ 0 };    // 总重复ACK数
+
+    // ========== 遥测 ==========
+    FlowGauges gauges;               // 事件循环发布的状态，采样线程只读
+    uint64_t sampled_delivered = 0;  // 上次采样时的delivered（只在采样线程中使用）
+    std::chrono::steady_clock::time_point sampled_time;  // 上次采样的时间
+
+    Flow() : send_window(MAX_SEND_WINDOW_SIZE), rtt_estimator(PACKET_TIMEOUT_MS) {}
 };
 
-// ========== 线程间共享状态（需要互斥锁保护）==========
-std::mutex window_mutex;  // 保护发送窗口的互斥锁
-std::map<uint32_t, PacketState> send_window;  // 发送窗口：<序列号, 数据包状态>
-uint32_t send_base = 1;         // 发送窗口基序号（最小未确认序列号）
-uint32_t next_seq_num = 1;      // 下一个要发送的序列号
-std::atomic<bool> transmission_complete(false);  // 传输完成标志（原子变量，线程安全）
-std::condition_variable retransmit_cv;  // 条件变量：用于快速重传信号
-uint32_t retransmit_seq_num = 0;  // 需要快速重传的序列号（0表示无）
-
-// ========== TCP RENO拥塞控制变量 ==========
-double cwnd = 1.0;               // 拥塞窗口（单位：数据包数）因为线性增长会加1/cwnd所以用double
-uint32_t ssthresh = 16;          // 慢启动阈值
-CongestionState state = SLOW_START;  // 当前拥塞控制状态
-int duplicate_ack_count = 0;    // 重复ACK计数（收到3个触发快速重传）
-
-// ========== 统计信息 ==========
-std::atomic<uint32_t> total_packets_sent(0);      // 总发送包数
-std::atomic<uint32_t> total_retransmissions(0);   // 总重传次数
-std::atomic<uint32_t> total_acks_received(0);     // 总接收ACK数
-
-// ========== 全局套接字和地址 ==========
-SOCKET client_socket;      // 客户端UDP套接字
-sockaddr_in server_addr;   // 服务器地址结构
+/*
+ send_segment - 按描述符构造并发送一个数据包
+ 载荷直接从本流的映射页复制到批量发送的槽位中，发送窗口本身不保存数据包副本；压缩传输时从压缩线程保留的块中复制
+ 载荷的校验和中间值在首次发送时计算并缓存在描述符中，重传时只需重新处理头部
+ 新包发送和重传都走这里，发送后按当前RTO登记重传定时器并消耗一个令牌；数据包在batch_io.flush()时真正发出
+ @param flow 数据包所属的流
+ @param ps 发送窗口中的数据包描述符
+ @param retransmission 是否为重传
+ @return false表示文件数据读取失败（文件被截断或映射失败），此时置位transfer_failed，不发送任何内容
+ */
+bool send_segment(Flow& flow, PacketState& ps, bool retransmission) {
+    Packet& packet = *reinterpret_cast<Packet*>(flow.batch_io.send_buffer());
+    packet.seq_num = ps.seq_num;
+    packet.ack_num = ps.parity_group;  // 数据包的ack_num为所在校验组的第一个序列号
+    bool block_start = false;
+    uint16_t payload_len = ps.data_len;
+    const char* payload = compression_enabled ? flow.compressor.payload(ps.seq_num, payload_len, block_start) : flow.source.data(ps.offset, ps.data_len);
+    if (payload == nullptr) {
+        LOG_ERROR("[stream {}] Could not read {} bytes at offset {}", flow.index, ps.data_len, ps.offset);
+        transfer_failed = true;
+        return false;
+    }
+    packet.flags = block_start ? BLOCK_START : 0;
+    packet.stream_id = flow.index;
+    packet.window_size = 0;
+    packet.data_len = ps.data_len;
+    packet.checksum = 0;
+    memcpy(packet.data, payload, ps.data_len);
+    if (!retransmission && ps.parity_group != 0) {
+        flow.parity.add(packet.data, ps.data_len, ps.data_len, packet.flags);  // 重传的包已经算进过校验组
+        flow.parity.count++;
+    }
+    if (!ps.payload_checksum_valid) {
+        ps.payload_checksum = checksum_payload(packet.data, ps.data_len, checksum_mode);
+        ps.payload_checksum_valid = true;
+    }
+    packet.checksum = checksum_with_payload(&packet, ps.payload_checksum, checksum_mode);
+    flow.batch_io.commit(HEADER_SIZE + ps.data_len);
+    ps.send_time = std::chrono::steady_clock::now();
+    ps.delivered = flow.delivered;            // 记录发送时的交付进度，确认时据此计算交付速率
+    ps.delivered_time = flow.delivered_time;
+    ps.retransmitted = ps.retransmitted || retransmission;
+    ps.deadline = ps.send_time + flow.rtt_estimator.rto();
+    flow.retransmit_timers.schedule(ps.seq_num, ps.deadline);
+    flow.pacer.consume(1);
+    return true;
+}
+
+/*
+ send_parity - 发送当前校验组的校验包，之后的新数据包开始新的校验组
+ 校验包不进入发送窗口、不登记重传定时器，但同样消耗令牌
+ */
+void send_parity(Flow& flow) {
+    Packet& packet = *reinterpret_cast<Packet*>(flow.batch_io.send_buffer());
+    fill_parity_packet(flow.parity, flow.index, packet);
+    packet.checksum = calculate_checksum(&packet, checksum_mode);
+    flow.batch_io.commit(HEADER_SIZE + packet.data_len);
+    flow.pacer.consume(1);
+    flow.parity.count = 0;
+    flow.total_parity_sent++;
+}
+
+/*
+ choose_parity_group - 选择新校验组的数据包数
+ 固定模式使用--fec=<n>；自适应模式以本流的重传率估计丢包率，让每组平均丢失约FEC_LOSSES_PER_GROUP个包，
+ 丢包越多组越小（冗余越高），没有丢包时取FEC_MAX_GROUP
+ */
+uint32_t choose_parity_group(Flow& flow) {
+    if (fec_group_size != 0) {
+        return fec_group_size;
+    }
+    uint32_t sent = flow.total_packets_sent;
+    double loss = sent > 0 ? (double)flow.total_retransmissions / sent : 0;
+    if (loss * FEC_MAX_GROUP <= FEC_LOSSES_PER_GROUP) {
+        return FEC_MAX_GROUP;
+    }
+    return (std::max)(FEC_MIN_GROUP, (uint32_t)(FEC_LOSSES_PER_GROUP / loss));
+}
+
+/*
+ in_congestion_epoch - 是否仍处在上一次拥塞事件的恢复期内
+ 恢复期从拥塞事件开始，到事件发生时已发送的数据全部被累计确认为止，约一个RTT
+ */
+bool in_congestion_epoch(Flow& flow) {
+    return flow.send_window.contains(flow.recovery_point);
+}
+
+/*
+ update_receive_window - 根据ACK中通告的窗口更新rwnd
+ 通告值按缩放因子换算为字节，再换算为数据包数；零窗口时仍允许1个包在途，起到窗口探测的作用
+ */
+void update_receive_window(Flow& flow, const Packet& ack_packet) {
+    uint64_t window_bytes = (uint64_t)ack_packet.window_size << window_scale;
+    flow.receive_window = (uint32_t)(std::max)((uint64_t)1, window_bytes / segment_size);
+}
 
 /*
- ACK接收线程
- 功能：独立线程持续接收服务器返回的ACK，并根据TCP RENO算法更新拥塞窗口
+ apply_sack_blocks - 处理ACK携带的SACK块
+ 将窗口内被选择确认的数据包标记为acked，超时与快速重传会跳过这些包
+ 每个块先截到发送窗口[base, next)以内再逐个标记，过时或损坏的块不会让循环走出窗口
+ @param flow ACK所属的流
+ @param ack_packet 收到的ACK包
+ */
+void apply_sack_blocks(Flow& flow, const Packet& ack_packet) {
+    SendRing& send_window = flow.send_window;
+    if (send_window.empty()) {
+        return;
+    }
+    const uint32_t base = send_window.base();
+    const uint32_t next = send_window.next();
+    int sack_count = ack_packet.data_len / sizeof(SackBlock);
+    const SackBlock* blocks = reinterpret_cast<const SackBlock*>(ack_packet.data);
+    for (int i = 0; i < sack_count && i < MAX_SACK_BLOCKS; i++) {
+        uint32_t left = blocks[i].left;
+        uint32_t right = blocks[i].right;
+        if ((int32_t)(left - base) < 0) {
+            left = base;
+        }
+        if ((int32_t)(right - next) > 0) {
+            right = next;
+        }
+        if ((int32_t)(right - left) <= 0) {
+            continue;  // 整个块都在窗口之外
+        }
+        for (uint32_t seq = left; seq != right; seq++) {
+            PacketState& ps = send_window.at(seq);
+            if (!ps.acked) {
+                ps.acked = true;
+                flow.delivered++;
+                flow.delivered_time = std::chrono::steady_clock::now();
+            }
+        }
+        uint32_t last = right - 1;
+        if (!send_window.contains(flow.highest_sacked) || last - base > flow.highest_sacked - base) {
+            flow.highest_sacked = last;
+        }
+    }
+}
+
+/*
+ process_ack - 处理一个ACK，并把ACK事件交给拥塞控制器
  关键逻辑：
-  1. 新ACK（ack_num >= send_base）：更新窗口，调整cwnd
-  2. 重复ACK（ack_num < send_base）：累计计数，3次触发快速重传
-  3. 拥塞控制状态转换
+  1. 新ACK（ack_num落在发送窗口内）：推进窗口基序号，由拥塞控制器调整cwnd
+  2. 重复ACK（ack_num < 窗口基序号）：累计计数，3次触发快速重传
+  3. SACK块：标记已被选择确认的数据包
+  4. 每个RTT最多报告一次拥塞事件
+ 在事件循环中随ACK到达立即调用，不经过其他线程
+ @param flow ACK所属的流
+ @param ack_packet 收到的ACK包，校验和已经验证
+ @return true表示需要快速重传
  */
-void receive_acks() {
-    Packet ack_packet;
-    int recv_len;
-    // 循环直到传输完成且发送窗口为空
-    while (!transmission_complete || !send_window.empty()) {
-        // 接收ACK数据包（阻塞调用）
-        recv_len = recvfrom(client_socket, (char*)&ack_packet, MAX_BUFFER_SIZE, 0, NULL, NULL);
-        if (recv_len > 0) {
-            // 验证校验和，确保ACK未损坏
-            if (verify_checksum(&ack_packet) && ack_packet.flags & ACK) {
-                std::lock_guard<std::mutex> lock(window_mutex);  // 加锁保护共享数据
-                total_acks_received++;
-
-                uint32_t acked_num = ack_packet.ack_num;  // 确认号
-                std::cout << "ACK received for SEQ=" << acked_num << std::endl;
-
-                // ========== TCP RENO拥塞控制核心逻辑 ==========
-                if (acked_num >= send_base) { 
-                    // ===== 情况1：收到新ACK（确认了新数据）=====
-                    duplicate_ack_count = 0;  // 重置重复ACK计数
-                    send_base = acked_num + 1;  // 更新窗口基序号
-
-                    // 从发送窗口中移除所有已确认的数据包
-                    for (auto it = send_window.begin(); it != send_window.end(); ) {
-                        if (it->first <= acked_num) {
-                            it = send_window.erase(it);  // 删除已确认的包
-                        }
-                        else {
-                            ++it;
-                        }
-                    }
+bool process_ack(Flow& flow, const Packet& ack_packet) {
+    SendRing& send_window = flow.send_window;
+    uint32_t acked_num = ack_packet.ack_num;  // 确认号
+    LOG_TRACE("[stream {}] ACK received for SEQ={}", flow.index, acked_num);
+    update_receive_window(flow, ack_packet);
 
-                    // === 根据当前状态调整拥塞窗口 ===
-                    if (state == FAST_RECOVERY) {
-                        // 快速恢复完成，进入拥塞避免
-                        state = CONGESTION_AVOIDANCE;
-                        cwnd = ssthresh;  // 将窗口收缩到阈值
-                    }
-                    else if (state == SLOW_START) {
-                        // 慢启动阶段：指数增长
-                        cwnd += 1;
-                        if (cwnd >= ssthresh) {
-                            state = CONGESTION_AVOIDANCE;  // 达到阈值，切换到拥塞避免
-                        }
-                    }
-                    else if (state == CONGESTION_AVOIDANCE) {
-                        // 拥塞避免阶段：线性增长（每个RTT增加1个包）
-                        cwnd += 1.0 / cwnd;
-                    }
+    // 续传时服务器可能已经有起始序列号之后的数据包（上次连接中越过空洞到达的），填上空洞后确认号会越过发送位置：
+    // 已发出的包全部确认，之后的新数据从确认号之后继续
+    uint64_t range_packets = (flow.end - flow.begin + segment_size - 1) / segment_size;
+    if (!compression_enabled && acked_num >= send_window.next() && acked_num <= range_packets) {
+        flow.skip_to_seq = acked_num + 1;
+        if (send_window.empty()) {
+            return false;
+        }
+        acked_num = send_window.next() - 1;
+    }
+
+    // ========== 拥塞控制核心逻辑 ==========
+    if (send_window.contains(acked_num)) {
+        // ===== 情况1：收到新ACK（确认了新数据）=====
+        flow.duplicate_ack_count = 0;  // 重置重复ACK计数
+        auto now = std::chrono::steady_clock::now();
+        AckEvent ev;
+        ev.now = now;
+
+        // RTT采样（Karn算法）：本次累计确认的范围内有重传过的包时，这个ACK可能是被重传包推动的，不采样；
+        // 被确认的包之前已被SACK过时，到达时间早于本ACK，也不采样
+        PacketState& acked_ps = send_window.at(acked_num);
+        bool valid_sample = !acked_ps.acked;
+        for (uint32_t s = send_window.base(); s != acked_num + 1; s++) {
+            PacketState& ps = send_window.at(s);
+            valid_sample = valid_sample && !ps.retransmitted;
+            if (!ps.acked) {
+                flow.delivered++;  // 之前没被SACK过的包在这里才算交付
+            }
+        }
+        flow.delivered_time = now;
+        if (valid_sample) {
+            ev.rtt_ms = std::chrono::duration<double, std::milli>(now - acked_ps.send_time).count();
+            flow.rtt_estimator.sample(ev.rtt_ms);
+            double interval_s = std::chrono::duration<double>(now - acked_ps.delivered_time).count();
+            if (interval_s > 0) {
+                ev.delivery_rate = (flow.delivered - acked_ps.delivered) / interval_s;
+            }
+        }
+        ev.prior_delivered = acked_ps.delivered;
+        ev.newly_acked = send_window.ack_through(acked_num);  // 推进窗口基序号即释放所有已确认的槽位
+        if (compression_enabled) {
+            flow.compressor.release_before(send_window.base());  // 已确认的压缩块不会再重传
+        }
+        apply_sack_blocks(flow, ack_packet);
+
+        // === 交给拥塞控制器调整窗口 ===
+        ev.in_flight = (uint32_t)send_window.size();
+        ev.delivered = flow.delivered;
+        ev.srtt_ms = flow.rtt_estimator.srtt_ms();
+        flow.congestion->on_ack(ev);
+        return false;
+    }
+
+    // ===== 情况2：收到重复ACK（确认号小于窗口基序号）=====
+    flow.duplicate_ack_count++;// 因为是重复ACK，计数加1
+    flow.total_duplicate_acks++;
+    apply_sack_blocks(flow, ack_packet);
+    flow.congestion->on_duplicate_ack();
+
+    if (flow.duplicate_ack_count == 3 && !in_congestion_epoch(flow) && !send_window.empty()) {
+        // 收到3个重复ACK，触发快速重传；本RTT内已经报告过拥塞事件时不再重复减窗
+        flow.congestion->on_loss(std::chrono::steady_clock::now());
+        flow.recovery_point = send_window.next() - 1;
+        return true;
+    }
+    return false;
+}
+
+/*
+ retransmit_holes - 快速重传：重传窗口基序号到最大SACK序列号之间所有未被选择确认的空洞，没有SACK信息时只重传基序号
+ 每轮最多重传令牌桶允许、且不超过cwnd个数据包，剩下的空洞从retransmit_cursor起留到之后的轮次；
+ 触发快速重传的那一轮即使没有令牌也立即重传基序号处的包
+ @param flow 要重传的流
+ @param triggered 本轮刚收到第3个重复ACK
+ @return false表示文件数据读取失败
+ */
+bool retransmit_holes(Flow& flow, bool triggered) {
+    SendRing& send_window = flow.send_window;
+    if (send_window.empty()) {
+        flow.retransmit_cursor = 0;
+        return true;
+    }
+    uint32_t base = send_window.base();
+    if (triggered || (flow.retransmit_cursor != 0 && (int32_t)(flow.retransmit_cursor - base) < 0)) {
+        flow.retransmit_cursor = base;  // 新的一轮，或者游标之前的包已被累计确认
+    }
+    if (flow.retransmit_cursor == 0) {
+        return true;
+    }
+    uint32_t last_hole = send_window.contains(flow.highest_sacked) ? flow.highest_sacked : base;
+    uint32_t allowance = (std::min)(flow.pacer.budget(std::chrono::steady_clock::now()), (uint32_t)(std::max)(1.0, flow.congestion->cwnd()));
+    if (triggered) {
+        allowance = (std::max)(allowance, 1u);
+    }
+    uint32_t& seq = flow.retransmit_cursor;
+    for (; allowance > 0 && seq - base <= last_hole - base; seq++) {
+        PacketState& ps = send_window.at(seq);
+        if (ps.acked) {
+            continue;
+        }
+        LOG_DEBUG("[stream {}] --- FAST RETRANSMIT for SEQ={} ---", flow.index, seq);
+        if (!send_segment(flow, ps, true)) {
+            return false;
+        }
+        flow.total_retransmissions++;
+        allowance--;
+    }
+    if (seq - base > last_hole - base) {
+        flow.retransmit_cursor = 0;  // 空洞都已重传
+    }
+    return true;
+}
+
+// publish_gauges - 把事件循环本轮结束时的状态发布给遥测
+void publish_gauges(Flow& flow) {
+    FlowGauges& gauges = flow.gauges;
+    double srtt_ms = flow.rtt_estimator.srtt_ms();
+    gauges.state.store(flow.congestion->state_name(), std::memory_order_relaxed);
+    gauges.cwnd.store(flow.congestion->cwnd(), std::memory_order_relaxed);
+    gauges.ssthresh.store(flow.congestion->ssthresh(), std::memory_order_relaxed);
+    gauges.srtt_ms.store(srtt_ms, std::memory_order_relaxed);
+    gauges.rttvar_ms.store(flow.rtt_estimator.rttvar_ms(), std::memory_order_relaxed);
+    gauges.rto_ms.store(flow.rtt_estimator.rto_ms(), std::memory_order_relaxed);
+    gauges.pacing_rate.store(flow.congestion->pacing_rate(srtt_ms), std::memory_order_relaxed);
+    gauges.in_flight.store((uint32_t)flow.send_window.size(), std::memory_order_relaxed);
+    gauges.receive_window.store(flow.receive_window, std::memory_order_relaxed);
+    gauges.delivered.store(flow.delivered, std::memory_order_relaxed);
+}
+
+/*
+ has_new_data - 本流是否还有没发送过的数据
+ 压缩传输时由压缩线程决定（压缩后的数据包数事先未知），否则按已发送的字节数判断
+ 压缩线程读不出文件数据时置位transfer_failed，与send_segment读取失败相同
+ */
+bool has_new_data(Flow& flow, uint64_t bytes_sent_total) {
+    if (compression_enabled) {
+        if (flow.compressor.failed() && !transfer_failed.exchange(true)) {
+            LOG_ERROR("[stream {}] Could not read the file to compress it", flow.index);
+        }
+        return !flow.compressor.exhausted(flow.send_window.next());
+    }
+    return bytes_sent_total < flow.end - flow.begin;
+}
+
+/*
+ next_segment - 取得下一个新数据包的文件偏移和长度
+ 压缩传输时载荷来自压缩线程，偏移不使用；压缩线程还没做好下一个块时返回false，事件循环不等待
+ @return true表示现在可以发送一个新数据包
+ */
+bool next_segment(Flow& flow, uint64_t bytes_sent_total, uint64_t& offset, uint16_t& data_len) {
+    if (compression_enabled) {
+        uint32_t seq = flow.send_window.next();
+        bool block_start;
+        if (!flow.compressor.ready(seq)) {
+            return false;
+        }
+        flow.compressor.payload(seq, data_len, block_start);
+        offset = 0;
+        return true;
+    }
+    const uint64_t range_size = flow.end - flow.begin;
+    if (bytes_sent_total >= range_size) {
+        return false;
+    }
+    offset = flow.begin + bytes_sent_total;
+    data_len = (uint16_t)(std::min)((uint64_t)segment_size, range_size - bytes_sent_total);
+    return true;
+}
+
+/*
+ run_flow - 一个流的事件循环（滑动窗口 + 超时重传），发送完本流的区间后发送FIN
+ 每轮在套接字上等到ACK到达、最早的重传定时器到期或下一个令牌可用（精确到微秒），
+ 然后依次处理这一批ACK、快速重传和超时重传、窗口允许的新数据包，最后一次发出整批
+ 发送窗口、定时器和拥塞控制器只在这个线程中访问，不需要加锁
+ @param flow 要发送的流
+ */
+void run_flow(Flow* flow_ptr) {
+    const int MAX_WAIT_MS = 100;      // 没有定时器和令牌要等时一轮最多等待的时间
+    const int COMPRESS_POLL_MS = 1;   // 压缩线程还没做好下一个块时，隔这么久再询问
+    Flow& flow = *flow_ptr;
+    SendRing& send_window = flow.send_window;
+    const uint64_t range_size = flow.end - flow.begin;
+    // 本流已发送的字节数；续传时起始序列号之前的数据服务器已经收到
+    uint64_t bytes_sent_total = (std::min)((uint64_t)(flow.first_seq - 1) * segment_size, range_size);
+    publish_gauges(flow);
+
+    auto wake_time = std::chrono::steady_clock::now();  // 第一轮不等待
+    // 循环条件：还有数据未发送 或 发送窗口不为空（有未确认的包）；任何一个流读文件失败时所有流都停止
+    while ((has_new_data(flow, bytes_sent_total) || !send_window.empty()) && !transfer_failed) {
+        // ========== 步骤1：等待并处理ACK ==========
+        // 一次取回已经到达的一批ACK，没有ACK时最多等到wake_time
+        bool fast_retransmit = false;
+        int count = flow.batch_io.receive_until(wake_time);
+        for (int i = 0; i < count; i++) {
+            const Packet& ack_packet = *reinterpret_cast<const Packet*>(flow.batch_io.datagram(i).data);
+            // 验证校验和，确保ACK未损坏；发送FIN之前不会有FIN-ACK
+            if (!verify_checksum(&ack_packet, checksum_mode) || (ack_packet.flags & (ACK | FIN)) != ACK) {
+                continue;
+            }
+            flow.total_acks_received++;
+            fast_retransmit = process_ack(flow, ack_packet) || fast_retransmit;
+        }
+        if (pacing_enabled) {
+            // 速率随每个ACK变化，每轮按拥塞控制器的最新状态更新
+            flow.pacer.set_rate(flow.congestion->pacing_rate(flow.rtt_estimator.srtt_ms()), std::chrono::steady_clock::now());
+        }
+
+        // ========== 步骤2：处理超时和快速重传 ==========
+        uint32_t seq;            // 定时器队列查询结果
+        std::chrono::steady_clock::time_point deadline;
+
+        if (fast_retransmit || flow.retransmit_cursor != 0) {
+            // === 快速重传（收到3个重复ACK，或上一轮还有没重传完的空洞）===
+            if (!retransmit_holes(flow, fast_retransmit)) {
+                break;
+            }
+        }
+        if (!fast_retransmit) {
+            // === 超时重传检测 ===
+            // 只查看定时器队列中已经到期的定时器，不再扫描整个窗口
+            auto now = std::chrono::steady_clock::now();
+            bool backed_off = false;
+            bool timeout_reported = false;
+            while (flow.retransmit_timers.peek(seq, deadline) && deadline <= now) {
+                flow.retransmit_timers.pop();
+                // 丢弃失效的定时器：包已被累计确认或SACK确认，或之后又重新发送过
+                if (!send_window.contains(seq)) {
+                    continue;
                 }
-                else { 
-                    // ===== 情况2：收到重复ACK（确认号小于send_base）=====
-                    duplicate_ack_count++;// 因为是重复ACK，计数加1
-                    
-                    if (state == FAST_RECOVERY) {
-                        // 快速恢复期间，每个重复ACK增加窗口（膨胀窗口）
-                        cwnd += 1;
-                    }
-                    else if (duplicate_ack_count == 3) {
-                        // 收到3个重复ACK，触发快速重传和快速恢复
-                        state = FAST_RECOVERY;
-                        ssthresh = (std::max)(2.0, cwnd / 2.0);  // 阈值设为窗口的一半
-                        cwnd = ssthresh + 3;  // 窗口设为阈值+3
-
-                        // 通知主线程进行快速重传
-                        retransmit_seq_num = send_base;
-                        retransmit_cv.notify_one();
+                PacketState& ps = send_window.at(seq);// 数据包状态
+                if (ps.acked || ps.deadline != deadline) {
+                    continue;
+                }
+                // 同一轮检测中到期的包只退避一次RTO
+                if (!backed_off) {
+                    flow.rtt_estimator.backoff();
+                    backed_off = true;
+                }
+                // 超时事件：同一轮检测中只报告一次；恢复期内只有重传包再次丢失才算新的拥塞事件
+                if (!timeout_reported && (!in_congestion_epoch(flow) || ps.retransmitted)) {
+                    flow.congestion->on_timeout(now);
+                    flow.recovery_point = send_window.next() - 1;
+                    flow.duplicate_ack_count = 0;
+                    timeout_reported = true;
+                }
+                LOG_DEBUG("[stream {}] --- TIMEOUT for SEQ={}. Retransmitting. RTO={}ms ---", flow.index, ps.seq_num, flow.rtt_estimator.rto_ms());
+                // 重传数据包
+                if (!send_segment(flow, ps, true)) {
+                    break;
+                }
+                flow.total_retransmissions++;// 统计重传次数
+            }
+        }
+
+        // ========== 步骤3：发送新数据包（受窗口和发送速率限制）==========
+        if (flow.skip_to_seq > send_window.next() && send_window.empty()) {
+            // 跳过服务器已经有的数据包，未满的校验组不再发出校验包
+            send_window = SendRing(MAX_SEND_WINDOW_SIZE, flow.skip_to_seq);
+            bytes_sent_total = (std::min)((uint64_t)(flow.skip_to_seq - 1) * segment_size, range_size);
+            flow.parity.count = 0;
+        }
+        // 窗口大小 = min(接收方通告窗口, 拥塞窗口)，且不超过发送窗口容量；令牌用完时等下一个令牌
+        uint32_t budget = flow.pacer.budget(std::chrono::steady_clock::now());
+        uint64_t offset;
+        uint16_t data_to_send;
+        while (send_window.size() <(std::min)((double)flow.receive_window, flow.congestion->cwnd()) && !send_window.full() && budget > 0 &&
+            next_segment(flow, bytes_sent_total, offset, data_to_send)) {//条件允许发送新包
+            budget--;
+            // 在发送窗口登记描述符（只记录文件偏移和长度，最多一个分段），然后发送
+            PacketState& ps = send_window.push(offset, data_to_send);
+            if (fec_enabled) {
+                if (flow.parity.count == 0) {
+                    flow.parity.reset(ps.seq_num);
+                    flow.parity_group_size = choose_parity_group(flow);
+                }
+                ps.parity_group = flow.parity.first_seq;
+            }
+            if (!send_segment(flow, ps, false)) {
+                break;
+            }
+            LOG_TRACE("[stream {}] Sent SEQ={}, CWND={}, SSTHRESH={}", flow.index, ps.seq_num, flow.congestion->cwnd(), flow.congestion->ssthresh());
+            flow.total_packets_sent++;
+
+            bytes_sent_total += data_to_send;// 更新已发送字节数
+            if (fec_enabled && flow.parity.count >= flow.parity_group_size) {
+                send_parity(flow);
+            }
+        }
+        // 最后一个校验组不满也要发出校验包
+        if (fec_enabled && flow.parity.count > 0 && !has_new_data(flow, bytes_sent_total)) {
+            send_parity(flow);
+        }
+
+        // 本轮的重传和新数据包一次发出
+        flow.batch_io.flush();
+        publish_gauges(flow);
+
+        // 下一轮最多等到最早的重传定时器到期；窗口还允许发送新包时，再等到下一个令牌可用或压缩线程做好下一个块
+        // ACK到达时立即醒来，不必等到这个时间
+        auto now = std::chrono::steady_clock::now();
+        wake_time = now + std::chrono::milliseconds(MAX_WAIT_MS);
+        if (flow.retransmit_timers.peek(seq, deadline) && deadline < wake_time) {
+            wake_time = deadline;
+        }
+        bool window_open = send_window.size() < (std::min)((double)flow.receive_window, flow.congestion->cwnd()) && !send_window.full();
+        if (window_open && has_new_data(flow, bytes_sent_total)) {
+            wake_time = (std::min)(wake_time, budget == 0 ? flow.pacer.next_send_time() : now + std::chrono::milliseconds(COMPRESS_POLL_MS));
+        }
+        if (flow.retransmit_cursor != 0) {
+            wake_time = (std::min)(wake_time, flow.pacer.next_send_time());  // 剩下的空洞等下一个令牌
+        }
+    }
+
+    if (transfer_failed) {
+        return;  // 文件数据不可用，不发送FIN，让服务器保留进度等待续传
+    }
+    // FIN携带整个文件的CRC32C；后台线程与发送并行，通常早已算完
+    if (!file_crc_ready.get()) {
+        LOG_ERROR("[stream {}] Could not read the file to compute its CRC32C", flow.index);
+        transfer_failed = true;
+        return;
+    }
+
+    // ========== 关闭本流 ==========
+    // 每个流各自发送FIN，服务器在所有流都结束、核对完文件后才应答带核对结果的FIN-ACK；FIN或FIN-ACK丢失时每个RTO重发一次FIN
+    // 服务器收到FIN但还没有结果时应答不带FIN标志、ack_num为FIN序列号加1的ACK：此后不计重发次数，每FIN_VERIFY_POLL_MS重发一次
+    const int FIN_ATTEMPTS = 10;
+    const int FIN_VERIFY_POLL_MS = 500;
+    Packet fin_packet = { 0 };
+    fin_packet.flags = FIN;// 设置FIN标志
+    fin_packet.stream_id = flow.index;
+    fin_packet.seq_num = send_window.next();// 设置序列号
+    fin_packet.data_len = sizeof(FinOptions);
+    reinterpret_cast<FinOptions*>(fin_packet.data)->file_crc = file_crc;
+    fin_packet.checksum = calculate_checksum(&fin_packet, checksum_mode);// 计算校验和
+    bool closed = false, verifying = false;
+    int status = FIN_UNVERIFIED;  // 没有载荷的FIN-ACK来自不核对文件的服务器
+    LOG_INFO("[stream {}] FIN sent. Waiting for final ACK.", flow.index);
+    for (int attempt = 0; attempt < FIN_ATTEMPTS && !closed; attempt++) {
+        flow.batch_io.send(&fin_packet, HEADER_SIZE + fin_packet.data_len);
+        flow.batch_io.flush();
+        // 等待FIN-ACK，迟到的数据ACK只计数
+        std::chrono::steady_clock::duration wait = flow.rtt_estimator.rto();
+        if (verifying) {
+            wait = (std::max)(wait, std::chrono::steady_clock::duration(std::chrono::milliseconds(FIN_VERIFY_POLL_MS)));
+        }
+        auto fin_deadline = std::chrono::steady_clock::now() + wait;
+        bool acknowledged = false;
+        while (!closed && std::chrono::steady_clock::now() < fin_deadline) {
+            int count = flow.batch_io.receive_until(fin_deadline);
+            for (int i = 0; i < count; i++) {
+                const Packet& ack_packet = *reinterpret_cast<const Packet*>(flow.batch_io.datagram(i).data);
+                if (!verify_checksum(&ack_packet, checksum_mode) || !(ack_packet.flags & ACK)) {
+                    continue;
+                }
+                flow.total_acks_received++;
+                if (ack_packet.flags & FIN) {
+                    closed = true;
+                    if (ack_packet.data_len >= sizeof(FinAckOptions)) {
+                        status = reinterpret_cast<const FinAckOptions*>(ack_packet.data)->status;
                     }
                 }
+                else if (ack_packet.ack_num == fin_packet.seq_num + 1) {
+                    acknowledged = true;
+                }
             }
         }
+        if (acknowledged && !closed) {
+            if (!verifying) {
+                LOG_INFO("[stream {}] FIN acknowledged, waiting for the server to verify the file.", flow.index);
+            }
+            verifying = true;
+            attempt = -1;  // 服务器还在，只是结果还没出来，重新计数
+        }
+    }
+    if (!closed) {
+        LOG_WARN("[stream {}] No FIN-ACK after {} attempts, closing anyway.", flow.index, FIN_ATTEMPTS);
+    }
+    else if (status == FIN_CORRUPT) {
+        LOG_ERROR("[stream {}] The server's copy of the file does not match.", flow.index);
+        copy_corrupt = true;
     }
 }
 
+// file_name_of - 路径中的文件名（不含目录）
+const char* file_name_of(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p != '\0'; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+/*
+ compute_transfer_id - 计算文件的传输ID
+ 由文件名（不含目录）、文件大小和首尾各DEFAULT_SEGMENT_SIZE字节的内容算出，同一个文件的每次上传都相同，
+ 服务器据此找到上次上传中断时保存的进度；不读取整个文件，大文件也能立即开始发送
+ @param transfer_id 输出：64位传输ID，不会为0（0表示不续传）
+ @return false表示文件首尾的数据读取失败
+ */
+bool compute_transfer_id(const char* path, FileSource& source, uint64_t& transfer_id) {
+    const char* name = file_name_of(path);
+    uint64_t size = source.size();
+    uint32_t name_crc = ~crc32c_update(0xFFFFFFFF, name, strlen(name));
+    uint32_t content_crc = crc32c_update(0xFFFFFFFF, &size, sizeof(size));
+    uint64_t head_len = (std::min)(size, (uint64_t)DEFAULT_SEGMENT_SIZE);
+    const char* head = source.data(0, (size_t)head_len);
+    if (head == nullptr) {
+        return false;
+    }
+    content_crc = crc32c_update(content_crc, head, (size_t)head_len);
+    const char* tail = source.data(size - head_len, (size_t)head_len);  // 可能与head共用缓冲区，head此后不再使用
+    if (tail == nullptr) {
+        return false;
+    }
+    content_crc = ~crc32c_update(content_crc, tail, (size_t)head_len);
+    uint64_t id = ((uint64_t)name_crc << 32) | content_crc;
+    transfer_id = id != 0 ? id : 1;
+    return true;
+}
+
+/*
+ load_batch - 读取批量传输的文件列表，组成要发送的字节流：清单在前，各个文件的内容依次相接
+ 列表每行一个文件路径，空行和#开头的行忽略；服务器按文件名（不含目录）保存，文件名不能重复
+ @param list_path 文件列表的路径
+ @param layout 输出：字节流的组成
+ @return false表示列表无法读取、为空、有文件无法访问或文件名重复
+ */
+bool load_batch(const char* list_path, SourceLayout& layout) {
+    std::ifstream list(list_path);
+    if (!list) {
+        std::cerr << "Failed to open file list: " << list_path << std::endl;
+        return false;
+    }
+    std::set<std::string> names;
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();  // Windows换行
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const char* name = file_name_of(line.c_str());
+        if (!layout.add_file(line.c_str())) {
+            std::cerr << "Failed to open file: " << line << std::endl;
+            return false;
+        }
+        if (*name == '\0' || strlen(name) > UINT8_MAX || !names.insert(name).second) {
+            std::cerr << "Invalid or repeated file name in batch: " << line << std::endl;
+            return false;
+        }
+        if (layout.paths.size() > MAX_BATCH_FILES) {
+            std::cerr << "Too many files in batch (at most " << MAX_BATCH_FILES << ")" << std::endl;
+            return false;
+        }
+    }
+    if (layout.paths.empty()) {
+        std::cerr << "File list is empty: " << list_path << std::endl;
+        return false;
+    }
+    BatchHeader header = { BATCH_MAGIC, (uint32_t)layout.paths.size() };
+    layout.header.assign((const char*)&header, sizeof(header));
+    for (size_t i = 0; i < layout.paths.size(); i++) {
+        const char* name = file_name_of(layout.paths[i].c_str());
+        BatchEntry entry = { layout.sizes[i], (uint16_t)strlen(name) };
+        layout.header.append((const char*)&entry, sizeof(entry));
+        layout.header.append(name, entry.name_length);
+    }
+    return true;
+}
+
+/*
+ compute_file_crc - 计算整个文件的CRC32C，随FIN发给服务器，服务器写完后读回文件核对
+ 按映射视图顺序读一遍文件，使用硬件CRC指令时耗时主要在把文件读入页缓存；在后台线程中调用，与发送并行
+ 传输中止（transfer_failed置位）时不再读下去，退出时不必等它读完整个文件
+ @param file_crc 输出：文件的CRC32C
+ @return false表示有一段文件读取失败或传输已经中止
+ */
+bool compute_file_crc(FileSource& source, uint32_t& file_crc) {
+    const size_t CHUNK_SIZE = 1 << 20;
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint64_t offset = 0; offset < source.size(); offset += CHUNK_SIZE) {
+        size_t len = (size_t)(std::min)((uint64_t)CHUNK_SIZE, source.size() - offset);
+        const char* chunk = source.data(offset, len);
+        if (chunk == nullptr || transfer_failed) {
+            return false;
+        }
+        crc = crc32c_update(crc, chunk, len);
+    }
+    file_crc = ~crc;
+    return true;
+}
+
+/*
+ wait_for_packet - 在套接字上等待数据包到达
+ @param s 套接字
+ @param timeout_ms 最长等待时间（毫秒）
+ @return true表示有数据包可读
+ */
+bool wait_for_packet(SOCKET s, int timeout_ms) {
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(s, &read_set);
+    timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    return select((int)s + 1, &read_set, NULL, NULL, &tv) > 0;
+}
+
+/*
+ probe_segment_size - 路径MTU探测（PLPMTUD）：找出到服务器的数据报不被分片的最大分段大小
+ 在设置了DF位的临时套接字上同时发出几种常见MTU对应的PROBE包，取得到回复的最大尺寸；超过路径MTU的探测包被丢弃，
+ 超过本机出口MTU的在发送时就失败。第二轮只重发比已确认尺寸更大的候选，等待时间按第一个回复的往返时间估计
+ 一个回复都没有（服务器不支持探测或探测包全部丢失）或无法设置DF位时使用DEFAULT_SEGMENT_SIZE
+ @param max_mtu 探测的MTU上限（--mtu）
+ @return 分段大小
+ */
+uint16_t probe_segment_size(int max_mtu) {
+    const int PROBE_MTUS[] = { 9000, 4352, 1500, 1492, 1280, 576 };  // 巨帧、FDDI、以太网、PPPoE、隧道、IPv4下限
+    const int PROBE_ROUNDS = 2;
+    const int PROBE_TIMEOUT_MS = 300;     // 没有任何回复时一轮的等待时间
+    const int PROBE_MIN_WAIT_MS = 20;     // 收到第一个回复后至少再等这么久
+    SOCKET s = create_udp_socket();
+    if (s == INVALID_SOCKET) {
+        return DEFAULT_SEGMENT_SIZE;
+    }
+    if (!set_dont_fragment(s)) {
+        closesocket(s);
+        return DEFAULT_SEGMENT_SIZE;  // 允许分片时探测不出路径MTU
+    }
+    Packet probe = { 0 }, reply = { 0 };
+    uint16_t best = 0;
+    int wait_ms = PROBE_TIMEOUT_MS;
+    for (int round = 0; round < PROBE_ROUNDS; round++) {
+        int pending = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int mtu : PROBE_MTUS) {
+            uint16_t size = (uint16_t)(mtu - IP_UDP_HEADER_SIZE - HEADER_SIZE);
+            if (mtu > max_mtu || size <= best) {
+                continue;
+            }
+            probe.flags = PROBE;
+            probe.seq_num = size;
+            probe.data_len = size;
+            probe.checksum = calculate_checksum(&probe);
+            if (sendto(s, (const char*)&probe, HEADER_SIZE + size, 0, (struct sockaddr*)&server_addr, sizeof(server_addr)) >= 0) {
+                pending++;
+            }
+        }
+        auto deadline = start + std::chrono::milliseconds(wait_ms);
+        while (pending > 0) {
+            int remaining_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining_ms <= 0 || !wait_for_packet(s, remaining_ms)) {
+                break;
+            }
+            int n = recvfrom(s, (char*)&reply, MAX_BUFFER_SIZE, 0, NULL, NULL);
+            if (n < HEADER_SIZE || !verify_checksum(&reply) || reply.flags != (PROBE | ACK) ||
+                reply.ack_num < (uint32_t)MIN_SEGMENT_SIZE || reply.ack_num > (uint32_t)MAX_DATA_SIZE) {
+                continue;
+            }
+            pending--;
+            if (best == 0) {
+                // 大的探测包与小的几乎同时到达，按第一个回复的往返时间缩短等待
+                auto rtt = std::chrono::steady_clock::now() - start;
+                wait_ms = (std::max)(PROBE_MIN_WAIT_MS, (int)std::chrono::duration_cast<std::chrono::milliseconds>(rtt * 2).count());
+                deadline = (std::min)(deadline, start + std::chrono::milliseconds(wait_ms));
+            }
+            best = (std::max)(best, (uint16_t)reply.ack_num);
+        }
+        if (pending == 0 && best != 0) {
+            break;  // 所有候选都有了结果
+        }
+    }
+    closesocket(s);
+    return best != 0 ? best : DEFAULT_SEGMENT_SIZE;
+}
+
+/*
+ connect_flow - 三次握手的前两步：在0号流的套接字上发送SYN，等待同一连接ID的SYN-ACK
+ SYN或SYN-ACK丢失时每个超时重发一次SYN，超时从PACKET_TIMEOUT_MS起成倍增加到CONNECT_MAX_RTO_MS，共等待CONNECT_TIMEOUT_MS后放弃；
+ 服务器对重传的SYN应答同一个SYN-ACK。没有握手选项的SYN-ACK（服务器不支持握手选项）也接受
+ @param flow 0号流，套接字已创建
+ @param syn 计算好校验和的SYN
+ @param connection_id SYN中的连接ID
+ @param syn_ack 输出：收到的SYN-ACK
+ @return true表示收到了SYN-ACK
+ */
+bool connect_flow(Flow& flow, const Packet& syn, uint32_t connection_id, Packet& syn_ack) {
+    const int CONNECT_TIMEOUT_MS = 30000;
+    const int CONNECT_MAX_RTO_MS = 4000;  // 丢包严重时30秒内仍能重发七八次
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+    int timeout_ms = PACKET_TIMEOUT_MS;
+    for (auto now = std::chrono::steady_clock::now(); now < deadline; timeout_ms = (std::min)(timeout_ms * 2, CONNECT_MAX_RTO_MS)) {
+        sendto(flow.socket, (const char*)&syn, HEADER_SIZE + syn.data_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        auto resend_time = (std::min)(now + std::chrono::milliseconds(timeout_ms), deadline);
+        for (; now < resend_time; now = std::chrono::steady_clock::now()) {
+            int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(resend_time - now).count() + 1;
+            if (!wait_for_packet(flow.socket, wait_ms)) {
+                continue;
+            }
+            int n = recvfrom(flow.socket, (char*)&syn_ack, MAX_BUFFER_SIZE, 0, NULL, NULL);
+            if (n < (int)offsetof(Packet, data) || !verify_checksum(&syn_ack) || (syn_ack.flags & (SYN | ACK)) != (SYN | ACK)) {
+                continue;
+            }
+            if (syn_ack.data_len < sizeof(HandshakeOptions) ||
+                reinterpret_cast<const HandshakeOptions*>(syn_ack.data)->connection_id == connection_id) {
+                return true;
+            }
+        }
+        now = std::chrono::steady_clock::now();
+        if (now < deadline) {
+            std::cout << "No SYN-ACK after " << timeout_ms << " ms, retransmitting SYN..." << std::endl;
+        }
+    }
+    return false;
+}
+
+/*
+ join_flow - 让一个附加流加入已经握手的连接
+ 在流自己的套接字上发送JOIN（载荷为握手选项，带连接ID），收到JOIN-ACK后流即可开始发送
+ JOIN丢失时按JOIN_TIMEOUT_MS重发，最多JOIN_ATTEMPTS次
+ @param flow 要加入的流，套接字已创建
+ @param connection_id 握手时的连接ID
+ @return true表示服务器已接受这个流
+ */
+bool join_flow(Flow& flow, uint32_t connection_id) {
+    const int JOIN_TIMEOUT_MS = 200;
+    const int JOIN_ATTEMPTS = 10;
+    Packet join_packet = { 0 }, recv_packet = { 0 };
+    join_packet.flags = JOIN;
+    join_packet.stream_id = flow.index;
+    join_packet.data_len = sizeof(HandshakeOptions);
+    reinterpret_cast<HandshakeOptions*>(join_packet.data)->connection_id = connection_id;
+    join_packet.checksum = calculate_checksum(&join_packet);
+    for (int attempt = 0; attempt < JOIN_ATTEMPTS; attempt++) {
+        sendto(flow.socket, (const char*)&join_packet, HEADER_SIZE + join_packet.data_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        while (wait_for_packet(flow.socket, JOIN_TIMEOUT_MS)) {
+            int n = recvfrom(flow.socket, (char*)&recv_packet, MAX_BUFFER_SIZE, 0, NULL, NULL);
+            if (n >= (int)offsetof(Packet, data) && verify_checksum(&recv_packet) &&
+                recv_packet.flags == (JOIN | ACK) && recv_packet.stream_id == flow.index) {
+                update_receive_window(flow, recv_packet);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// 发送方遥测的数值列，顺序与sample_flow填写的一致
+const std::vector<std::string> FLOW_TELEMETRY_COLUMNS = {
+    "cwnd", "ssthresh", "in_flight", "rwnd", "srtt_ms", "rttvar_ms", "rto_ms", "pacing_rate_pps",
+    "packets_sent", "retransmissions", "duplicate_acks", "delivered", "goodput_mbps",
+};
+
+/*
+ sample_flow - 采集一个流的遥测样本
+ 在采样线程中调用，只读取事件循环发布的原子量和计数器，不打断事件循环
+ goodput按两次采样之间新交付（累计确认或SACK确认）的数据包数计算
+ @param flow 要采样的流
+ @param row 输出：一行样本
+ */
+void sample_flow(Flow& flow, TelemetryRow& row) {
+    const FlowGauges& gauges = flow.gauges;
+    auto now = std::chrono::steady_clock::now();
+    uint64_t delivered = gauges.delivered;
+    double interval_s = std::chrono::duration<double>(now - flow.sampled_time).count();
+    double goodput_mbps = interval_s > 0 ? (delivered - flow.sampled_delivered) * segment_size * 8 / interval_s / 1e6 : 0;
+    flow.sampled_delivered = delivered;
+    flow.sampled_time = now;
+    row.id = "stream " + std::to_string(flow.index);
+    row.state = gauges.state;
+    row.values = {
+        gauges.cwnd, gauges.ssthresh, (double)gauges.in_flight, (double)gauges.receive_window,
+        gauges.srtt_ms, gauges.rttvar_ms, gauges.rto_ms, gauges.pacing_rate,
+        (double)flow.total_packets_sent, (double)flow.total_retransmissions, (double)flow.total_duplicate_acks,
+        (double)delivered, goodput_mbps,
+    };
+}
+
+/*
+ shutdown_client - 退出前的清理，正常结束和启动之后的每个错误出口都经过这里
+ 出错时先置位transfer_failed让后台的CRC计算停下，等它结束后停止遥测和日志线程，
+ 再停止压缩线程，关闭文件映射、批量收发和套接字，释放Winsock
+ @param telemetry 遥测（没有启动时stop什么也不做）
+ @param flows 已经创建的流，可以为空；事件循环线程都已结束
+ @param file_source 主线程的文件映射，没有打开时close什么也不做
+ @param status 返回给main的退出码，非0表示出错
+ @return status
+ */
+int shutdown_client(Telemetry& telemetry, std::vector<std::unique_ptr<Flow>>& flows, FileSource& file_source, int status) {
+    if (status != 0) {
+        transfer_failed = true;
+    }
+    if (file_crc_ready.valid()) {
+        file_crc_ready.wait();
+    }
+    telemetry.stop();
+    async_logger().stop();
+    file_source.close();
+    for (std::unique_ptr<Flow>& flow : flows) {
+        flow->compressor.stop();
+        flow->source.close();
+        flow->batch_io.close();
+        if (flow->socket != INVALID_SOCKET) {
+            closesocket(flow->socket);
+        }
+    }
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+    cleanup_winsock();
+    return status;
+}
 
 /*
  @param argc 命令行参数个数
- @param argv 命令行参数数组：argv[1]=服务器IP, argv[2]=文件路径
+ @param argv 命令行参数数组：argv[1]=服务器IP, argv[2]=文件路径, 之后为可选参数：
+             拥塞控制算法（reno/cubic/bbr，默认reno），--crc32c（请求使用CRC32C校验和），
+             --streams=<n>（条带传输的流数，默认1），--no-resume（不续传，总是从头发送），
+             --no-pacing（不平滑发送，窗口允许的数据包背靠背发出），
+             --compress（请求压缩传输，压缩传输不续传），
+             --fec=<n|auto>（请求FEC，每n个数据包一个校验包，auto按丢包率自适应），
+             --mtu=<bytes>（路径MTU探测的上限，默认9000；576时不使用更大的数据报），
+             --trace=<file>（遥测轨迹文件，.json/.jsonl为JSON Lines，否则为CSV），
+             --trace-interval=<ms>（遥测采样间隔，默认100毫秒），
+             --stats-port=<port>（遥测统计端点，在127.0.0.1的这个TCP端口上返回最近一次采样的JSON），
+             --log=<trace|debug|info|warn|error|off>（日志级别，默认info；trace输出每个数据包），
+             --batch（文件路径是文件列表，列表中的文件在一个连接中批量发送）
  流程：
     1. 初始化套接字
-    2. 三次握手建立连接
-    3. 读取文件到内存
-    4. 启动ACK接收线程
-    5. 主发送循环（滑动窗口 + 超时重传）
-    6. 四次挥手关闭连接
-    7. 输出传输统计
+    2. 映射待发送文件（批量传输时为清单和列表中的所有文件）
+    3. 三次握手建立连接
+    4. 每个流启动一个事件循环线程，其余的流先发送JOIN加入连接
+    5. 每个流的事件循环（滑动窗口 + 超时重传），发送完后各自关闭
+    6. 输出传输统计
  */
 int main(int argc, char* argv[]) {
     // ========== 参数检查 （终端情况下使用）==========
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <server_ip> <file_path>" << std::endl;
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <file_path> [reno|cubic|bbr] [--crc32c] [--streams=<n>] [--no-resume] [--no-pacing] [--compress] [--fec=<n|auto>] [--mtu=<bytes>] [--trace=<file>] [--trace-interval=<ms>] [--stats-port=<port>] [--log=<level>] [--batch]" << std::endl;
         return 1;
     }
     const char* server_ip = argv[1];
     const char* file_path = argv[2];
+    const char* congestion_name = "reno";
+    ChecksumMode requested_checksum = CHECKSUM_INTERNET;
+    int stream_count = 1;
+    bool resume = true;
+    bool compress = false;
+    bool fec = false;
+    int max_mtu = 9000;
+    const char* trace_path = nullptr;
+    int trace_interval_ms = TELEMETRY_DEFAULT_INTERVAL_MS;
+    int stats_port = 0;
+    bool batch = false;
+    for (int i = 3; i < argc; i++) {
+        int log_level;
+        if (strcmp(argv[i], "--crc32c") == 0) {
+            requested_checksum = CHECKSUM_CRC32C;
+        }
+        else if (strncmp(argv[i], "--streams=", 10) == 0 && atoi(argv[i] + 10) >= 1 && atoi(argv[i] + 10) <= MAX_STREAMS) {
+            stream_count = atoi(argv[i] + 10);
+        }
+        else if (strcmp(argv[i], "--no-resume") == 0) {
+            resume = false;
+        }
+        else if (strcmp(argv[i], "--no-pacing") == 0) {
+            pacing_enabled = false;
+        }
+        else if (strcmp(argv[i], "--compress") == 0) {
+            compress = true;
+        }
+        else if (strcmp(argv[i], "--fec=auto") == 0) {
+            fec = true;
+            fec_group_size = 0;
+        }
+        else if (strncmp(argv[i], "--fec=", 6) == 0 && atoi(argv[i] + 6) >= (int)FEC_MIN_GROUP && atoi(argv[i] + 6) <= (int)FEC_MAX_GROUP) {
+            fec = true;
+            fec_group_size = atoi(argv[i] + 6);
+        }
+        else if (strncmp(argv[i], "--mtu=", 6) == 0 && atoi(argv[i] + 6) >= 576 && atoi(argv[i] + 6) <= 9000) {
+            max_mtu = atoi(argv[i] + 6);
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+            trace_path = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--trace-interval=", 17) == 0 && atoi(argv[i] + 17) > 0) {
+            trace_interval_ms = atoi(argv[i] + 17);
+        }
+        else if (strncmp(argv[i], "--stats-port=", 13) == 0 && atoi(argv[i] + 13) > 0 && atoi(argv[i] + 13) <= 65535) {
+            stats_port = atoi(argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--log=", 6) == 0 && parse_log_level(argv[i] + 6, log_level)) {
+            async_logger().set_level(log_level);
+        }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        }
+        else if (argv[i][0] != '-') {
+            congestion_name = argv[i];
+        }
+        else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
 
-    // ========== 初始化Winsock ==========
-    if (!initialize_winsock()) {
+    // ========== 选择拥塞控制算法 ==========
+    // 每个流有自己的拥塞控制器，这里只检查名称
+    if (!create_congestion_controller(congestion_name)) {
+        std::cerr << "Unknown congestion control algorithm: " << congestion_name << std::endl;
         return 1;
     }
 
-    // ========== 创建UDP套接字 ==========
-    if ((client_socket = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed" << std::endl;
+    async_logger().start();
+
+    // ========== 初始化Winsock ==========
+    if (!initialize_winsock()) {
+        async_logger().stop();
         return 1;
     }
+#ifdef _WIN32
+    // 默认定时器精度约15.6ms，平滑发送需要按毫秒唤醒事件循环
+    timeBeginPeriod(1);
+#endif
+    // 在这里声明，之后的错误出口都能经过shutdown_client停止和关闭它们
+    FileSource file_source;
+    std::vector<std::unique_ptr<Flow>> flows;
+    Telemetry telemetry;
 
     // ========== 设置服务器地址 ==========
     // 注意：连接到Router端口进行测试，Router会转发到真实服务器
@@ -180,150 +1128,308 @@ int main(int argc, char* argv[]) {
     server_addr.sin_port = htons(ROUTER_PORT);  // 连接Router端口12345进行丢包/延时测试
     inet_pton(AF_INET, server_ip, &server_addr.sin_addr);  // 转换IP地址
 
+    // ========== 映射待发送文件 ==========
+    // 握手前打开文件：文件不存在时不建立连接；映射是O(1)操作，不会推迟首个数据包
+    // 批量传输时发送的是清单加上列表中所有文件的字节流，之后的流程与单个文件相同
+    SourceLayout source_layout;
+    if (batch) {
+        if (!load_batch(file_path, source_layout)) {
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        std::cout << "Batch: " << source_layout.paths.size() << " files, " << source_layout.total_size() / 1024.0 << " KB with the manifest" << std::endl;
+    }
+    else if (!source_layout.add_file(file_path)) {
+        std::cerr << "Failed to open file: " << file_path << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
+    }
+    if (!file_source.open(source_layout)) {
+        std::cerr << "Failed to open file: " << file_path << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
+    }
+    const uint64_t file_size = file_source.size();
+
+    // ========== 后台计算文件的CRC32C ==========
+    // 用单独的文件映射读一遍整个文件，与MTU探测、握手和发送并行；结果随每个流的FIN发出
+    file_crc_ready = std::async(std::launch::async, [source_layout]() {
+        FileSource crc_source;
+        return crc_source.open(source_layout) && compute_file_crc(crc_source, file_crc);
+    }).share();
+
+    // ========== 路径MTU探测 ==========
+    // 分段大小决定条带划分和文件偏移，必须在握手之前确定
+    segment_size = probe_segment_size(max_mtu);
+    std::cout << "Segment size: " << segment_size << " bytes (datagram " << segment_size + HEADER_SIZE << " bytes)" << std::endl;
+
+    // ========== 划分条带 ==========
+    // 每个流负责连续的stripe_packets个数据包，文件太小时减少流数，保证每个流至少有一个包
+    // 条带长度向上取整后按它重新计算流数，最后的流不会是空的：例如9个包请求4个流时每个流3个包，只用3个流
+    uint64_t total_packets = (file_size + segment_size - 1) / segment_size;
+    stream_count = (int)(std::max)((uint64_t)1, (std::min)((uint64_t)stream_count, total_packets));
+    uint32_t stripe_packets = (uint32_t)((total_packets + stream_count - 1) / stream_count);
+    if (total_packets > 0) {
+        stream_count = (int)((total_packets + stripe_packets - 1) / stripe_packets);
+    }
+    for (int i = 0; i < stream_count; i++) {
+        flows.emplace_back(new Flow());
+        Flow& flow = *flows.back();
+        flow.index = (uint8_t)i;
+        flow.begin = (std::min)((uint64_t)i * stripe_packets * segment_size, file_size);
+        flow.end = (std::min)((uint64_t)(i + 1) * stripe_packets * segment_size, file_size);
+        flow.congestion = create_congestion_controller(congestion_name);
+        if (!flow.source.open(source_layout)) {
+            std::cerr << "Failed to open file: " << file_path << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        // ========== 创建UDP套接字 ==========
+        if ((flow.socket = create_udp_socket()) == INVALID_SOCKET) {
+            std::cerr << "Socket creation failed" << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        set_dont_fragment(flow.socket);  // 分段大小已按路径MTU选定，数据报不应再被分片
+    }
+    std::cout << "Congestion control: " << flows[0]->congestion->name() << std::endl;
+    Flow& primary = *flows[0];
+
     // ========== 三次握手建立连接 ==========
     Packet send_packet = { 0 }, recv_packet = { 0 };
+    uint64_t resumed_bytes = 0;  // 续传时服务器已经按序收到、不需要再发送的字节数
     
-    // 第一步：发送SYN
+    // 第一步：发送SYN，载荷携带本端能接受的最大窗口缩放因子、请求的校验和模式、随机的连接ID和条带划分
+    // 服务器按客户端地址区分会话，连接ID用来区分同一地址上的新连接和重传的SYN，附加的流也凭连接ID加入
+    uint32_t connection_id = std::random_device()();
     send_packet.flags = SYN;
+    if (compress) {
+        send_packet.flags |= COMPRESS;
+    }
+    if (fec) {
+        send_packet.flags |= PARITY;
+    }
     send_packet.seq_num = 0;
+    send_packet.data_len = sizeof(HandshakeOptions);
+    HandshakeOptions* syn_options = reinterpret_cast<HandshakeOptions*>(send_packet.data);
+    syn_options->window_scale = MAX_WINDOW_SCALE;
+    syn_options->checksum_mode = requested_checksum;
+    syn_options->connection_id = connection_id;
+    syn_options->stream_count = (uint8_t)stream_count;
+    syn_options->stripe_packets = stripe_packets;
+    syn_options->segment_size = segment_size;
+    uint64_t transfer_id = 0;  // 压缩传输不续传
+    if (resume && !compress && !compute_transfer_id(file_path, file_source, transfer_id)) {
+        std::cerr << "Transfer aborted: the file could not be read" << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
+    }
+    syn_options->transfer_id = transfer_id;
+    // 文件元数据：服务器据此预分配输出文件、确定接收位图的大小，收齐最后一个字节即可完成并核对内容
+    const char* file_name = file_name_of(file_path);
+    size_t name_length = (std::min)(strlen(file_name), (size_t)UINT8_MAX);
+    syn_options->file_size = file_size;
+    syn_options->name_length = (uint8_t)name_length;
+    syn_options->batch_files = batch ? (uint32_t)source_layout.paths.size() : 0;
+    memcpy(send_packet.data + sizeof(HandshakeOptions), file_name, name_length);  // 文件名紧跟在握手选项之后
+    send_packet.data_len += (uint16_t)name_length;
     send_packet.checksum = calculate_checksum(&send_packet);
-    sendto(client_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
     std::cout << "SYN sent. Waiting for SYN-ACK..." << std::endl;
 
-    // 第二步：接收SYN-ACK
-    recvfrom(client_socket, (char*)&recv_packet, MAX_BUFFER_SIZE, 0, NULL, NULL);//阻塞等待服务器返回的数据包
-    if (recv_packet.flags == (SYN | ACK)) {//收到的包是不是 SYN-ACK
-        std::cout << "SYN-ACK received. Sending final ACK." << std::endl;
-        
-        // 第三步：发送ACK
-        send_packet = { 0 };//整个结构体清零
-        send_packet.flags = ACK;
-        send_packet.ack_num = recv_packet.seq_num + 1;//期望下一个包
-        send_packet.checksum = calculate_checksum(&send_packet);
-        sendto(client_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    // 第二步：接收SYN-ACK，超时重发SYN
+    if (!connect_flow(primary, send_packet, connection_id, recv_packet)) {
+        std::cerr << "No response from the server" << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
     }
+    std::cout << "SYN-ACK received. Sending final ACK." << std::endl;
+    compression_enabled = compress && (recv_packet.flags & COMPRESS);  // 服务器不认识COMPRESS时不压缩
+    fec_enabled = fec && (recv_packet.flags & PARITY);
+    // 服务器选定的窗口缩放因子、校验和模式和初始接收窗口；没有握手选项时不缩放，使用Internet校验和
+    if (recv_packet.data_len >= sizeof(HandshakeOptions)) {
+        const HandshakeOptions* options = reinterpret_cast<const HandshakeOptions*>(recv_packet.data);
+        if (options->stream_count == 0) {
+            std::cerr << "Server refused the connection (see the server log)" << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        window_scale = (std::min)((int)options->window_scale, MAX_WINDOW_SCALE);
+        if (options->checksum_mode == CHECKSUM_CRC32C) {
+            checksum_mode = CHECKSUM_CRC32C;
+        }
+        update_receive_window(primary, recv_packet);
+        if (options->stream_count != stream_count) {
+            std::cerr << "Server does not accept " << stream_count << " streams" << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        if (options->segment_size != segment_size) {
+            std::cerr << "Server does not accept " << segment_size << "-byte segments" << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        // 续传：握手选项之后是每个流的起始序列号
+        if (recv_packet.data_len >= sizeof(HandshakeOptions) + stream_count * sizeof(uint32_t)) {
+            const uint32_t* resume_seq = reinterpret_cast<const uint32_t*>(recv_packet.data + sizeof(HandshakeOptions));
+            for (int i = 0; i < stream_count; i++) {
+                Flow& flow = *flows[i];
+                uint64_t range_packets = (flow.end - flow.begin + segment_size - 1) / segment_size;
+                flow.first_seq = (uint32_t)(std::min)((uint64_t)(std::max)(resume_seq[i], 1u), range_packets + 1);
+                flow.send_window = SendRing(MAX_SEND_WINDOW_SIZE, flow.first_seq);
+                resumed_bytes += (std::min)((uint64_t)(flow.first_seq - 1) * segment_size, flow.end - flow.begin);
+            }
+        }
+    }
+    else if (stream_count > 1) {
+        std::cerr << "Server does not support striped transfers" << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
+    }
+    std::cout << "Window scale: " << (int)window_scale << ", receive window: " << primary.receive_window << " packets" << std::endl;
+    std::cout << "Checksum: " << (checksum_mode == CHECKSUM_CRC32C ? "CRC32C" : "Internet") << std::endl;
+    
+    // 第三步：发送ACK
+    send_packet = { 0 };//整个结构体清零
+    send_packet.flags = ACK;
+    send_packet.ack_num = recv_packet.seq_num + 1;//期望下一个包
+    send_packet.checksum = calculate_checksum(&send_packet);
+    sendto(primary.socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
     std::cout << "Connection established." << std::endl;
-
-    // ========== 读取文件到内存 ==========
-    std::ifstream file(file_path, std::ios::binary);  // 以二进制模式打开
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << file_path << std::endl;
-        return 1;
+    if (compress) {
+        std::cout << "Compression: " << (compression_enabled ? "on" : "off (not supported by the server)") << std::endl;
     }
-    // 使用迭代器将整个文件读入vector
-    std::vector<char> file_buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-
-    // ========== 启动ACK接收线程 ==========
-    std::thread ack_thread(receive_acks);
-
-    // ========== 主发送循环 ==========
-    auto start_time = std::chrono::high_resolution_clock::now();  // 记录开始时间
-    size_t bytes_sent_total = 0;  // 已发送的总字节数
-
-    // 循环条件：还有数据未发送 或 发送窗口不为空（有未确认的包）
-    while (bytes_sent_total < file_buffer.size() || !send_window.empty()) {
-        std::unique_lock<std::mutex> lock(window_mutex);  // 加锁
-
-        // ========== 步骤1：处理超时和快速重传 ==========
-        uint32_t fast_retransmit_target = retransmit_seq_num;
-        retransmit_seq_num = 0;  // 清除快速重传信号
-        
-        if (fast_retransmit_target > 0 && send_window.count(fast_retransmit_target)) {
-            // === 快速重传（收到3个重复ACK）===
-            std::cout << "--- FAST RETRANSMIT for SEQ=" << fast_retransmit_target << " ---" << std::endl;
-            PacketState& ps = send_window.at(fast_retransmit_target);//状态设置为未确认
-            ps.packet.checksum = calculate_checksum(&ps.packet);
-            // 重传数据包
-            sendto(client_socket, (const char*)&ps.packet, HEADER_SIZE + ps.packet.data_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-            ps.send_time = std::chrono::steady_clock::now();
-            total_retransmissions++;
+    if (fec) {
+        std::cout << "FEC: ";
+        if (!fec_enabled) {
+            std::cout << "off (not supported by the server)";
+        }
+        else if (fec_group_size == 0) {
+            std::cout << "adaptive";
         }
         else {
-            // === 超时重传检测 ===
-            for (auto& pair : send_window) {
-                auto& ps = pair.second;// 数据包状态
-                auto now = std::chrono::steady_clock::now();
-                // 计算自发送以来的时间
-                if (std::chrono::duration_cast<std::chrono::milliseconds>(now - ps.send_time).count() > PACKET_TIMEOUT_MS) {
-                    std::cout << "--- TIMEOUT for SEQ=" << ps.packet.seq_num << ". Retransmitting. ---" << std::endl;
-                    ps.packet.checksum = calculate_checksum(&ps.packet);
-                    // 重传数据包
-                    sendto(client_socket, (const char*)&ps.packet, HEADER_SIZE + ps.packet.data_len, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-                    ps.send_time = now;// 更新发送时间
-                    total_retransmissions++;// 统计重传次数
-
-                    // 超时事件触发：进入慢启动，窗口减半
-                    state = SLOW_START;
-                    ssthresh = (std::max)(2.0, cwnd / 2.0);
-                    cwnd = 1;
-                    duplicate_ack_count = 0;
-                }
-            }
+            std::cout << "1 parity packet per " << fec_group_size << " packets";
         }
+        std::cout << std::endl;
+    }
 
-        // ========== 步骤2：发送新数据包（受窗口限制）==========
-        // 窗口大小 = min(流量控制窗口, 拥塞窗口)
-        while (send_window.size() <(std::min)((double)FLOW_CONTROL_WINDOW_SIZE, cwnd) && bytes_sent_total < file_buffer.size()) {//条件允许发送新包
-            // 计算本次发送的数据量（最多MAX_DATA_SIZE字节）
-            int data_to_send = (std::min)((size_t)MAX_DATA_SIZE, file_buffer.size() - bytes_sent_total);
-
-            // 构造新数据包
-            Packet new_packet = { 0 };
-            new_packet.seq_num = next_seq_num;
-            new_packet.data_len = data_to_send;
-            memcpy(new_packet.data, file_buffer.data() + bytes_sent_total, data_to_send);  // 复制数据
-            new_packet.checksum = calculate_checksum(&new_packet);  // 计算校验和
+    // ========== 启动压缩线程 ==========
+    // 握手确定压缩后立即开始，附加的流加入连接期间压缩线程已经在准备第一批块
+    if (compression_enabled) {
+        for (std::unique_ptr<Flow>& flow : flows) {
+            if (!flow->compressor.start(source_layout, flow->begin, flow->end, segment_size)) {
+                std::cerr << "Failed to open file: " << file_path << std::endl;
+                return shutdown_client(telemetry, flows, file_source, 1);
+            }
+        }
+    }
+    if (resumed_bytes > 0) {
+        std::cout << "Resuming: " << resumed_bytes / 1024.0 << " KB already received by the server." << std::endl;
+    }
 
-            // 发送数据包
-            sendto(client_socket, (const char*)&new_packet, HEADER_SIZE + data_to_send, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-            std::cout << "Sent SEQ=" << next_seq_num << ", CWND=" << cwnd << ", SSTHRESH=" << ssthresh << std::endl;
-            total_packets_sent++;
+    if (stream_count > 1) {
+        std::cout << "Striping across " << stream_count << " streams, " << stripe_packets << " packets each." << std::endl;
+    }
 
-            // 将数据包加入发送窗口
-            PacketState ps;
-            ps.packet = new_packet;
-            ps.send_time = std::chrono::steady_clock::now();  // 记录发送时间
-            send_window[next_seq_num] = ps;// 插入发送窗口
+    // ========== 启用批量收发 ==========
+    // 握手阶段每次只有一个包，直接使用套接字；之后的数据包、ACK和FIN都经过batch_io
+    // 附加的流在自己的线程中收到JOIN-ACK之后才启用
+    primary.batch_io.open(primary.socket);
+    primary.batch_io.set_peer(server_addr);
+    std::cout << "Batched I/O: " << primary.batch_io.mode_name() << std::endl;
+    std::cout << "Pacing: " << (pacing_enabled ? "on" : "off") << std::endl;
 
-            next_seq_num++;
-            bytes_sent_total += data_to_send;// 更新已发送字节数
+    // ========== 启动遥测 ==========
+    if (trace_path != nullptr || stats_port != 0) {
+        for (std::unique_ptr<Flow>& flow : flows) {
+            flow->sampled_time = std::chrono::steady_clock::now();
         }
-
-        // 等待一小段时间或收到快速重传信号（避免忙等待）
-        retransmit_cv.wait_for(lock, std::chrono::milliseconds(10));
+        bool started = telemetry.start(trace_path, stats_port, trace_interval_ms, FLOW_TELEMETRY_COLUMNS, [&flows](std::vector<TelemetryRow>& rows) {
+            for (std::unique_ptr<Flow>& flow : flows) {
+                rows.emplace_back();
+                sample_flow(*flow, rows.back());
+            }
+        });
+        if (!started) {
+            std::cerr << "Could not start telemetry (trace file or stats port unavailable)." << std::endl;
+            return shutdown_client(telemetry, flows, file_source, 1);
+        }
+        std::cout << "Telemetry: every " << trace_interval_ms << " ms";
+        if (trace_path != nullptr) {
+            std::cout << ", trace " << trace_path;
+        }
+        if (stats_port != 0) {
+            std::cout << ", stats http://127.0.0.1:" << stats_port << "/";
+        }
+        std::cout << std::endl;
     }
-    transmission_complete = true;  // 标记传输完成
-
-    // ========== 四次挥手关闭连接 ==========
-    send_packet = { 0 };// 发送FIN
-    send_packet.flags = FIN;// 设置FIN标志
-    send_packet.seq_num = next_seq_num;// 设置序列号
-    send_packet.checksum = calculate_checksum(&send_packet);// 计算校验和
-    // 发送FIN包
-    sendto(client_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    std::cout << "FIN sent. Waiting for final ACK." << std::endl;
 
-    ack_thread.join();  // 等待ACK接收线程结束
+    // ========== 启动每个流的事件循环线程 ==========
+    // 0号流随握手加入，立即开始发送；附加的流先在自己的套接字上加入连接，各流的JOIN同时进行
+    auto start_time = std::chrono::high_resolution_clock::now();  // 记录开始时间
+    std::atomic<bool> join_failed(false);
+    std::vector<std::thread> threads;
+    for (std::unique_ptr<Flow>& flow : flows) {
+        threads.emplace_back([connection_id, &join_failed](Flow* flow) {
+            if (flow->index > 0) {
+                if (!join_flow(*flow, connection_id)) {
+                    LOG_ERROR("[stream {}] Could not join the connection", flow->index);
+                    join_failed = true;
+                    return;
+                }
+                flow->batch_io.open(flow->socket);
+                flow->batch_io.set_peer(server_addr);
+            }
+            run_flow(flow);
+        }, flow.get());
+    }
+    for (std::thread& t : threads) {
+        t.join();  // 等待所有流结束
+    }
+    if (join_failed || transfer_failed || copy_corrupt) {
+        std::cerr << (join_failed ? "Not every stream could join the connection" : transfer_failed ? "Transfer aborted: the file could not be read"
+            : "The server's copy of the file does not match, upload it again") << std::endl;
+        return shutdown_client(telemetry, flows, file_source, 1);
+    }
+    telemetry.stop();  // 最后一次采样记录结束时的状态
+    async_logger().stop();  // 输出剩余的日志，统计信息放在最后
 
     // ========== 计算并输出传输统计 ==========
     auto end_time = std::chrono::high_resolution_clock::now();
     double duration_s = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count() / 1e6;
-    double throughput_kbps = (file_buffer.size() * 8) / (duration_s * 1024);  // 吞吐率（Kbps）
+    double throughput_kbps = ((file_size - resumed_bytes) * 8) / (duration_s * 1024);  // 吞吐率（Kbps），只计本次发送的数据
+    uint32_t total_packets_sent = 0, total_retransmissions = 0, total_acks_received = 0, total_parity_sent = 0, total_duplicate_acks = 0;
+    for (std::unique_ptr<Flow>& flow : flows) {
+        total_packets_sent += flow->total_packets_sent;
+        total_retransmissions += flow->total_retransmissions;
+        total_acks_received += flow->total_acks_received;
+        total_parity_sent += flow->total_parity_sent;
+        total_duplicate_acks += flow->total_duplicate_acks;
+    }
 
     std::cout << "\n--- Transmission Summary ---" << std::endl;
     std::cout << "Total time: " << duration_s << " seconds" << std::endl;
-    std::cout << "File size: " << file_buffer.size() / 1024.0 << " KB" << std::endl;
+    std::cout << "File size: " << file_size / 1024.0 << " KB" << std::endl;
+    if (batch) {
+        std::cout << "Files: " << source_layout.paths.size() << std::endl;
+    }
     std::cout << "Average throughput: " << throughput_kbps << " Kbps" << std::endl;
-    std::cout << "Total packets sent: " << total_packets_sent.load() << std::endl;
-    std::cout << "Total retransmissions: " << total_retransmissions.load() << std::endl;
-    std::cout << "Total ACKs received: " << total_acks_received.load() << std::endl;
+    std::cout << "Total packets sent: " << total_packets_sent << std::endl;
+    std::cout << "Total retransmissions: " << total_retransmissions << std::endl;
+    std::cout << "Total ACKs received: " << total_acks_received << std::endl;
+    std::cout << "Duplicate ACKs received: " << total_duplicate_acks << std::endl;
+    if (fec_enabled) {
+        std::cout << "FEC parity packets sent: " << total_parity_sent << std::endl;
+    }
     if (total_packets_sent > 0) {
-        double loss_rate = (double)total_retransmissions.load() / total_packets_sent.load() * 100;
-        std::cout << "Packet loss rate: " << loss_rate << "%" << std::endl;
+        // 发送方看不到真实的丢包率，这里是重传占发送的比例（含伪重传）
+        double retransmission_rate = (double)total_retransmissions / total_packets_sent * 100;
+        std::cout << "Retransmission rate: " << retransmission_rate << "%" << std::endl;
+    }
+    if (compression_enabled) {
+        uint64_t raw_bytes = 0, stored_bytes = 0;
+        for (std::unique_ptr<Flow>& flow : flows) {
+            raw_bytes += flow->compressor.raw_bytes();
+            stored_bytes += flow->compressor.stored_bytes();
+        }
+        if (stored_bytes > 0) {
+            std::cout << "Compressed size: " << stored_bytes / 1024.0 << " KB (ratio " << (double)raw_bytes / stored_bytes << ")" << std::endl;
+        }
+    }
+    if (flows.size() > 1) {
+        for (std::unique_ptr<Flow>& flow : flows) {
+            std::cout << "Stream " << (int)flow->index << ": " << flow->total_packets_sent.load() << " packets, "
+                << flow->total_retransmissions.load() << " retransmissions" << std::endl;
+        }
     }
 
-    closesocket(client_socket);
-    cleanup_winsock();
-    return 0;
-}
\ No newline at end of file
+    return shutdown_client(telemetry, flows, file_source, 0);
+}
@@ -0,0 +1,318 @@
+﻿/*
+ file_source.h - 文件数据源
+ 以内存映射方式按需读取待发送文件，代替一次性把整个文件读入内存
+ 只映射文件的一段滑动视图，内存占用与文件大小无关
+ 批量传输时数据源由一段内存中的清单和依次相接的多个文件组成，对发送方来说仍是一段连续的字节
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// ========== 文件数据源常量 ==========
+const uint64_t FILE_VIEW_SIZE = 64ull * 1024 * 1024; // 单个映射视图大小（64MB），32位进程也能映射
+
+/*
+ file_size_of - 取得文件大小
+ @return false表示文件不存在或无法访问
+ */
+inline bool file_size_of(const char* path, uint64_t& size) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info) || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+    size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+#endif
+    return true;
+}
+
+// 数据源的组成：开头的内存数据（批量传输的清单，单个文件时为空），之后依次相接的文件
+struct SourceLayout {
+    std::string header;
+    std::vector<std::string> paths;
+    std::vector<uint64_t> sizes;  // 与paths一一对应
+
+    // 追加一个文件；@return false表示文件无法访问
+    bool add_file(const char* path) {
+        uint64_t size = 0;
+        if (!file_size_of(path, size)) {
+            return false;
+        }
+        paths.push_back(path);
+        sizes.push_back(size);
+        return true;
+    }
+
+    uint64_t total_size() const {
+        uint64_t total = header.size();
+        for (uint64_t size : sizes) {
+            total += size;
+        }
+        return total;
+    }
+};
+
+/*
+ FileSource - 只读内存映射文件数据源
+ 用法：open()打开文件后，通过data(offset, len)取得文件中一段字节的只读指针
+ 返回的指针直接指向映射页，在下一次data()调用之前有效
+ 当请求的范围落在当前视图之外时，视图会重新映射到包含该范围的位置
+ 由多个文件组成时同一时刻只打开其中一个文件；跨越文件边界的范围拼接到内部缓冲区中返回
+ */
+class FileSource {
+public:
+    FileSource() = default;
+    ~FileSource() { close(); }
+
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    /*
+     open - 打开单个文件
+     @param path 文件路径
+     @return true表示成功，false表示文件无法打开
+     */
+    bool open(const char* path) {
+        SourceLayout layout;
+        return layout.add_file(path) && open(layout) && open_part(0);
+    }
+
+    /*
+     open - 按组成打开数据源，文件在第一次读到时才打开
+     @param layout 开头的内存数据和依次相接的文件
+     @return true表示成功
+     */
+    bool open(const SourceLayout& layout) {
+        close();
+        header_ = layout.header;
+        uint64_t offset = header_.size();
+        for (size_t i = 0; i < layout.paths.size(); i++) {
+            parts_.push_back(Part{ offset, layout.sizes[i], layout.paths[i] });
+            offset += layout.sizes[i];
+        }
+        size_ = offset;
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        granularity_ = info.dwAllocationGranularity;  // 视图起点必须按分配粒度对齐
+#else
+        granularity_ = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));  // 视图起点必须按页对齐
+#endif
+        return true;
+    }
+
+    /*
+     close - 解除映射并关闭文件
+     */
+    void close() {
+        close_part();
+        header_.clear();
+        parts_.clear();
+        size_ = 0;
+    }
+
+    uint64_t size() const { return size_; }
+
+    /*
+     data - 取得[offset, offset + len)范围的只读指针
+     @param offset 数据源内偏移
+     @param len 字节数（不超过FILE_VIEW_SIZE减去一个对齐粒度）
+     @return 指向映射页（或内部缓冲区）的指针，范围越界或映射失败时返回nullptr
+     */
+    const char* data(uint64_t offset, size_t len) {
+        if (offset + len > size_) {
+            return nullptr;
+        }
+        if (offset + len <= header_.size()) {
+            return header_.data() + offset;
+        }
+        if (offset >= header_.size()) {
+            size_t part = find_part(offset);
+            if (offset + len <= parts_[part].offset + parts_[part].size) {
+                return part_data(part, offset - parts_[part].offset, len);
+            }
+        }
+        return gather(offset, len);
+    }
+
+private:
+    // 数据源中的一个文件
+    struct Part {
+        uint64_t offset;  // 在数据源中的起始偏移
+        uint64_t size;
+        std::string path;
+    };
+
+    // 包含offset的文件：起始偏移不超过offset的最后一个（跳过其前的空文件）
+    size_t find_part(uint64_t offset) const {
+        size_t lo = 0, hi = parts_.size();
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (parts_[mid].offset <= offset) {
+                lo = mid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // 跨越清单和文件、或多个文件的范围：逐段复制到scratch_
+    const char* gather(uint64_t offset, size_t len) {
+        scratch_.resize(len);
+        size_t copied = 0;
+        while (copied < len) {
+            uint64_t pos = offset + copied;
+            uint64_t region_end = header_.size();
+            if (pos >= region_end) {
+                const Part& part = parts_[find_part(pos)];
+                region_end = part.offset + part.size;
+            }
+            size_t piece = (size_t)(std::min)((uint64_t)(len - copied), region_end - pos);
+            const char* src = data(pos, piece);  // 这一段只在一个区域内，不会再进入gather
+            if (src == nullptr) {
+                return nullptr;
+            }
+            memcpy(scratch_.data() + copied, src, piece);
+            copied += piece;
+        }
+        return scratch_.data();
+    }
+
+    // 文件part中[offset, offset + len)的指针，必要时先换成打开这个文件
+    const char* part_data(size_t part, uint64_t offset, size_t len) {
+        if (part != current_ && !open_part(part)) {
+            return nullptr;
+        }
+        if (view_ == nullptr || offset < view_offset_ || offset + len > view_offset_ + view_len_) {
+            if (!map_view(offset)) {
+                return nullptr;
+            }
+        }
+        return view_ + (offset - view_offset_);
+    }
+
+    // 打开第part个文件，关闭原来打开的文件
+    bool open_part(size_t part) {
+        close_part();
+        const char* path = parts_[part].path.c_str();
+#ifdef _WIN32
+        file_handle_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_handle_ == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        // 空文件无法创建映射对象，也不需要映射
+        if (parts_[part].size > 0) {
+            mapping_handle_ = CreateFileMappingA(file_handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_handle_ == NULL) {
+                close_part();
+                return false;
+            }
+        }
+#else
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ < 0) {
+            return false;
+        }
+#endif
+        current_ = part;
+        return true;
+    }
+
+    void close_part() {
+        unmap_view();
+#ifdef _WIN32
+        if (mapping_handle_ != NULL) {
+            CloseHandle(mapping_handle_);
+            mapping_handle_ = NULL;
+        }
+        if (file_handle_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_handle_);
+            file_handle_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+        current_ = SIZE_MAX;
+    }
+
+    // 将视图重新映射到当前文件中包含offset的对齐位置
+    bool map_view(uint64_t offset) {
+        unmap_view();
+        uint64_t start = offset - offset % granularity_;
+        uint64_t len = (std::min)(FILE_VIEW_SIZE, parts_[current_].size - start);
+#ifdef _WIN32
+        void* view = MapViewOfFile(mapping_handle_, FILE_MAP_READ,
+            static_cast<DWORD>(start >> 32), static_cast<DWORD>(start & 0xFFFFFFFF), static_cast<SIZE_T>(len));
+        if (view == NULL) {
+            return false;
+        }
+#else
+        void* view = mmap(NULL, static_cast<size_t>(len), PROT_READ, MAP_PRIVATE, fd_, static_cast<off_t>(start));
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        madvise(view, static_cast<size_t>(len), MADV_SEQUENTIAL);  // 顺序访问提示，内核据此预读
+#endif
+        view_ = static_cast<const char*>(view);
+        view_offset_ = start;
+        view_len_ = len;
+        return true;
+    }
+
+    void unmap_view() {
+        if (view_ == nullptr) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(view_);
+#else
+        munmap(const_cast<char*>(view_), static_cast<size_t>(view_len_));
+#endif
+        view_ = nullptr;
+        view_offset_ = 0;
+        view_len_ = 0;
+    }
+
+#ifdef _WIN32
+    HANDLE file_handle_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle_ = NULL;
+#else
+    int fd_ = -1;
+#endif
+    std::string header_;       // 开头的内存数据
+    std::vector<Part> parts_;
+    size_t current_ = SIZE_MAX;  // 当前打开的文件在parts_中的下标
+    std::vector<char> scratch_;  // 跨越边界的范围拼接在这里
+    uint64_t size_ = 0;        // 整个数据源的字节数
+    uint64_t granularity_ = 4096;
+    const char* view_ = nullptr;   // 当前映射视图起始地址
+    uint64_t view_offset_ = 0;     // 当前视图在当前文件中的起始偏移
+    uint64_t view_len_ = 0;        // 当前视图长度
+};
@@ -0,0 +1,78 @@
+﻿/*
+ pacer.h - 发送速率平滑（pacing）
+ 用令牌桶把窗口允许发送的数据包按拥塞控制器给出的速率（CongestionController::pacing_rate）均匀发出，
+ 代替整窗背靠背突发
+ 令牌按速率连续累积，上限为约PACING_QUANTUM_MS毫秒的发送量：定时器唤醒得晚时可以补发积累的令牌，
+ 但突发长度不会超过这个上限；速率为0时不限速
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+// ========== 速率平滑常量 ==========
+const double PACING_QUANTUM_MS = 1.0;       // 令牌桶容量对应的发送时长（毫秒），接近定时器精度
+const double PACING_MIN_BURST = 2.0;        // 令牌桶容量下限（数据包数），低速时也允许成对发送
+const double PACING_MAX_BURST = 64.0;       // 令牌桶容量上限（数据包数），不超过一次批量发送的包数
+
+/*
+ Pacer - 令牌桶
+ 每个令牌允许发送一个数据包；新数据包只在有令牌时发送，重传直接发送但同样消耗令牌（可以透支），
+ 因此重传不会被推迟，而平均发送速率仍然不超过设定值
+ */
+class Pacer {
+public:
+    /*
+     set_rate - 设置发送速率，先按旧速率补充到now为止的令牌
+     @param packets_per_second 数据包/秒，0表示不限速
+     */
+    void set_rate(double packets_per_second, std::chrono::steady_clock::time_point now) {
+        refill(now);
+        rate_ = packets_per_second;
+        burst_ = (std::min)(PACING_MAX_BURST, (std::max)(PACING_MIN_BURST, rate_ * PACING_QUANTUM_MS / 1000.0));
+        tokens_ = (std::min)(tokens_, burst_);
+    }
+
+    bool enabled() const { return rate_ > 0; }
+    double rate() const { return rate_; }
+
+    // 当前允许立即发送的数据包数；不限速时不设上限
+    uint32_t budget(std::chrono::steady_clock::time_point now) {
+        if (!enabled()) {
+            return UINT32_MAX;
+        }
+        refill(now);
+        return tokens_ >= 1 ? (uint32_t)tokens_ : 0;
+    }
+
+    // 发送了count个数据包
+    void consume(uint32_t count) {
+        if (enabled()) {
+            tokens_ -= count;
+        }
+    }
+
+    // 下一个令牌可用的时间，用于决定事件循环的唤醒时间
+    std::chrono::steady_clock::time_point next_send_time() const {
+        if (!enabled() || tokens_ >= 1) {
+            return last_refill_;
+        }
+        return last_refill_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>((1 - tokens_) / rate_));
+    }
+
+private:
+    void refill(std::chrono::steady_clock::time_point now) {
+        if (now > last_refill_ && enabled()) {
+            tokens_ = (std::min)(burst_, tokens_ + rate_ * std::chrono::duration<double>(now - last_refill_).count());
+        }
+        last_refill_ = now;
+    }
+
+    double rate_ = 0;      // 数据包/秒
+    double burst_ = PACING_MIN_BURST;
+    double tokens_ = PACING_MIN_BURST;  // 可以为负：重传透支的令牌
+    std::chrono::steady_clock::time_point last_refill_;
+};
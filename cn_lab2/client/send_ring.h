@@ -0,0 +1,97 @@
+﻿/*
+ send_ring.h - 发送窗口环形缓冲区
+ 用固定容量的环形数组保存在途数据包的描述符，代替std::map
+ 槽位按 seq_num % capacity 直接定位，描述符只记录载荷在文件中的偏移，不复制数据
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <chrono>
+
+// ========== 发送窗口中数据包的状态 ==========
+struct PacketState {
+    uint32_t seq_num = 0;   // 序列号
+    uint64_t offset = 0;    // 载荷在文件中的起始偏移
+    uint16_t data_len = 0;  // 载荷长度
+    std::chrono::steady_clock::time_point send_time;  // 最近一次发送时间，用于RTT采样
+    std::chrono::steady_clock::time_point deadline;   // 当前重传定时器的截止时间
+    uint64_t delivered = 0;  // 发送时的累计交付包数，用于交付速率采样
+    std::chrono::steady_clock::time_point delivered_time;  // 发送时最近一次交付的时间
+    bool acked = false;     // 是否已被确认
+    bool retransmitted = false;  // 是否重传过（Karn算法：重传过的包不产生RTT样本）
+    uint32_t payload_checksum = 0;   // 载荷部分的校验和中间值，重传时直接复用
+    bool payload_checksum_valid = false;
+    uint32_t parity_group = 0;  // 所在FEC校验组的第一个序列号，首次发送时确定，重传时不变；0表示不使用FEC
+};
+
+/*
+ SendRing - 发送窗口
+ 窗口覆盖序列号区间 [base, next)，容量取不小于请求值的2的幂，用掩码代替取模
+ 所有槽位在构造时一次性分配，运行期间不再分配内存
+ 累计确认只需推进base，不需要逐个删除节点
+ */
+class SendRing {
+public:
+    explicit SendRing(uint32_t min_capacity, uint32_t initial_seq = 1)
+        : base_(initial_seq), next_(initial_seq) {
+        uint32_t capacity = 1;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    uint32_t base() const { return base_; }
+    uint32_t next() const { return next_; }
+    uint32_t capacity() const { return mask_ + 1; }
+    size_t size() const { return next_ - base_; }
+    bool empty() const { return next_ == base_; }
+    bool full() const { return size() > mask_; }
+
+    // 序列号是否在窗口内（已发送且未被累计确认）
+    bool contains(uint32_t seq_num) const {
+        return seq_num - base_ < next_ - base_;
+    }
+
+    // 取得窗口内某个序列号的描述符，调用前需确认contains(seq_num)
+    PacketState& at(uint32_t seq_num) { return slots_[seq_num & mask_]; }
+
+    /*
+     push - 在窗口尾部登记一个新数据包
+     @return 新槽位的引用，其seq_num为原next
+     */
+    PacketState& push(uint64_t offset, uint16_t data_len) {
+        PacketState& ps = slots_[next_ & mask_];
+        ps.seq_num = next_;
+        ps.offset = offset;
+        ps.data_len = data_len;
+        ps.acked = false;
+        ps.retransmitted = false;
+        ps.payload_checksum_valid = false;
+        ps.parity_group = 0;
+        next_++;
+        return ps;
+    }
+
+    /*
+     ack_through - 累计确认到acked_num（含），窗口基序号前移
+     @return 本次新确认的数据包数
+     */
+    uint32_t ack_through(uint32_t acked_num) {
+        if (!contains(acked_num)) {
+            return 0;
+        }
+        uint32_t newly_acked = acked_num + 1 - base_;
+        base_ = acked_num + 1;
+        return newly_acked;
+    }
+
+private:
+    std::vector<PacketState> slots_;
+    uint32_t mask_ = 0;
+    uint32_t base_;  // 最小未确认序列号
+    uint32_t next_;  // 下一个要发送的序列号
+};
@@ -0,0 +1,603 @@
+﻿/*
+ batch_io.h - 批量数据报收发
+ 一次系统调用发送或接收一批UDP数据报，避免每个数据包一次sendto/recvfrom
+ 1. Windows：Registered I/O（RIO），收发缓冲区预先注册，一批请求只提交一次
+ 2. Linux：sendmmsg/recvmmsg，内核支持时同时使用UDP GSO（发送分段卸载）和UDP GRO（接收合并）
+ 3. 其他平台或初始化失败时：逐个调用sendto/recvfrom，接口不变
+ 数据报缓冲区由BatchSocket持有，调用者直接在发送槽位中构造数据包，不需要额外复制
+ */
+
+#pragma once
+
+#include "common.h"
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <mswsock.h>
+#else
+#include <sys/select.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#define BATCH_IO_HAVE_MMSG 1
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103  // 旧版本头文件没有定义，内核4.18起支持
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104      // 内核5.0起支持
+#endif
+#endif
+
+// ========== 批量收发常量 ==========
+const int SEND_BATCH_SIZE = 64;     // 一批最多发送的数据报个数
+const int RECV_BATCH_SIZE = 64;     // 一次最多接收的数据报个数
+const int GRO_RECV_BATCH_SIZE = 8;  // 启用GRO时的接收缓冲区个数，每个缓冲区可以容纳多个合并的数据报
+const int GRO_BUFFER_SIZE = 65535;  // 启用GRO时单个接收缓冲区的大小
+const size_t MAX_GSO_BYTES = 65507;  // 一个GSO超级数据报的最大长度（受UDP长度字段限制）
+
+enum BatchIoMode {
+    BATCH_IO_FALLBACK = 0,  // 逐个sendto/recvfrom
+    BATCH_IO_RIO = 1,       // Windows Registered I/O
+    BATCH_IO_MMSG = 2,      // Linux sendmmsg/recvmmsg
+};
+
+// 接收到的一个数据报，data指向BatchSocket内部的缓冲区，下一次receive之前有效
+struct ReceivedDatagram {
+    const char* data;
+    int len;
+    sockaddr_in from;
+};
+
+/*
+ create_udp_socket - 创建UDP套接字
+ Windows上带WSA_FLAG_REGISTERED_IO标志创建，之后才能使用RIO；失败时退回普通套接字
+ */
+inline SOCKET create_udp_socket() {
+#ifdef _WIN32
+    SOCKET s = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+    if (s != INVALID_SOCKET) {
+        return s;
+    }
+#endif
+    return socket(AF_INET, SOCK_DGRAM, 0);
+}
+
+/*
+ set_dont_fragment - 设置DF位：超过路径MTU的数据报被丢弃而不是分片
+ 超过本机出口MTU的数据报在sendto时直接失败
+ @return true表示设置成功
+ */
+inline bool set_dont_fragment(SOCKET s) {
+#ifdef _WIN32
+    DWORD value = TRUE;
+    return setsockopt(s, IPPROTO_IP, IP_DONTFRAGMENT, (const char*)&value, sizeof(value)) == 0;
+#elif defined(IP_MTU_DISCOVER)
+    int value = IP_PMTUDISC_DO;
+    return setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ BatchSocket - 批量数据报收发
+ 发送：send_buffer()取得下一个槽位（MAX_BUFFER_SIZE字节），写入后commit(len)，flush()一次提交整批
+ 接收：receive(timeout_ms)或receive_until(deadline)一次取回一批数据报，用datagram(i)访问
+ 发送一侧和接收一侧可以分别由两个线程使用，同一侧不能并发调用
+ 打开之后套接字上的收发都应经过BatchSocket，握手等打开之前的收发可以直接使用套接字
+ */
+class BatchSocket {
+public:
+    BatchSocket() = default;
+    BatchSocket(const BatchSocket&) = delete;
+    BatchSocket& operator=(const BatchSocket&) = delete;
+    ~BatchSocket() { close(); }
+
+    /*
+     open - 在已创建的UDP套接字上启用批量收发
+     按平台依次尝试RIO、sendmmsg/recvmmsg，都不可用时使用逐个收发，因此总是成功
+     @param s UDP套接字，Windows上需由create_udp_socket创建才能使用RIO
+     */
+    void open(SOCKET s) {
+        close();
+        socket_ = s;
+        mode_ = BATCH_IO_FALLBACK;
+        recv_slots_ = RECV_BATCH_SIZE;
+        recv_slot_size_ = MAX_BUFFER_SIZE;
+#ifdef _WIN32
+        if (open_rio()) {
+            mode_ = BATCH_IO_RIO;
+            return;
+        }
+#endif
+#ifdef BATCH_IO_HAVE_MMSG
+        mode_ = BATCH_IO_MMSG;
+        int value = 0;
+        socklen_t value_len = sizeof(value);
+        gso_ = getsockopt(socket_, IPPROTO_UDP, UDP_SEGMENT, &value, &value_len) == 0;
+        value = 1;
+        gro_ = setsockopt(socket_, IPPROTO_UDP, UDP_GRO, &value, sizeof(value)) == 0;
+        if (gro_) {
+            recv_slots_ = GRO_RECV_BATCH_SIZE;
+            recv_slot_size_ = GRO_BUFFER_SIZE;
+        }
+#endif
+        send_region_.resize((size_t)SEND_BATCH_SIZE * MAX_BUFFER_SIZE);
+        recv_region_.resize((size_t)recv_slots_ * recv_slot_size_);
+        send_base_ = send_region_.data();
+        recv_base_ = recv_region_.data();
+    }
+
+    // 释放缓冲区和RIO资源；不关闭套接字本身
+    void close() {
+#ifdef _WIN32
+        close_rio();
+#endif
+        send_count_ = 0;
+        datagrams_.clear();
+        send_base_ = recv_base_ = NULL;
+        socket_ = INVALID_SOCKET;
+    }
+
+    // 设置发送目的地址
+    void set_peer(const sockaddr_in& peer) { peer_ = peer; }
+
+    BatchIoMode mode() const { return mode_; }
+
+    const char* mode_name() const {
+        switch (mode_) {
+        case BATCH_IO_RIO: return "Registered I/O";
+        case BATCH_IO_MMSG: return gso_ ? (gro_ ? "sendmmsg/recvmmsg + GSO/GRO" : "sendmmsg/recvmmsg + GSO")
+                                        : (gro_ ? "sendmmsg/recvmmsg + GRO" : "sendmmsg/recvmmsg");
+        default: return "sendto/recvfrom";
+        }
+    }
+
+    // ========== 发送 ==========
+
+    // 下一个待发送数据报的缓冲区；本批已满时先发送整批
+    char* send_buffer() {
+        if (send_count_ == SEND_BATCH_SIZE) {
+            flush();
+        }
+        return send_base_ + (size_t)send_count_ * MAX_BUFFER_SIZE;
+    }
+
+    // 确认send_buffer()中写入了len字节
+    void commit(int len) {
+        send_len_[send_count_++] = len;
+    }
+
+    // 复制一个数据报到本批中
+    void send(const void* data, int len) {
+        memcpy(send_buffer(), data, len);
+        commit(len);
+    }
+
+    size_t pending() const { return send_count_; }
+
+    /*
+     flush - 发送本批所有已提交的数据报
+     @return 成功交给内核的数据报个数
+     */
+    int flush() {
+        if (send_count_ == 0) {
+            return 0;
+        }
+        int sent;
+        switch (mode_) {
+#ifdef _WIN32
+        case BATCH_IO_RIO: sent = flush_rio(); break;
+#endif
+#ifdef BATCH_IO_HAVE_MMSG
+        case BATCH_IO_MMSG: sent = flush_mmsg(); break;
+#endif
+        default: sent = flush_fallback(); break;
+        }
+        send_count_ = 0;
+        return sent;
+    }
+
+    // ========== 接收 ==========
+
+    /*
+     receive - 等待并接收一批数据报
+     上一批数据报的缓冲区在这里被回收，调用前必须处理完
+     @param timeout_ms 最长等待时间，负数表示一直等待
+     @return 收到的数据报个数，0表示超时，-1表示套接字出错
+     */
+    int receive(int timeout_ms) {
+        return receive_us(timeout_ms < 0 ? -1 : (long long)timeout_ms * 1000);
+    }
+
+    /*
+     receive_until - 等待并接收一批数据报，最多等到deadline
+     等待精确到微秒（Linux上使用ppoll），事件循环据此按重传定时器和令牌的时间点醒来；deadline已过时只取已经到达的
+     @return 与receive相同
+     */
+    int receive_until(std::chrono::steady_clock::time_point deadline) {
+        long long timeout_us = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return receive_us((std::max)(timeout_us, 0LL));
+    }
+
+    const ReceivedDatagram& datagram(int i) const { return datagrams_[i]; }
+
+private:
+    // 按模式接收一批数据报，timeout_us为负数表示一直等待
+    int receive_us(long long timeout_us) {
+        datagrams_.clear();
+        switch (mode_) {
+#ifdef _WIN32
+        case BATCH_IO_RIO: return receive_rio(timeout_us);
+#endif
+#ifdef BATCH_IO_HAVE_MMSG
+        case BATCH_IO_MMSG: return receive_mmsg(timeout_us);
+#endif
+        default: return receive_fallback(timeout_us);
+        }
+    }
+
+    // 等待套接字可读；只有毫秒精度的接口向上取整，不会在截止时间之前空转
+    bool wait_readable(long long timeout_us) {
+#ifdef _WIN32
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(socket_, &read_set);
+        timeval tv = { (long)(timeout_us / 1000000), (long)(timeout_us % 1000000) };
+        return select(0, &read_set, NULL, NULL, timeout_us < 0 ? NULL : &tv) > 0;
+#elif defined(__linux__)
+        pollfd pfd = { socket_, POLLIN, 0 };
+        timespec ts = { (time_t)(timeout_us / 1000000), (long)(timeout_us % 1000000) * 1000 };
+        return ppoll(&pfd, 1, timeout_us < 0 ? NULL : &ts, NULL) > 0;
+#else
+        pollfd pfd = { socket_, POLLIN, 0 };
+        return poll(&pfd, 1, timeout_us < 0 ? -1 : (int)((timeout_us + 999) / 1000)) > 0;
+#endif
+    }
+
+    // 逐个发送
+    int flush_fallback() {
+        int sent = 0;
+        for (size_t i = 0; i < send_count_; i++) {
+            if (sendto(socket_, send_base_ + i * MAX_BUFFER_SIZE, send_len_[i], 0, (const sockaddr*)&peer_, sizeof(peer_)) >= 0) {
+                sent++;
+            }
+        }
+        return sent;
+    }
+
+    // 等到可读后逐个接收，直到没有更多数据报或缓冲区用完
+    int receive_fallback(long long timeout_us) {
+        long long wait_us = timeout_us;
+        for (int i = 0; i < recv_slots_ && wait_readable(wait_us); i++) {
+            char* buffer = recv_base_ + (size_t)i * recv_slot_size_;
+            ReceivedDatagram dg;
+            socklen_t from_len = sizeof(dg.from);
+            dg.len = recvfrom(socket_, buffer, recv_slot_size_, 0, (sockaddr*)&dg.from, &from_len);
+            if (dg.len > 0) {
+                dg.data = buffer;
+                datagrams_.push_back(dg);
+            }
+            wait_us = 0;  // 第一个数据报之后只取已经到达的
+        }
+        return (int)datagrams_.size();
+    }
+
+#ifdef BATCH_IO_HAVE_MMSG
+    /*
+     flush_mmsg - sendmmsg一次提交整批
+     启用GSO时，连续的满长度数据报在槽位中首尾相接，合并为一个带UDP_SEGMENT的超级数据报，由内核或网卡分段
+     */
+    int flush_mmsg() {
+        int sent = 0;
+        size_t first = 0;
+        while (first < send_count_) {
+            mmsghdr msgs[SEND_BATCH_SIZE];
+            iovec iovs[SEND_BATCH_SIZE];  // 每个数据报一个，合并的数据报由相邻的几个组成一条消息
+            size_t group_start[SEND_BATCH_SIZE];
+            size_t group_size[SEND_BATCH_SIZE];
+            int count = 0;
+            memset(msgs, 0, sizeof(msgs));
+            for (size_t i = first; i < send_count_; count++) {
+                // 除最后一个外长度都与第一个相同的连续数据报才能合并，分段长度即第一个数据报的长度
+                size_t j = i + 1;
+                size_t bytes = send_len_[i];
+                while (gso_ && j < send_count_ && bytes + send_len_[j] <= MAX_GSO_BYTES &&
+                    send_len_[j - 1] == send_len_[i] && send_len_[j] <= send_len_[i]) {
+                    bytes += send_len_[j];
+                    j++;
+                }
+                // 槽位按MAX_BUFFER_SIZE排列，数据报之间不连续，内核按iovec顺序拼接后再分段
+                for (size_t k = i; k < j; k++) {
+                    iovs[k - first].iov_base = send_base_ + k * MAX_BUFFER_SIZE;
+                    iovs[k - first].iov_len = send_len_[k];
+                }
+                msghdr& hdr = msgs[count].msg_hdr;
+                hdr.msg_name = &peer_;
+                hdr.msg_namelen = sizeof(peer_);
+                hdr.msg_iov = &iovs[i - first];
+                hdr.msg_iovlen = j - i;
+                if (j - i > 1) {
+                    hdr.msg_control = gso_control_[count];
+                    hdr.msg_controllen = sizeof(gso_control_[count]);
+                    cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+                    cm->cmsg_level = IPPROTO_UDP;
+                    cm->cmsg_type = UDP_SEGMENT;
+                    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    uint16_t segment_size = (uint16_t)send_len_[i];
+                    memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+                }
+                group_start[count] = i;
+                group_size[count] = j - i;
+                i = j;
+            }
+
+            int done = 0;
+            while (done < count) {
+                int n = sendmmsg(socket_, msgs + done, count - done, 0);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                for (int k = done; k < done + n; k++) {
+                    sent += (int)group_size[k];
+                }
+                done += n;
+            }
+            if (done == count) {
+                break;
+            }
+            if (gso_ && errno == EIO && group_size[done] > 1) {
+                // 出口设备不支持分段卸载：关闭GSO，从失败的消息开始重新组织
+                gso_ = false;
+                first = group_start[done];
+                continue;
+            }
+            // 其他错误（例如发送缓冲区满）：跳过失败的消息，UDP本身就允许丢包
+            first = group_start[done] + group_size[done];
+        }
+        return sent;
+    }
+
+    // recvmmsg一次取回所有已经到达的数据报；GRO合并的数据报按分段长度拆开
+    int receive_mmsg(long long timeout_us) {
+        if (!wait_readable(timeout_us)) {
+            return 0;
+        }
+        mmsghdr msgs[RECV_BATCH_SIZE];
+        iovec iovs[RECV_BATCH_SIZE];
+        sockaddr_in from[RECV_BATCH_SIZE];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < recv_slots_; i++) {
+            iovs[i].iov_base = recv_base_ + (size_t)i * recv_slot_size_;
+            iovs[i].iov_len = recv_slot_size_;
+            msghdr& hdr = msgs[i].msg_hdr;
+            hdr.msg_name = &from[i];
+            hdr.msg_namelen = sizeof(from[i]);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            if (gro_) {
+                hdr.msg_control = gro_control_[i];
+                hdr.msg_controllen = sizeof(gro_control_[i]);
+            }
+        }
+        int n = recvmmsg(socket_, msgs, recv_slots_, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNREFUSED) ? 0 : -1;
+        }
+        for (int i = 0; i < n; i++) {
+            int len = (int)msgs[i].msg_len;
+            int segment_size = len;
+            msghdr& hdr = msgs[i].msg_hdr;
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&hdr); gro_ && cm != NULL; cm = CMSG_NXTHDR(&hdr, cm)) {
+                if (cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO) {
+                    memcpy(&segment_size, CMSG_DATA(cm), sizeof(segment_size));
+                }
+            }
+            const char* data = static_cast<const char*>(iovs[i].iov_base);
+            for (int offset = 0; offset < len && segment_size > 0; offset += segment_size) {
+                ReceivedDatagram dg;
+                dg.data = data + offset;
+                dg.len = (std::min)(segment_size, len - offset);
+                dg.from = from[i];
+                datagrams_.push_back(dg);
+            }
+        }
+        return (int)datagrams_.size();
+    }
+
+    char gso_control_[SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+    char gro_control_[RECV_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+#endif
+
+#ifdef _WIN32
+    // 注册区域布局：[发送槽位][接收槽位][发送目的地址][每个接收槽位的来源地址]
+    size_t recv_offset() const { return (size_t)SEND_BATCH_SIZE * MAX_BUFFER_SIZE; }
+    size_t peer_offset() const { return recv_offset() + (size_t)RECV_BATCH_SIZE * MAX_BUFFER_SIZE; }
+    size_t from_offset(int i) const { return peer_offset() + (i + 1) * sizeof(SOCKADDR_INET); }
+    size_t region_size() const { return from_offset(RECV_BATCH_SIZE); }
+
+    /*
+     open_rio - 取得RIO函数表，注册缓冲区，创建完成队列和请求队列，并预先投递所有接收请求
+     接收完成队列使用事件通知，以便receive可以阻塞等待；发送完成队列轮询
+     */
+    bool open_rio() {
+        GUID function_table_id = WSAID_MULTIPLE_RIO;
+        DWORD bytes = 0;
+        memset(&rio_, 0, sizeof(rio_));
+        rio_.cbSize = sizeof(rio_);
+        if (WSAIoctl(socket_, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &function_table_id, sizeof(function_table_id),
+            &rio_, sizeof(rio_), &bytes, NULL, NULL) != 0) {
+            return false;
+        }
+        rio_region_ = static_cast<char*>(VirtualAlloc(NULL, region_size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (rio_region_ == NULL) {
+            return false;
+        }
+        rio_buffer_ = rio_.RIORegisterBuffer(rio_region_, (DWORD)region_size());
+        recv_event_ = WSACreateEvent();
+        RIO_NOTIFICATION_COMPLETION notification;
+        memset(&notification, 0, sizeof(notification));
+        notification.Type = RIO_EVENT_COMPLETION;
+        notification.Event.EventHandle = recv_event_;
+        notification.Event.NotifyReset = TRUE;
+        if (rio_buffer_ == RIO_INVALID_BUFFERID || recv_event_ == WSA_INVALID_EVENT) {
+            close_rio();
+            return false;
+        }
+        recv_cq_ = rio_.RIOCreateCompletionQueue(RECV_BATCH_SIZE, &notification);
+        send_cq_ = rio_.RIOCreateCompletionQueue(SEND_BATCH_SIZE, NULL);
+        if (recv_cq_ == RIO_INVALID_CQ || send_cq_ == RIO_INVALID_CQ) {
+            close_rio();
+            return false;
+        }
+        rq_ = rio_.RIOCreateRequestQueue(socket_, RECV_BATCH_SIZE, 1, SEND_BATCH_SIZE, 1, recv_cq_, send_cq_, NULL);
+        if (rq_ == RIO_INVALID_RQ) {
+            close_rio();
+            return false;
+        }
+        send_base_ = rio_region_;
+        recv_base_ = rio_region_ + recv_offset();
+        std::vector<int> all(RECV_BATCH_SIZE);
+        for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+            all[i] = i;
+        }
+        post_receives(all);
+        return true;
+    }
+
+    // 关闭完成队列、注销缓冲区；请求队列随套接字关闭而释放
+    void close_rio() {
+        if (recv_cq_ != RIO_INVALID_CQ) {
+            rio_.RIOCloseCompletionQueue(recv_cq_);
+            recv_cq_ = RIO_INVALID_CQ;
+        }
+        if (send_cq_ != RIO_INVALID_CQ) {
+            rio_.RIOCloseCompletionQueue(send_cq_);
+            send_cq_ = RIO_INVALID_CQ;
+        }
+        if (rio_buffer_ != RIO_INVALID_BUFFERID) {
+            rio_.RIODeregisterBuffer(rio_buffer_);
+            rio_buffer_ = RIO_INVALID_BUFFERID;
+        }
+        if (recv_event_ != WSA_INVALID_EVENT) {
+            WSACloseEvent(recv_event_);
+            recv_event_ = WSA_INVALID_EVENT;
+        }
+        if (rio_region_ != NULL) {
+            VirtualFree(rio_region_, 0, MEM_RELEASE);
+            rio_region_ = NULL;
+        }
+        rq_ = RIO_INVALID_RQ;
+    }
+
+    // 投递一组接收请求，最后一次性提交；请求队列不是线程安全的，和发送共用一把锁
+    void post_receives(const std::vector<int>& slots) {
+        if (slots.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(rq_mutex_);
+        for (int slot : slots) {
+            RIO_BUF data = { rio_buffer_, (ULONG)(recv_offset() + (size_t)slot * MAX_BUFFER_SIZE), (ULONG)MAX_BUFFER_SIZE };
+            RIO_BUF from = { rio_buffer_, (ULONG)from_offset(slot), (ULONG)sizeof(SOCKADDR_INET) };
+            rio_.RIOReceiveEx(rq_, &data, 1, NULL, &from, NULL, NULL, RIO_MSG_DEFER, (PVOID)(intptr_t)slot);
+        }
+        rio_.RIOReceiveEx(rq_, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL);
+    }
+
+    // 整批发送请求一次提交，等待发送完成后槽位才能重用
+    int flush_rio() {
+        SOCKADDR_INET* peer = reinterpret_cast<SOCKADDR_INET*>(rio_region_ + peer_offset());
+        memset(peer, 0, sizeof(*peer));
+        peer->Ipv4 = peer_;
+        RIO_BUF peer_buf = { rio_buffer_, (ULONG)peer_offset(), (ULONG)sizeof(SOCKADDR_INET) };
+        int posted = 0;
+        {
+            std::lock_guard<std::mutex> lock(rq_mutex_);
+            for (size_t i = 0; i < send_count_; i++) {
+                RIO_BUF data = { rio_buffer_, (ULONG)(i * MAX_BUFFER_SIZE), (ULONG)send_len_[i] };
+                DWORD flags = i + 1 < send_count_ ? RIO_MSG_DEFER : 0;
+                if (rio_.RIOSendEx(rq_, &data, 1, NULL, &peer_buf, NULL, NULL, flags, NULL)) {
+                    posted++;
+                }
+            }
+        }
+        int sent = 0;
+        RIORESULT results[SEND_BATCH_SIZE];
+        for (int completed = 0; completed < posted;) {
+            ULONG n = rio_.RIODequeueCompletion(send_cq_, results, SEND_BATCH_SIZE);
+            if (n == RIO_CORRUPT_CQ) {
+                break;
+            }
+            for (ULONG k = 0; k < n; k++) {
+                sent += results[k].Status == 0 ? 1 : 0;
+            }
+            completed += (int)n;
+        }
+        return sent;
+    }
+
+    // 先把上一批的缓冲区重新投递，再取完成的接收请求；没有完成时等待事件通知
+    int receive_rio(long long timeout_us) {
+        post_receives(recv_done_);
+        recv_done_.clear();
+        RIORESULT results[RECV_BATCH_SIZE];
+        ULONG n = rio_.RIODequeueCompletion(recv_cq_, results, RECV_BATCH_SIZE);
+        if (n == 0) {
+            rio_.RIONotify(recv_cq_);
+            WaitForSingleObject(recv_event_, timeout_us < 0 ? INFINITE : (DWORD)((timeout_us + 999) / 1000));
+            n = rio_.RIODequeueCompletion(recv_cq_, results, RECV_BATCH_SIZE);
+        }
+        if (n == RIO_CORRUPT_CQ) {
+            return -1;
+        }
+        for (ULONG k = 0; k < n; k++) {
+            int slot = (int)(intptr_t)results[k].RequestContext;
+            recv_done_.push_back(slot);
+            if (results[k].Status != 0) {
+                continue;  // 例如对端端口不可达（WSAECONNRESET），忽略
+            }
+            ReceivedDatagram dg;
+            dg.data = recv_base_ + (size_t)slot * MAX_BUFFER_SIZE;
+            dg.len = (int)results[k].BytesTransferred;
+            dg.from = reinterpret_cast<const SOCKADDR_INET*>(rio_region_ + from_offset(slot))->Ipv4;
+            datagrams_.push_back(dg);
+        }
+        return (int)datagrams_.size();
+    }
+
+    RIO_EXTENSION_FUNCTION_TABLE rio_;
+    char* rio_region_ = NULL;
+    RIO_BUFFERID rio_buffer_ = RIO_INVALID_BUFFERID;
+    RIO_CQ send_cq_ = RIO_INVALID_CQ;
+    RIO_CQ recv_cq_ = RIO_INVALID_CQ;
+    RIO_RQ rq_ = RIO_INVALID_RQ;
+    WSAEVENT recv_event_ = WSA_INVALID_EVENT;
+    std::mutex rq_mutex_;
+    std::vector<int> recv_done_;  // 上一批完成的接收槽位，下一次receive时重新投递
+#endif
+
+    SOCKET socket_ = INVALID_SOCKET;
+    BatchIoMode mode_ = BATCH_IO_FALLBACK;
+    bool gso_ = false;  // sendmmsg时合并满长度数据报（UDP_SEGMENT）
+    bool gro_ = false;  // 接收时内核合并数据报（UDP_GRO）
+    sockaddr_in peer_ = {};
+    char* send_base_ = NULL;
+    char* recv_base_ = NULL;
+    std::vector<char> send_region_;
+    std::vector<char> recv_region_;
+    int send_len_[SEND_BATCH_SIZE];
+    size_t send_count_ = 0;
+    int recv_slots_ = RECV_BATCH_SIZE;
+    int recv_slot_size_ = MAX_BUFFER_SIZE;
+    std::vector<ReceivedDatagram> datagrams_;
+};
@@ -0,0 +1,287 @@
+﻿/*
+ checksum.h - 校验和引擎
+ 1. 16位反码和（Internet校验和）：SSE2/AVX2/NEON向量化实现，标量实现兜底，运行时按CPU特性选择
+ 2. CRC32C：SSE4.2/ARMv8硬件指令，查表实现兜底
+ 只处理字节序列，不涉及数据包结构；数据包级别的校验和见common.h
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define CHECKSUM_NEON 1
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+#define CHECKSUM_ARM_CRC32 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <arm_acle.h>
+#endif
+#endif
+#endif
+
+// GCC/Clang需要为使用扩展指令集的函数单独声明目标；MSVC可以直接使用内建函数
+#if defined(CHECKSUM_X86) && !defined(_MSC_VER)
+#define CHECKSUM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CHECKSUM_TARGET(isa)
+#endif
+
+// ========== 校验和模式 ==========
+enum ChecksumMode : uint8_t {
+    CHECKSUM_INTERNET = 0,  // 16位反码和（默认）
+    CHECKSUM_CRC32C = 1,    // CRC32C，折叠为16位存入checksum字段
+};
+
+// ========== 反码和 ==========
+
+// 将累加和折叠为16位：高位进位加回低位
+inline uint16_t ones_complement_fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(sum);
+}
+
+// 标量实现：按本机字节序逐个16位字累加，奇数尾字节作为低8位加入
+inline uint64_t ones_complement_sum_scalar(const uint8_t* p, size_t len) {
+    uint64_t sum = 0;
+    while (len > 1) {
+        uint16_t word;
+        memcpy(&word, p, 2);  // 允许非对齐地址
+        sum += word;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        sum += *p;
+    }
+    return sum;
+}
+
+#ifdef CHECKSUM_X86
+// SSE2：每次处理16字节，把8个16位字拆成低半字和高半字累加到4个32位通道
+CHECKSUM_TARGET("sse2")
+inline uint64_t ones_complement_sum_sse2(const uint8_t* p, size_t len) {
+    const __m128i low_mask = _mm_set1_epi32(0xFFFF);
+    uint64_t sum = 0;
+    while (len >= 16) {
+        // 每个32位通道每轮最多加2 * 0xFFFF，32768轮之内不会溢出
+        size_t blocks = (std::min)(len / 16, (size_t)32768);
+        __m128i acc = _mm_setzero_si128();
+        for (size_t i = 0; i < blocks; i++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            acc = _mm_add_epi32(acc, _mm_and_si128(v, low_mask));
+            acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+            p += 16;
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        len -= blocks * 16;
+    }
+    return sum + ones_complement_sum_scalar(p, len);
+}
+
+// AVX2：每次处理32字节，原理同SSE2
+CHECKSUM_TARGET("avx2")
+inline uint64_t ones_complement_sum_avx2(const uint8_t* p, size_t len) {
+    const __m256i low_mask = _mm256_set1_epi32(0xFFFF);
+    uint64_t sum = 0;
+    while (len >= 32) {
+        size_t blocks = (std::min)(len / 32, (size_t)32768);
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t i = 0; i < blocks; i++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(v, low_mask));
+            acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+            p += 32;
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+        len -= blocks * 32;
+    }
+    return sum + ones_complement_sum_scalar(p, len);
+}
+#endif
+
+#ifdef CHECKSUM_NEON
+// NEON：vpadalq_u16把相邻两个16位字相加后累加到32位通道
+inline uint64_t ones_complement_sum_neon(const uint8_t* p, size_t len) {
+    uint64_t sum = 0;
+    while (len >= 16) {
+        size_t blocks = (std::min)(len / 16, (size_t)32768);
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (size_t i = 0; i < blocks; i++) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(p)));
+            p += 16;
+        }
+        sum += vgetq_lane_u32(acc, 0) + (uint64_t)vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+        len -= blocks * 16;
+    }
+    return sum + ones_complement_sum_scalar(p, len);
+}
+#endif
+
+// ========== CPU特性检测 ==========
+#ifdef CHECKSUM_X86
+inline bool cpu_has_avx2() {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6) {
+        return false;  // 操作系统没有启用YMM寄存器状态保存
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline bool cpu_has_sse42() {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+typedef uint64_t (*OnesComplementSumFn)(const uint8_t*, size_t);
+
+// 运行时选择反码和实现，只在第一次调用时检测一次
+inline OnesComplementSumFn select_ones_complement_sum() {
+#if defined(CHECKSUM_X86)
+    if (cpu_has_avx2()) {
+        return ones_complement_sum_avx2;
+    }
+    return ones_complement_sum_sse2;
+#elif defined(CHECKSUM_NEON)
+    return ones_complement_sum_neon;
+#else
+    return ones_complement_sum_scalar;
+#endif
+}
+
+/*
+ ones_complement_sum - 计算字节序列的16位反码累加和（未折叠、未取反）
+ 多段数据的累加和可以直接相加，再用ones_complement_fold折叠
+ */
+inline uint64_t ones_complement_sum(const void* data, size_t len) {
+    static const OnesComplementSumFn fn = select_ones_complement_sum();
+    return fn(static_cast<const uint8_t*>(data), len);
+}
+
+// ========== CRC32C ==========
+
+// 查表实现（Castagnoli多项式，反射形式0x82F63B78）
+inline uint32_t crc32c_software(uint32_t crc, const uint8_t* p, size_t len) {
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    for (size_t i = 0; i < len; i++) {
+        crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CHECKSUM_X86
+// SSE4.2 crc32指令：64位进程每次处理8字节
+CHECKSUM_TARGET("sse4.2")
+inline uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+#if defined(_M_X64) || defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+    return crc;
+}
+#endif
+
+#ifdef CHECKSUM_ARM_CRC32
+inline uint32_t crc32c_arm(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+    return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFn)(uint32_t, const uint8_t*, size_t);
+
+inline Crc32cFn select_crc32c() {
+#if defined(CHECKSUM_X86)
+    if (cpu_has_sse42()) {
+        return crc32c_sse42;
+    }
+#elif defined(CHECKSUM_ARM_CRC32)
+    return crc32c_arm;
+#endif
+    return crc32c_software;
+}
+
+/*
+ crc32c_update - 在已有的CRC32C上继续处理一段数据
+ crc为内部状态（初值0xFFFFFFFF，最终结果需取反），便于分段计算
+ */
+inline uint32_t crc32c_update(uint32_t crc, const void* data, size_t len) {
+    static const Crc32cFn fn = select_crc32c();
+    return fn(crc, static_cast<const uint8_t*>(data), len);
+}
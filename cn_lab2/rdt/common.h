@@ -0,0 +1,307 @@
+﻿/*
+ common.h - 公共头文件
+ 定义了客户端和服务器端共同使用的协议常量、数据结构和工具函数
+ 实现了基于UDP的可靠数据传输协议的基础组件
+ 文件传输的客户端、服务器、测试台和多连接消息传输（rdt_transport.h）共用这一份，协议常量只在这里定义
+ */
+
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <cstddef>
+#include "checksum.h"
+
+// Windows套接字相关头文件
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")  // 链接Winsock库
+#else
+// POSIX套接字：补齐Winsock的类型和函数名，其余代码两边通用
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int SOCKET;
+const SOCKET INVALID_SOCKET = -1;
+const int SOCKET_ERROR = -1;
+inline int closesocket(SOCKET s) { return close(s); }
+#endif
+
+// ========== 协议常量定义 ==========
+const int SERVER_PORT = 8888;  // 服务器真实监听端口
+const int ROUTER_PORT = 12345; // Router模拟器端口（客户端连接此端口进行测试）
+const int IP_UDP_HEADER_SIZE = 28;  // IPv4头部20字节 + UDP头部8字节
+const int MAX_BUFFER_SIZE = 9000 - IP_UDP_HEADER_SIZE; // 最大数据报（UDP载荷）：9000字节巨帧减去IP/UDP头部，也是收发缓冲区的大小
+const int HEADER_SIZE = 16;    // 数据包头部大小（字节），即offsetof(Packet, data)
+const int MAX_DATA_SIZE = MAX_BUFFER_SIZE - HEADER_SIZE;  // 数据载荷上限：8956字节，实际的分段大小在握手时协商
+const int DEFAULT_SEGMENT_SIZE = 1500 - IP_UDP_HEADER_SIZE - HEADER_SIZE;  // 以太网MTU下不分片的分段大小：1456字节，无法探测时使用
+const int MIN_SEGMENT_SIZE = 576 - IP_UDP_HEADER_SIZE - HEADER_SIZE;       // 分段大小下限：IPv4要求所有链路都能通过576字节的数据报
+const int FLOW_CONTROL_WINDOW_SIZE = 64; // 初始流量控制窗口（数据包数），收到接收方通告的窗口之前使用
+const int MAX_SEND_WINDOW_SIZE = 16384;  // 发送窗口上限（数据包数），决定发送窗口环形缓冲区的容量
+const int RECEIVE_WINDOW_SIZE = 16384;   // 接收窗口（数据包数）：接收方只接受期望序列号之后这么多个包
+const int MAX_WINDOW_SCALE = 14;         // 窗口缩放因子上限（与TCP相同）
+const int MAX_STREAMS = 16;              // 条带传输最多的流数
+const int PACKET_TIMEOUT_MS = 1000; // 数据包超时重传时间（毫秒），1秒适合大文件传输
+
+// ========== 数据包标志位定义 ==========
+// 使用位移操作定义标志位，方便进行按位或操作组合多个标志
+enum Flags {
+    SYN = 1 << 0, // 同步标志 (值=1)，用于建立连接
+    ACK = 1 << 1, // 确认标志 (值=2)，用于确认收到数据
+    FIN = 1 << 2, // 结束标志 (值=4)，用于关闭连接
+    JOIN = 1 << 3, // 加入标志 (值=8)，条带传输的附加流加入已建立的连接
+    COMPRESS = 1 << 4, // 压缩标志 (值=16)，SYN中请求压缩传输，SYN-ACK中表示接收方同意
+    BLOCK_START = 1 << 5, // 块起始标志 (值=32)，压缩传输中标记携带块头的数据包
+    PARITY = 1 << 6, // 校验标志 (值=64)，SYN中请求FEC，SYN-ACK中表示接收方同意；数据阶段标记校验包
+    PROBE = 1 << 7, // 探测标志 (值=128)，路径MTU探测包及其回复
+};
+
+// ========== 分段大小与路径MTU探测 ==========
+// 分段大小（数据包载荷长度）在握手中协商：每个流中除最后一个数据包外载荷都是这么长，文件偏移也按它计算
+// 握手之前客户端在设置了DF位的套接字上同时发送几种常见MTU对应的PROBE包（PLPMTUD），
+// 服务器对每个PROBE回复PROBE|ACK，ack_num为收到的载荷长度；客户端取得到回复的最大尺寸，之后的数据报不会被分片
+
+// ========== 选择确认(SACK)定义 ==========
+// ACK包的数据载荷携带若干SACK块，data_len = 块数 * sizeof(SackBlock)
+// 每个块描述ack_num之后一段已经收到的连续序列号区间
+const int MAX_SACK_BLOCKS = 32; // 单个ACK最多携带的SACK块数
+
+// ========== 流量控制定义 ==========
+// window_size字段以字节为单位，实际窗口 = window_size << 窗口缩放因子
+// 缩放因子在握手时协商：SYN携带发送方能接受的最大缩放因子，SYN-ACK携带接收方选定的缩放因子
+
+// ========== 条带传输定义 ==========
+// 文件按数据包切分为stream_count个条带：第i个流负责第i*stripe_packets个数据包起的stripe_packets个数据包，
+// 每个流的序列号都从1开始，第i个流序列号为seq的数据包位于文件偏移 (i * stripe_packets + seq - 1) * 分段大小
+// 只有0号流进行三次握手；其余的流在各自的套接字上发送带连接ID的JOIN，收到JOIN-ACK后开始发送
+// 每个流的数据包、ACK和FIN都在stream_id字段中标明所属的流
+
+// ========== 断点续传定义 ==========
+// SYN携带由文件名、大小和首尾内容算出的传输ID；接收方按传输ID保存接收进度
+// 有进度可以续传时，SYN-ACK的握手选项之后跟随stream_count个uint32_t，依次为每个流的起始序列号，
+// 发送方从这个序列号开始发送；起始序列号之后已经收到的数据包由之后ACK中的SACK块报告
+
+// ========== 压缩传输定义 ==========
+// 协商压缩后，每个流把自己负责的文件区间按COMPRESS_BLOCK_SIZE切块压缩，数据包载荷变为一串压缩块：
+// 每个块以CompressedBlockHeader开头，连同压缩数据占用若干个连续序列号，只有最后一个数据包不满
+// 块的第一个数据包带BLOCK_START标志；块头记录原始偏移，接收方凑齐一个块就解压并写到该偏移，与其他块的到达顺序无关
+// 压缩传输不支持断点续传（序列号与文件偏移不再对应），发送方此时传输ID为0
+const int COMPRESS_BLOCK_SIZE = 64 * 1024; // 压缩块的原始大小（字节）
+
+enum CompressMethod {
+    COMPRESS_STORED = 0, // 不可压缩的块原样发送
+    COMPRESS_LZ = 1,     // LZ4块格式（lz_block.h）
+};
+
+// ========== 前向纠错(FEC)定义 ==========
+// 协商FEC后，每个流的数据包按发送顺序分成校验组，每组发完后发送一个校验包（fec.h）
+// 数据包的ack_num为所在校验组的第一个序列号；校验包的seq_num为组内第一个序列号，ack_num为组内数据包数
+// 校验包不占用序列号、不进入发送窗口，丢失也不重传；组内只缺一个数据包时接收方直接恢复它
+
+// ========== 延迟确认定义 ==========
+// 按序到达的数据包每DELAYED_ACK_SEGMENTS个合并为一个累计ACK，或在第一个未确认的数据包到达DELAYED_ACK_TIMEOUT_MS后确认
+// 乱序、重复和填补空洞的数据包立即确认，发送方仍然能看到重复ACK
+const int DELAYED_ACK_SEGMENTS = 8;    // 累计这么多个按序数据包后确认
+const int DELAYED_ACK_TIMEOUT_MS = 5;  // 延迟确认的最长等待时间（毫秒）
+
+// ========== 批量传输定义 ==========
+// 一批文件按单个文件的方式在一个连接中发送：发送的字节流是清单加上依次相接的各个文件内容，文件之间不对齐，小文件共用数据包
+// 清单 = BatchHeader + file_count个（BatchEntry + 文件名）；接收方收齐整个字节流后按清单拆分成独立的文件
+// SYN中的batch_files不为0表示批量传输，文件名和大小是整个字节流的
+const uint32_t BATCH_MAGIC = 0x48435442;  // "BTCH"
+const uint32_t MAX_BATCH_FILES = 1 << 20; // 一批最多的文件数
+
+// 接收方核对文件的结果，由FIN-ACK带回
+enum FinStatus {
+    FIN_VERIFIED = 0,    // 文件与发送方的CRC32C一致
+    FIN_UNVERIFIED = 1,  // 没有核对（文件大小或CRC32C未知）
+    FIN_CORRUPT = 2,     // 不一致或写入失败，接收方已丢弃进度，需要重新上传
+};
+
+// ========== 数据包结构定义 ==========
+
+#pragma pack(push, 1)//确保结构体按1字节对齐，避免编译器自动填充字节
+struct Packet {
+    uint32_t seq_num;     // 序列号：标识数据包的顺序，从1开始
+    uint32_t ack_num;     // 确认号：期望接收的下一个序列号
+    uint8_t flags;        // 标志位：SYN/ACK/FIN/JOIN的组合
+    uint8_t stream_id;    // 流编号：条带传输时数据包所属的流，不使用条带传输时为0
+    uint16_t window_size; // 窗口大小：用于流量控制
+    uint16_t data_len;    // 数据长度：实际数据载荷的字节数
+    uint16_t checksum;    // 校验和：用于差错检测
+    char data[MAX_DATA_SIZE];  // 数据载荷：data_len字节，线路上只发送头部和这部分
+};
+
+// 握手选项：SYN和SYN-ACK的数据载荷
+struct HandshakeOptions {
+    uint8_t window_scale;  // 窗口缩放因子
+    uint8_t checksum_mode; // 校验和模式（ChecksumMode）：SYN中为请求的模式，SYN-ACK中为接收方采用的模式
+    uint32_t connection_id; // 连接ID：客户端随机选取，SYN-ACK原样带回；服务器据此区分同一地址上的新旧连接
+    uint8_t stream_count;   // 流数：SYN中为请求的流数，SYN-ACK中为接收方接受的流数，0表示接收方拒绝连接
+    uint32_t stripe_packets; // 每个流负责的数据包数（stream_count为1时不使用）
+    uint64_t transfer_id;    // 传输ID：同一个文件的每次上传都相同，0表示不续传
+    uint16_t segment_size;   // 分段大小：SYN中为探测得到的大小，SYN-ACK中为接收方接受的大小
+    uint64_t file_size;      // 文件大小（只在SYN中）：接收方据此预分配输出文件，收齐最后一个字节即可结束；0表示未知
+    uint8_t name_length;     // 文件名（不含目录）的字节数，SYN中文件名紧跟在握手选项之后
+    uint32_t batch_files;    // 批量传输的文件数（只在SYN中），0表示发送的是单个文件
+};
+
+// FIN的数据载荷：发送方在后台算出的整个文件的CRC32C，接收方收齐文件并收到它后读回文件核对；没有载荷的FIN不核对
+struct FinOptions {
+    uint32_t file_crc;
+};
+
+// FIN-ACK的数据载荷：接收方核对整个文件的结果（FinStatus）；没有载荷的FIN-ACK来自不核对文件的接收方
+// 所有流都结束、核对完成之前，接收方对FIN只应答ack_num为FIN序列号加1、不带FIN标志的ACK，发送方继续重发FIN等待结果
+struct FinAckOptions {
+    uint8_t status;
+};
+
+// 批量传输的清单头：字节流的开头
+struct BatchHeader {
+    uint32_t magic;       // BATCH_MAGIC
+    uint32_t file_count;  // 之后的BatchEntry个数
+};
+
+// 清单中的一个文件，后面紧跟name_length字节的文件名（不含目录）
+struct BatchEntry {
+    uint64_t size;         // 文件大小
+    uint16_t name_length;
+};
+
+// 压缩块头：压缩块中第一个数据包的载荷开头
+struct CompressedBlockHeader {
+    uint64_t raw_offset;     // 块在文件中的偏移
+    uint32_t raw_length;     // 原始长度
+    uint32_t stored_length;  // 块头之后的数据长度
+    uint8_t method;          // CompressMethod
+};
+
+struct SackBlock {
+    uint32_t left;   // 区间起始序列号（含）
+    uint32_t right;  // 区间结束序列号（不含）
+};
+#pragma pack(pop)  // 恢复默认对齐方式
+
+static_assert(offsetof(Packet, data) == HEADER_SIZE, "HEADER_SIZE must match the packet header");
+
+
+// ========== 工具函数 ==========
+
+/*
+ checksum_payload - 计算数据载荷部分的校验和中间值
+ 载荷不变的数据包（例如重传）可以缓存这个值，之后只需重新处理头部，不必再累加1480字节
+ @param data 载荷
+ @param len 载荷长度
+ @param mode 校验和模式
+ @return 中间值：Internet模式为折叠后的16位反码和，CRC32C模式为CRC内部状态
+ */
+inline uint32_t checksum_payload(const char* data, size_t len, ChecksumMode mode) {
+    if (mode == CHECKSUM_CRC32C) {
+        return crc32c_update(0xFFFFFFFF, data, len);
+    }
+    return ones_complement_fold(ones_complement_sum(data, len));
+}
+
+/*
+ checksum_with_payload - 由载荷中间值和头部计算数据包校验和
+ 头部只处理checksum字段之前的字段，直接跳过checksum字段本身，不需要修改输入
+ CRC32C模式先处理载荷再处理头部，因此载荷部分可以缓存；32位结果折叠为16位
+ @param packet 数据包（只读取头部）
+ @param payload_partial checksum_payload的返回值
+ @param mode 校验和模式
+ @return 16位校验和
+ */
+inline uint16_t checksum_with_payload(const Packet* packet, uint32_t payload_partial, ChecksumMode mode) {
+    const size_t covered_header = offsetof(Packet, checksum);
+    if (mode == CHECKSUM_CRC32C) {
+        uint32_t crc = ~crc32c_update(payload_partial, packet, covered_header);
+        return static_cast<uint16_t>((crc >> 16) ^ (crc & 0xFFFF));
+    }
+    uint64_t sum = payload_partial + ones_complement_sum(packet, covered_header);
+    return static_cast<uint16_t>(~ones_complement_fold(sum));
+}
+
+/*
+ calculate_checksum - 计算数据包校验和
+ 功能：对头部（不含checksum字段）和数据载荷计算校验和，用于差错检测
+ 默认算法：按16位字累加，然后对进位进行折叠，最后取反；累加部分使用向量化实现
+ @param packet 指向待计算校验和的数据包
+ @param mode 校验和模式，默认为Internet校验和
+ @return 计算得到的16位校验和
+ */
+inline uint16_t calculate_checksum(const Packet* packet, ChecksumMode mode = CHECKSUM_INTERNET) {
+    return checksum_with_payload(packet, checksum_payload(packet->data, packet->data_len, mode), mode);
+}
+
+/*
+ verify_checksum - 验证数据包校验和
+ @param packet 指向待验证的数据包
+ @param mode 校验和模式，默认为Internet校验和
+ @return true表示校验和正确，false表示数据包损坏
+ */
+inline bool verify_checksum(const Packet* packet, ChecksumMode mode = CHECKSUM_INTERNET) {
+    if (packet->data_len > MAX_DATA_SIZE) {
+        return false;  // 长度字段已损坏，不能按它读取载荷
+    }
+    return calculate_checksum(packet, mode) == packet->checksum;
+}
+
+/*
+ choose_window_scale - 选择窗口缩放因子
+ 取能让整个接收窗口（字节）装进16位window_size字段的最小移位数，不超过对方能接受的上限
+ @param offered_scale 对方SYN中给出的最大缩放因子，对方不支持缩放时为0
+ @param segment_size 协商的分段大小
+ @param window_packets 接收窗口（数据包数）
+ */
+inline uint8_t choose_window_scale(uint8_t offered_scale, uint16_t segment_size, uint32_t window_packets = RECEIVE_WINDOW_SIZE) {
+    uint64_t window_bytes = (uint64_t)window_packets * segment_size;
+    uint8_t scale = 0;
+    while ((window_bytes >> scale) > 0xFFFF && scale < MAX_WINDOW_SCALE) {
+        scale++;
+    }
+    return scale < offered_scale ? scale : offered_scale;
+}
+
+/*
+ advertised_window - 计算ACK中通告的window_size字段
+ @param free_segments 接收方还能接受的数据包数
+ @param segment_size 协商的分段大小
+ @param window_scale 协商好的缩放因子
+ */
+inline uint16_t advertised_window(uint32_t free_segments, uint16_t segment_size, uint8_t window_scale) {
+    uint64_t window = ((uint64_t)free_segments * segment_size) >> window_scale;
+    return (uint16_t)(window < 0xFFFF ? window : 0xFFFF);
+}
+
+/*
+ initialize_winsock - 初始化Windows套接字库
+ Windows平台使用Socket前必须调用此函数初始化Winsock
+ @return true表示初始化成功，false表示失败
+ */
+inline bool initialize_winsock() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        std::cerr << "WSAStartup failed." << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+/*
+ cleanup_winsock - 清理Windows套接字库
+ 程序结束时调用，释放Winsock资源
+ */
+inline void cleanup_winsock() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,424 @@
+﻿/*
+ congestion.h - 可插拔的拥塞控制
+ CongestionController定义ACK、丢包、超时三类事件的回调，发送端只通过该接口读写拥塞窗口
+ 内置三种算法：
+ 1. Reno：慢启动、拥塞避免、快速恢复
+ 2. CUBIC：拥塞避免阶段按时间的三次函数增长窗口（RFC 8312）
+ 3. BBR：根据瓶颈带宽和最小RTT的估计值计算窗口，不把丢包当作拥塞信号
+ 控制器同时给出发送速率，发送端据此平滑发送（见pacer.h）
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+// ========== 拥塞控制常量 ==========
+const double CUBIC_C = 0.4;       // CUBIC三次函数缩放常数
+const double CUBIC_BETA = 0.7;    // CUBIC乘性减小因子
+const double PACING_SLOW_START_GAIN = 2.0;  // 慢启动阶段的速率增益：cwnd每个RTT翻倍，速率要跟得上
+const double PACING_AVOIDANCE_GAIN = 1.2;   // 拥塞避免阶段的速率增益，略高于cwnd/SRTT以免限制窗口增长
+const int BBR_BW_FILTER_ROUNDS = 10;      // BBR瓶颈带宽最大值滤波的轮数
+const int BBR_MIN_RTT_WINDOW_S = 10;      // BBR最小RTT的有效期（秒）
+const int BBR_PROBE_RTT_DURATION_MS = 200;  // BBR排空队列测量RTT的持续时间
+const double BBR_HIGH_GAIN = 2.885;       // 2/ln2，启动阶段每轮带宽翻倍
+const double BBR_CWND_GAIN = 2.0;         // 稳态窗口增益
+const double BBR_MIN_CWND = 4.0;          // 最小窗口，也是PROBE_RTT阶段的窗口
+const int BBR_PROBE_BW_CYCLE = 8;
+const double BBR_PROBE_BW_GAINS[BBR_PROBE_BW_CYCLE] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };  // 带宽探测的增益循环
+
+// ========== 拥塞控制状态定义 ==========
+enum CongestionState {
+    SLOW_START,           // 慢启动：指数增长cwnd
+    CONGESTION_AVOIDANCE, // 拥塞避免：线性增长cwnd
+    FAST_RECOVERY         // 快速恢复：收到3个重复ACK后进入
+};
+
+/*
+ AckEvent - 一次新ACK（推进了窗口基序号）携带给拥塞控制器的信息
+ */
+struct AckEvent {
+    std::chrono::steady_clock::time_point now;  // 收到ACK的时间
+    uint32_t newly_acked = 0;    // 本次新确认的数据包数
+    uint32_t in_flight = 0;      // 确认后仍在途的数据包数
+    double rtt_ms = -1;          // 本次RTT样本（毫秒），没有有效样本时为负数
+    double srtt_ms = 0;          // 平滑RTT（毫秒），还没有样本时为0
+    uint64_t delivered = 0;      // 到目前为止累计交付的数据包数
+    uint64_t prior_delivered = 0;  // 被确认的数据包发送时的累计交付数，用于划分往返轮次
+    double delivery_rate = -1;   // 交付速率样本（包/秒），没有有效样本时为负数
+};
+
+/*
+ CongestionController - 拥塞控制器接口
+ 调用者保证每个RTT内最多报告一次on_loss，同一轮超时检测中最多报告一次on_timeout
+ */
+class CongestionController {
+public:
+    virtual ~CongestionController() {}
+
+    virtual const char* name() const = 0;
+    virtual const char* state_name() const = 0;
+
+    // 收到新ACK
+    virtual void on_ack(const AckEvent& ev) = 0;
+    // 收到重复ACK
+    virtual void on_duplicate_ack() {}
+    // 快速重传触发的丢包事件
+    virtual void on_loss(std::chrono::steady_clock::time_point now) = 0;
+    // 超时重传事件
+    virtual void on_timeout(std::chrono::steady_clock::time_point now) = 0;
+
+    virtual double cwnd() const = 0;      // 拥塞窗口（单位：数据包数）
+    virtual double ssthresh() const = 0;  // 慢启动阈值
+
+    /*
+     pacing_rate - 发送速率（数据包/秒）
+     默认按 gain * cwnd / SRTT 计算，慢启动阶段增益更大；还没有RTT样本时返回0，表示不限速
+     @param srtt_ms 平滑RTT（毫秒）
+     */
+    virtual double pacing_rate(double srtt_ms) const {
+        if (srtt_ms <= 0) {
+            return 0;
+        }
+        double gain = cwnd() < ssthresh() ? PACING_SLOW_START_GAIN : PACING_AVOIDANCE_GAIN;
+        return gain * cwnd() / (srtt_ms / 1000.0);
+    }
+};
+
+// ========== TCP RENO ==========
+class RenoController : public CongestionController {
+public:
+    const char* name() const override { return "reno"; }
+    const char* state_name() const override { return reno_state_name(state_); }
+
+    void on_ack(const AckEvent& ev) override {
+        for (uint32_t i = 0; i < ev.newly_acked; i++) {
+            if (state_ == FAST_RECOVERY) {
+                // 快速恢复完成，进入拥塞避免
+                state_ = CONGESTION_AVOIDANCE;
+                cwnd_ = ssthresh_;  // 将窗口收缩到阈值
+                break;
+            }
+            else if (state_ == SLOW_START) {
+                // 慢启动阶段：指数增长
+                cwnd_ += 1;
+                if (cwnd_ >= ssthresh_) {
+                    state_ = CONGESTION_AVOIDANCE;  // 达到阈值，切换到拥塞避免
+                }
+            }
+            else {
+                // 拥塞避免阶段：线性增长（每个RTT增加1个包）
+                cwnd_ += 1.0 / cwnd_;
+            }
+        }
+    }
+
+    void on_duplicate_ack() override {
+        if (state_ == FAST_RECOVERY) {
+            cwnd_ += 1;  // 快速恢复期间，每个重复ACK增加窗口（膨胀窗口）
+        }
+    }
+
+    void on_loss(std::chrono::steady_clock::time_point) override {
+        // 收到3个重复ACK，进入快速恢复
+        state_ = FAST_RECOVERY;
+        ssthresh_ = (std::max)(2.0, cwnd_ / 2.0);  // 阈值设为窗口的一半
+        cwnd_ = ssthresh_ + 3;  // 窗口设为阈值+3
+    }
+
+    void on_timeout(std::chrono::steady_clock::time_point) override {
+        // 超时：进入慢启动，阈值减半
+        state_ = SLOW_START;
+        ssthresh_ = (std::max)(2.0, cwnd_ / 2.0);
+        cwnd_ = 1;
+    }
+
+    double cwnd() const override { return cwnd_; }
+    double ssthresh() const override { return ssthresh_; }
+
+    static const char* reno_state_name(CongestionState state) {
+        switch (state) {
+        case SLOW_START: return "SLOW_START";
+        case CONGESTION_AVOIDANCE: return "CONGESTION_AVOIDANCE";
+        default: return "FAST_RECOVERY";
+        }
+    }
+
+private:
+    double cwnd_ = 1.0;       // 因为线性增长会加1/cwnd所以用double
+    double ssthresh_ = 16;
+    CongestionState state_ = SLOW_START;
+};
+
+// ========== CUBIC ==========
+class CubicController : public CongestionController {
+public:
+    const char* name() const override { return "cubic"; }
+    const char* state_name() const override { return RenoController::reno_state_name(state_); }
+
+    void on_ack(const AckEvent& ev) override {
+        if (state_ == FAST_RECOVERY) {
+            state_ = CONGESTION_AVOIDANCE;  // 恢复结束，窗口已在on_loss中降到beta * W_max
+        }
+        for (uint32_t i = 0; i < ev.newly_acked; i++) {
+            if (state_ == SLOW_START) {
+                cwnd_ += 1;
+                if (cwnd_ >= ssthresh_) {
+                    state_ = CONGESTION_AVOIDANCE;
+                }
+                continue;
+            }
+            if (!epoch_started_) {
+                // 新的拥塞避免周期：以当前窗口和W_max计算到达W_max所需的时间K
+                epoch_started_ = true;
+                epoch_start_ = ev.now;
+                if (cwnd_ < w_max_) {
+                    k_ = std::cbrt((w_max_ - cwnd_) / CUBIC_C);
+                    origin_ = w_max_;
+                }
+                else {
+                    k_ = 0;
+                    origin_ = cwnd_;
+                }
+                w_est_ = cwnd_;
+            }
+            double rtt_s = (ev.srtt_ms > 0 ? ev.srtt_ms : 100.0) / 1000.0;
+            double t = std::chrono::duration<double>(ev.now - epoch_start_).count() + rtt_s;
+            double target = origin_ + CUBIC_C * (t - k_) * (t - k_) * (t - k_);
+
+            // TCP友好区域：不低于同样条件下Reno能达到的窗口
+            w_est_ += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) / cwnd_;
+            target = (std::max)(target, w_est_);
+
+            if (target > cwnd_) {
+                cwnd_ += (target - cwnd_) / cwnd_;
+            }
+            else {
+                cwnd_ += 0.01 / cwnd_;  // 平台区：几乎不增长
+            }
+        }
+    }
+
+    void on_loss(std::chrono::steady_clock::time_point) override {
+        reduce();
+        state_ = FAST_RECOVERY;
+        cwnd_ = ssthresh_;
+    }
+
+    void on_timeout(std::chrono::steady_clock::time_point) override {
+        reduce();
+        state_ = SLOW_START;
+        cwnd_ = 1;
+    }
+
+    double cwnd() const override { return cwnd_; }
+    double ssthresh() const override { return ssthresh_; }
+
+private:
+    // 丢包时记录W_max（快速收敛：连续两次丢包时W_max还在下降，让出更多带宽），阈值降为beta倍
+    void reduce() {
+        if (cwnd_ < w_max_) {
+            w_max_ = cwnd_ * (1 + CUBIC_BETA) / 2;
+        }
+        else {
+            w_max_ = cwnd_;
+        }
+        ssthresh_ = (std::max)(2.0, cwnd_ * CUBIC_BETA);
+        epoch_started_ = false;
+    }
+
+    double cwnd_ = 1.0;
+    double ssthresh_ = 16;
+    CongestionState state_ = SLOW_START;
+    double w_max_ = 0;       // 上次丢包时的窗口
+    double k_ = 0;           // 从周期开始增长回W_max所需的时间（秒）
+    double origin_ = 0;      // 三次函数的平台点
+    double w_est_ = 0;       // 按Reno方式估计的窗口
+    bool epoch_started_ = false;
+    std::chrono::steady_clock::time_point epoch_start_;
+};
+
+// ========== BBR ==========
+class BbrController : public CongestionController {
+public:
+    const char* name() const override { return "bbr"; }
+    const char* state_name() const override {
+        switch (mode_) {
+        case STARTUP: return "STARTUP";
+        case DRAIN: return "DRAIN";
+        case PROBE_BW: return "PROBE_BW";
+        default: return "PROBE_RTT";
+        }
+    }
+
+    void on_ack(const AckEvent& ev) override {
+        // === 往返轮次：被确认的包是在上一轮开始之后发出的，说明过去了一个RTT ===
+        bool round_start = false;
+        if (ev.prior_delivered >= next_round_delivered_) {
+            next_round_delivered_ = ev.delivered;
+            round_count_++;
+            round_start = true;
+            bw_samples_[round_count_ % BBR_BW_FILTER_ROUNDS] = 0;
+        }
+
+        // === 更新模型：最近若干轮的最大交付速率，最近若干秒的最小RTT ===
+        if (ev.delivery_rate > 0) {
+            double& slot = bw_samples_[round_count_ % BBR_BW_FILTER_ROUNDS];
+            slot = (std::max)(slot, ev.delivery_rate);
+        }
+        bool min_rtt_expired = has_min_rtt_ && ev.now - min_rtt_stamp_ > std::chrono::seconds(BBR_MIN_RTT_WINDOW_S);
+        if (ev.rtt_ms > 0 && (!has_min_rtt_ || ev.rtt_ms <= min_rtt_ms_ || min_rtt_expired)) {
+            min_rtt_ms_ = ev.rtt_ms;
+            min_rtt_stamp_ = ev.now;
+            has_min_rtt_ = true;
+            min_rtt_expired = false;
+        }
+
+        update_mode(ev, round_start, min_rtt_expired);
+
+        // === 窗口：向 cwnd_gain * BDP 靠拢，管道未满时按慢启动方式增长 ===
+        double target = target_cwnd();
+        if (mode_ == PROBE_RTT) {
+            cwnd_ = BBR_MIN_CWND;
+        }
+        else if (filled_pipe_ && target > 0) {
+            cwnd_ = (std::min)(cwnd_ + ev.newly_acked, target);
+        }
+        else {
+            cwnd_ += ev.newly_acked;
+        }
+        cwnd_ = (std::max)(cwnd_, BBR_MIN_CWND);
+    }
+
+    // BBR不把快速重传当作拥塞信号，窗口由模型决定
+    void on_loss(std::chrono::steady_clock::time_point) override {}
+
+    void on_timeout(std::chrono::steady_clock::time_point) override {
+        cwnd_ = 1;  // 超时后包守恒：窗口从1重新增长到模型给出的目标值
+    }
+
+    double cwnd() const override { return cwnd_; }
+    // BBR不使用慢启动阈值，这里返回模型估计的目标窗口
+    double ssthresh() const override { return target_cwnd(); }
+
+    double btl_bw() const {
+        double bw = 0;
+        for (double sample : bw_samples_) {
+            bw = (std::max)(bw, sample);
+        }
+        return bw;
+    }
+    double min_rtt_ms() const { return min_rtt_ms_; }
+    double pacing_gain() const { return mode_ == PROBE_BW ? BBR_PROBE_BW_GAINS[cycle_index_] : (mode_ == DRAIN ? 1 / BBR_HIGH_GAIN : (mode_ == PROBE_RTT ? 1.0 : BBR_HIGH_GAIN)); }
+
+    // BBR按 pacing_gain * 瓶颈带宽 发送；还没有带宽样本时按启动增益和 cwnd / SRTT 估计
+    double pacing_rate(double srtt_ms) const override {
+        double bw = btl_bw();
+        if (bw > 0) {
+            return pacing_gain() * bw;
+        }
+        return srtt_ms > 0 ? BBR_HIGH_GAIN * cwnd_ / (srtt_ms / 1000.0) : 0;
+    }
+
+private:
+    enum Mode { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+    double bdp() const {
+        return btl_bw() * min_rtt_ms_ / 1000.0;
+    }
+
+    double target_cwnd() const {
+        if (!has_min_rtt_ || btl_bw() <= 0) {
+            return 0;
+        }
+        double gain = (mode_ == STARTUP || mode_ == DRAIN) ? BBR_HIGH_GAIN : BBR_CWND_GAIN;
+        return (std::max)(BBR_MIN_CWND, gain * bdp());
+    }
+
+    void update_mode(const AckEvent& ev, bool round_start, bool min_rtt_expired) {
+        // 启动阶段：连续3轮带宽增长不到25%，认为管道已满
+        if (!filled_pipe_ && round_start) {
+            double bw = btl_bw();
+            if (bw >= full_bw_ * 1.25) {
+                full_bw_ = bw;
+                full_bw_rounds_ = 0;
+            }
+            else if (++full_bw_rounds_ >= 3) {
+                filled_pipe_ = true;
+            }
+        }
+        if (mode_ == STARTUP && filled_pipe_) {
+            mode_ = DRAIN;
+        }
+        if (mode_ == DRAIN && ev.in_flight <= bdp()) {
+            enter_probe_bw(ev.now);
+        }
+
+        // 带宽探测阶段：每个最小RTT切换一次增益
+        if (mode_ == PROBE_BW && ev.now - cycle_stamp_ > std::chrono::duration<double, std::milli>(min_rtt_ms_)) {
+            cycle_index_ = (cycle_index_ + 1) % BBR_PROBE_BW_CYCLE;
+            cycle_stamp_ = ev.now;
+        }
+
+        // 最小RTT过期：短暂把窗口降到4个包，排空队列以重新测量
+        if (min_rtt_expired && mode_ != PROBE_RTT) {
+            mode_ = PROBE_RTT;
+            prior_cwnd_ = cwnd_;
+            probe_rtt_done_ = ev.now + std::chrono::milliseconds(BBR_PROBE_RTT_DURATION_MS);
+            min_rtt_stamp_ = ev.now;
+        }
+        if (mode_ == PROBE_RTT && ev.now >= probe_rtt_done_) {
+            cwnd_ = (std::max)(cwnd_, prior_cwnd_);
+            if (filled_pipe_) {
+                enter_probe_bw(ev.now);
+            }
+            else {
+                mode_ = STARTUP;
+            }
+        }
+    }
+
+    void enter_probe_bw(std::chrono::steady_clock::time_point now) {
+        mode_ = PROBE_BW;
+        cycle_index_ = 0;
+        cycle_stamp_ = now;
+    }
+
+    Mode mode_ = STARTUP;
+    double cwnd_ = BBR_MIN_CWND;
+    double bw_samples_[BBR_BW_FILTER_ROUNDS] = {};  // 每轮的最大交付速率（包/秒）
+    uint64_t round_count_ = 0;
+    uint64_t next_round_delivered_ = 0;
+    double min_rtt_ms_ = 0;
+    bool has_min_rtt_ = false;
+    std::chrono::steady_clock::time_point min_rtt_stamp_;
+    bool filled_pipe_ = false;
+    double full_bw_ = 0;
+    int full_bw_rounds_ = 0;
+    int cycle_index_ = 0;
+    std::chrono::steady_clock::time_point cycle_stamp_;
+    std::chrono::steady_clock::time_point probe_rtt_done_;
+    double prior_cwnd_ = 0;
+};
+
+/*
+ create_congestion_controller - 按名字创建拥塞控制器
+ @param name "reno"、"cubic"或"bbr"
+ @return 控制器，名字无法识别时返回nullptr
+ */
+inline std::unique_ptr<CongestionController> create_congestion_controller(const char* name) {
+    if (strcmp(name, "reno") == 0) {
+        return std::unique_ptr<CongestionController>(new RenoController());
+    }
+    if (strcmp(name, "cubic") == 0) {
+        return std::unique_ptr<CongestionController>(new CubicController());
+    }
+    if (strcmp(name, "bbr") == 0) {
+        return std::unique_ptr<CongestionController>(new BbrController());
+    }
+    return nullptr;
+}
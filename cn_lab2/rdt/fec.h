@@ -0,0 +1,73 @@
+﻿/*
+ fec.h - 前向纠错（FEC）的异或校验
+ 发送方把每个流中连续的一组数据包（校验组）的载荷按字节异或，组发完后多发一个校验包；
+ 接收方同样累加收到的数据包和校验包，组内恰好缺一个数据包时，累加结果就是缺的那个包，无需等待重传
+ 载荷长度不同时短的载荷补零后异或，长度和标志位另外异或，恢复出的包长度、块起始标志都与原包相同
+ */
+
+#pragma once
+
+#include "common.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// ========== FEC常量 ==========
+const uint32_t FEC_MIN_GROUP = 2;     // 校验组最少的数据包数（冗余度50%）
+const uint32_t FEC_MAX_GROUP = 64;    // 校验组最多的数据包数
+const double FEC_LOSSES_PER_GROUP = 0.5;  // 自适应时让每组平均丢失约这么多个包：单个校验包只能恢复一个
+
+/*
+ ParityAccumulator - 一个校验组的异或累加
+ 发送方累加组内的数据包得到校验包，接收方累加收到的数据包和校验包
+ */
+struct ParityAccumulator {
+    uint32_t first_seq = 0;   // 组内第一个数据包的序列号
+    uint32_t count = 0;       // 已累加的数据包数（不含校验包）
+    uint16_t max_len = 0;     // 已累加的最长载荷
+    uint16_t len_xor = 0;     // 载荷长度的异或
+    uint8_t flags_xor = 0;    // 标志位的异或（不含PARITY）
+    char data[MAX_DATA_SIZE];
+
+    ParityAccumulator() { reset(0); }
+
+    void reset(uint32_t first) {
+        first_seq = first;
+        count = 0;
+        max_len = 0;
+        len_xor = 0;
+        flags_xor = 0;
+        memset(data, 0, sizeof(data));
+    }
+
+    /*
+     add - 累加一个载荷
+     @param payload 载荷
+     @param len 载荷长度
+     @param len_tag 参与长度异或的值：数据包为len，校验包为其中记录的长度异或
+     @param flags 参与标志异或的值
+     */
+    void add(const char* payload, uint16_t len, uint16_t len_tag, uint8_t flags) {
+        for (uint16_t i = 0; i < len; i++) {
+            data[i] ^= payload[i];
+        }
+        max_len = (std::max)(max_len, len);
+        len_xor ^= len_tag;
+        flags_xor ^= flags;
+    }
+};
+
+/*
+ fill_parity_packet - 由发送方的累加结果构造校验包
+ seq_num为组内第一个序列号，ack_num为组内数据包数，window_size为载荷长度的异或，
+ flags为PARITY加上组内数据包标志位的异或
+ */
+inline void fill_parity_packet(const ParityAccumulator& parity, uint8_t stream_id, Packet& packet) {
+    packet.seq_num = parity.first_seq;
+    packet.ack_num = parity.count;
+    packet.flags = (uint8_t)(PARITY | parity.flags_xor);
+    packet.stream_id = stream_id;
+    packet.window_size = parity.len_xor;
+    packet.data_len = parity.max_len;
+    memcpy(packet.data, parity.data, parity.max_len);
+}
@@ -0,0 +1,302 @@
+﻿/*
+ log.h - 异步分级日志
+ 热路径只把固定长度的二进制记录（格式串指针 + 参数）写入无锁环形缓冲区，不做格式化也不做I/O
+ 后台线程取出记录，格式化后成批写到标准输出，缓冲区为空时才刷新
+ 1. 级别：TRACE（每个数据包）< DEBUG < INFO < WARN < ERROR，运行时用set_level过滤
+ 2. 编译期裁剪：LOG_COMPILE_LEVEL以下级别的宏展开为空，参数也不会被求值
+ 3. 缓冲区满时丢弃记录并计数，日志永远不会阻塞发送或接收
+ 格式串使用"{}"占位，参数支持整数、浮点数和生命周期足够长的字符串（如字符串字面量）
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+// ========== 日志级别 ==========
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+// 编译期最低级别，低于它的日志语句不生成任何代码；发布构建可以定义为LOG_LEVEL_INFO
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+const int LOG_MAX_ARGS = 6;              // 单条记录最多携带的参数个数
+const size_t LOG_RING_CAPACITY = 1 << 16; // 环形缓冲区记录数（2的幂）
+
+inline const char* log_level_name(int level) {
+    static const char* const names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "OFF" };
+    return level >= LOG_LEVEL_TRACE && level <= LOG_LEVEL_OFF ? names[level] : "?";
+}
+
+/*
+ parse_log_level - 解析级别名称（trace/debug/info/warn/error/off）
+ @return 解析成功返回true，结果写入level
+ */
+inline bool parse_log_level(const char* name, int& level) {
+    static const char* const names[] = { "trace", "debug", "info", "warn", "error", "off" };
+    for (int i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_OFF; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 一个日志参数：按类型保存原始值，格式化推迟到后台线程
+struct LogArg {
+    enum Type : uint8_t { UNSIGNED, SIGNED, REAL, STRING } type;
+    union {
+        uint64_t u;
+        int64_t i;
+        double d;
+        const char* s;
+    };
+};
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, LogArg>::type make_log_arg(T value) {
+    LogArg arg;
+    arg.type = LogArg::UNSIGNED;
+    arg.u = value;
+    return arg;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, LogArg>::type make_log_arg(T value) {
+    LogArg arg;
+    arg.type = LogArg::SIGNED;
+    arg.i = value;
+    return arg;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, LogArg>::type make_log_arg(T value) {
+    LogArg arg;
+    arg.type = LogArg::REAL;
+    arg.d = value;
+    return arg;
+}
+
+inline LogArg make_log_arg(const char* value) {
+    LogArg arg;
+    arg.type = LogArg::STRING;
+    arg.s = value;
+    return arg;
+}
+
+/*
+ AsyncLogger - 多生产者单消费者的异步日志
+ 环形缓冲区采用按槽位序号同步的有界队列：生产者用一次CAS抢占位置，写完后发布槽位序号，
+ 消费者只读取序号已经发布的槽位，整个过程没有锁
+ */
+class AsyncLogger {
+public:
+    AsyncLogger() : cells_(new Cell[LOG_RING_CAPACITY]), start_(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < LOG_RING_CAPACITY; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~AsyncLogger() { stop(); }
+
+    // 启动后台输出线程
+    void start(FILE* out = stdout) {
+        if (running_.exchange(true)) {
+            return;
+        }
+        out_ = out;
+        drain_thread_ = std::thread(&AsyncLogger::drain_loop, this);
+    }
+
+    // 输出缓冲区中剩余的记录后停止后台线程；丢弃过记录时报告丢弃数
+    void stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        drain_thread_.join();
+        uint64_t dropped = dropped_.exchange(0);
+        if (dropped > 0) {
+            fprintf(out_, "[log] %llu records dropped (ring buffer full)\n", (unsigned long long)dropped);
+        }
+        fflush(out_);
+    }
+
+    void set_level(int level) { level_.store(level, std::memory_order_relaxed); }
+    int level() const { return level_.load(std::memory_order_relaxed); }
+    bool enabled(int level) const { return level >= level_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    /*
+     log - 记录一条日志（热路径）
+     只复制格式串指针和参数，缓冲区满时直接丢弃
+     */
+    template <typename... Args>
+    void log(int level, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        const LogArg packed[] = { make_log_arg(args)..., LogArg() };
+        push(level, format, packed, sizeof...(Args));
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        uint64_t timestamp_us;
+        const char* format;
+        uint8_t level;
+        uint8_t arg_count;
+        LogArg args[LOG_MAX_ARGS];
+    };
+
+    void push(int level, const char* format, const LogArg* args, size_t arg_count) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & (LOG_RING_CAPACITY - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);  // 缓冲区已满
+                return;
+            }
+            else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->timestamp_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+        cell->format = format;
+        cell->level = (uint8_t)level;
+        cell->arg_count = (uint8_t)arg_count;
+        memcpy(cell->args, args, arg_count * sizeof(LogArg));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    // 取出一条已发布的记录并格式化到line中，没有记录时返回false
+    bool pop(char* line, size_t size, size_t& len) {
+        Cell& cell = cells_[dequeue_pos_ & (LOG_RING_CAPACITY - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+            return false;
+        }
+        len = format_record(cell, line, size);
+        cell.sequence.store(dequeue_pos_ + LOG_RING_CAPACITY, std::memory_order_release);
+        dequeue_pos_++;
+        return true;
+    }
+
+    // 把记录格式化为一行："[秒.微秒] LEVEL 消息\n"
+    static size_t format_record(const Cell& cell, char* line, size_t size) {
+        int n = snprintf(line, size, "[%6llu.%06llu] %-5s ", (unsigned long long)(cell.timestamp_us / 1000000),
+            (unsigned long long)(cell.timestamp_us % 1000000), log_level_name(cell.level));
+        size_t len = n > 0 ? (size_t)n : 0;
+        size_t next_arg = 0;
+        for (const char* p = cell.format; *p != '\0' && len + 1 < size; p++) {
+            if (p[0] == '{' && p[1] == '}' && next_arg < cell.arg_count) {
+                const LogArg& arg = cell.args[next_arg++];
+                switch (arg.type) {
+                case LogArg::UNSIGNED: n = snprintf(line + len, size - len, "%llu", (unsigned long long)arg.u); break;
+                case LogArg::SIGNED: n = snprintf(line + len, size - len, "%lld", (long long)arg.i); break;
+                case LogArg::REAL: n = snprintf(line + len, size - len, "%g", arg.d); break;
+                default: n = snprintf(line + len, size - len, "%s", arg.s != NULL ? arg.s : "(null)"); break;
+                }
+                len += n > 0 ? (std::min)((size_t)n, size - len - 1) : 0;
+                p++;
+            }
+            else {
+                line[len++] = *p;
+            }
+        }
+        line[len++] = '\n';
+        return len;
+    }
+
+    // 后台线程：成批格式化输出，缓冲区为空时刷新并短暂休眠；停止时先排空缓冲区
+    void drain_loop() {
+        char line[512];
+        for (;;) {
+            bool stopping = !running_.load(std::memory_order_acquire);
+            size_t len;
+            size_t count = 0;
+            while (pop(line, sizeof(line) - 1, len)) {
+                fwrite(line, 1, len, out_);
+                count++;
+            }
+            fflush(out_);
+            if (stopping) {
+                break;
+            }
+            if (count == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{ 0 };  // 生产者之间竞争的位置，与消费者的位置分开缓存行
+    alignas(64) size_t dequeue_pos_ = 0;  // 只由后台线程访问
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::atomic<int> level_{ LOG_LEVEL_INFO };
+    std::atomic<bool> running_{ false };
+    std::chrono::steady_clock::time_point start_;
+    FILE* out_ = stdout;
+    std::thread drain_thread_;
+};
+
+// 进程内唯一的日志实例
+inline AsyncLogger& async_logger() {
+    static AsyncLogger instance;
+    return instance;
+}
+
+// ========== 日志宏 ==========
+// 运行时级别不够时不会求值参数
+#define LOG_AT(level, ...) \
+    do { \
+        if (async_logger().enabled(level)) { \
+            async_logger().log(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
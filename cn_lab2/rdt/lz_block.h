@@ -0,0 +1,187 @@
+﻿/*
+ lz_block.h - LZ4块格式的压缩与解压
+ 格式与LZ4块格式相同：每个序列由token、字面量和(偏移, 匹配长度)组成，最后一个序列只有字面量
+ 压缩用4字节哈希表做贪心匹配，速度优先；解压检查所有长度和偏移，损坏的输入只会返回失败
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// ========== LZ常量 ==========
+const int LZ_HASH_BITS = 16;           // 哈希表大小为2^16个位置
+const int LZ_MIN_MATCH = 4;            // 最短匹配长度
+const size_t LZ_LAST_LITERALS = 5;     // 块末尾至少这么多字节必须是字面量（LZ4格式约定）
+const size_t LZ_MATCH_SAFE_END = 12;   // 最后一个匹配必须在距末尾这么多字节之前开始（LZ4格式约定）
+const size_t LZ_MAX_OFFSET = 65535;    // 16位偏移
+
+inline uint32_t lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 写出长度的扩展字节：每个255表示继续
+inline uint8_t* lz_write_length(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// 最坏情况（完全不可压缩）下的压缩输出大小
+inline size_t lz_compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+/*
+ lz_compress - 压缩一块数据
+ @param src 原始数据
+ @param len 原始长度
+ @param dst 输出缓冲区
+ @param capacity 输出缓冲区容量，不小于lz_compress_bound(len)时一定成功
+ @return 压缩后的长度，输出放不下时返回0
+ */
+inline size_t lz_compress(const char* src, size_t len, char* dst, size_t capacity) {
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;  // 还没写出的字面量的起点
+    const uint8_t* end = base + len;
+    uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* oend = op + capacity;
+
+    if (len > LZ_MATCH_SAFE_END) {
+        std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+        const uint8_t* match_start_limit = end - LZ_MATCH_SAFE_END;
+        const uint8_t* match_end_limit = end - LZ_LAST_LITERALS;
+        while (ip < match_start_limit) {
+            uint32_t h = lz_hash(lz_read32(ip));
+            const uint8_t* candidate = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (candidate >= ip || (size_t)(ip - candidate) > LZ_MAX_OFFSET || lz_read32(candidate) != lz_read32(ip)) {
+                ip++;
+                continue;
+            }
+            // 向后延伸匹配
+            const uint8_t* match_end = ip + LZ_MIN_MATCH;
+            const uint8_t* ref = candidate + LZ_MIN_MATCH;
+            while (match_end < match_end_limit && *match_end == *ref) {
+                match_end++;
+                ref++;
+            }
+            size_t literal_len = (size_t)(ip - anchor);
+            size_t match_len = (size_t)(match_end - ip) - LZ_MIN_MATCH;
+            if ((size_t)(oend - op) < 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1) {
+                return 0;
+            }
+            // 一个序列：token、字面量、偏移、匹配长度
+            uint8_t* token = op++;
+            *token = (uint8_t)(((literal_len < 15 ? literal_len : 15) << 4) | (match_len < 15 ? match_len : 15));
+            if (literal_len >= 15) {
+                op = lz_write_length(op, literal_len - 15);
+            }
+            memcpy(op, anchor, literal_len);
+            op += literal_len;
+            uint16_t offset = (uint16_t)(ip - candidate);
+            *op++ = (uint8_t)(offset & 0xFF);
+            *op++ = (uint8_t)(offset >> 8);
+            if (match_len >= 15) {
+                op = lz_write_length(op, match_len - 15);
+            }
+            ip = match_end;
+            anchor = ip;
+        }
+    }
+
+    // 最后一个序列只有字面量
+    size_t literal_len = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + literal_len / 255 + 1 + literal_len) {
+        return 0;
+    }
+    *op++ = (uint8_t)((literal_len < 15 ? literal_len : 15) << 4);
+    if (literal_len >= 15) {
+        op = lz_write_length(op, literal_len - 15);
+    }
+    memcpy(op, anchor, literal_len);
+    op += literal_len;
+    return (size_t)(op - reinterpret_cast<uint8_t*>(dst));
+}
+
+/*
+ lz_decompress - 解压一块数据
+ @param src 压缩数据
+ @param len 压缩长度
+ @param dst 输出缓冲区
+ @param raw_len 原始长度，输出必须恰好是这么多字节
+ @return true表示解压成功
+ */
+inline bool lz_decompress(const char* src, size_t len, char* dst, size_t raw_len) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* iend = ip + len;
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* op = out;
+    uint8_t* oend = out + raw_len;
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        // 字面量
+        size_t literal_len = token >> 4;
+        if (literal_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                literal_len += b;
+            } while (b == 255);
+        }
+        if (literal_len > (size_t)(iend - ip) || literal_len > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == iend) {
+            break;  // 最后一个序列
+        }
+        // 匹配：偏移可以小于长度，此时逐字节复制实现重复
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) {
+            return false;
+        }
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) {
+            return false;
+        }
+        const uint8_t* ref = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            op[i] = ref[i];
+        }
+        op += match_len;
+    }
+    return op == oend;
+}
@@ -0,0 +1,93 @@
+﻿/*
+ rdt_api.cpp - rdt_api.h的实现
+ */
+
+#include "rdt_api.h"
+#include "rdt_transport.h"
+
+static_assert(RDT_MAX_MESSAGE == RDT_MAX_MESSAGE_SIZE, "RDT_MAX_MESSAGE must match the transport");
+static_assert(RDT_STREAMS == RDT_STREAM_COUNT, "RDT_STREAMS must match the transport");
+
+struct rdt_endpoint {
+    RdtEndpoint endpoint;
+};
+
+rdt_endpoint* rdt_open(unsigned short port) {
+    if (!initialize_winsock()) {
+        return NULL;
+    }
+    rdt_endpoint* ep = new rdt_endpoint();
+    if (!ep->endpoint.start(port)) {
+        delete ep;
+        cleanup_winsock();
+        return NULL;
+    }
+    return ep;
+}
+
+rdt_handle rdt_connect(rdt_endpoint* ep, const char* host, unsigned short port, int timeout_ms) {
+    sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &peer.sin_addr) != 1) {
+        return 0;
+    }
+    return ep->endpoint.connect(peer, timeout_ms);
+}
+
+int rdt_send(rdt_endpoint* ep, rdt_handle handle, const void* data, int len, int stream) {
+    if (len < 0) {
+        return RDT_TOO_LONG;
+    }
+    if (stream != RDT_UNORDERED && (stream < 0 || stream >= RDT_STREAMS)) {
+        return RDT_BAD_STREAM;
+    }
+    uint8_t id = stream == RDT_UNORDERED ? RDT_STREAM_UNORDERED : (uint8_t)stream;
+    switch (ep->endpoint.send(handle, data, (size_t)len, id)) {
+    case RDT_SEND_OK: return RDT_OK;
+    case RDT_SEND_QUEUE_FULL: return RDT_QUEUE_FULL;
+    case RDT_SEND_TOO_LONG: return RDT_TOO_LONG;
+    case RDT_SEND_BAD_STREAM: return RDT_BAD_STREAM;
+    default: return RDT_CONN_CLOSED;
+    }
+}
+
+int rdt_flush(rdt_endpoint* ep, rdt_handle handle, int timeout_ms) {
+    return ep->endpoint.flush(handle, timeout_ms) ? 1 : 0;
+}
+
+int rdt_recv(rdt_endpoint* ep, rdt_event* ev, char* buf, int cap, int timeout_ms) {
+    RdtEvent event;
+    ev->handle = 0;
+    ev->context = NULL;
+    ev->len = 0;
+    if (!ep->endpoint.recv(event, timeout_ms)) {
+        return RDT_TIMEOUT;
+    }
+    ev->handle = event.handle;
+    ev->context = event.context;
+    ev->len = (int)event.data.size();
+    if (buf != NULL && cap > 0) {
+        memcpy(buf, event.data.data(), (std::min)(event.data.size(), (size_t)cap));
+    }
+    switch (event.type) {
+    case RDT_EVENT_ACCEPT: return RDT_ACCEPTED;
+    case RDT_EVENT_MESSAGE: return RDT_MESSAGE;
+    case RDT_EVENT_CLOSED: return RDT_CLOSED;
+    default: return RDT_TIMEOUT;
+    }
+}
+
+void rdt_set_context(rdt_endpoint* ep, rdt_handle handle, void* context) {
+    ep->endpoint.set_context(handle, context);
+}
+
+void rdt_close(rdt_endpoint* ep, rdt_handle handle) {
+    ep->endpoint.close(handle);
+}
+
+void rdt_destroy(rdt_endpoint* ep) {
+    delete ep;
+    cleanup_winsock();
+}
@@ -0,0 +1,93 @@
+﻿/*
+ rdt_api.h - 可靠UDP消息传输的C接口
+ 给C程序（ChatRoom）使用的RdtEndpoint封装，实现在rdt_api.cpp中，使用者把它加进自己的工程一起编译
+ 所有函数都可以从多个线程调用；rdt_recv通常由一个线程循环调用，取出连接、消息和关闭三类事件
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rdt_endpoint rdt_endpoint;  // 不透明的端点
+typedef unsigned int rdt_handle;           // 连接句柄，0表示无效
+
+// 交付方式：rdt_send的stream取0 ~ RDT_STREAMS-1时，同一个流的消息按发送顺序交付，不同的流互不等待
+#define RDT_STREAMS 64     // 每个连接的有序流数
+#define RDT_UNORDERED (-1) // 到齐即交付，不等之前丢失的消息
+
+// rdt_recv的返回值
+#define RDT_TIMEOUT 0      // 等待超时，没有事件
+#define RDT_ACCEPTED 1     // 对端建立了新连接
+#define RDT_MESSAGE 2      // 收到一条消息
+#define RDT_CLOSED 3       // 连接已关闭，每个句柄恰好一次，之后句柄失效
+
+// rdt_send的返回值
+#define RDT_OK 0
+#define RDT_QUEUE_FULL (-1)    // 发送队列已满，连接仍然可用
+#define RDT_CONN_CLOSED (-2)   // 连接已关闭或正在关闭
+#define RDT_TOO_LONG (-3)      // 消息长度为负或超过RDT_MAX_MESSAGE
+#define RDT_BAD_STREAM (-4)    // 流编号不是有效的有序流，也不是RDT_UNORDERED
+
+#define RDT_MAX_MESSAGE 65536  // 一条消息的最大字节数
+
+typedef struct {
+    rdt_handle handle;
+    void* context;     // rdt_set_context设置的指针
+    int len;           // 消息的实际字节数，可能大于缓冲区（超出的部分被丢弃）
+} rdt_event;
+
+/*
+ rdt_open - 创建端点，绑定UDP端口并启动服务线程
+ @param port 本地端口，0表示由系统选择
+ @return 端点，失败时返回NULL
+ */
+rdt_endpoint* rdt_open(unsigned short port);
+
+/*
+ rdt_connect - 与对端握手
+ @param host 对端的IPv4地址
+ @param timeout_ms 最长等待时间
+ @return 连接句柄，失败或超时返回0
+ */
+rdt_handle rdt_connect(rdt_endpoint* ep, const char* host, unsigned short port, int timeout_ms);
+
+/*
+ rdt_send - 发送一条消息，不等待确认
+ @param stream 有序流的编号（0 ~ RDT_STREAMS-1），或RDT_UNORDERED
+ @return RDT_OK表示成功，失败时为RDT_QUEUE_FULL、RDT_CONN_CLOSED、RDT_TOO_LONG或RDT_BAD_STREAM
+ */
+int rdt_send(rdt_endpoint* ep, rdt_handle handle, const void* data, int len, int stream);
+
+/*
+ rdt_flush - 等待已发送的消息全部被对端收到
+ 之后发出的消息不论在哪个流，对端都在这些消息之后收到
+ @return 1表示全部收到；0表示超时或连接已关闭
+ */
+int rdt_flush(rdt_endpoint* ep, rdt_handle handle, int timeout_ms);
+
+/*
+ rdt_recv - 取出下一个事件
+ @param ev 事件所属的连接和消息长度
+ @param buf 消息缓冲区，只在RDT_MESSAGE时写入
+ @param cap buf的大小
+ @param timeout_ms 最长等待时间，负数表示一直等待
+ @return 事件类型 RDT_TIMEOUT/RDT_ACCEPTED/RDT_MESSAGE/RDT_CLOSED
+ */
+int rdt_recv(rdt_endpoint* ep, rdt_event* ev, char* buf, int cap, int timeout_ms);
+
+// 设置连接的上下文指针，之后这个连接的事件都带着它
+void rdt_set_context(rdt_endpoint* ep, rdt_handle handle, void* context);
+
+// 关闭连接：已发送的消息仍会送达，完成后rdt_recv得到RDT_CLOSED
+void rdt_close(rdt_endpoint* ep, rdt_handle handle);
+
+// 停止服务线程并释放端点，所有连接直接丢弃
+void rdt_destroy(rdt_endpoint* ep);
+
+#ifdef __cplusplus
+}
+#endif
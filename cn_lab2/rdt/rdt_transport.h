@@ -0,0 +1,982 @@
+﻿/*
+ rdt_transport.h - 多连接的可靠UDP消息传输
+ 把文件传输中的握手、滑动窗口、SACK与超时重传、拥塞控制和校验和做成一个可复用的端点：
+ 一个RdtEndpoint占用一个UDP套接字，可以同时主动连接多个对端、接受多个对端的连接，每个连接用一个句柄表示
+ 1. 接口：connect/send/recv/close，收发的单位是消息（不超过RDT_MAX_MESSAGE_SIZE字节），不是字节流
+ 2. 交付方式：有序消息属于RDT_STREAM_COUNT个流之一，只等同一个流中之前的消息，其他流的丢包不耽误它；
+    无序消息凑齐自己的分段就交付，不受任何丢包的影响
+ 3. 线程：一个服务线程负责接收和定时器，send在调用线程中按窗口直接发出；端点内的状态由一把锁保护
+ 协议沿用文件传输的数据包格式（common.h），各字段的含义见下面的定义
+ */
+
+#pragma once
+
+#include "common.h"
+#include "batch_io.h"
+#include "rto.h"
+#include "congestion.h"
+#include <cstring>
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+// ========== 消息传输定义 ==========
+// 握手：SYN / SYN-ACK / ACK，载荷为HandshakeOptions（只使用connection_id、window_scale、checksum_mode和segment_size），
+// 握手包总是使用Internet校验和；服务器收到SYN即建立连接，SYN-ACK丢失时客户端重传SYN，服务器按连接ID原样重发
+// 数据包：seq_num为分段的序列号（从1开始，所有流共用一个序列号空间，重传和确认与流无关），ack_num为所在消息第一个分段的序列号，
+// window_size为消息的分段数，stream_id为消息所在的有序流（RDT_STREAM_UNORDERED表示无序）；
+// 载荷开头RDT_SEGMENT_TAG_SIZE字节是消息在流内的序号（从1开始，无序消息为0），之后才是消息内容
+// ACK：与文件传输相同，ack_num为已按序接收的最高序列号，载荷为SACK块，window_size为通告的接收窗口
+// 关闭：发送方的数据全部被确认后发送FIN，对端回复FIN-ACK；不认识的地址发来的FIN也回复FIN-ACK，让对端尽快结束
+// 保活：连接空闲RDT_KEEPALIVE_MS后发送一个ACK，RDT_IDLE_TIMEOUT_MS内收不到对端任何数据包就认为连接断开
+const int RDT_MAX_MESSAGE_SIZE = 64 * 1024;  // 一条消息的最大字节数
+const int RDT_RECEIVE_WINDOW = 1024;         // 每个连接的接收窗口（数据包数），包括已收到但应用还没取走的消息
+const int RDT_SEND_QUEUE_PACKETS = 4096;     // 每个连接在途和排队的数据包上限，超过时send失败
+const int RDT_KEEPALIVE_MS = 1000;           // 空闲多久发送一次保活ACK
+const int RDT_IDLE_TIMEOUT_MS = 10000;       // 多久收不到对端的数据包就关闭连接
+const int RDT_FIN_ATTEMPTS = 5;              // FIN最多发送的次数，之后不等FIN-ACK直接关闭
+const int RDT_SERVICE_INTERVAL_MS = 10;      // 服务线程没有定时器要等时一轮最多等待的时间
+const char* const RDT_CONGESTION = "reno";   // 每个连接使用的拥塞控制算法（congestion.h）
+const int RDT_STREAM_COUNT = 64;             // 每个连接的有序流数，编号0 ~ RDT_STREAM_COUNT-1
+const uint8_t RDT_STREAM_UNORDERED = 0xFF;   // stream_id取这个值表示无序消息：到齐即交付
+const int RDT_SEGMENT_TAG_SIZE = sizeof(uint32_t);  // 每个分段载荷开头的流内序号
+
+// send的结果
+enum RdtSendResult {
+    RDT_SEND_OK = 0,
+    RDT_SEND_QUEUE_FULL = 1,  // 发送队列已满：对端或网络跟不上，连接仍然可用
+    RDT_SEND_CLOSED = 2,      // 连接不存在、已经关闭或正在关闭
+    RDT_SEND_TOO_LONG = 3,    // 消息超过RDT_MAX_MESSAGE_SIZE
+    RDT_SEND_BAD_STREAM = 4,  // 流编号既不在[0, RDT_STREAM_COUNT)内，也不是RDT_STREAM_UNORDERED
+};
+
+enum RdtEventType {
+    RDT_EVENT_NONE = 0,     // 等待超时
+    RDT_EVENT_ACCEPT = 1,   // 对端建立了新连接
+    RDT_EVENT_MESSAGE = 2,  // 收到一条消息
+    RDT_EVENT_CLOSED = 3,   // 连接已关闭（对端关闭、超时或本端close），每个句柄恰好一次，之后句柄失效
+};
+
+// recv取出的一个事件
+struct RdtEvent {
+    RdtEventType type = RDT_EVENT_NONE;
+    uint32_t handle = 0;
+    void* context = NULL;   // set_context为这个连接设置的指针
+    std::string data;       // 消息内容（只在RDT_EVENT_MESSAGE中）
+};
+
+/*
+ RdtEndpoint - 可靠UDP消息传输的端点
+ 句柄是从1开始递增的整数，0表示无效；关闭事件被recv取走之后句柄才会失效
+ */
+class RdtEndpoint {
+public:
+    RdtEndpoint() = default;
+    RdtEndpoint(const RdtEndpoint&) = delete;
+    RdtEndpoint& operator=(const RdtEndpoint&) = delete;
+    ~RdtEndpoint() { stop(); }
+
+    /*
+     start - 打开套接字并启动服务线程
+     @param port 本地UDP端口，0表示由系统选择（只发起连接的一端）
+     @return false表示套接字创建或绑定失败
+     */
+    bool start(uint16_t port) {
+        socket_ = create_udp_socket();
+        if (socket_ == INVALID_SOCKET) {
+            return false;
+        }
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(port);
+        if (bind(socket_, (const sockaddr*)&local, sizeof(local)) == SOCKET_ERROR) {
+            closesocket(socket_);
+            socket_ = INVALID_SOCKET;
+            return false;
+        }
+        batch_io_.open(socket_);
+        running_ = true;
+        service_thread_ = std::thread(&RdtEndpoint::service_loop, this);
+        return true;
+    }
+
+    // 停止服务线程并关闭套接字，所有连接直接丢弃，不再发送FIN
+    void stop() {
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        service_thread_.join();
+        batch_io_.close();
+        closesocket(socket_);
+        socket_ = INVALID_SOCKET;
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.clear();
+        by_address_.clear();
+        events_.clear();
+        events_ready_.notify_all();
+    }
+
+    /*
+     connect - 与对端握手，建立一个连接
+     每个RTO重发一次SYN，直到收到SYN-ACK或超时
+     @param peer 对端地址
+     @param timeout_ms 最长等待时间
+     @return 连接句柄，0表示超时或已经有到这个地址的连接
+     */
+    uint32_t connect(const sockaddr_in& peer, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t key = address_key(peer);
+        if (!running_ || by_address_.count(key) != 0) {
+            return 0;
+        }
+        Connection& c = add_connection(peer, random_connection_id());
+        c.state = SYN_SENT;
+        c.segment_size = DEFAULT_SEGMENT_SIZE;
+        send_syn(c);
+        batch_io_.flush();
+        uint32_t handle = c.handle;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        established_.wait_until(lock, deadline, [&] {
+            auto it = connections_.find(handle);
+            return it == connections_.end() || it->second->state != SYN_SENT;
+        });
+        auto it = connections_.find(handle);
+        if (it == connections_.end()) {
+            return 0;
+        }
+        if (it->second->state == SYN_SENT) {
+            close_connection(*it->second);
+            return 0;
+        }
+        return handle;
+    }
+
+    /*
+     send - 发送一条消息
+     按分段大小切分后排进连接的发送队列，窗口允许的分段立即发出，其余的随ACK到达陆续发出
+     @param stream 有序流的编号，同一个流的消息按send的顺序交付；RDT_STREAM_UNORDERED表示无序
+     @return RDT_SEND_OK，或者失败的原因（RdtSendResult）
+     */
+    RdtSendResult send(uint32_t handle, const void* data, size_t len, uint8_t stream) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Connection* c = find_open(handle);
+        if (c == NULL || c->closing) {
+            return RDT_SEND_CLOSED;
+        }
+        if (len > (size_t)RDT_MAX_MESSAGE_SIZE) {
+            return RDT_SEND_TOO_LONG;
+        }
+        if (stream >= RDT_STREAM_COUNT && stream != RDT_STREAM_UNORDERED) {
+            return RDT_SEND_BAD_STREAM;
+        }
+        size_t capacity = message_bytes_per_segment(*c);
+        size_t count = len == 0 ? 1 : (len + capacity - 1) / capacity;
+        if (c->in_flight.size() + c->unsent.size() + count > (size_t)RDT_SEND_QUEUE_PACKETS) {
+            return RDT_SEND_QUEUE_FULL;
+        }
+        const char* bytes = static_cast<const char*>(data);
+        uint32_t first_seq = c->next_seq;
+        uint32_t stream_seq = stream == RDT_STREAM_UNORDERED ? 0 : c->next_stream_seq[stream]++;
+        for (size_t i = 0; i < count; i++) {
+            size_t offset = i * capacity;
+            size_t piece = (std::min)(capacity, len - offset);
+            OutPacket op;
+            op.seq_num = c->next_seq++;
+            op.first_seq = first_seq;
+            op.fragment_count = (uint16_t)count;
+            op.stream = stream;
+            op.stream_seq = stream_seq;
+            op.payload.assign(bytes + offset, piece);
+            c->unsent.push_back(std::move(op));
+        }
+        if (c->state == ESTABLISHED) {
+            send_new_packets(*c);
+            batch_io_.flush();
+        }
+        return RDT_SEND_OK;
+    }
+
+    /*
+     recv - 取出下一个事件
+     @param timeout_ms 最长等待时间，负数表示一直等待
+     @return false表示超时，event.type为RDT_EVENT_NONE
+     */
+    bool recv(RdtEvent& event, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto ready = [&] { return !events_.empty() || !running_; };
+        if (timeout_ms < 0) {
+            events_ready_.wait(lock, ready);
+        }
+        else {
+            events_ready_.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+        }
+        if (events_.empty()) {
+            event = RdtEvent();
+            return false;
+        }
+        event = std::move(events_.front());
+        events_.pop_front();
+        auto it = connections_.find(event.handle);
+        if (it != connections_.end()) {
+            Connection& c = *it->second;
+            event.context = c.context;
+            if (event.type == RDT_EVENT_MESSAGE) {
+                size_t capacity = message_bytes_per_segment(c);
+                c.queued_packets -= (uint32_t)(std::max)((size_t)1, (event.data.size() + capacity - 1) / capacity);
+            }
+            if (event.type == RDT_EVENT_CLOSED) {
+                connections_.erase(it);
+            }
+        }
+        return true;
+    }
+
+    // 设置连接的上下文指针，之后这个连接的事件都带着它
+    void set_context(uint32_t handle, void* context) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = connections_.find(handle);
+        if (it != connections_.end()) {
+            it->second->context = context;
+        }
+    }
+
+    /*
+     flush - 等待已经交给send的消息全部被对端确认
+     对端按收到的顺序处理事件时，之后发出的任何消息（不论哪个流）都排在这些消息之后
+     @param timeout_ms 最长等待时间
+     @return false表示超时，或者连接已经关闭
+     */
+    bool flush(uint32_t handle, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        return drained_.wait_until(lock, deadline, [&] {
+            Connection* c = find_open(handle);
+            return c == NULL || (c->state != SYN_SENT && c->in_flight.empty() && c->unsent.empty());
+        }) && find_open(handle) != NULL;
+    }
+
+    /*
+     close - 关闭连接
+     已经交给send的消息仍会发完，全部确认后发送FIN；关闭完成时recv得到RDT_EVENT_CLOSED
+     */
+    void close(uint32_t handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Connection* c = find_open(handle);
+        if (c != NULL) {
+            c->closing = true;
+        }
+    }
+
+    // 对端地址，句柄无效时返回false
+    bool peer_address(uint32_t handle, sockaddr_in& peer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = connections_.find(handle);
+        if (it == connections_.end()) {
+            return false;
+        }
+        peer = it->second->peer;
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    enum ConnectionState {
+        SYN_SENT,     // 主动连接，等待SYN-ACK
+        ESTABLISHED,  // 可以收发数据
+        FIN_SENT,     // 数据已经全部确认，等待FIN-ACK
+        CLOSED,       // 已经关闭，等待recv取走关闭事件
+    };
+
+    // 发送队列中的一个分段，重传时从这里重新构造数据包
+    struct OutPacket {
+        uint32_t seq_num = 0;
+        uint32_t first_seq = 0;       // 所在消息的第一个序列号
+        uint16_t fragment_count = 0;  // 所在消息的分段数
+        uint8_t stream = 0;
+        uint32_t stream_seq = 0;      // 消息在流内的序号
+        std::string payload;          // 消息内容的一段，不含流内序号
+        bool acked = false;           // 已经被SACK确认
+        bool retransmitted = false;
+        time_point send_time;
+        time_point deadline;          // 当前的重传截止时间，用来识别失效的定时器
+    };
+
+    // 接收方缓存的一个分段；消息交付后载荷清空，分段留到累计确认越过它为止，用来识别重复的包
+    struct InFragment {
+        uint32_t first_seq = 0;
+        uint16_t fragment_count = 0;
+        uint8_t stream = 0;
+        uint32_t stream_seq = 0;
+        bool delivered = false;
+        std::string payload;
+    };
+
+    struct Connection {
+        uint32_t handle = 0;
+        uint32_t connection_id = 0;
+        sockaddr_in peer;
+        ConnectionState state = SYN_SENT;
+        void* context = NULL;
+        bool closing = false;          // 本端已经调用close
+        uint16_t segment_size = DEFAULT_SEGMENT_SIZE;
+        uint8_t window_scale = 0;      // 握手时服务器选定的缩放因子，两个方向的通告窗口都使用它
+        ChecksumMode checksum_mode = CHECKSUM_INTERNET;
+        std::string syn_ack;           // 服务器一侧保存的SYN-ACK，收到重传的SYN时原样重发
+        time_point handshake_time;     // 发出SYN或SYN-ACK的时间，用于第一个RTT样本
+        int handshake_attempts = 0;
+        time_point last_received;
+        time_point last_sent;
+
+        // 发送方
+        uint32_t next_seq = 1;                // 下一个新分段的序列号
+        std::vector<uint32_t> next_stream_seq = std::vector<uint32_t>(RDT_STREAM_COUNT, 1);  // 每个流下一条消息的流内序号
+        std::deque<OutPacket> in_flight;      // 已发出未确认的分段，序列号从in_flight.front()起连续
+        std::deque<OutPacket> unsent;         // 还没发出过的分段
+        RttEstimator rtt_estimator{ PACKET_TIMEOUT_MS };
+        TimerQueue retransmit_timers;
+        std::unique_ptr<CongestionController> congestion;
+        uint32_t receive_window = FLOW_CONTROL_WINDOW_SIZE;  // 对端通告的窗口（数据包数）
+        uint32_t duplicate_ack_count = 0;
+        uint32_t recovery_point = 0;          // 上一次拥塞事件时已发送的最高序列号
+        uint32_t highest_sacked = 0;
+        uint64_t delivered = 0;
+        int fin_attempts = 0;
+        time_point fin_deadline;
+
+        // 接收方
+        uint32_t expected_seq = 1;                 // 第一个还没收到的序列号
+        std::map<uint32_t, InFragment> received;   // 按序列号排列的已收到分段（含累计确认之前还没交付的）
+        std::vector<uint32_t> expected_stream_seq = std::vector<uint32_t>(RDT_STREAM_COUNT, 1);  // 每个流下一条要交付的流内序号
+        std::map<std::pair<uint8_t, uint32_t>, uint32_t> waiting;  // 已经到齐、在等同一流中之前消息的有序消息：(流, 流内序号) -> 第一个序列号
+        uint32_t queued_packets = 0;               // 已交付但应用还没取走的消息占用的分段数
+        bool ack_pending = false;                  // 本批数据报处理完后要发送ACK
+    };
+
+    // ========== 连接表 ==========
+
+    // 每个分段能装的消息字节数：分段大小减去流内序号
+    static size_t message_bytes_per_segment(const Connection& c) {
+        return (size_t)c.segment_size - RDT_SEGMENT_TAG_SIZE;
+    }
+
+    static uint64_t address_key(const sockaddr_in& addr) {
+        return ((uint64_t)ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+    }
+
+    uint32_t random_connection_id() {
+        std::uniform_int_distribution<uint32_t> dist(1, 0xFFFFFFFFu);
+        return dist(random_);
+    }
+
+    Connection& add_connection(const sockaddr_in& peer, uint32_t connection_id) {
+        std::unique_ptr<Connection> c(new Connection());
+        c->handle = next_handle_++;
+        c->connection_id = connection_id;
+        c->peer = peer;
+        c->congestion = create_congestion_controller(RDT_CONGESTION);
+        c->last_received = c->last_sent = std::chrono::steady_clock::now();
+        Connection& ref = *c;
+        by_address_[address_key(peer)] = ref.handle;
+        connections_[ref.handle] = std::move(c);
+        return ref;
+    }
+
+    // 从地址表中移除，之后同一地址可以建立新连接；连接对象留到关闭事件被取走
+    void remove_connection(Connection& c) {
+        auto it = by_address_.find(address_key(c.peer));
+        if (it != by_address_.end() && it->second == c.handle) {
+            by_address_.erase(it);
+        }
+        c.state = CLOSED;
+        c.in_flight.clear();
+        c.unsent.clear();
+        c.received.clear();
+        c.waiting.clear();
+        drained_.notify_all();
+    }
+
+    // 关闭连接并通知应用；握手还没完成的主动连接应用还不知道，直接删除，等待中的connect返回失败
+    void close_connection(Connection& c) {
+        if (c.state == SYN_SENT) {
+            uint32_t handle = c.handle;
+            remove_connection(c);
+            connections_.erase(handle);
+            established_.notify_all();
+            return;
+        }
+        remove_connection(c);
+        push_event(RDT_EVENT_CLOSED, c.handle, std::string());
+    }
+
+    Connection* find_open(uint32_t handle) {
+        auto it = connections_.find(handle);
+        if (it == connections_.end() || it->second->state == CLOSED) {
+            return NULL;
+        }
+        return it->second.get();
+    }
+
+    Connection* find_by_address(const sockaddr_in& from) {
+        auto it = by_address_.find(address_key(from));
+        return it == by_address_.end() ? NULL : find_open(it->second);
+    }
+
+    void push_event(RdtEventType type, uint32_t handle, std::string data) {
+        RdtEvent event;
+        event.type = type;
+        event.handle = handle;
+        event.data = std::move(data);
+        events_.push_back(std::move(event));
+        events_ready_.notify_one();
+    }
+
+    // ========== 发送数据包 ==========
+
+    // 取得发往c的下一个数据包缓冲区；目的地址变化时先发出之前的一批
+    Packet& packet_buffer(Connection& c) {
+        uint64_t key = address_key(c.peer);
+        if (batch_io_.pending() > 0 && key != batch_peer_) {
+            batch_io_.flush();
+        }
+        batch_io_.set_peer(c.peer);
+        batch_peer_ = key;
+        Packet& packet = *reinterpret_cast<Packet*>(batch_io_.send_buffer());
+        memset(&packet, 0, HEADER_SIZE);
+        return packet;
+    }
+
+    void commit_packet(Connection& c, Packet& packet, ChecksumMode mode) {
+        packet.checksum = calculate_checksum(&packet, mode);
+        batch_io_.commit(HEADER_SIZE + packet.data_len);
+        c.last_sent = std::chrono::steady_clock::now();
+    }
+
+    void send_syn(Connection& c) {
+        Packet& packet = packet_buffer(c);
+        HandshakeOptions options;
+        memset(&options, 0, sizeof(options));
+        options.window_scale = MAX_WINDOW_SCALE;
+        options.checksum_mode = CHECKSUM_INTERNET;
+        options.connection_id = c.connection_id;
+        options.stream_count = 1;
+        options.segment_size = (uint16_t)c.segment_size;
+        packet.flags = SYN;
+        packet.data_len = sizeof(options);
+        memcpy(packet.data, &options, sizeof(options));
+        commit_packet(c, packet, CHECKSUM_INTERNET);
+        c.handshake_time = c.last_sent;
+        c.handshake_attempts++;
+    }
+
+    /*
+     send_ack - 发送累计ACK，附带期望序列号之后已收到区间的SACK块
+     接收窗口扣除乱序缓存的分段和应用还没取走的消息
+     */
+    void send_ack(Connection& c) {
+        Packet& packet = packet_buffer(c);
+        SackBlock* blocks = reinterpret_cast<SackBlock*>(packet.data);
+        int count = 0;
+        for (auto it = c.received.lower_bound(c.expected_seq); it != c.received.end() && count < MAX_SACK_BLOCKS; count++) {
+            uint32_t left = it->first;
+            uint32_t right = left;
+            while (it != c.received.end() && it->first == right) {
+                ++it;
+                right++;
+            }
+            blocks[count].left = left;
+            blocks[count].right = right;
+        }
+        uint32_t used = (uint32_t)c.received.size() + c.queued_packets;
+        packet.flags = ACK;
+        packet.ack_num = c.expected_seq - 1;
+        packet.window_size = advertised_window(used < (uint32_t)RDT_RECEIVE_WINDOW ? RDT_RECEIVE_WINDOW - used : 0, c.segment_size, c.window_scale);
+        packet.data_len = (uint16_t)(count * sizeof(SackBlock));
+        commit_packet(c, packet, c.checksum_mode);
+        c.ack_pending = false;
+    }
+
+    // 发送或重传一个数据分段，按当前RTO登记重传定时器
+    void send_segment(Connection& c, OutPacket& op, bool retransmission) {
+        Packet& packet = packet_buffer(c);
+        packet.seq_num = op.seq_num;
+        packet.ack_num = op.first_seq;
+        packet.stream_id = op.stream;
+        packet.window_size = op.fragment_count;
+        packet.data_len = (uint16_t)(RDT_SEGMENT_TAG_SIZE + op.payload.size());
+        memcpy(packet.data, &op.stream_seq, RDT_SEGMENT_TAG_SIZE);
+        memcpy(packet.data + RDT_SEGMENT_TAG_SIZE, op.payload.data(), op.payload.size());
+        commit_packet(c, packet, c.checksum_mode);
+        op.send_time = c.last_sent;
+        op.retransmitted = op.retransmitted || retransmission;
+        op.deadline = op.send_time + c.rtt_estimator.rto();
+        c.retransmit_timers.schedule(op.seq_num, op.deadline);
+    }
+
+    // 窗口 = min(拥塞窗口, 对端通告窗口)，窗口内能发多少新分段就发多少
+    void send_new_packets(Connection& c) {
+        double window = (std::min)((double)c.receive_window, c.congestion->cwnd());
+        while (!c.unsent.empty() && c.in_flight.size() < window) {
+            c.in_flight.push_back(std::move(c.unsent.front()));
+            c.unsent.pop_front();
+            send_segment(c, c.in_flight.back(), false);
+        }
+    }
+
+    void send_fin(Connection& c, uint8_t flags) {
+        Packet& packet = packet_buffer(c);
+        packet.flags = flags;
+        packet.seq_num = c.next_seq;
+        commit_packet(c, packet, c.checksum_mode);
+    }
+
+    // ========== 接收数据包 ==========
+
+    /*
+     handle_datagram - 处理一个数据报
+     握手包按地址查找或建立连接，其余的交给对应的连接；不认识的地址只回复FIN
+     */
+    void handle_datagram(const ReceivedDatagram& dg) {
+        if (dg.len < HEADER_SIZE) {
+            return;
+        }
+        const Packet& packet = *reinterpret_cast<const Packet*>(dg.data);
+        if (packet.data_len > MAX_DATA_SIZE || HEADER_SIZE + packet.data_len != dg.len) {
+            return;
+        }
+        Connection* c = find_by_address(dg.from);
+        if (packet.flags & SYN) {
+            if (verify_checksum(&packet, CHECKSUM_INTERNET) && packet.data_len >= sizeof(HandshakeOptions)) {
+                HandshakeOptions options;
+                memcpy(&options, packet.data, sizeof(options));
+                handle_handshake(c, packet, options, dg.from);
+            }
+            return;
+        }
+        if (c == NULL) {
+            if ((packet.flags & (FIN | ACK)) == FIN && verify_checksum(&packet, CHECKSUM_INTERNET)) {
+                Connection stray;
+                stray.peer = dg.from;
+                send_fin(stray, FIN | ACK);
+            }
+            return;
+        }
+        if (c->state == SYN_SENT || !verify_checksum(&packet, c->checksum_mode)) {
+            return;
+        }
+        c->last_received = std::chrono::steady_clock::now();
+        if (packet.flags & FIN) {
+            handle_fin(*c, packet);
+        }
+        else if (packet.flags & ACK) {
+            process_ack(*c, packet);
+        }
+        else {
+            handle_data(*c, packet);
+        }
+    }
+
+    /*
+     handle_handshake - 处理SYN和SYN-ACK
+     服务器收到新的连接ID就建立连接（同一地址上的旧连接被替换），收到重传的SYN就重发SYN-ACK；
+     客户端收到SYN-ACK后采用服务器选定的参数，回复ACK，唤醒等待中的connect
+     */
+    void handle_handshake(Connection* c, const Packet& packet, const HandshakeOptions& options, const sockaddr_in& from) {
+        auto now = std::chrono::steady_clock::now();
+        if ((packet.flags & ACK) == 0) {
+            if (c != NULL && c->connection_id == options.connection_id) {
+                if (!c->syn_ack.empty()) {
+                    Packet& resend = packet_buffer(*c);
+                    memcpy(&resend, c->syn_ack.data(), c->syn_ack.size());
+                    batch_io_.commit((int)c->syn_ack.size());
+                    c->handshake_attempts++;
+                }
+                return;
+            }
+            if (c != NULL) {
+                close_connection(*c);
+            }
+            Connection& accepted = add_connection(from, options.connection_id);
+            accepted.state = ESTABLISHED;
+            accepted.segment_size = (uint16_t)(std::max)(MIN_SEGMENT_SIZE, (std::min)((int)options.segment_size, DEFAULT_SEGMENT_SIZE));
+            accepted.window_scale = choose_window_scale(options.window_scale, accepted.segment_size, RDT_RECEIVE_WINDOW);
+            accepted.checksum_mode = options.checksum_mode == CHECKSUM_CRC32C ? CHECKSUM_CRC32C : CHECKSUM_INTERNET;
+
+            HandshakeOptions reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.window_scale = accepted.window_scale;
+            reply.checksum_mode = accepted.checksum_mode;
+            reply.connection_id = accepted.connection_id;
+            reply.stream_count = 1;
+            reply.segment_size = accepted.segment_size;
+            Packet& syn_ack = packet_buffer(accepted);
+            syn_ack.flags = SYN | ACK;
+            syn_ack.window_size = advertised_window(RDT_RECEIVE_WINDOW, accepted.segment_size, accepted.window_scale);
+            syn_ack.data_len = sizeof(reply);
+            memcpy(syn_ack.data, &reply, sizeof(reply));
+            syn_ack.checksum = calculate_checksum(&syn_ack, CHECKSUM_INTERNET);
+            accepted.syn_ack.assign(reinterpret_cast<const char*>(&syn_ack), HEADER_SIZE + syn_ack.data_len);
+            batch_io_.commit(HEADER_SIZE + syn_ack.data_len);
+            accepted.last_sent = accepted.handshake_time = now;
+            accepted.handshake_attempts = 1;
+            push_event(RDT_EVENT_ACCEPT, accepted.handle, std::string());
+            return;
+        }
+        if (c == NULL || c->state != SYN_SENT || c->connection_id != options.connection_id) {
+            return;
+        }
+        // 只发过一次SYN时，SYN到SYN-ACK的时间就是第一个RTT样本
+        if (c->handshake_attempts == 1) {
+            c->rtt_estimator.sample(std::chrono::duration<double, std::milli>(now - c->handshake_time).count());
+        }
+        c->state = ESTABLISHED;
+        c->segment_size = options.segment_size;
+        c->window_scale = options.window_scale;
+        c->checksum_mode = options.checksum_mode == CHECKSUM_CRC32C ? CHECKSUM_CRC32C : CHECKSUM_INTERNET;
+        c->last_received = now;
+        update_receive_window(*c, packet);
+        send_ack(*c);
+        send_new_packets(*c);
+        established_.notify_all();
+    }
+
+    /*
+     handle_data - 处理一个数据分段
+     窗口内第一次收到的分段放进接收表；乱序和重复的包立即确认，按序的包在本批处理完后合并确认
+     消息的分段到齐时：无序消息直接交付，有序消息轮到它在流内的序号时交付，否则等同一个流中之前的消息
+     */
+    void handle_data(Connection& c, const Packet& packet) {
+        uint32_t seq = packet.seq_num;
+        uint32_t first = packet.ack_num;
+        uint16_t count = packet.window_size;
+        uint8_t stream = packet.stream_id;
+        uint32_t stream_seq = 0;
+        if (packet.data_len >= RDT_SEGMENT_TAG_SIZE) {
+            memcpy(&stream_seq, packet.data, RDT_SEGMENT_TAG_SIZE);
+        }
+        bool valid = count > 0 && first <= seq && seq - first < count && packet.data_len >= RDT_SEGMENT_TAG_SIZE &&
+            (stream == RDT_STREAM_UNORDERED || (stream < RDT_STREAM_COUNT && stream_seq > 0));
+        if (!valid || seq < c.expected_seq || seq - c.expected_seq >= (uint32_t)RDT_RECEIVE_WINDOW || c.received.count(seq) != 0) {
+            send_ack(c);  // 重复或窗口外的包：立即确认，发送方据此推进窗口
+            return;
+        }
+        bool in_order = seq == c.expected_seq;
+        InFragment& fragment = c.received[seq];
+        fragment.first_seq = first;
+        fragment.fragment_count = count;
+        fragment.stream = stream;
+        fragment.stream_seq = stream_seq;
+        fragment.payload.assign(packet.data + RDT_SEGMENT_TAG_SIZE, packet.data_len - RDT_SEGMENT_TAG_SIZE);
+        while (c.received.count(c.expected_seq) != 0) {
+            c.expected_seq++;
+        }
+
+        if (message_complete(c, first, count)) {
+            if (stream == RDT_STREAM_UNORDERED) {
+                deliver_message(c, first, count);
+            }
+            else if (stream_seq == c.expected_stream_seq[stream]) {
+                deliver_stream(c, stream, first, count);
+            }
+            else if (stream_seq > c.expected_stream_seq[stream]) {
+                c.waiting[std::make_pair(stream, stream_seq)] = first;
+            }
+            else {
+                discard_message(c, first, count);  // 流内序号已经交付过：对端出错，丢弃，不让它卡住接收表
+            }
+        }
+        // 累计确认越过、已经交付的消息从接收表中移除；这时同一流中之前的消息都已到齐，有序消息不会还在等待
+        while (!c.received.empty() && c.received.begin()->first < c.expected_seq) {
+            const InFragment& head = c.received.begin()->second;
+            uint32_t end = head.first_seq + head.fragment_count;
+            if (end > c.expected_seq || !head.delivered) {
+                break;
+            }
+            c.received.erase(c.received.begin(), c.received.lower_bound(end));
+        }
+        if (in_order) {
+            c.ack_pending = true;
+        }
+        else {
+            send_ack(c);
+        }
+    }
+
+    bool message_complete(Connection& c, uint32_t first, uint16_t count) {
+        for (uint32_t s = first; s != first + count; s++) {
+            if (c.received.count(s) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 交付流中轮到的消息，再依次交付同一流中已经到齐、在等它的后续消息
+    void deliver_stream(Connection& c, uint8_t stream, uint32_t first, uint16_t count) {
+        deliver_message(c, first, count);
+        uint32_t& next = c.expected_stream_seq[stream];
+        next++;
+        for (auto it = c.waiting.find(std::make_pair(stream, next)); it != c.waiting.end(); it = c.waiting.find(std::make_pair(stream, next))) {
+            uint32_t waiting_first = it->second;
+            c.waiting.erase(it);
+            deliver_message(c, waiting_first, c.received[waiting_first].fragment_count);
+            next++;
+        }
+    }
+
+    void discard_message(Connection& c, uint32_t first, uint16_t count) {
+        for (uint32_t s = first; s != first + count; s++) {
+            InFragment& fragment = c.received[s];
+            fragment.payload.clear();
+            fragment.delivered = true;
+        }
+    }
+
+    // 拼接消息的所有分段交给应用；分段留在接收表中，直到累计确认越过它们
+    void deliver_message(Connection& c, uint32_t first, uint16_t count) {
+        std::string message;
+        for (uint32_t s = first; s != first + count; s++) {
+            InFragment& fragment = c.received[s];
+            message += fragment.payload;
+            fragment.payload.clear();
+            fragment.payload.shrink_to_fit();
+            fragment.delivered = true;
+        }
+        c.queued_packets += count;
+        push_event(RDT_EVENT_MESSAGE, c.handle, std::move(message));
+    }
+
+    // FIN：数据全部收到后才接受，回复FIN-ACK并关闭；本端发出的FIN得到了FIN-ACK也在这里关闭
+    void handle_fin(Connection& c, const Packet& packet) {
+        if (packet.flags & ACK) {
+            if (c.state == FIN_SENT) {
+                close_connection(c);
+            }
+            return;
+        }
+        if (packet.seq_num != c.expected_seq) {
+            return;
+        }
+        send_fin(c, FIN | ACK);
+        close_connection(c);
+    }
+
+    // 根据ACK中通告的窗口更新rwnd；零窗口时仍允许1个包在途，起到窗口探测的作用
+    void update_receive_window(Connection& c, const Packet& ack_packet) {
+        uint64_t window_bytes = (uint64_t)ack_packet.window_size << c.window_scale;
+        c.receive_window = (uint32_t)(std::max)((uint64_t)1, window_bytes / c.segment_size);
+    }
+
+    bool in_window(const Connection& c, uint32_t seq) const {
+        return !c.in_flight.empty() && seq >= c.in_flight.front().seq_num && seq < c.in_flight.front().seq_num + c.in_flight.size();
+    }
+
+    OutPacket& at(Connection& c, uint32_t seq) {
+        return c.in_flight[seq - c.in_flight.front().seq_num];
+    }
+
+    // 标记被SACK确认的分段，超时与快速重传会跳过这些包
+    void apply_sack_blocks(Connection& c, const Packet& ack_packet) {
+        int sack_count = ack_packet.data_len / sizeof(SackBlock);
+        const SackBlock* blocks = reinterpret_cast<const SackBlock*>(ack_packet.data);
+        for (int i = 0; i < sack_count && i < MAX_SACK_BLOCKS; i++) {
+            for (uint32_t seq = blocks[i].left; seq != blocks[i].right && in_window(c, seq); seq++) {
+                OutPacket& op = at(c, seq);
+                if (!op.acked) {
+                    op.acked = true;
+                    c.delivered++;
+                }
+                if (!in_window(c, c.highest_sacked) || seq > c.highest_sacked) {
+                    c.highest_sacked = seq;
+                }
+            }
+        }
+    }
+
+    /*
+     process_ack - 处理一个ACK，与文件传输的发送端相同：
+     新ACK推进窗口并交给拥塞控制器，3个重复ACK触发快速重传，每个RTT最多报告一次拥塞事件
+     */
+    void process_ack(Connection& c, const Packet& ack_packet) {
+        update_receive_window(c, ack_packet);
+        uint32_t acked_num = ack_packet.ack_num;
+        // 服务器一侧：握手的ACK（只发过一次SYN-ACK时）给出第一个RTT样本
+        if (!c.rtt_estimator.has_sample() && c.handshake_attempts == 1 && acked_num == 0 && ack_packet.data_len == 0 && c.in_flight.empty()) {
+            c.rtt_estimator.sample(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - c.handshake_time).count());
+        }
+        bool fast_retransmit = false;
+        if (in_window(c, acked_num)) {
+            c.duplicate_ack_count = 0;
+            auto now = std::chrono::steady_clock::now();
+            AckEvent ev;
+            ev.now = now;
+            // Karn算法：累计确认的范围内有重传过的包，或被确认的包之前已被SACK过时不采样
+            OutPacket& acked_op = at(c, acked_num);
+            bool valid_sample = !acked_op.acked;
+            uint32_t newly_acked = acked_num - c.in_flight.front().seq_num + 1;
+            for (uint32_t i = 0; i < newly_acked; i++) {
+                valid_sample = valid_sample && !c.in_flight[i].retransmitted;
+                if (!c.in_flight[i].acked) {
+                    c.delivered++;
+                }
+            }
+            if (valid_sample) {
+                ev.rtt_ms = std::chrono::duration<double, std::milli>(now - acked_op.send_time).count();
+                c.rtt_estimator.sample(ev.rtt_ms);
+            }
+            c.in_flight.erase(c.in_flight.begin(), c.in_flight.begin() + newly_acked);
+            if (c.in_flight.empty() && c.unsent.empty()) {
+                drained_.notify_all();
+            }
+            apply_sack_blocks(c, ack_packet);
+            ev.newly_acked = newly_acked;
+            ev.in_flight = (uint32_t)c.in_flight.size();
+            ev.delivered = c.delivered;
+            ev.srtt_ms = c.rtt_estimator.srtt_ms();
+            c.congestion->on_ack(ev);
+        }
+        else if (!c.in_flight.empty() && acked_num + 1 == c.in_flight.front().seq_num) {
+            c.duplicate_ack_count++;
+            apply_sack_blocks(c, ack_packet);
+            c.congestion->on_duplicate_ack();
+            if (c.duplicate_ack_count == 3 && !in_window(c, c.recovery_point)) {
+                c.congestion->on_loss(std::chrono::steady_clock::now());
+                c.recovery_point = c.next_seq - 1;
+                fast_retransmit = true;
+            }
+        }
+        if (fast_retransmit) {
+            // 重传窗口基序号到最大SACK序列号之间所有未被选择确认的空洞
+            uint32_t base = c.in_flight.front().seq_num;
+            uint32_t last_hole = in_window(c, c.highest_sacked) ? c.highest_sacked : base;
+            for (uint32_t seq = base; seq <= last_hole; seq++) {
+                OutPacket& op = at(c, seq);
+                if (!op.acked) {
+                    send_segment(c, op, true);
+                }
+            }
+        }
+        send_new_packets(c);
+    }
+
+    // ========== 服务线程 ==========
+
+    /*
+     service_connection - 一轮中处理一个连接的定时器
+     超时重传、握手重传、关闭和保活；返回下一次需要醒来的时间
+     */
+    time_point service_connection(Connection& c, time_point now) {
+        time_point wake = now + std::chrono::milliseconds(RDT_SERVICE_INTERVAL_MS);
+        if (c.state == SYN_SENT) {
+            if (now - c.handshake_time >= c.rtt_estimator.rto()) {
+                c.rtt_estimator.backoff();
+                send_syn(c);
+            }
+            return wake;
+        }
+        if (c.ack_pending) {
+            send_ack(c);
+        }
+        if (now - c.last_received >= std::chrono::milliseconds(RDT_IDLE_TIMEOUT_MS)) {
+            close_connection(c);
+            return wake;
+        }
+
+        uint32_t seq;
+        time_point deadline;
+        bool backed_off = false;
+        bool timeout_reported = false;
+        while (c.retransmit_timers.peek(seq, deadline) && deadline <= now) {
+            c.retransmit_timers.pop();
+            if (!in_window(c, seq)) {
+                continue;
+            }
+            OutPacket& op = at(c, seq);
+            if (op.acked || op.deadline != deadline) {
+                continue;
+            }
+            if (!backed_off) {
+                c.rtt_estimator.backoff();
+                backed_off = true;
+            }
+            if (!timeout_reported && (!in_window(c, c.recovery_point) || op.retransmitted)) {
+                c.congestion->on_timeout(now);
+                c.recovery_point = c.next_seq - 1;
+                c.duplicate_ack_count = 0;
+                timeout_reported = true;
+            }
+            send_segment(c, op, true);
+        }
+        send_new_packets(c);
+
+        if (c.closing && c.in_flight.empty() && c.unsent.empty()) {
+            if (c.state == ESTABLISHED || now >= c.fin_deadline) {
+                if (c.fin_attempts == RDT_FIN_ATTEMPTS) {
+                    close_connection(c);
+                    return wake;
+                }
+                c.state = FIN_SENT;
+                c.fin_attempts++;
+                c.fin_deadline = now + c.rtt_estimator.rto();
+                send_fin(c, FIN);
+            }
+            wake = (std::min)(wake, c.fin_deadline);
+        }
+        else if (now - c.last_sent >= std::chrono::milliseconds(RDT_KEEPALIVE_MS)) {
+            send_ack(c);
+        }
+        if (c.retransmit_timers.peek(seq, deadline)) {
+            wake = (std::min)(wake, deadline);
+        }
+        return wake;
+    }
+
+    // 服务线程：接收一批数据报并处理，然后处理所有连接的定时器，整批发出
+    void service_loop() {
+        time_point wake_time = std::chrono::steady_clock::now();
+        while (running_) {
+            int count = batch_io_.receive_until(wake_time);
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < count; i++) {
+                handle_datagram(batch_io_.datagram(i));
+            }
+            auto now = std::chrono::steady_clock::now();
+            wake_time = now + std::chrono::milliseconds(RDT_SERVICE_INTERVAL_MS);
+            for (auto& entry : connections_) {
+                if (entry.second->state != CLOSED) {
+                    wake_time = (std::min)(wake_time, service_connection(*entry.second, now));
+                }
+            }
+            batch_io_.flush();
+        }
+    }
+
+    SOCKET socket_ = INVALID_SOCKET;
+    BatchSocket batch_io_;           // 接收一侧只由服务线程使用，发送一侧在mutex_下使用
+    uint64_t batch_peer_ = 0;        // 本批数据报的目的地址
+    std::thread service_thread_;
+    std::atomic<bool> running_{ false };
+    std::mutex mutex_;
+    std::condition_variable events_ready_;
+    std::condition_variable established_;
+    std::condition_variable drained_;    // 某个连接的发送队列清空（全部被确认）或连接关闭
+    std::unordered_map<uint32_t, std::unique_ptr<Connection>> connections_;
+    std::unordered_map<uint64_t, uint32_t> by_address_;
+    std::deque<RdtEvent> events_;
+    uint32_t next_handle_ = 1;
+    std::mt19937 random_{ std::random_device{}() };
+};
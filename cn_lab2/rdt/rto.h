@@ -0,0 +1,106 @@
+﻿/*
+ rto.h - 自适应超时重传
+ RttEstimator按RFC 6298估计SRTT/RTTVAR并计算RTO，超时后指数退避
+ TimerQueue按截止时间排序保存重传定时器，发送端每次只处理真正到期的数据包
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <queue>
+#include <vector>
+#include <algorithm>
+
+// ========== 超时重传常量 ==========
+const double MIN_RTO_MS = 20.0;     // RTO下限（毫秒），局域网下避免过早超时
+const double MAX_RTO_MS = 60000.0;  // RTO上限（毫秒），指数退避的封顶值
+const double RTO_CLOCK_GRANULARITY_MS = 1.0;  // 时钟粒度G
+
+/*
+ RttEstimator - RTT估计器
+ 第一个样本：SRTT = R，RTTVAR = R / 2
+ 之后：RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - R|，SRTT = 7/8 * SRTT + 1/8 * R
+ RTO = SRTT + max(G, 4 * RTTVAR)，限制在[MIN_RTO_MS, MAX_RTO_MS]
+ 按Karn算法，调用者只能用从未重传过的数据包产生样本
+ */
+class RttEstimator {
+public:
+    explicit RttEstimator(double initial_rto_ms) : rto_ms_(initial_rto_ms) {}
+
+    // 加入一个RTT样本（毫秒），同时清除之前的退避
+    void sample(double rtt_ms) {
+        if (!has_sample_) {
+            srtt_ms_ = rtt_ms;
+            rttvar_ms_ = rtt_ms / 2;
+            has_sample_ = true;
+        }
+        else {
+            double err = srtt_ms_ > rtt_ms ? srtt_ms_ - rtt_ms : rtt_ms - srtt_ms_;
+            rttvar_ms_ = 0.75 * rttvar_ms_ + 0.25 * err;
+            srtt_ms_ = 0.875 * srtt_ms_ + 0.125 * rtt_ms;
+        }
+        rto_ms_ = clamp(srtt_ms_ + (std::max)(RTO_CLOCK_GRANULARITY_MS, 4 * rttvar_ms_));
+    }
+
+    // 超时事件：RTO加倍
+    void backoff() {
+        rto_ms_ = clamp(rto_ms_ * 2);
+    }
+
+    bool has_sample() const { return has_sample_; }
+    double srtt_ms() const { return srtt_ms_; }
+    double rttvar_ms() const { return rttvar_ms_; }
+    double rto_ms() const { return rto_ms_; }
+
+    std::chrono::steady_clock::duration rto() const {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(rto_ms_));
+    }
+
+private:
+    static double clamp(double rto_ms) {
+        return (std::min)(MAX_RTO_MS, (std::max)(MIN_RTO_MS, rto_ms));
+    }
+
+    bool has_sample_ = false;
+    double srtt_ms_ = 0;
+    double rttvar_ms_ = 0;
+    double rto_ms_;
+};
+
+/*
+ TimerQueue - 按截止时间排序的重传定时器队列（最小堆）
+ 数据包每发送一次就登记一个定时器，不支持删除：
+ 被确认或重新发送过的数据包留下的旧定时器由调用者在peek时识别并丢弃
+ */
+class TimerQueue {
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    void schedule(uint32_t seq_num, time_point deadline) {
+        heap_.push(Timer{ deadline, seq_num });
+    }
+
+    // 查看最早到期的定时器，队列为空时返回false
+    bool peek(uint32_t& seq_num, time_point& deadline) const {
+        if (heap_.empty()) {
+            return false;
+        }
+        seq_num = heap_.top().seq_num;
+        deadline = heap_.top().deadline;
+        return true;
+    }
+
+    void pop() { heap_.pop(); }
+    bool empty() const { return heap_.empty(); }
+    size_t size() const { return heap_.size(); }
+
+private:
+    struct Timer {
+        time_point deadline;
+        uint32_t seq_num;
+        bool operator>(const Timer& other) const { return deadline > other.deadline; }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> heap_;
+};
@@ -0,0 +1,245 @@
+﻿/*
+ telemetry.h - 定时采样的传输遥测
+ 采样线程每隔固定间隔调用一次采样回调，回调为每个流填写一行样本（编号、状态和一组数值列）
+ 1. 轨迹文件：每行样本追加到文件，扩展名为.json或.jsonl时每行一个JSON对象，否则为CSV
+ 2. 统计端点：在本机回环地址的TCP端口上应答HTTP请求，返回最近一轮样本的JSON
+ 热路径上没有任何额外操作：回调只在采样时短暂加锁读取已有的状态和计数器，开销由采样间隔决定
+ */
+
+#pragma once
+
+#include "common.h"
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ========== 遥测常量 ==========
+const int TELEMETRY_DEFAULT_INTERVAL_MS = 100;  // 默认采样间隔（毫秒）
+const int TELEMETRY_POLL_MS = 200;              // 统计端点检查停止标志的间隔
+
+// 一行样本：一个流在某个采样时刻的状态
+struct TelemetryRow {
+    std::string id;              // 流的编号，例如"stream 0"
+    const char* state = "";      // 状态名（拥塞控制状态或会话状态），必须是字符串常量
+    std::vector<double> values;  // 与列名一一对应
+};
+
+/*
+ Telemetry - 采样线程、轨迹文件和统计端点
+ start()之后按间隔采样，stop()时再采样一次，保证轨迹包含结束时的状态
+ */
+class Telemetry {
+public:
+    typedef std::function<void(std::vector<TelemetryRow>&)> Sampler;
+
+    Telemetry() = default;
+    ~Telemetry() { stop(); }
+
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    /*
+     start - 打开轨迹文件和统计端点，启动采样线程
+     @param trace_path 轨迹文件路径，nullptr表示不写文件
+     @param stats_port 统计端点的TCP端口，0表示不开放
+     @param interval_ms 采样间隔
+     @param columns 数值列的列名
+     @param sampler 采样回调，在采样线程中调用
+     @return false表示轨迹文件无法创建或端口无法监听
+     */
+    bool start(const char* trace_path, int stats_port, int interval_ms, const std::vector<std::string>& columns, Sampler sampler) {
+        columns_ = columns;
+        sampler_ = sampler;
+        interval_ = std::chrono::milliseconds(interval_ms);
+        if (trace_path != nullptr) {
+            size_t len = strlen(trace_path);
+            json_ = (len >= 5 && strcmp(trace_path + len - 5, ".json") == 0) || (len >= 6 && strcmp(trace_path + len - 6, ".jsonl") == 0);
+            trace_.open(trace_path, std::ios::trunc);
+            if (!trace_) {
+                return false;
+            }
+            trace_ << std::setprecision(10);
+            if (!json_) {
+                trace_ << "time_s,id,state";
+                for (const std::string& column : columns_) {
+                    trace_ << "," << column;
+                }
+                trace_ << "\n";
+            }
+        }
+        if (stats_port != 0 && !open_endpoint(stats_port)) {
+            return false;
+        }
+        start_time_ = std::chrono::steady_clock::now();
+        stop_ = false;
+        sample_thread_ = std::thread(&Telemetry::run_sampler, this);
+        if (listen_socket_ != INVALID_SOCKET) {
+            endpoint_thread_ = std::thread(&Telemetry::run_endpoint, this);
+        }
+        return true;
+    }
+
+    // 停止采样（最后再采样一次）并关闭轨迹文件和统计端点
+    void stop() {
+        if (!sample_thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        stop_cv_.notify_one();
+        sample_thread_.join();
+        if (endpoint_thread_.joinable()) {
+            endpoint_thread_.join();
+        }
+        if (listen_socket_ != INVALID_SOCKET) {
+            closesocket(listen_socket_);
+            listen_socket_ = INVALID_SOCKET;
+        }
+        trace_.close();
+    }
+
+private:
+    // 采样线程：按间隔采样，直到stop()
+    void run_sampler() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto next = start_time_ + interval_;
+        while (!stop_cv_.wait_until(lock, next, [this] { return stop_; })) {
+            lock.unlock();
+            sample();
+            lock.lock();
+            next += interval_;
+        }
+        lock.unlock();
+        sample();
+    }
+
+    // 采样一轮：写入轨迹文件，并替换统计端点返回的JSON
+    void sample() {
+        rows_.clear();
+        sampler_(rows_);
+        double time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+        std::ostringstream latest;
+        latest << std::setprecision(10) << "{\"time_s\":" << time_s << ",\"rows\":[";
+        for (size_t i = 0; i < rows_.size(); i++) {
+            const TelemetryRow& row = rows_[i];
+            latest << (i > 0 ? "," : "") << json_object(time_s, row);
+            if (!trace_.is_open()) {
+                continue;
+            }
+            if (json_) {
+                trace_ << json_object(time_s, row) << "\n";
+            }
+            else {
+                trace_ << time_s << "," << row.id << "," << row.state;
+                for (double value : row.values) {
+                    trace_ << "," << value;
+                }
+                trace_ << "\n";
+            }
+        }
+        latest << "]}";
+        if (trace_.is_open()) {
+            trace_.flush();  // 进程异常退出时轨迹也是完整的
+        }
+        std::lock_guard<std::mutex> lock(latest_mutex_);
+        latest_ = latest.str();
+    }
+
+    std::string json_object(double time_s, const TelemetryRow& row) const {
+        std::ostringstream out;
+        out << std::setprecision(10) << "{\"time_s\":" << time_s << ",\"id\":\"" << row.id << "\",\"state\":\"" << row.state << "\"";
+        for (size_t i = 0; i < row.values.size() && i < columns_.size(); i++) {
+            out << ",\"" << columns_[i] << "\":" << row.values[i];
+        }
+        out << "}";
+        return out.str();
+    }
+
+    bool open_endpoint(int port) {
+        listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listen_socket_ == INVALID_SOCKET) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((u_short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // 只对本机开放
+        if (bind(listen_socket_, (const sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(listen_socket_, 4) == SOCKET_ERROR) {
+            closesocket(listen_socket_);
+            listen_socket_ = INVALID_SOCKET;
+            return false;
+        }
+        return true;
+    }
+
+    static bool wait_readable(SOCKET s, int timeout_ms) {
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(s, &read_set);
+        timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        return select((int)s + 1, &read_set, NULL, NULL, &tv) > 0;
+    }
+
+    // 统计端点线程：每个连接读取请求（内容不论），返回最近一轮样本后关闭
+    void run_endpoint() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_) {
+                    return;
+                }
+            }
+            if (!wait_readable(listen_socket_, TELEMETRY_POLL_MS)) {
+                continue;
+            }
+            SOCKET client = accept(listen_socket_, NULL, NULL);
+            if (client == INVALID_SOCKET) {
+                continue;
+            }
+            char request[1024];
+            if (wait_readable(client, TELEMETRY_POLL_MS)) {
+                recv(client, request, sizeof(request), 0);
+            }
+            std::string body;
+            {
+                std::lock_guard<std::mutex> lock(latest_mutex_);
+                body = latest_.empty() ? "{\"time_s\":0,\"rows\":[]}" : latest_;
+            }
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            send(client, response.data(), (int)response.size(), 0);
+            closesocket(client);
+        }
+    }
+
+    std::vector<std::string> columns_;
+    Sampler sampler_;
+    std::chrono::steady_clock::duration interval_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::vector<TelemetryRow> rows_;  // 只在采样线程中使用
+    std::ofstream trace_;
+    bool json_ = false;
+    SOCKET listen_socket_ = INVALID_SOCKET;
+    std::thread sample_thread_;
+    std::thread endpoint_thread_;
+
+    std::mutex mutex_;                 // 保护stop_
+    std::condition_variable stop_cv_;
+    bool stop_ = false;
+    std::mutex latest_mutex_;          // 保护latest_
+    std::string latest_;               // 最近一轮样本的JSON
+};
@@ -0,0 +1,105 @@
+﻿/*
+ batch_unpack.h - 批量传输的拆分
+ 批量传输收到的是清单加上各个文件内容依次相接的字节流，按单个文件的方式接收和核对
+ 完整接收并核对通过后，按清单把字节流拆分成输出目录中的独立文件
+ 清单中的文件名来自网络，只保留文件名本身，不允许借助路径分隔符或".."写到输出目录之外
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include "file_sink.h"
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+/*
+ batch_file_name - 把清单中的文件名变成输出目录中安全的文件名
+ 路径分隔符、驱动器号的冒号和控制字符替换为'_'，空名、"."和".."改为按下标命名
+ @param name 清单中的文件名
+ @param index 文件在清单中的下标
+ */
+inline std::string batch_file_name(std::string name, uint32_t index) {
+    for (char& c : name) {
+        if (c == '/' || c == '\\' || c == ':' || (unsigned char)c < 0x20) {
+            c = '_';
+        }
+    }
+    if (name.empty() || name == "." || name == "..") {
+        name = "file_" + std::to_string(index);
+    }
+    return name;
+}
+
+// make_directory - 创建目录，已经存在时也算成功
+inline bool make_directory(const std::string& path) {
+#ifdef _WIN32
+    return CreateDirectoryA(path.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+/*
+ unpack_batch - 按清单把字节流拆分成目录中的独立文件
+ 先完整解析清单并检查各文件大小之和与字节流一致，清单损坏时一个文件也不创建
+ @param stream 已经写完的字节流文件
+ @param stream_size 字节流的字节数
+ @param directory 输出目录，不存在时创建
+ @param buffer 复制用的缓冲区
+ @param files 输出：拆出的文件数
+ @return false表示清单损坏、目录无法创建或有文件写入失败
+ */
+inline bool unpack_batch(FileSink& stream, uint64_t stream_size, const std::string& directory, std::vector<char>& buffer, uint32_t& files) {
+    files = 0;
+    BatchHeader header;
+    if (stream.read_at(0, (char*)&header, sizeof(header)) != sizeof(header) || header.magic != BATCH_MAGIC || header.file_count > MAX_BATCH_FILES) {
+        return false;
+    }
+    // 解析清单
+    std::vector<BatchEntry> entries(header.file_count);
+    std::vector<std::string> names(header.file_count);
+    uint64_t offset = sizeof(header);
+    uint64_t content_size = 0;
+    for (uint32_t i = 0; i < header.file_count; i++) {
+        if (stream.read_at(offset, (char*)&entries[i], sizeof(BatchEntry)) != sizeof(BatchEntry)) {
+            return false;
+        }
+        offset += sizeof(BatchEntry);
+        names[i].resize(entries[i].name_length);
+        if (entries[i].name_length > 0 && stream.read_at(offset, &names[i][0], entries[i].name_length) != entries[i].name_length) {
+            return false;
+        }
+        offset += entries[i].name_length;
+        content_size += entries[i].size;
+    }
+    if (offset + content_size != stream_size || !make_directory(directory)) {
+        return false;
+    }
+    // 依次复制每个文件的内容
+    for (uint32_t i = 0; i < header.file_count; i++) {
+        FileSink output;
+        if (!output.open((directory + "/" + batch_file_name(names[i], i)).c_str())) {
+            return false;
+        }
+        for (uint64_t copied = 0; copied < entries[i].size; ) {
+            size_t want = (size_t)(std::min)((uint64_t)buffer.size(), entries[i].size - copied);
+            size_t got = stream.read_at(offset + copied, buffer.data(), want);
+            if (got == 0 || !output.write_at(copied, buffer.data(), got)) {
+                return false;
+            }
+            copied += got;
+        }
+        offset += entries[i].size;
+        files++;
+    }
+    return true;
+}
@@ -0,0 +1,85 @@
+﻿/*
+ block_assembler.h - 压缩块的重组
+ 压缩传输中一个块占用若干个连续的序列号，只有第一个数据包（BLOCK_START）以块头开头
+ 数据包可能乱序到达：先按序列号暂存，一个块的数据包全部到达后拼成完整的块交给调用者解压写入
+ 只暂存接收窗口内第一次收到的数据包，暂存量不超过一个接收窗口
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <vector>
+
+/*
+ BlockAssembler - 一个流的压缩块重组器
+ 块之间互不依赖，先凑齐的块先交出，不必等待前面的块
+ */
+class BlockAssembler {
+public:
+    /*
+     add - 暂存一个第一次收到的数据包
+     @param seq 序列号
+     @param data 载荷
+     @param len 载荷长度
+     @param block_start 数据包带BLOCK_START标志
+     @param segment_size 分段大小：块中除最后一个外的数据包都是这么长
+     @param block 输出：这个数据包所在的块凑齐时为整个块（块头 + 数据）
+     @return true表示有一个块凑齐了
+     */
+    bool add(uint32_t seq, const char* data, uint16_t len, bool block_start, uint16_t segment_size, std::vector<char>& block) {
+        auto it = segments_.emplace(seq, Segment()).first;
+        it->second.block_start = block_start;
+        it->second.data.assign(data, data + len);
+        // 向前找到块的第一个数据包；中间缺包时块肯定还没凑齐
+        while (!it->second.block_start) {
+            if (it == segments_.begin()) {
+                return false;
+            }
+            auto prev = std::prev(it);
+            if (prev->first != it->first - 1) {
+                return false;
+            }
+            it = prev;
+        }
+        return take_block(it, segment_size, block);
+    }
+
+    // 暂存的数据包数
+    size_t pending() const { return segments_.size(); }
+
+private:
+    struct Segment {
+        bool block_start = false;
+        std::vector<char> data;
+    };
+
+    // 从块的第一个数据包起检查块是否完整，完整时拼接并移出暂存
+    bool take_block(std::map<uint32_t, Segment>::iterator head, uint16_t segment_size, std::vector<char>& block) {
+        if (head->second.data.size() < sizeof(CompressedBlockHeader)) {
+            return false;
+        }
+        CompressedBlockHeader header;
+        memcpy(&header, head->second.data.data(), sizeof(header));
+        uint64_t block_size = sizeof(header) + (uint64_t)header.stored_length;
+        uint64_t packet_count = (block_size + segment_size - 1) / segment_size;
+        auto it = head;
+        for (uint64_t i = 0; i < packet_count; i++, ++it) {
+            if (it == segments_.end() || it->first != head->first + i) {
+                return false;
+            }
+        }
+        block.clear();
+        block.reserve((size_t)block_size);
+        for (auto part = head; part != it; ++part) {
+            block.insert(block.end(), part->second.data.begin(), part->second.data.end());
+        }
+        segments_.erase(head, it);
+        return block.size() == block_size;  // 长度不符说明块头与数据包长度矛盾，丢弃这个块
+    }
+
+    std::map<uint32_t, Segment> segments_;  // 还没凑成块的数据包，按序列号排序
+};
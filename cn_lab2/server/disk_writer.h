@@ -0,0 +1,321 @@
+﻿/*
+ disk_writer.h - 异步写文件
+ 网络线程只把载荷复制进内存中的写入段：文件中首尾相接的数据包合并为一段，每段最多WRITER_RUN_SIZE字节；
+ 新段只按第一个数据包的大小分配，之后成倍扩大，丢包时大量只有一个数据包的段占用的内存与积压的字节数相当
+ 专门的写线程把积累下来的段整批取走后逐段写入文件，网络线程同时往另一组段里继续填写，从不等待磁盘
+ 压缩块原样交给写线程，解压也在写线程中进行
+ 已交出、还没写入文件的字节数（积压）从接收窗口中扣除，磁盘跟不上时发送方随之减速，积压不会无限增长
+ SYN给出文件大小时写线程先按最终大小预分配文件；文件完整接收后读回整个文件，与FIN中的CRC32C核对，结果由verify_state()取得
+ 批量传输核对通过后，写线程再按清单把收到的字节流拆分成独立的文件，然后删除字节流文件
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include "file_sink.h"
+#include "../rdt/lz_block.h"
+#include "../rdt/log.h"
+#include "../rdt/checksum.h"
+#include "batch_unpack.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ========== 写文件常量 ==========
+const size_t WRITER_RUN_SIZE = 1 << 20;  // 一个写入段的最大字节数，一次写调用写一段
+const size_t WRITER_SPARE_RUNS = 8;      // 写完后留作复用的缓冲区个数，避免每段重新分配
+
+// 输出文件的核对结果，写线程关闭文件时给出
+enum VerifyState {
+    VERIFY_PENDING,  // 文件还没有关闭，或正在读回核对
+    VERIFY_PASSED,   // 与发送方的CRC32C一致
+    VERIFY_FAILED,   // 不一致，或有数据写入失败
+    VERIFY_SKIPPED,  // 没有核对（文件大小或CRC32C未知），写入都成功
+};
+
+/*
+ DiskWriter - 一个输出文件的写线程
+ open()之后由网络线程调用write()/write_block()交出数据，finish()或stop()之后写线程写完剩余的数据并关闭文件
+ */
+class DiskWriter {
+public:
+    DiskWriter() = default;
+    ~DiskWriter() { stop(); }
+
+    DiskWriter(const DiskWriter&) = delete;
+    DiskWriter& operator=(const DiskWriter&) = delete;
+
+    /*
+     open - 创建（或截断）输出文件并启动写线程
+     @param keep_existing 为true时保留已有内容，用于断点续传
+     @param session_number 日志中的会话编号
+     @param file_size SYN给出的文件大小，用于预分配和核对；0表示未知
+     @return true表示成功
+     */
+    bool open(const char* path, bool keep_existing, uint32_t session_number, uint64_t file_size = 0) {
+        if (!sink_.open(path, keep_existing)) {
+            return false;
+        }
+        path_ = path;
+        session_number_ = session_number;
+        file_size_ = file_size;
+        thread_ = std::thread(&DiskWriter::run, this);
+        return true;
+    }
+
+    /*
+     unpack_to - 批量传输：核对通过后把字节流拆分到这个目录，须在open()之前调用
+     */
+    void unpack_to(const std::string& directory) {
+        unpack_directory_ = directory;
+    }
+
+    /*
+     write - 交出一段要写到文件指定偏移的数据
+     与上一段在文件中首尾相接且上一段还没满时直接接在后面，段的容量不够时成倍扩大，最多到WRITER_RUN_SIZE
+     */
+    void write(uint64_t offset, const char* data, size_t len) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool wake = filling_.empty();
+        if (filling_.empty() || filling_.back().compressed || filling_.back().offset + filling_.back().data.size() != offset ||
+            filling_.back().data.size() + len > WRITER_RUN_SIZE) {
+            filling_.push_back(take_spare(offset, len));
+        }
+        std::vector<char>& run = filling_.back().data;
+        if (run.size() + len > run.capacity()) {
+            run.reserve((std::min)((std::max)(run.capacity() * 2, run.size() + len), WRITER_RUN_SIZE));
+        }
+        run.insert(run.end(), data, data + len);
+        queued_bytes_ += len;
+        if (wake) {
+            cv_.notify_one();  // 写线程只在没有待写的段时等待
+        }
+    }
+
+    /*
+     write_block - 交出一个凑齐的压缩块（块头 + 块数据），写线程解压后按块头中的偏移写入
+     @param block 块的内容被移走，调用后为空
+     */
+    void write_block(std::vector<char>& block) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool wake = filling_.empty();
+        Run run;
+        run.compressed = true;
+        run.data.swap(block);
+        queued_bytes_ += run.data.size();
+        filling_.push_back(std::move(run));
+        if (wake) {
+            cv_.notify_one();
+        }
+    }
+
+    // 写线程关闭文件之前为VERIFY_PENDING
+    VerifyState verify_state() const {
+        return verify_state_.load();
+    }
+
+    // 已交出、还没写入文件的字节数
+    uint64_t backlog() const {
+        return queued_bytes_.load(std::memory_order_relaxed) - written_bytes_.load(std::memory_order_relaxed);
+    }
+
+    /*
+     sync - 等到调用之前交出的数据全部写入，再把文件刷到磁盘
+     保存断点续传进度之前调用，会等待磁盘，不能在网络线程的热路径上使用
+     @return false表示有数据写入失败或刷新失败
+     */
+    bool sync() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            uint64_t target = queued_bytes_;
+            drained_cv_.wait(lock, [this, target] { return written_bytes_ >= target; });
+        }
+        return write_errors_ == 0 && sink_.sync();
+    }
+
+    /*
+     finish - 写完已交出的数据后关闭文件，不等待
+     @param verify 为true时（文件已完整接收）关闭前读回文件与file_crc核对，open()时没有给出文件大小则不核对
+     @param file_crc 发送方在FIN中给出的整个文件的CRC32C
+     */
+    void finish(bool verify = false, uint32_t file_crc = 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (verify && !verify_) {
+            file_crc_ = file_crc;
+        }
+        verify_ = verify_ || verify;
+        closing_ = true;
+        cv_.notify_one();
+    }
+
+    // stop - 写完已交出的数据，关闭文件并等待写线程退出
+    void stop() {
+        finish();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+private:
+    // 一个写入段：文件中连续的一段数据，或一个待解压的压缩块
+    struct Run {
+        uint64_t offset = 0;
+        bool compressed = false;
+        std::vector<char> data;
+    };
+
+    // 取一个复用的缓冲区作为新的写入段，没有时按第一段数据的大小分配；调用时必须持有mutex_
+    Run take_spare(uint64_t offset, size_t len) {
+        Run run;
+        run.offset = offset;
+        if (!spare_.empty()) {
+            run.data.swap(spare_.back());
+            spare_.pop_back();
+        }
+        else {
+            run.data.reserve(len);
+        }
+        return run;
+    }
+
+    // 写线程：交换出已经积累的段，在锁外逐段写入
+    void run() {
+        if (file_size_ > 0 && !sink_.preallocate(file_size_)) {
+            LOG_DEBUG("[session {}] Output file not preallocated", session_number_);
+        }
+        std::vector<Run> writing;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return !filling_.empty() || closing_; });
+            if (filling_.empty()) {
+                break;  // 已经要求关闭，且没有待写的数据
+            }
+            writing.swap(filling_);
+            lock.unlock();
+            uint64_t bytes = 0;
+            for (Run& run : writing) {
+                bytes += run.data.size();
+                write_run(run);
+            }
+            lock.lock();
+            for (Run& run : writing) {
+                if (!run.compressed && spare_.size() < WRITER_SPARE_RUNS) {
+                    run.data.clear();
+                    spare_.push_back(std::move(run.data));
+                }
+            }
+            writing.clear();
+            written_bytes_ += bytes;
+            drained_cv_.notify_all();
+        }
+        bool verify = verify_ && file_size_ > 0;
+        lock.unlock();
+        bool unpacked = false;
+        bool verified = verify && verify_file();
+        if (verified && !unpack_directory_.empty()) {
+            uint32_t files = 0;
+            unpacked = unpack_batch(sink_, file_size_, unpack_directory_, raw_, files);
+            if (unpacked) {
+                LOG_INFO("[session {}] Unpacked {} files", session_number_, files);
+            }
+            else {
+                LOG_ERROR("[session {}] Could not unpack the batch ({} files written), keeping the received stream", session_number_, files);
+            }
+        }
+        sink_.close();
+        if (unpacked) {
+            std::remove(path_.c_str());
+        }
+        verify_state_ = verified ? VERIFY_PASSED : (verify || write_errors_ > 0) ? VERIFY_FAILED : VERIFY_SKIPPED;
+    }
+
+    /*
+     verify_file - 读回整个文件计算CRC32C，与FIN中给出的比较，结果写入日志
+     @return true表示一致
+     */
+    bool verify_file() {
+        raw_.resize(WRITER_RUN_SIZE);
+        uint32_t crc = 0xFFFFFFFF;
+        uint64_t offset = 0;
+        while (offset < file_size_) {
+            size_t want = (size_t)(std::min)((uint64_t)raw_.size(), file_size_ - offset);
+            size_t got = sink_.read_at(offset, raw_.data(), want);
+            if (got == 0) {
+                break;
+            }
+            crc = crc32c_update(crc, raw_.data(), got);
+            offset += got;
+        }
+        crc = ~crc;
+        if (offset == file_size_ && crc == file_crc_ && write_errors_ == 0) {
+            LOG_INFO("[session {}] Verified {} bytes against the sender's CRC32C", session_number_, file_size_);
+            return true;
+        }
+        LOG_ERROR("[session {}] Output file does not match the sender's: read {} of {} bytes, CRC32C {} (expected {})",
+            session_number_, offset, file_size_, crc, file_crc_);
+        return false;
+    }
+
+    void write_run(const Run& run) {
+        if (!run.compressed) {
+            if (!sink_.write_at(run.offset, run.data.data(), run.data.size())) {
+                write_errors_++;
+                LOG_ERROR("[session {}] Write to output file failed", session_number_);
+            }
+            return;
+        }
+        // 压缩块：解压后按块头中的偏移写入，块之间互不依赖
+        CompressedBlockHeader header;
+        memcpy(&header, run.data.data(), sizeof(header));
+        const char* stored = run.data.data() + sizeof(header);
+        const char* data = NULL;
+        if (header.method == COMPRESS_STORED && header.stored_length == header.raw_length) {
+            data = stored;
+        }
+        else if (header.method == COMPRESS_LZ && header.raw_length <= (uint32_t)COMPRESS_BLOCK_SIZE) {
+            raw_.resize(header.raw_length);
+            if (lz_decompress(stored, header.stored_length, raw_.data(), header.raw_length)) {
+                data = raw_.data();
+            }
+        }
+        if (data == NULL) {
+            write_errors_++;
+            LOG_ERROR("[session {}] Corrupt compressed block at offset {}", session_number_, header.raw_offset);
+            return;
+        }
+        if (!sink_.write_at(header.raw_offset, data, header.raw_length)) {
+            write_errors_++;
+            LOG_ERROR("[session {}] Write to output file failed", session_number_);
+        }
+    }
+
+    FileSink sink_;
+    std::string path_;
+    std::string unpack_directory_;  // 批量传输的输出目录，空表示不拆分
+    uint32_t session_number_ = 0;
+    uint64_t file_size_ = 0;  // 0表示文件大小未知
+    uint32_t file_crc_ = 0;   // finish()给出，写线程在closing_之后才读取
+    std::thread thread_;
+    std::vector<char> raw_;  // 解压和核对用的缓冲区，只在写线程中使用
+
+    // ========== 与网络线程共享（由mutex_保护）==========
+    std::mutex mutex_;
+    std::condition_variable cv_;          // 有新的段或要求关闭时唤醒写线程
+    std::condition_variable drained_cv_;  // 写完一批后唤醒sync()
+    std::vector<Run> filling_;            // 网络线程正在填写的段，写线程整批换走
+    std::vector<std::vector<char>> spare_;
+    bool closing_ = false;
+    bool verify_ = false;
+
+    std::atomic<uint64_t> queued_bytes_{ 0 };   // 累计交出的字节数（只在持有mutex_时增加）
+    std::atomic<uint64_t> written_bytes_{ 0 };  // 累计写入（或写入失败）的字节数
+    std::atomic<uint32_t> write_errors_{ 0 };
+    std::atomic<VerifyState> verify_state_{ VERIFY_PENDING };
+};
@@ -0,0 +1,142 @@
+﻿/*
+ file_sink.h - 定位写文件
+ 每个数据包在文件中的偏移由序列号唯一确定，收到即按偏移写入
+ 乱序到达的数据包不需要在内存中排队
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ FileSink - 支持按偏移写入的输出文件
+ */
+class FileSink {
+public:
+    FileSink() = default;
+    ~FileSink() { close(); }
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    /*
+     open - 创建（或截断）输出文件
+     @param keep_existing 为true时保留已有内容，用于断点续传
+     @return true表示成功
+     */
+    bool open(const char* path, bool keep_existing = false) {
+        close();
+#ifdef _WIN32
+        // 允许共享读写：接管同一个传输的新会话在旧会话的写线程关闭文件之前就要打开它
+        handle_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, keep_existing ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        return handle_ != INVALID_HANDLE_VALUE;
+#else
+        fd_ = ::open(path, O_RDWR | O_CREAT | (keep_existing ? 0 : O_TRUNC), 0644);
+        return fd_ >= 0;
+#endif
+    }
+
+    bool is_open() const {
+#ifdef _WIN32
+        return handle_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ >= 0;
+#endif
+    }
+
+    /*
+     write_at - 将数据写到文件的指定偏移
+     @return true表示全部写入成功
+     */
+    bool write_at(uint64_t offset, const char* data, size_t len) {
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        return WriteFile(handle_, data, static_cast<DWORD>(len), &written, &ov) && written == len;
+#else
+        return pwrite(fd_, data, len, static_cast<off_t>(offset)) == static_cast<ssize_t>(len);
+#endif
+    }
+
+    /*
+     read_at - 从文件的指定偏移读取数据，用于写完后核对文件内容
+     @return 实际读到的字节数，出错时为0
+     */
+    size_t read_at(uint64_t offset, char* data, size_t len) {
+#ifdef _WIN32
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD read = 0;
+        return ReadFile(handle_, data, static_cast<DWORD>(len), &read, &ov) ? read : 0;
+#else
+        ssize_t n = pread(fd_, data, len, static_cast<off_t>(offset));
+        return n > 0 ? static_cast<size_t>(n) : 0;
+#endif
+    }
+
+    /*
+     preallocate - 按最终大小一次性为文件分配磁盘空间
+     乱序写入不再零散地扩展文件，文件系统可以分配连续的区段；不支持的文件系统上什么也不做
+     不会截断已有的内容
+     @return true表示已经分配
+     */
+    bool preallocate(uint64_t size) {
+#ifdef _WIN32
+        LARGE_INTEGER current, target;
+        target.QuadPart = static_cast<LONGLONG>(size);
+        if (!GetFileSizeEx(handle_, &current) || current.QuadPart >= target.QuadPart) {
+            return false;
+        }
+        return SetFilePointerEx(handle_, target, NULL, FILE_BEGIN) && SetEndOfFile(handle_);
+#elif defined(__linux__)
+        return fallocate(fd_, 0, 0, static_cast<off_t>(size)) == 0;  // 不像posix_fallocate那样在不支持时逐块写零
+#else
+        (void)size;
+        return false;
+#endif
+    }
+
+    /*
+     sync - 把已写入的数据刷到磁盘
+     保存断点续传进度之前调用，保证进度文件中记录的数据包不会因为崩溃而丢失
+     */
+    bool sync() {
+#ifdef _WIN32
+        return FlushFileBuffers(handle_) != 0;
+#else
+        return fsync(fd_) == 0;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle_);
+            handle_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+    int fd_ = -1;
+#endif
+};
@@ -0,0 +1,112 @@
+﻿/*
+ progress.h - 断点续传的接收进度文件
+ 进度文件保存在输出文件旁边（<输出文件名>.progress），记录传输ID、连续接收的高水位和已写入数据包的位图
+ 位图按文件中的数据包下标（文件偏移 / 分段大小）索引，与发送方的条带划分无关；分段大小不同的上传不能续传
+ 写入顺序：先把输出文件刷到磁盘，再写临时文件并改名覆盖旧的进度文件，
+ 因此进度文件中记录的数据包一定已经落盘，进程或机器崩溃后进度文件要么是旧版本要么是新版本
+ */
+
+#pragma once
+
+#include "recv_bitmap.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// ========== 进度文件格式 ==========
+const uint32_t PROGRESS_MAGIC = 0x50544452;  // "RDTP"
+const uint32_t PROGRESS_VERSION = 2;
+const int PROGRESS_SAVE_INTERVAL_MS = 1000;  // 有新数据时保存进度的间隔
+
+struct ProgressHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t transfer_id;         // 客户端在SYN中给出的传输ID
+    uint64_t contiguous_packets;  // 高水位：从文件开头起连续写入的数据包数
+    uint64_t word_count;          // 之后跟随的位图64位字数
+    uint32_t segment_size;        // 分段大小，位图的下标按它计算
+};
+
+// 进度文件路径：输出文件名加.progress后缀
+inline std::string progress_path(const std::string& output_path) {
+    return output_path + ".progress";
+}
+
+/*
+ save_progress - 原子地保存接收进度
+ 调用前必须已经把位图中记录的数据包刷到磁盘（FileSink::sync）
+ @param path 进度文件路径
+ @param transfer_id 传输ID
+ @param segment_size 分段大小
+ @param stored 已写入的数据包位图
+ @return true表示保存成功
+ */
+inline bool save_progress(const std::string& path, uint64_t transfer_id, uint32_t segment_size, const RecvBitmap& stored) {
+    std::string temp_path = path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    const std::vector<uint64_t>& words = stored.words();
+    ProgressHeader header;
+    memset(&header, 0, sizeof(header));  // 结构体末尾的填充也写入文件
+    header.magic = PROGRESS_MAGIC;
+    header.version = PROGRESS_VERSION;
+    header.transfer_id = transfer_id;
+    header.contiguous_packets = stored.next_missing(0);
+    header.word_count = words.size();
+    header.segment_size = segment_size;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (words.empty() || fwrite(words.data(), sizeof(uint64_t), words.size(), file) == words.size());
+    ok = fflush(file) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        remove(temp_path.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    return MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(temp_path.c_str(), path.c_str()) == 0;
+#endif
+}
+
+/*
+ load_progress - 读取接收进度
+ @param path 进度文件路径
+ @param transfer_id 期望的传输ID，文件中的ID不同时视为没有进度
+ @param segment_size 本次协商的分段大小，与保存时不同时同样视为没有进度
+ @param stored 输出：已写入的数据包位图
+ @return true表示读到了属于这个传输的进度
+ */
+inline bool load_progress(const std::string& path, uint64_t transfer_id, uint32_t segment_size, RecvBitmap& stored) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    ProgressHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRESS_MAGIC &&
+        header.version == PROGRESS_VERSION && header.transfer_id == transfer_id && header.segment_size == segment_size &&
+        header.word_count <= (1ull << 26);  // 位图不超过512MB，防止损坏的文件导致巨大的分配
+    std::vector<uint64_t> words;
+    if (ok) {
+        words.resize((size_t)header.word_count);
+        ok = words.empty() || fread(words.data(), sizeof(uint64_t), words.size(), file) == words.size();
+    }
+    fclose(file);
+    if (ok) {
+        stored.assign(std::move(words));
+    }
+    return ok;
+}
+
+// 传输完成后删除进度文件
+inline void remove_progress(const std::string& path) {
+    remove(path.c_str());
+}
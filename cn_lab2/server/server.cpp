@@ -1,17 +1,64 @@
 ﻿/*
 功能：实现基于UDP的可靠文件接收服务器
 特性：
-    1. 连接管理：三次握手接受连接
+    1. 连接管理：三次握手接受连接；多个客户端可以同时上传，按客户端地址和连接ID区分会话
     2. 差错检测：校验和验证
-    3. 选择确认：支持乱序接收，缓存乱序包
-    4. 流量控制：发送ACK通知客户端
+    3. 选择确认：支持乱序接收，乱序包按偏移直接写入文件，用位图记录到达情况
+    4. 流量控制：每个ACK通告接收窗口，握手时协商窗口缩放因子
+    5. 批量收发与延迟确认：一次取回一批数据包，按序到达的数据包合并为一个累计ACK
+    6. 日志：逐包日志写入异步日志缓冲区，由后台线程输出，默认只输出INFO及以上
+    7. 多线程：Linux上每个工作线程一个SO_REUSEPORT套接字，Windows上工作线程共享一个IOCP
+    8. 条带传输：一个文件由多个流并行发送，每个流按自己的序列号确认，数据按偏移写入同一个文件
+    9. 断点续传：定期把接收进度保存在输出文件旁边，同一文件再次上传时在SYN-ACK中告知每个流的起始序列号
+    10. 压缩传输：SYN带COMPRESS标志时同意压缩，数据包凑成完整的压缩块后解压并按块头中的偏移写入
+    11. 前向纠错：SYN带PARITY标志时同意FEC，校验组内只缺一个数据包时由校验包直接恢复，不等待重传
+    12. 路径MTU探测：应答客户端握手前的PROBE包，分段大小在握手中协商，文件偏移按协商的分段大小计算
+    13. 遥测：按固定间隔采样每个会话每个流的接收进度、空洞跨度、重复包、乱序深度和goodput，写入轨迹文件并通过HTTP统计端点提供
+    14. 异步写文件：每个会话的写线程把相接的数据包合并成大段写入，解压也在写线程中进行；写入积压从接收窗口中扣除，网络线程不等待磁盘
+    15. 文件元数据：SYN给出文件名和大小时预分配输出文件、接收位图一次分配到位，收齐最后一个字节即完成会话；
+        FIN带来发送方的CRC32C后，写完并读回文件核对
+    16. 批量传输：SYN给出文件数时收到的是清单加各文件内容的字节流，核对通过后按清单拆分到输出目录
  */
 
-#include "common.h"
-#include <fstream>
-#include <map>
+#include "../rdt/common.h"
+#include "../rdt/batch_io.h"
+#include "../rdt/log.h"
+#include "../rdt/lz_block.h"
+#include "../rdt/telemetry.h"
+#include "disk_writer.h"
+#include "recv_bitmap.h"
+#include "session.h"
 #include <algorithm>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <mstcpip.h>
+#endif
+
+// ========== 服务器全局状态 ==========
+SessionTable sessions;                          // 所有会话
+std::atomic<uint32_t> next_session_number(1);   // 下一个会话编号
+std::atomic<uint32_t> sessions_completed(0);    // 已完成的会话数
+std::atomic<bool> server_stopping(false);       // 工作线程退出标志
+uint32_t session_limit = 0;                     // 完成这么多个会话后退出，0表示一直运行
+uint64_t max_file_size = 64ULL << 30;           // SYN声明的文件大小上限（字节），超过的连接不接受
+std::mutex console_mutex;                       // 多个会话的统计信息整块输出，避免交错
+
+/*
+ Worker - 工作线程的私有状态
+ touched：本批数据包涉及的会话；pending：还有延迟确认未发送的会话
+ */
+struct Worker {
+    int index = 0;
+    SOCKET socket = INVALID_SOCKET;  // 发送ACK使用的套接字
+    std::vector<std::shared_ptr<Session>> touched;
+    std::vector<std::shared_ptr<Session>> pending;
+    std::chrono::steady_clock::time_point next_expiry_check;
+};
 
 /*
 错误处理函数
@@ -23,145 +70,1237 @@ void die(const char* message) {
 }
 
 /*
- 流程：
-    1. 初始化并绑定UDP套接字
-    2. 三次握手接受连接
-    3. 接收数据包，处理乱序
-    4. 写入文件
-    5. 发送ACK确认
-    6. 四次挥手关闭连接
- */
-int main() {
-    // ========== 初始化Winsock ==========
-    if (!initialize_winsock()) {
-        return 1;
+ fill_sack_blocks - 根据接收位图生成SACK块
+ 从期望序列号开始，依次找出已收到的连续区间，最多MAX_SACK_BLOCKS个
+ @param received 接收位图
+ @param expected_seq_num 期望接收的序列号（第一个空洞）
+ @param highest_seq_num 已收到的最大序列号
+ @param blocks 输出的SACK块数组
+ @return 生成的块数
+ */
+int fill_sack_blocks(const RecvBitmap& received, uint32_t expected_seq_num, uint32_t highest_seq_num, SackBlock* blocks) {
+    int count = 0;
+    uint32_t seq = expected_seq_num;
+    while (count < MAX_SACK_BLOCKS) {
+        uint32_t left = received.next_received(seq, highest_seq_num + 1);
+        if (left > highest_seq_num) {
+            break;  // 之后再没有收到的包
+        }
+        uint32_t right = received.next_missing(left);
+        blocks[count].left = left;
+        blocks[count].right = right;
+        count++;
+        seq = right;
+    }
+    return count;
+}
+
+/*
+ free_receive_window - 会话的每个流当前可以通告的接收窗口（数据包数）
+ 乱序的数据包直接交给写线程，不占用窗口；写线程还没写入文件的积压按分段大小折算后从窗口中扣除
+ */
+uint32_t free_receive_window(const Session& session) {
+    uint64_t backlog_segments = session.output_file.backlog() / session.segment_size;
+    return (uint32_t)(RECEIVE_WINDOW_SIZE - (std::min)(backlog_segments, (uint64_t)RECEIVE_WINDOW_SIZE));
+}
+
+/*
+ send_packet_to - 计算好校验和的数据包发给会话对端
+ */
+void send_packet_to(SOCKET s, const Packet& packet, const sockaddr_in& peer) {
+    sendto(s, (const char*)&packet, HEADER_SIZE + packet.data_len, 0, (const struct sockaddr*)&peer, sizeof(peer));
+}
+
+/*
+ send_ack - 发送一个流当前的累计ACK
+ 确认已按序接收的最高序列号，并在载荷中附带期望序列号之后已收到区间的SACK块
+ 调用时必须持有session.mutex
+ */
+void send_ack(Session& session, SessionStream& stream, uint8_t stream_id, SOCKET s) {
+    Packet ack_packet;
+    int sack_count = fill_sack_blocks(stream.received, stream.expected_seq_num, stream.highest_seq_num, reinterpret_cast<SackBlock*>(ack_packet.data));
+    LOG_TRACE("[session {}/{}] Received SEQ={}. Sending ACK for SEQ={}, SACK blocks={}", session.number, stream_id, stream.last_seq_num, stream.expected_seq_num - 1, sack_count);
+    ack_packet.seq_num = 0;
+    ack_packet.flags = ACK;
+    ack_packet.stream_id = stream_id;
+    ack_packet.ack_num = stream.expected_seq_num - 1;  // ACK = 已按序接收的最高序列号
+    ack_packet.window_size = advertised_window(free_receive_window(session), session.segment_size, session.window_scale);
+    ack_packet.data_len = sack_count * sizeof(SackBlock);
+    ack_packet.checksum = calculate_checksum(&ack_packet, session.checksum_mode);
+    send_packet_to(s, ack_packet, stream.peer);
+    stream.acks_sent++;
+    stream.unacked_segments = 0;
+    stream.ack_now = false;
+}
+
+/*
+ persist_progress - 保存会话的断点续传进度
+ 在会话锁内复制位图，在锁外等写线程写完位图中的数据包、刷新输出文件后再写进度文件，不阻塞这个会话的数据包处理
+ 复制之后交出的数据包留到下一次保存
+ 调用时不能持有session.mutex
+ */
+void persist_progress(Session& session) {
+    RecvBitmap snapshot;
+    {
+        std::lock_guard<std::mutex> lock(session.mutex);
+        if (!session.progress_dirty || session.output_closed) {
+            return;  // 输出文件已经交给写线程关闭，之前保存的进度在核对结束之前一直保留
+        }
+        snapshot = session.stored_packets;
+        session.progress_dirty = false;
+    }
+    std::lock_guard<std::mutex> lock(session.progress_mutex);
+    if (!session.progress_active) {
+        return;  // 会话已经结束，进度文件已删除
+    }
+    if (!session.output_file.sync() || !save_progress(progress_path(session.output_path), session.transfer_id, session.segment_size, snapshot)) {
+        LOG_WARN("[session {}] Could not save progress", session.number);
+    }
+}
+
+/*
+ stop_progress - 停止保存会话的进度
+ @param completed true表示写线程已经核对完文件，删除进度文件；
+                  false时写线程写完剩余的数据后直接关闭输出文件
+ 调用时必须持有session.mutex
+ */
+void stop_progress(Session& session, bool completed) {
+    std::lock_guard<std::mutex> lock(session.progress_mutex);
+    if (session.progress_active && completed) {
+        remove_progress(progress_path(session.output_path));
+    }
+    session.progress_active = false;
+    if (!completed && !session.output_closed) {
+        session.output_closed = true;
+        session.output_file.finish();
+    }
+}
+
+/*
+ close_output - 完整接收的文件：写线程写完剩余的数据后读回文件，与FIN中的CRC32C核对，再关闭输出文件
+ 最后一个字节通常比带CRC32C的FIN先到，先到的一方等另一方；所有流都结束或会话清除时仍没有CRC32C则不核对，直接关闭
+ 调用时必须持有session.mutex
+ */
+void close_output(Session& session) {
+    if (session.output_closed) {
+        return;
+    }
+    session.output_closed = true;
+    if (!session.file_crc_known) {
+        LOG_WARN("[session {}] The sender gave no CRC32C, output file not verified", session.number);
+    }
+    session.output_file.finish(session.file_crc_known, session.file_crc);
+}
+
+/*
+ progress_saver - 进度保存线程：每隔PROGRESS_SAVE_INTERVAL_MS保存有新数据的会话的进度
+ 退出时再保存一次，服务器停止时未完成的传输也能续传
+ */
+void progress_saver() {
+    while (!server_stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PROGRESS_SAVE_INTERVAL_MS));
+        for (const std::shared_ptr<Session>& session : sessions.snapshot()) {
+            persist_progress(*session);
+        }
+    }
+    for (const std::shared_ptr<Session>& session : sessions.snapshot()) {
+        persist_progress(*session);
+    }
+}
+
+/*
+ take_over_transfer - 同一个传输ID的新连接接管旧会话
+ 客户端中途退出后立即重新上传时，旧会话还没有超时；新会话已经按旧会话保存的进度打开了输出文件，
+ 这里再保存一次旧会话之后写入的进度，然后关闭它
+ */
+void take_over_transfer(const std::shared_ptr<Session>& old) {
+    persist_progress(*old);
+    std::lock_guard<std::mutex> lock(old->mutex);
+    if (old->state != SESSION_CLOSED) {
+        LOG_INFO("[session {}] Taken over by a new connection for the same transfer.", old->number);
+        old->state = SESSION_CLOSED;
+    }
+    stop_progress(*old, false);
+    sessions.erase(old);
+}
+
+/*
+ restore_stream - 按进度位图恢复一个流的接收状态
+ 本流范围内已写入的数据包在流的位图中标记为已收到，期望序列号为本流第一个缺失的数据包
+ @param stream_packets 本流负责的数据包数，不使用条带传输时不限
+ */
+void restore_stream(SessionStream& stream, const RecvBitmap& stored, uint64_t stream_packets) {
+    uint64_t stored_limit = (uint64_t)stored.words().size() * 64;
+    for (uint64_t i = 0; i < stream_packets && stream.first_packet + i < stored_limit; i++) {
+        if (stored.test((uint32_t)(stream.first_packet + i))) {
+            uint32_t seq = (uint32_t)i + 1;
+            stream.received.set(seq);
+            stream.highest_seq_num = seq;
+        }
+    }
+    stream.expected_seq_num = stream.received.next_missing(1);
+}
+
+/*
+ refuse_syn - 拒绝SYN：应答流数为0的SYN-ACK，客户端看到后放弃连接，不必等到握手超时
+ 不创建会话，客户端重传的SYN会重新检查一遍
+ */
+void refuse_syn(const Packet& syn, const sockaddr_in& from, uint32_t connection_id, SOCKET s) {
+    Packet refusal = { 0 };
+    refusal.flags = SYN | ACK;
+    refusal.ack_num = syn.seq_num + 1;
+    refusal.data_len = sizeof(HandshakeOptions);
+    HandshakeOptions* options = reinterpret_cast<HandshakeOptions*>(refusal.data);
+    options->connection_id = connection_id;
+    options->stream_count = 0;
+    refusal.checksum = calculate_checksum(&refusal);
+    send_packet_to(s, refusal, from);
+}
+
+/*
+ accept_syn - 收到新连接的SYN：创建会话，协商选项，发送SYN-ACK
+ SYN没有携带握手选项时，客户端不支持窗口缩放和条带传输，使用Internet校验和
+ 请求的流数不在[1, MAX_STREAMS]内时只接受1个流，客户端看到SYN-ACK中的流数不同会放弃连接
+ 声明的文件大小超过max_file_size、数据包数超出32位序列号、条带覆盖不了整个文件或输出文件无法创建时拒绝连接（refuse_syn），
+ 位图和预分配都取决于文件大小
+ */
+void accept_syn(const Packet& syn, const sockaddr_in& from, uint32_t connection_id, SOCKET s) {
+    std::shared_ptr<Session> session = std::make_shared<Session>();
+    session->key = make_session_key(from);
+    session->connection_id = connection_id;
+    session->number = next_session_number++;
+    session->start_time = session->last_activity = std::chrono::steady_clock::now();
+
+    uint8_t offered_scale = 0;
+    uint8_t stream_count = 1;
+    uint32_t stripe_packets = 0;
+    uint64_t transfer_id = 0;
+    if (syn.data_len >= sizeof(HandshakeOptions)) {
+        const HandshakeOptions* options = reinterpret_cast<const HandshakeOptions*>(syn.data);
+        offered_scale = options->window_scale;
+        if (options->checksum_mode == CHECKSUM_CRC32C) {
+            session->checksum_mode = CHECKSUM_CRC32C;  // 认识的模式才接受，否则回退到默认模式
+        }
+        if (options->stream_count >= 1 && options->stream_count <= MAX_STREAMS) {
+            stream_count = options->stream_count;
+            stripe_packets = options->stripe_packets;
+        }
+        transfer_id = options->transfer_id;
+        // 客户端探测得到的分段大小，超出本端能处理的范围时截到范围内，客户端看到大小不同会放弃连接
+        session->segment_size = (uint16_t)(std::min)((std::max)((int)options->segment_size, MIN_SEGMENT_SIZE), MAX_DATA_SIZE);
+        // 文件元数据：大小，文件名紧跟在握手选项之后；CRC32C随FIN到达
+        session->file_size = options->file_size;
+        session->batch_files = options->batch_files;
+        if (syn.data_len >= sizeof(HandshakeOptions) + options->name_length) {
+            session->file_name.assign(syn.data + sizeof(HandshakeOptions), options->name_length);
+        }
+    }
+    // 压缩传输的序列号与文件偏移不对应，进度文件无法记录，不续传
+    session->compressed = (syn.flags & COMPRESS) != 0;
+    if (session->compressed) {
+        transfer_id = 0;
+    }
+    session->fec = (syn.flags & PARITY) != 0;
+    session->window_scale = choose_window_scale(offered_scale, session->segment_size);
+
+    // 每个流负责文件中连续的stripe_packets个数据包；0号流就是握手所在的地址
+    // 已知文件大小时每个流的数据包数也就确定了，位图一次分配到位；压缩传输的序列号数取决于压缩结果，仍按需扩展
+    uint64_t total_packets = (session->file_size + session->segment_size - 1) / session->segment_size;
+    if (session->file_size > max_file_size) {
+        LOG_WARN("[session {}] Rejected SYN: file size {} exceeds the limit of {} bytes", session->number, session->file_size, max_file_size);
+        refuse_syn(syn, from, connection_id, s);
+        return;
+    }
+    if (session->file_size > 0 && !session->compressed &&
+        (total_packets >= UINT32_MAX || (stream_count > 1 && total_packets > (uint64_t)stripe_packets * stream_count))) {
+        LOG_WARN("[session {}] Rejected SYN: {} packets do not fit {} stream(s) of {} packets", session->number, total_packets, (int)stream_count, stripe_packets);
+        refuse_syn(syn, from, connection_id, s);
+        return;
+    }
+    session->streams.resize(stream_count);
+    for (uint8_t i = 0; i < stream_count; i++) {
+        SessionStream& stream = session->streams[i];
+        stream.first_packet = (uint64_t)i * stripe_packets;
+        if (session->file_size > 0 && !session->compressed) {
+            uint64_t remaining = total_packets > stream.first_packet ? total_packets - stream.first_packet : 0;
+            stream.packet_count = (uint32_t)(stream_count > 1 ? (std::min)(remaining, (uint64_t)stripe_packets) : remaining);
+            stream.received.reserve(stream.packet_count + 1);  // 序列号从1开始
+        }
+    }
+    session->streams[0].joined = true;
+    session->streams[0].key = session->key;
+    session->streams[0].peer = from;
+
+    // 带传输ID的上传按ID命名输出文件，同一个文件再次上传时找得到上次的进度
+    // 同一个传输ID的旧会话还在时先保存它的进度，等输出文件打开成功后再接管，打开失败时旧会话不受影响
+    bool resumed = false;
+    std::shared_ptr<Session> previous;
+    if (transfer_id != 0) {
+        previous = sessions.find_transfer(transfer_id);
+        if (previous) {
+            persist_progress(*previous);
+        }
+        char file_name[64];
+        snprintf(file_name, sizeof(file_name), "received_file_%016llx", (unsigned long long)transfer_id);
+        session->output_path = file_name;
+        session->transfer_id = transfer_id;
+        session->progress_active = true;
+        resumed = load_progress(progress_path(session->output_path), transfer_id, session->segment_size, session->stored_packets);
+        if (session->file_size > 0) {
+            session->stored_packets.reserve((uint32_t)total_packets);
+        }
+    }
+    else {
+        session->output_path = "received_file_" + std::to_string(session->number);
+    }
+    if (session->batch_files > 0) {
+        session->output_file.unpack_to(session->output_path + "_files");  // 批量传输拆分到输出文件旁边的目录
+    }
+    if (!session->output_file.open(session->output_path.c_str(), resumed, session->number, session->file_size)) {
+        LOG_ERROR("[session {}] Could not create output file", session->number);
+        refuse_syn(syn, from, connection_id, s);
+        return;
+    }
+    if (previous) {
+        take_over_transfer(previous);
+    }
+    if (resumed) {
+        for (uint8_t i = 0; i < stream_count; i++) {
+            restore_stream(session->streams[i], session->stored_packets, stream_count > 1 ? stripe_packets : UINT64_MAX);
+        }
+        for (uint64_t word : session->stored_packets.words()) {
+            for (; word != 0; word &= word - 1) {
+                session->resumed_packets++;
+            }
+        }
+    }
+
+    // 发送SYN-ACK，载荷携带选定的窗口缩放因子、采用的校验和模式、连接ID和接受的流数
+    Packet& syn_ack = session->syn_ack;
+    memset(&syn_ack, 0, sizeof(syn_ack));
+    syn_ack.flags = SYN | ACK;// 同时设置SYN和ACK标志
+    if (session->compressed) {
+        syn_ack.flags |= COMPRESS;  // 同意压缩传输
+    }
+    if (session->fec) {
+        syn_ack.flags |= PARITY;    // 同意FEC
+    }
+    syn_ack.ack_num = syn.seq_num + 1;
+    syn_ack.window_size = advertised_window(RECEIVE_WINDOW_SIZE, session->segment_size, session->window_scale);
+    syn_ack.data_len = sizeof(HandshakeOptions);
+    HandshakeOptions* options = reinterpret_cast<HandshakeOptions*>(syn_ack.data);
+    options->window_scale = session->window_scale;
+    options->checksum_mode = session->checksum_mode;
+    options->connection_id = connection_id;
+    options->stream_count = stream_count;
+    options->stripe_packets = stripe_packets;
+    options->transfer_id = transfer_id;
+    options->segment_size = session->segment_size;
+    if (resumed) {
+        // 续传：握手选项之后依次是每个流的起始序列号
+        uint32_t* resume_seq = reinterpret_cast<uint32_t*>(syn_ack.data + sizeof(HandshakeOptions));
+        for (uint8_t i = 0; i < stream_count; i++) {
+            resume_seq[i] = session->streams[i].expected_seq_num;
+        }
+        syn_ack.data_len += stream_count * sizeof(uint32_t);
+    }
+    syn_ack.checksum = calculate_checksum(&syn_ack);
+
+    sessions.insert(session);
+    send_packet_to(s, syn_ack, from);
+    {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &from.sin_addr, address, sizeof(address));
+        std::cout << "[session " << session->number << "] SYN from " << address << ":" << ntohs(from.sin_port)
+            << " (connection " << connection_id << ")";
+        if (session->file_size > 0) {
+            std::cout << ", file " << (session->file_name.empty() ? "?" : session->file_name) << " (" << session->file_size << " bytes)";
+        }
+        if (session->batch_files > 0) {
+            std::cout << ", batch of " << session->batch_files << " files";
+        }
+        std::cout << ", window scale " << (int)session->window_scale
+            << ", checksum " << (session->checksum_mode == CHECKSUM_CRC32C ? "CRC32C" : "Internet")
+            << ", segment " << session->segment_size << " bytes";
+        if (session->compressed) {
+            std::cout << ", compressed";
+        }
+        if (session->fec) {
+            std::cout << ", FEC";
+        }
+        if (stream_count > 1) {
+            std::cout << ", " << (int)stream_count << " streams of " << stripe_packets << " packets";
+        }
+        std::cout << ", writing " << session->output_path;
+        if (resumed) {
+            std::cout << " (resuming, " << session->resumed_packets << " packets already stored)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+/*
+ accept_join - 条带传输的附加流加入会话：记录流的地址，应答JOIN-ACK
+ JOIN-ACK丢失时客户端会重发JOIN，同一地址的重复JOIN再应答一次即可
+ */
+void accept_join(const Packet& join, const sockaddr_in& from, SOCKET s) {
+    if (join.data_len < sizeof(HandshakeOptions)) {
+        return;
+    }
+    uint32_t connection_id = reinterpret_cast<const HandshakeOptions*>(join.data)->connection_id;
+    std::shared_ptr<Session> session = sessions.find_connection(connection_id);
+    if (!session) {
+        LOG_DEBUG("JOIN for unknown connection {}, discarding.", connection_id);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    SessionKey key = make_session_key(from);
+    if (session->state == SESSION_CLOSED || join.stream_id == 0 || join.stream_id >= session->streams.size()) {
+        return;
+    }
+    SessionStream& stream = session->streams[join.stream_id];
+    if (stream.joined && !(stream.key == key)) {
+        return;  // 这个流已经由另一个地址加入
+    }
+    if (!stream.joined) {
+        stream.joined = true;
+        stream.key = key;
+        stream.peer = from;
+        sessions.insert_key(key, session);
+        LOG_INFO("[session {}] Stream {} joined.", session->number, join.stream_id);
+    }
+    session->last_activity = std::chrono::steady_clock::now();
+
+    Packet join_ack;
+    memset(&join_ack, 0, sizeof(join_ack));
+    join_ack.flags = JOIN | ACK;
+    join_ack.stream_id = join.stream_id;
+    join_ack.window_size = advertised_window(free_receive_window(*session), session->segment_size, session->window_scale);
+    join_ack.checksum = calculate_checksum(&join_ack);
+    send_packet_to(s, join_ack, from);
+}
+
+/*
+ transfer_complete - 文件是否已经完整接收
+ SYN给出了文件大小时才能判断：不压缩时每个流的期望序列号都越过了本流的最后一个数据包，压缩时解压后的字节数达到文件大小
+ 调用时必须持有session.mutex
+ */
+bool transfer_complete(const Session& session) {
+    if (session.file_size == 0) {
+        return false;
+    }
+    if (session.compressed) {
+        return session.raw_bytes >= session.file_size;
+    }
+    for (const SessionStream& stream : session.streams) {
+        if (stream.expected_seq_num <= stream.packet_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ complete_session - 文件完整接收：写线程写完剩余的数据后关闭输出文件，输出接收统计
+ 已知文件大小时在最后一个字节到达时调用，否则在所有流都结束时调用；会话照常应答之后的FIN
+ 进度文件保留到核对结束（report_verification），核对期间服务器停止时仍可续传
+ 调用时必须持有session.mutex
+ */
+void complete_session(Session& session) {
+    session.complete = true;
+    if (session.file_crc_known) {
+        close_output(session);
+    }
+
+    // 计算并输出接收统计
+    double duration_s = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - session.start_time).count() / 1e6;
+    std::ostringstream summary;
+    summary << "\n--- Reception Summary (session " << session.number << ") ---\n";
+    if (!session.file_name.empty()) {
+        summary << "File: " << session.file_name << " (" << session.file_size << " bytes)\n";
+    }
+    if (session.batch_files > 0) {
+        summary << "Batch: " << session.batch_files << " files, unpacked into " << session.output_path << "_files\n";
+    }
+    if (session.streams.size() > 1) {
+        summary << "Streams: " << session.streams.size() << "\n";
+    }
+    if (session.resumed_packets > 0) {
+        summary << "Resumed with " << session.resumed_packets << " packets already stored\n";
+    }
+    if (session.compressed && session.payload_bytes > 0) {
+        summary << "Compressed: " << session.payload_bytes / 1024.0 << " KB received, " << session.raw_bytes / 1024.0
+            << " KB written (ratio " << (double)session.raw_bytes / session.payload_bytes << ")\n";
+    }
+    if (session.fec) {
+        summary << "FEC: " << session.parity_packets << " parity packets received, " << session.recovered_packets << " packets recovered\n";
+    }
+    uint32_t duplicate_packets = 0;
+    for (const SessionStream& other : session.streams) {
+        duplicate_packets += other.duplicate_packets;
+    }
+    summary << "Total packets received: " << session.total_packets_received << "\n"
+        << "Out-of-order packets: " << session.out_of_order_packets << "\n"
+        << "Duplicate packets: " << duplicate_packets << "\n"
+        << "Reception time: " << duration_s << " seconds\n";
+    {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        std::cout << summary.str() << std::flush;
+    }
+}
+
+/*
+ send_fin_ack - 应答一个流的FIN
+ 核对结果已经得出时应答带结果的FIN-ACK；否则只应答ack_num为FIN序列号加1的ACK，发送方继续重发FIN等待结果
+ 调用时必须持有session.mutex
+ */
+void send_fin_ack(Session& session, uint8_t stream_id, SOCKET s) {
+    SessionStream& stream = session.streams[stream_id];
+    Packet fin_ack;
+    memset(&fin_ack, 0, sizeof(fin_ack));
+    fin_ack.flags = session.verdict_sent ? ACK | FIN : ACK;
+    fin_ack.stream_id = stream_id;
+    fin_ack.ack_num = stream.fin_seq + 1;
+    if (session.verdict_sent) {
+        fin_ack.data_len = sizeof(FinAckOptions);
+        reinterpret_cast<FinAckOptions*>(fin_ack.data)->status = (uint8_t)session.verdict;
+    }
+    fin_ack.checksum = calculate_checksum(&fin_ack, session.checksum_mode);
+    send_packet_to(s, fin_ack, stream.peer);
+}
+
+/*
+ report_verification - 所有流都结束、写线程核对完文件后：删除进度文件，向每个流应答带核对结果的FIN-ACK，输出结果
+ 核对失败时进度也一并删除：位图只说明数据包都已写入，说不出哪些字节有错，重新上传必须从头开始
+ 核对还在进行时什么也不做，之后重传的FIN或定期清理时再检查
+ 调用时必须持有session.mutex
+ @return true表示已经应答过核对结果
+ */
+bool report_verification(Session& session, SOCKET s) {
+    if (session.verdict_sent) {
+        return true;
+    }
+    VerifyState result = session.output_file.verify_state();
+    if (session.state != SESSION_CLOSED || result == VERIFY_PENDING) {
+        return false;
+    }
+    session.verdict_sent = true;
+    session.verdict = result == VERIFY_PASSED ? FIN_VERIFIED : result == VERIFY_FAILED ? FIN_CORRUPT : FIN_UNVERIFIED;
+    stop_progress(session, true);
+    for (uint8_t i = 0; i < session.streams.size(); i++) {
+        send_fin_ack(session, i, s);
+    }
+    {
+        std::lock_guard<std::mutex> lock(console_mutex);
+        std::cout << "[session " << session.number << "] "
+            << (session.verdict == FIN_CORRUPT ? "File received but does not match the sender's, the sender must upload it again." : "File received successfully.")
+            << std::endl;
+    }
+    uint32_t completed = ++sessions_completed;
+    if (session_limit > 0 && completed >= session_limit) {
+        server_stopping = true;
+    }
+    return true;
+}
+
+/*
+ finish_stream - 收到一个流的FIN：所有流都结束后会话进入CLOSED状态，暂时保留以应答重传的FIN
+ 每个流的FIN都带有整个文件的CRC32C，取第一个；文件已经完整接收时据此核对并关闭输出文件
+ 文件大小未知时到这里才算完整接收，关闭输出文件并输出统计信息
+ 核对结果得出之前FIN只得到不带FIN标志的ACK，结果得出后每个流都收到带结果的FIN-ACK（report_verification）
+ 调用时必须持有session.mutex
+ */
+void finish_stream(Session& session, uint8_t stream_id, const Packet& fin, SOCKET s) {
+    SessionStream& stream = session.streams[stream_id];
+    stream.fin_seq = fin.seq_num;
+    if (!session.file_crc_known && fin.data_len >= sizeof(FinOptions)) {
+        session.file_crc = reinterpret_cast<const FinOptions*>(fin.data)->file_crc;
+        session.file_crc_known = true;
+    }
+    if (session.complete && session.file_crc_known) {
+        close_output(session);
+    }
+    if (!stream.finished && stream.blocks.pending() > 0) {
+        LOG_WARN("[session {}] Stream {} finished with {} packets of incomplete compressed blocks", session.number, stream_id, stream.blocks.pending());
+    }
+    stream.finished = true;
+    if (session.state != SESSION_CLOSED) {
+        bool all_finished = true;
+        for (const SessionStream& other : session.streams) {
+            all_finished = all_finished && other.finished;
+        }
+        if (all_finished) {
+            session.state = SESSION_CLOSED;
+            if (!session.complete) {
+                complete_session(session);
+            }
+            close_output(session);  // 不会再有FIN带来CRC32C
+        }
+    }
+    bool reported = session.verdict_sent;
+    if (!report_verification(session, s) || reported) {
+        send_fin_ack(session, stream_id, s);  // 还有流在传输或写线程还在核对时只确认收到；已有结果时再应答一次
+    }
+}
+
+void receive_segment(Session& session, SessionStream& stream, const Packet& packet);
+
+/*
+ add_to_parity_group - 把第一次收到的数据包或一个校验包累加到所在的校验组
+ 校验包已到、组内恰好缺一个数据包时，累加结果就是缺失的数据包，按正常到达的数据包处理
+ 期望序列号越过的组一定已经完整，顺便清除
+ 调用时必须持有session.mutex
+ */
+void add_to_parity_group(Session& session, SessionStream& stream, const Packet& packet) {
+    while (!stream.parity_groups.empty() && stream.parity_groups.begin()->first + FEC_MAX_GROUP <= stream.expected_seq_num) {
+        stream.parity_groups.erase(stream.parity_groups.begin());
+    }
+    bool parity = (packet.flags & PARITY) != 0;
+    uint32_t first_seq = parity ? packet.seq_num : packet.ack_num;
+    if (first_seq == 0 || first_seq + FEC_MAX_GROUP <= stream.expected_seq_num) {
+        return;  // 组内的数据包都已收到
+    }
+    if (parity) {
+        if (packet.ack_num == 0 || packet.ack_num > FEC_MAX_GROUP || packet.seq_num + packet.ack_num <= stream.expected_seq_num) {
+            return;
+        }
+        ParityGroup& group = stream.parity_groups[first_seq];
+        if (group.packets != 0) {
+            return;  // 重复的校验包
+        }
+        group.packets = packet.ack_num;
+        group.sum.add(packet.data, packet.data_len, packet.window_size, (uint8_t)(packet.flags & ~PARITY));
+    }
+    else {
+        if (packet.seq_num - first_seq >= FEC_MAX_GROUP) {
+            return;
+        }
+        ParityGroup& group = stream.parity_groups[first_seq];
+        group.sum.add(packet.data, packet.data_len, packet.data_len, packet.flags);
+        group.sum.count++;
+    }
+
+    auto it = stream.parity_groups.find(first_seq);
+    ParityGroup& group = it->second;
+    if (group.packets == 0 || group.sum.count + 1 < group.packets) {
+        return;  // 校验包还没到，或缺不止一个
+    }
+    // 确认恰好缺一个：续传前已经收到的数据包不在累加结果中，此时不能恢复
+    uint32_t missing_seq = 0;
+    int missing_count = 0;
+    for (uint32_t seq = first_seq; seq != first_seq + group.packets; seq++) {
+        if (!stream.received.test(seq)) {
+            missing_seq = seq;
+            missing_count++;
+        }
+    }
+    if (missing_count != 1 || group.sum.count + 1 != group.packets || group.sum.len_xor > MAX_DATA_SIZE) {
+        if (missing_count == 0) {
+            stream.parity_groups.erase(it);
+        }
+        return;
+    }
+    Packet recovered;
+    recovered.seq_num = missing_seq;
+    recovered.ack_num = 0;  // 不再累加到校验组
+    recovered.flags = group.sum.flags_xor;
+    recovered.stream_id = packet.stream_id;
+    recovered.window_size = 0;
+    recovered.data_len = group.sum.len_xor;
+    recovered.checksum = 0;
+    memcpy(recovered.data, group.sum.data, recovered.data_len);
+    stream.parity_groups.erase(it);
+    session.recovered_packets++;
+    LOG_DEBUG("[session {}] Recovered SEQ={} from parity.", session.number, missing_seq);
+    receive_segment(session, stream, recovered);
+}
+
+/*
+ receive_segment - 处理一个数据包：按偏移写入文件，更新流的期望序列号，决定何时确认
+ 压缩传输时数据包先交给流的块重组器，凑齐一个块才写入；序列号和确认的处理与不压缩时相同
+ 使用FEC时第一次收到的数据包还要累加到校验组，可能因此恢复出组内缺失的数据包
+ 已知文件大小时收齐最后一个字节即完成会话；完成之后的数据包都按重复包处理，只用于重发ACK
+ 调用时必须持有session.mutex
+ */
+void receive_segment(Session& session, SessionStream& stream, const Packet& packet) {
+    stream.last_seq_num = packet.seq_num;
+
+    // 除每个流的最后一个包外数据包都满载，文件偏移由流的起始偏移和序列号直接确定
+    // 情况1和情况2：收到期望的数据包或接收窗口内的未来数据包，第一次收到时按偏移写入文件
+    bool in_window = !session.complete && packet.seq_num >= stream.expected_seq_num && packet.seq_num - stream.expected_seq_num < (uint32_t)RECEIVE_WINDOW_SIZE;
+    bool in_order = false;
+    bool first_receipt = in_window && stream.received.set(packet.seq_num);
+    if (first_receipt) {
+        session.payload_bytes += packet.data_len;
+        stream.unique_bytes += packet.data_len;
+        if (packet.seq_num < stream.highest_seq_num) {
+            stream.reorder_depth = (std::max)(stream.reorder_depth, stream.highest_seq_num - packet.seq_num);
+        }
+        if (session.compressed) {
+            // 凑齐的块交给写线程解压写入
+            std::vector<char> block;
+            if (stream.blocks.add(packet.seq_num, packet.data, packet.data_len, (packet.flags & BLOCK_START) != 0, session.segment_size, block)) {
+                CompressedBlockHeader header;
+                memcpy(&header, block.data(), sizeof(header));
+                session.raw_bytes += header.raw_length;
+                session.output_file.write_block(block);
+            }
+        }
+        else {
+            uint64_t packet_index = stream.first_packet + packet.seq_num - 1;
+            session.output_file.write(packet_index * session.segment_size, packet.data, packet.data_len);
+            session.raw_bytes += packet.data_len;
+            if (session.transfer_id != 0) {
+                session.stored_packets.set((uint32_t)packet_index);  // 保存进度前sync()保证它已经写入
+                session.progress_dirty = true;
+            }
+        }
+        stream.highest_seq_num = (std::max)(stream.highest_seq_num, packet.seq_num);
+        if (packet.seq_num == stream.expected_seq_num) {
+            // 按序到达：跳过位图中已经连续到达的后续数据包
+            stream.expected_seq_num = stream.received.next_missing(stream.expected_seq_num);
+            // 没有填补空洞（位图中后面没有已收到的包）时才算普通的按序到达
+            in_order = stream.expected_seq_num == packet.seq_num + 1;
+        }
+        else {
+            session.out_of_order_packets++;  // 乱序到达：已写入文件，等待前面的空洞被填上
+            stream.out_of_order_packets++;
+        }
+    }
+    else {
+        stream.duplicate_packets++;
+    }
+    // 情况3：收到重复的数据包（seq_num < expected_seq_num，或已写入过的乱序包），或超出接收窗口的包
+    // 直接忽略，仍然发送ACK
+
+    // 按序到达的数据包可以延迟确认；乱序、重复、填补空洞的数据包要立即确认，
+    // 发送方依靠这些ACK（和其中的SACK块）尽快发现丢包
+    if (in_order && stream.expected_seq_num > stream.highest_seq_num) {
+        if (stream.unacked_segments++ == 0) {
+            stream.ack_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DELAYED_ACK_TIMEOUT_MS);
+        }
+    }
+    else {
+        stream.ack_now = true;
+    }
+
+    if (first_receipt && transfer_complete(session)) {
+        complete_session(session);
+        stream.ack_now = true;  // 最后一个数据包立即确认，发送方不必等延迟确认
+    }
+    if (first_receipt && session.fec && packet.ack_num != 0) {
+        add_to_parity_group(session, stream, packet);
+    }
+}
+
+/*
+ handle_datagram - 按客户端地址把数据报分派给会话和流
+ SYN、JOIN和握手的最后一个ACK（不带数据的纯ACK）使用Internet校验和，其余数据包使用会话协商的校验和模式
+ @param data 数据报
+ @param len 数据报长度
+ @param from 来源地址
+ @param worker 当前工作线程，涉及的会话记入worker.touched，本批结束后统一决定是否发送ACK
+ */
+void handle_datagram(const char* data, int len, const sockaddr_in& from, Worker& worker) {
+    if (len < (int)offsetof(Packet, data)) {
+        return;  // 连头部都不完整
+    }
+    const Packet& packet = *reinterpret_cast<const Packet*>(data);
+    if (len < HEADER_SIZE + (int)packet.data_len) {
+        return;  // 数据报被截断，载荷不完整
+    }
+    SessionKey key = make_session_key(from);
+
+    // ========== 路径MTU探测 ==========
+    // 探测包不属于任何会话，只需报告收到的载荷长度
+    if (packet.flags & PROBE) {
+        if (verify_checksum(&packet)) {
+            Packet reply;
+            memset(&reply, 0, HEADER_SIZE);
+            reply.flags = PROBE | ACK;
+            reply.ack_num = packet.data_len;
+            reply.checksum = calculate_checksum(&reply);
+            send_packet_to(worker.socket, reply, from);
+        }
+        return;
+    }
+
+    // ========== 附加流加入 ==========
+    if (packet.flags & JOIN) {
+        if (verify_checksum(&packet)) {
+            accept_join(packet, from, worker.socket);
+        }
+        return;
+    }
+
+    std::shared_ptr<Session> session = sessions.find(key);
+
+    // ========== 新连接或重传的SYN ==========
+    if (packet.flags & SYN) {
+        if (!verify_checksum(&packet)) {
+            LOG_WARN("Corrupt SYN received, discarding.");
+            return;
+        }
+        uint32_t connection_id = 0;
+        if (packet.data_len >= sizeof(HandshakeOptions)) {
+            connection_id = reinterpret_cast<const HandshakeOptions*>(packet.data)->connection_id;
+        }
+        if (session) {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->connection_id == connection_id && session->state != SESSION_CLOSED) {
+                send_packet_to(worker.socket, session->syn_ack, from);  // SYN-ACK丢失，客户端重传了SYN
+                return;
+            }
+        }
+        accept_syn(packet, from, connection_id, worker.socket);  // 同一地址上的新连接替换旧会话
+        return;
+    }
+
+    if (!session) {
+        LOG_DEBUG("Packet SEQ={} from unknown peer, discarding.", packet.seq_num);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->last_activity = std::chrono::steady_clock::now();
+    bool handshake_ack = packet.flags == ACK && packet.data_len == 0;
+    if (!verify_checksum(&packet, handshake_ack ? CHECKSUM_INTERNET : session->checksum_mode)) {
+        LOG_WARN("[session {}] Corrupt packet received, discarding.", session->number);
+        return;  // 数据包损坏，丢弃
+    }
+    // 数据包必须来自它声明的流加入时的地址
+    uint8_t stream_id = packet.stream_id;
+    if (stream_id >= session->streams.size() || !session->streams[stream_id].joined || !(session->streams[stream_id].key == key)) {
+        LOG_DEBUG("[session {}] Packet for stream {} from wrong address, discarding.", session->number, stream_id);
+        return;
+    }
+    SessionStream& stream = session->streams[stream_id];
+
+    // ========== 握手的最后一个ACK ==========
+    if (handshake_ack) {
+        if (session->state == SESSION_SYN_RECEIVED) {
+            session->state = SESSION_ESTABLISHED;
+            LOG_INFO("[session {}] Connection established.", session->number);
+        }
+        return;
+    }
+
+    // ========== FIN（流关闭）==========
+    if (packet.flags & FIN) {
+        finish_stream(*session, stream_id, packet, worker.socket);
+        return;
+    }
+    if (session->state == SESSION_CLOSED || stream.finished) {
+        return;  // 流已关闭，迟到的数据包直接丢弃
+    }
+    // 握手的最后一个ACK丢失时，第一个数据包同样说明连接已经建立
+    session->state = SESSION_ESTABLISHED;
+
+    // ========== FEC校验包 ==========
+    if (packet.flags & PARITY) {
+        if (session->fec) {
+            session->parity_packets++;
+            add_to_parity_group(*session, stream, packet);
+            worker.touched.push_back(session);  // 可能恢复了数据包，需要确认
+        }
+        return;
+    }
+
+    // ========== 数据包 ==========
+    session->total_packets_received++;
+    stream.packets_received++;
+    receive_segment(*session, stream, packet);
+    worker.touched.push_back(session);
+}
+
+/*
+ flush_acks - 一批数据包处理完后，为涉及的会话和等待延迟确认的会话发送到期的ACK
+ 需要立即确认、累计到DELAYED_ACK_SEGMENTS个或延迟确认超时时发送；每个流一批最多一个ACK
+ @return 距离下一个延迟确认截止时间的毫秒数，没有等待确认的会话时返回-1
+ */
+int flush_acks(Worker& worker) {
+    std::vector<std::shared_ptr<Session>>& candidates = worker.pending;
+    candidates.insert(candidates.end(), worker.touched.begin(), worker.touched.end());
+    worker.touched.clear();
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<Session>> still_pending;
+    int timeout_ms = -1;
+    for (const std::shared_ptr<Session>& session : candidates) {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        bool pending = false;
+        for (size_t i = 0; i < session->streams.size(); i++) {
+            SessionStream& stream = session->streams[i];
+            if (stream.ack_now || stream.unacked_segments >= DELAYED_ACK_SEGMENTS ||
+                (stream.unacked_segments > 0 && now >= stream.ack_deadline)) {
+                send_ack(*session, stream, (uint8_t)i, worker.socket);
+            }
+            if (stream.unacked_segments > 0) {
+                pending = true;
+                int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(stream.ack_deadline - now).count();
+                remaining = (std::max)(remaining, 0);
+                timeout_ms = timeout_ms < 0 ? remaining : (std::min)(timeout_ms, remaining);
+            }
+        }
+        if (pending) {
+            still_pending.push_back(session);
+        }
+    }
+    worker.pending.swap(still_pending);
+    return timeout_ms;
+}
+
+/*
+ expire_sessions - 清除空闲超时的会话和已经结束足够久的会话
+ 空闲超时的会话先保存断点续传进度，客户端之后可以续传；已经结束的会话核对完文件后立即应答结果，不等下一个重传的FIN
+ 只由0号工作线程每秒调用一次
+ @param s 应答FIN-ACK用的套接字
+ */
+void expire_sessions(SOCKET s) {
+    auto now = std::chrono::steady_clock::now();
+    for (const std::shared_ptr<Session>& session : sessions.snapshot()) {
+        std::unique_lock<std::mutex> lock(session->mutex);
+        auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - session->last_activity).count();
+        bool done = session->state == SESSION_CLOSED || session->complete;  // 完整接收后只剩FIN要应答
+        report_verification(*session, s);
+        if (done ? idle_ms >= SESSION_CLOSED_LINGER_MS : idle_ms >= SESSION_IDLE_TIMEOUT_MS) {
+            if (!done) {
+                LOG_WARN("[session {}] Idle for {} ms, dropping.", session->number, (int64_t)idle_ms);
+                lock.unlock();
+                persist_progress(*session);
+                lock.lock();
+                stop_progress(*session, false);
+            }
+            else if (session->complete) {
+                close_output(*session);  // 完整接收但FIN一直没有到达
+            }
+            sessions.erase(session);
+        }
+    }
+}
+
+/*
+ worker_housekeeping - 每批数据包之后的收尾：发送到期的ACK，0号线程定期清理会话
+ @return 下一次接收最多等待的毫秒数
+ */
+int worker_housekeeping(Worker& worker) {
+    const int MAX_WAIT_MS = 100;  // 不超过这个时间检查一次退出标志
+    int timeout_ms = flush_acks(worker);
+    auto now = std::chrono::steady_clock::now();
+    if (worker.index == 0 && now >= worker.next_expiry_check) {
+        expire_sessions(worker.socket);
+        worker.next_expiry_check = now + std::chrono::seconds(1);
     }
+    return timeout_ms < 0 ? MAX_WAIT_MS : (std::min)(timeout_ms, MAX_WAIT_MS);
+}
+
+#ifdef _WIN32
+// ========== Windows：IOCP工作线程池 ==========
 
-    SOCKET server_socket;
-    sockaddr_in server_addr, client_addr;
-    int client_addr_len = sizeof(client_addr);
+// 一个投递在IOCP上的接收请求
+struct IocpReceive {
+    OVERLAPPED overlapped;
+    WSABUF buffer;
+    char data[MAX_BUFFER_SIZE];
+    sockaddr_in from;
+    INT from_len;
+    DWORD flags;
+};
 
-    // ========== 创建UDP套接字 ==========
-    if ((server_socket = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
+// 投递一个异步接收请求，完成时由任意一个工作线程取回
+bool post_receive(SOCKET s, IocpReceive* request) {
+    memset(&request->overlapped, 0, sizeof(request->overlapped));
+    request->buffer.buf = request->data;
+    request->buffer.len = sizeof(request->data);
+    request->from_len = sizeof(request->from);
+    request->flags = 0;
+    int result = WSARecvFrom(s, &request->buffer, 1, NULL, &request->flags, (sockaddr*)&request->from, &request->from_len, &request->overlapped, NULL);
+    return result == 0 || WSAGetLastError() == WSA_IO_PENDING;
+}
+
+/*
+ iocp_worker - IOCP工作线程：一次取回一批完成的接收请求，处理后重新投递
+ 同一个会话的数据包可能被不同线程取回，由会话锁串行化
+ */
+void iocp_worker(int index, SOCKET s, HANDLE iocp) {
+    Worker worker;
+    worker.index = index;
+    worker.socket = s;
+    OVERLAPPED_ENTRY entries[RECV_BATCH_SIZE];
+    int timeout_ms = 0;
+    while (!server_stopping) {
+        ULONG count = 0;
+        if (GetQueuedCompletionStatusEx(iocp, entries, RECV_BATCH_SIZE, &count, (DWORD)timeout_ms, FALSE)) {
+            for (ULONG i = 0; i < count; i++) {
+                IocpReceive* request = CONTAINING_RECORD(entries[i].lpOverlapped, IocpReceive, overlapped);
+                if (request->overlapped.Internal == 0) {  // STATUS_SUCCESS
+                    handle_datagram(request->data, (int)entries[i].dwNumberOfBytesTransferred, request->from, worker);
+                }
+                post_receive(s, request);
+            }
+        }
+        timeout_ms = worker_housekeeping(worker);
+    }
+}
+
+/*
+ run_workers - 创建重叠I/O套接字并关联到IOCP，预先投递接收请求，启动工作线程
+ */
+void run_workers(int worker_count) {
+    SOCKET s = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if (s == INVALID_SOCKET) {
         die("Could not create socket");
     }
+    // 对端端口不可达时不要让后续的接收失败（WSAECONNRESET）
+    BOOL report_reset = FALSE;
+    DWORD bytes = 0;
+    WSAIoctl(s, SIO_UDP_CONNRESET, &report_reset, sizeof(report_reset), NULL, 0, &bytes, NULL, NULL);
 
-    // ========== 准备服务器地址结构 ==========
+    sockaddr_in server_addr = {};
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;  // 监听所有网络接口
     server_addr.sin_port = htons(SERVER_PORT);  // 绑定到8888端口
-
-    // ========== 绑定套接字 ==========
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+    if (bind(s, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
         die("Bind failed");
     }
-    std::cout << "Server listening on port " << SERVER_PORT << std::endl;
-
-    // ========== 三次握手接受连接 ==========
-    Packet recv_packet, send_packet;
-    std::cout << "Waiting for SYN..." << std::endl;
-    
-    // 第一步：接收客户端的SYN
-    recvfrom(server_socket, (char*)&recv_packet, MAX_BUFFER_SIZE, 0, (struct sockaddr*)&client_addr, &client_addr_len);
-    if (recv_packet.flags & SYN) {
-        std::cout << "SYN received. Sending SYN-ACK..." << std::endl;
-        
-        // 第二步：发送SYN-ACK
-        send_packet = { 0 };
-        send_packet.flags = SYN | ACK;// 同时设置SYN和ACK标志
-        send_packet.ack_num = recv_packet.seq_num + 1;
-        send_packet.checksum = calculate_checksum(&send_packet);
-        sendto(server_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&client_addr, client_addr_len);
-
-        // 第三步：接收最终ACK
-        recvfrom(server_socket, (char*)&recv_packet, MAX_BUFFER_SIZE, 0, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (recv_packet.flags & ACK) {
-            std::cout << "Connection established." << std::endl;
-        }
-    }
-
-    // ========== 文件接收逻辑 ==========
-    std::ofstream output_file("received_file", std::ios::binary);  // 以二进制模式写入文件
-    uint32_t expected_seq_num = 1;  // 期望接收的序列号（从1开始）
-    std::map<uint32_t, Packet> receive_buffer; // 乱序包缓冲区：<序列号, 数据包>
-    uint32_t total_packets_received = 0;  // 总接收包数
-    uint32_t out_of_order_packets = 0;    // 乱序包数量
-    auto start_time = std::chrono::high_resolution_clock::now();  // 记录开始时间
-
-    while (true) {
-        // 接收数据包
-        int recv_len = recvfrom(server_socket, (char*)&recv_packet, MAX_BUFFER_SIZE, 0, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (recv_len <= 0) continue;  // 接收失败，跳过
-
-        // ========== 步骤1：验证校验和 ==========
-        if (!verify_checksum(&recv_packet)) {
-            std::cerr << "Corrupt packet received, discarding." << std::endl;
-            continue;  // 数据包损坏，丢弃
-        }
-
-        // ========== 步骤2：检查FIN标志（连接关闭）==========
-        if (recv_packet.flags & FIN) {
-            std::cout << "FIN received. Sending ACK and closing." << std::endl;
-            
-            // 发送FIN-ACK
-            send_packet = { 0 };
-            send_packet.flags = ACK | FIN;
-            send_packet.ack_num = recv_packet.seq_num + 1;
-            send_packet.checksum = calculate_checksum(&send_packet);
-            sendto(server_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&client_addr, client_addr_len);
-            
-            // 计算并输出接收统计
-            auto end_time = std::chrono::high_resolution_clock::now();
-            double duration_s = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count() / 1e6;
-            std::cout << "\n--- Reception Summary ---" << std::endl;
-            std::cout << "Total packets received: " << total_packets_received << std::endl;
-            std::cout << "Out-of-order packets: " << out_of_order_packets << std::endl;
-            std::cout << "Reception time: " << duration_s << " seconds" << std::endl;
-            
-            break;  // 退出接收循环
-        }
-
-        total_packets_received++;
-
-        // ========== 步骤3：选择确认逻辑 ==========
-        
-        // 情况1：收到期望的数据包（按序到达）
-        if (recv_packet.seq_num == expected_seq_num) {
-            // 写入数据到文件
-            output_file.write(recv_packet.data, recv_packet.data_len);
-            expected_seq_num++;  // 期望序列号+1
-
-            // 检查缓冲区中是否有连续的后续数据包
-            while (receive_buffer.count(expected_seq_num)) {  // count()检查map中是否存在expected_seq_num这个键，存在返回1，不存在返回0
-                Packet buffered_packet = receive_buffer[expected_seq_num];  // 从缓存中取出该序列号对应的数据包
-                output_file.write(buffered_packet.data, buffered_packet.data_len);  // 将缓存的数据包写入文件
-                receive_buffer.erase(expected_seq_num);  // 从缓冲区删除已写入的数据包释放内存
-                expected_seq_num++;  // 期望序列号+1，继续检查下一个连续的包
-            }  // 循环结束条件：缓存中不存在expected_seq_num，说明出现了间隙
-        }
-        // 情况2：收到未来的数据包（乱序到达）
-        else if (recv_packet.seq_num > expected_seq_num) {
-            // 将乱序包存入缓冲区，等待前面的包到达
-            receive_buffer[recv_packet.seq_num] = recv_packet;
-            out_of_order_packets++;
-        }
-        // 情况3：收到重复的旧数据包（seq_num < expected_seq_num）
-        // 直接忽略，仍然发送ACK
-
-        // ========== 步骤4：发送ACK确认 ==========
-        // 始终发送当前已按序接收的最高序列号
-        std::cout << "Received SEQ=" << recv_packet.seq_num << ". Sending ACK for SEQ=" << expected_seq_num - 1 << std::endl;
-        send_packet = { 0 };
-        send_packet.flags = ACK;
-        send_packet.ack_num = expected_seq_num - 1;  // ACK = 已按序接收的最高序列号
-        send_packet.checksum = calculate_checksum(&send_packet);
-        sendto(server_socket, (const char*)&send_packet, HEADER_SIZE, 0, (struct sockaddr*)&client_addr, client_addr_len);
-    }
-
-    output_file.close();
-    std::cout << "File received successfully." << std::endl;
-
-    closesocket(server_socket);
+    HANDLE iocp = CreateIoCompletionPort((HANDLE)s, NULL, 0, worker_count);
+    if (iocp == NULL) {
+        die("CreateIoCompletionPort failed");
+    }
+    std::vector<std::unique_ptr<IocpReceive>> requests;
+    for (int i = 0; i < worker_count * RECV_BATCH_SIZE; i++) {
+        requests.emplace_back(new IocpReceive());
+        post_receive(s, requests.back().get());
+    }
+    std::cout << "Server listening on port " << SERVER_PORT << " (IOCP, " << worker_count << " workers)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < worker_count; i++) {
+        threads.emplace_back(iocp_worker, i, s, iocp);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    closesocket(s);  // 取消还在等待的接收请求
+    CloseHandle(iocp);
+}
+#else
+// ========== POSIX：每个工作线程一个SO_REUSEPORT套接字 ==========
+
+/*
+ socket_worker - 在自己的套接字上批量接收，内核按四元组哈希把同一客户端的数据报固定交给同一个套接字
+ */
+void socket_worker(int index, SOCKET s) {
+    Worker worker;
+    worker.index = index;
+    worker.socket = s;
+    BatchSocket batch_io;
+    batch_io.open(s);
+    int timeout_ms = 0;
+    while (!server_stopping) {
+        int count = batch_io.receive(timeout_ms);
+        for (int i = 0; i < count; i++) {
+            const ReceivedDatagram& dg = batch_io.datagram(i);
+            handle_datagram(dg.data, dg.len, dg.from, worker);
+        }
+        timeout_ms = worker_housekeeping(worker);
+    }
+}
+
+// 创建并绑定一个监听套接字；reuse_port为true时允许多个套接字绑定同一端口
+SOCKET open_listen_socket(bool reuse_port) {
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+#ifdef SO_REUSEPORT
+    int one = 1;
+    if (reuse_port && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+#else
+    if (reuse_port) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+#endif
+    sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;  // 监听所有网络接口
+    server_addr.sin_port = htons(SERVER_PORT);  // 绑定到8888端口
+    if (bind(s, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+/*
+ run_workers - 为每个工作线程打开一个SO_REUSEPORT套接字；不支持时所有线程共享一个套接字
+ */
+void run_workers(int worker_count) {
+    std::vector<SOCKET> sockets;
+    for (int i = 0; i < worker_count && worker_count > 1; i++) {
+        SOCKET s = open_listen_socket(true);
+        if (s == INVALID_SOCKET) {
+            for (SOCKET opened : sockets) {
+                closesocket(opened);
+            }
+            sockets.clear();
+            break;
+        }
+        sockets.push_back(s);
+    }
+    bool reuse_port = !sockets.empty();
+    if (!reuse_port) {
+        SOCKET s = open_listen_socket(false);
+        if (s == INVALID_SOCKET) {
+            die("Bind failed");
+        }
+        sockets.push_back(s);
+    }
+    std::cout << "Server listening on port " << SERVER_PORT << " (" << worker_count << " workers, "
+        << (reuse_port ? "SO_REUSEPORT" : "shared socket") << ")" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < worker_count; i++) {
+        threads.emplace_back(socket_worker, i, sockets[i % sockets.size()]);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    for (SOCKET s : sockets) {
+        closesocket(s);
+    }
+}
+#endif
+
+// 接收方遥测的数值列，顺序与sample_sessions填写的一致
+const std::vector<std::string> STREAM_TELEMETRY_COLUMNS = {
+    "expected_seq", "highest_seq", "hole_span", "packets_received", "duplicate_packets", "out_of_order_packets",
+    "reorder_depth", "acks_sent", "parity_recovered", "goodput_mbps", "write_backlog_kb",
+};
+
+/*
+ sample_sessions - 采集所有会话每个流的遥测样本
+ 在采样线程中调用，逐个短暂持有会话锁；条带传输的会话在表中有多个键，只采样一次
+ hole_span为期望序列号到已收到的最大序列号之间的跨度（接收窗口中被空洞占住的部分），
+ goodput按两次采样之间第一次收到的载荷字节数计算，不含重复的数据包；write_backlog_kb是整个会话的写入积压
+ @param rows 输出：每个会话的每个流一行
+ */
+void sample_sessions(std::vector<TelemetryRow>& rows) {
+    std::vector<std::shared_ptr<Session>> all = sessions.snapshot();
+    std::unordered_set<Session*> seen;
+    for (const std::shared_ptr<Session>& session : all) {
+        if (!seen.insert(session.get()).second) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(session->mutex);
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < session->streams.size(); i++) {
+            SessionStream& stream = session->streams[i];
+            if (!stream.joined) {
+                continue;
+            }
+            if (stream.sampled_time == std::chrono::steady_clock::time_point()) {
+                stream.sampled_time = session->start_time;
+            }
+            double interval_s = std::chrono::duration<double>(now - stream.sampled_time).count();
+            double goodput_mbps = interval_s > 0 ? (stream.unique_bytes - stream.sampled_bytes) * 8 / interval_s / 1e6 : 0;
+            stream.sampled_bytes = stream.unique_bytes;
+            stream.sampled_time = now;
+            uint32_t hole_span = stream.highest_seq_num >= stream.expected_seq_num ? stream.highest_seq_num - stream.expected_seq_num + 1 : 0;
+            rows.emplace_back();
+            TelemetryRow& row = rows.back();
+            row.id = "session " + std::to_string(session->number) + "/" + std::to_string(i);
+            row.state = session_state_name(session->state);
+            row.values = {
+                (double)stream.expected_seq_num, (double)stream.highest_seq_num, (double)hole_span,
+                (double)stream.packets_received, (double)stream.duplicate_packets, (double)stream.out_of_order_packets,
+                (double)stream.reorder_depth, (double)stream.acks_sent, (double)session->recovered_packets, goodput_mbps,
+                session->output_file.backlog() / 1024.0,
+            };
+            stream.reorder_depth = 0;
+        }
+    }
+}
+
+/*
+ @param argc 命令行参数个数
+ @param argv 命令行参数数组：--workers=<n>（工作线程数，默认为CPU核数），
+             --sessions=<n>（完成n个会话后退出，默认一直运行），--log=<level>（日志级别，默认info），
+             --trace=<file>（遥测轨迹文件，.json/.jsonl为JSON Lines，否则为CSV），--trace-interval=<ms>（采样间隔，默认100毫秒），
+             --stats-port=<port>（遥测统计端点，在127.0.0.1的这个TCP端口上返回最近一次采样的JSON）
+             --max-file-size=<MB>（接受的最大文件，默认65536 MB）
+ 流程：
+    1. 启动工作线程，每个线程接收数据报并按客户端地址分派给会话
+    2. 三次握手创建会话，每个会话写入自己的输出文件received_file_<编号>
+    3. 接收数据包，处理乱序，写入文件，发送（延迟）ACK确认
+    4. 收到FIN后应答并关闭会话
+ */
+int main(int argc, char* argv[]) {
+    // ========== 参数检查 ==========
+    int worker_count = (int)(std::max)(1u, std::thread::hardware_concurrency());
+    const char* trace_path = nullptr;
+    int trace_interval_ms = TELEMETRY_DEFAULT_INTERVAL_MS;
+    int stats_port = 0;
+    for (int i = 1; i < argc; i++) {
+        int log_level;
+        if (strncmp(argv[i], "--log=", 6) == 0 && parse_log_level(argv[i] + 6, log_level)) {
+            async_logger().set_level(log_level);
+        }
+        else if (strncmp(argv[i], "--workers=", 10) == 0 && atoi(argv[i] + 10) > 0) {
+            worker_count = atoi(argv[i] + 10);
+        }
+        else if (strncmp(argv[i], "--sessions=", 11) == 0 && atoi(argv[i] + 11) >= 0) {
+            session_limit = (uint32_t)atoi(argv[i] + 11);
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+            trace_path = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--trace-interval=", 17) == 0 && atoi(argv[i] + 17) > 0) {
+            trace_interval_ms = atoi(argv[i] + 17);
+        }
+        else if (strncmp(argv[i], "--max-file-size=", 16) == 0 && atoll(argv[i] + 16) > 0) {
+            max_file_size = (uint64_t)atoll(argv[i] + 16) << 20;
+        }
+        else if (strncmp(argv[i], "--stats-port=", 13) == 0 && atoi(argv[i] + 13) > 0 && atoi(argv[i] + 13) <= 65535) {
+            stats_port = atoi(argv[i] + 13);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--workers=<n>] [--sessions=<n>] [--trace=<file>] [--trace-interval=<ms>] [--stats-port=<port>] [--max-file-size=<MB>] [--log=<trace|debug|info|warn|error|off>]" << std::endl;
+            return 1;
+        }
+    }
+    async_logger().start();
+
+    // ========== 初始化Winsock ==========
+    if (!initialize_winsock()) {
+        return 1;
+    }
+
+    Telemetry telemetry;
+    if ((trace_path != nullptr || stats_port != 0) &&
+        !telemetry.start(trace_path, stats_port, trace_interval_ms, STREAM_TELEMETRY_COLUMNS, sample_sessions)) {
+        std::cerr << "Could not start telemetry (trace file or stats port unavailable)." << std::endl;
+        return 1;
+    }
+
+    std::thread saver(progress_saver);
+    run_workers(worker_count);
+    saver.join();
+    // 等所有会话的写线程写完已经收到的数据
+    for (const std::shared_ptr<Session>& session : sessions.snapshot()) {
+        session->output_file.stop();
+    }
+    telemetry.stop();
+
+    async_logger().stop();
+    std::cout << "Server stopped after " << sessions_completed.load() << " sessions." << std::endl;
     cleanup_winsock();
     return 0;
 }
@@ -0,0 +1,276 @@
+﻿/*
+ session.h - 会话表
+ 服务器同时接收多个客户端的上传，每个连接的接收状态保存在独立的Session中
+ 会话表按客户端地址分片加锁，不同客户端的数据包可以由不同工作线程并行处理
+ 条带传输的会话有多个流，每个流来自客户端的一个地址，各自维护接收位图和延迟确认状态
+ 带传输ID的会话另外按文件中的数据包下标记录已写入的数据包，定期保存为断点续传的进度文件
+ 压缩传输的会话每个流另有一个块重组器，数据包凑成完整的压缩块后才解压写入
+ 使用FEC的会话每个流按校验组累加收到的数据包和校验包，用于恢复组内唯一缺失的数据包
+ 每个流另有供遥测采样的计数器，只在持有会话锁时读写
+ 输出文件由会话自己的写线程写入，数据包处理只把载荷交给它
+ SYN给出文件大小时接收位图一次分配到位，收齐最后一个字节时会话即告完成，不必等待FIN
+ */
+
+#pragma once
+
+#include "../rdt/common.h"
+#include "disk_writer.h"
+#include "recv_bitmap.h"
+#include "progress.h"
+#include "block_assembler.h"
+#include "../rdt/fec.h"
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ========== 会话常量 ==========
+const int SESSION_SHARDS = 64;                 // 会话表的分片数（每片一把锁）
+const int SESSION_IDLE_TIMEOUT_MS = 60000;     // 超过这么久没有收到任何数据包的会话被清除
+const int SESSION_CLOSED_LINGER_MS = 5000;     // 已结束的会话保留这么久，用于应答重传的FIN
+
+enum SessionState {
+    SESSION_SYN_RECEIVED,  // 已发送SYN-ACK，等待握手的最后一个ACK
+    SESSION_ESTABLISHED,   // 正在接收数据
+    SESSION_CLOSED,        // 已确认FIN，暂时保留以应答重传的FIN
+};
+
+inline const char* session_state_name(SessionState state) {
+    switch (state) {
+    case SESSION_SYN_RECEIVED: return "SYN_RECEIVED";
+    case SESSION_ESTABLISHED: return "ESTABLISHED";
+    case SESSION_CLOSED: return "CLOSED";
+    }
+    return "?";
+}
+
+// 会话表的键：客户端地址和端口
+// 握手中的连接ID用来区分同一地址发起的新连接和当前连接重传的握手包
+struct SessionKey {
+    uint32_t address;  // 网络字节序
+    uint16_t port;     // 网络字节序
+
+    bool operator==(const SessionKey& other) const { return address == other.address && port == other.port; }
+};
+
+inline SessionKey make_session_key(const sockaddr_in& addr) {
+    SessionKey key;
+    key.address = addr.sin_addr.s_addr;
+    key.port = addr.sin_port;
+    return key;
+}
+
+struct SessionKeyHash {
+    size_t operator()(const SessionKey& key) const {
+        uint64_t h = ((uint64_t)key.address << 16) | key.port;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;  // 64位混合，使相邻端口分散到不同分片
+        h ^= h >> 33;
+        return (size_t)h;
+    }
+};
+
+// FEC校验组的接收状态：累加收到的数据包和校验包
+struct ParityGroup {
+    ParityAccumulator sum;     // sum.count为已累加的数据包数
+    uint32_t packets = 0;      // 组内数据包数，由校验包给出；0表示校验包还没到
+};
+
+// 会话中一个流的接收状态：序列号、接收位图和延迟确认都按流独立
+struct SessionStream {
+    bool joined = false;    // 0号流随握手加入，其余的流收到JOIN后加入
+    bool finished = false;  // 已收到本流的FIN
+    uint32_t fin_seq = 0;   // 本流FIN的序列号，带核对结果的FIN-ACK确认它
+    SessionKey key;         // 本流的客户端地址
+    sockaddr_in peer;
+    uint64_t first_packet = 0;  // 本流1号数据包在文件中的数据包下标（文件偏移 / 分段大小）
+    uint32_t packet_count = 0;  // 本流负责的数据包数；文件大小未知或压缩传输时为0，不使用
+
+    RecvBitmap received;
+    uint32_t expected_seq_num = 1;
+    uint32_t highest_seq_num = 0;
+    BlockAssembler blocks;  // 压缩传输：还没凑成块的数据包
+    std::map<uint32_t, ParityGroup> parity_groups;  // FEC：按组内第一个序列号索引的未完成校验组
+
+    // 延迟确认
+    int unacked_segments = 0;      // 已接收但还没有确认的按序数据包数
+    bool ack_now = false;          // 刚收到需要立即确认的数据包
+    uint32_t last_seq_num = 0;     // 最近收到的数据包序列号，只用于输出
+    std::chrono::steady_clock::time_point ack_deadline;  // 第一个未确认数据包到达后DELAYED_ACK_TIMEOUT_MS
+
+    // 遥测计数
+    uint32_t packets_received = 0;      // 收到的数据包（含重复，不含校验包恢复的）
+    uint32_t duplicate_packets = 0;     // 重复的或超出接收窗口的数据包
+    uint32_t out_of_order_packets = 0;  // 第一次收到时不是期望序列号的数据包
+    uint32_t acks_sent = 0;
+    uint64_t unique_bytes = 0;          // 第一次收到的载荷字节数
+    uint32_t reorder_depth = 0;         // 本采样间隔内迟到的数据包比已收到的最大序列号小多少，取最大值；采样后清零
+    uint64_t sampled_bytes = 0;         // 上次采样时的unique_bytes
+    std::chrono::steady_clock::time_point sampled_time;  // 上次采样的时间
+};
+
+// 单个连接的接收状态，所有字段都由mutex保护
+struct Session {
+    std::mutex mutex;
+    SessionKey key;              // 0号流（握手所在）的客户端地址
+    uint32_t connection_id = 0;  // 客户端在SYN中给出的连接ID
+    uint32_t number = 0;  // 本地会话编号，用于输出文件名
+    SessionState state = SESSION_SYN_RECEIVED;
+    uint8_t window_scale = 0;
+    ChecksumMode checksum_mode = CHECKSUM_INTERNET;
+    uint16_t segment_size = DEFAULT_SEGMENT_SIZE;  // 握手协商的分段大小
+    bool compressed = false;        // 协商了压缩传输
+    bool fec = false;               // 协商了FEC
+    Packet syn_ack;                 // 收到重传的SYN时原样重发
+    std::string file_name;          // SYN中给出的文件名，只用于输出
+    uint64_t file_size = 0;         // SYN中给出的文件大小，0表示未知（只有FIN能结束会话）
+    uint32_t file_crc = 0;          // FIN中给出的整个文件的CRC32C
+    bool file_crc_known = false;    // 已经收到带CRC32C的FIN
+    uint32_t batch_files = 0;       // 批量传输的文件数，0表示单个文件
+    bool complete = false;          // 文件已经完整接收，之后的数据包都按重复包处理
+
+    DiskWriter output_file;         // 写线程，自带锁
+    bool output_closed = false;     // 已经让写线程关闭输出文件
+    bool verdict_sent = false;      // 已经向每个流应答带核对结果的FIN-ACK
+    FinStatus verdict = FIN_UNVERIFIED;  // 核对结果，verdict_sent之后有效
+    std::string output_path;
+    std::vector<SessionStream> streams;  // 下标即stream_id，不使用条带传输时只有一个
+    uint32_t total_packets_received = 0;
+    uint32_t out_of_order_packets = 0;
+    uint32_t parity_packets = 0;     // 收到的FEC校验包数
+    uint32_t recovered_packets = 0;  // 由校验包恢复的数据包数
+    uint64_t payload_bytes = 0;   // 收到的载荷字节数（不含重复的数据包）
+    uint64_t raw_bytes = 0;       // 交给写线程的字节数；压缩传输时为解压后的字节数
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point last_activity;
+
+    // 断点续传
+    uint64_t transfer_id = 0;       // 客户端在SYN中给出的传输ID，0表示不续传
+    RecvBitmap stored_packets;      // 按文件中的数据包下标记录已写入的数据包
+    uint64_t resumed_packets = 0;   // 会话开始时进度文件中已有的数据包数
+    bool progress_dirty = false;    // 上次保存进度之后又写入了数据包
+    // 保存进度时在会话锁之外等待写线程写完并刷新输出文件，由progress_mutex与关闭输出文件互斥
+    std::mutex progress_mutex;
+    bool progress_active = false;   // 进度仍需保存；会话结束或被接管后为false（由progress_mutex保护）
+};
+
+/*
+ SessionTable - 按键哈希分片的会话表
+ 查找只锁一个分片，服务不同客户端的工作线程之间不会互相等待
+ 会话以shared_ptr保存：即使另一个线程把会话从表中删除，已经取得它的线程仍可安全使用
+ 条带传输的会话在表中有多个键（每个流一个），另按连接ID索引，供附加流的JOIN查找
+ 加锁顺序总是先会话锁、后分片锁
+ */
+class SessionTable {
+public:
+    std::shared_ptr<Session> find(const SessionKey& key) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(key);
+        return it == shard.sessions.end() ? nullptr : it->second;
+    }
+
+    std::shared_ptr<Session> find_connection(uint32_t connection_id) {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        auto it = connections_.find(connection_id);
+        return it == connections_.end() ? nullptr : it->second;
+    }
+
+    // 正在接收某个传输ID的会话；客户端重新连接续传时由新会话接管
+    std::shared_ptr<Session> find_transfer(uint64_t transfer_id) {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        auto it = transfers_.find(transfer_id);
+        return it == transfers_.end() ? nullptr : it->second;
+    }
+
+    // 插入会话，替换同一个键、同一个连接ID、同一个传输ID原有的会话
+    void insert(const std::shared_ptr<Session>& session) {
+        insert_key(session->key, session);
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_[session->connection_id] = session;
+        if (session->transfer_id != 0) {
+            transfers_[session->transfer_id] = session;
+        }
+    }
+
+    // 让附加流的地址也指向会话
+    void insert_key(const SessionKey& key, const std::shared_ptr<Session>& session) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.sessions[key] = session;
+    }
+
+    // 删除会话的所有键；表中的键已经指向别的会话时保留。调用时必须持有session->mutex
+    void erase(const std::shared_ptr<Session>& session) {
+        erase_key(session->key, session);
+        for (const SessionStream& stream : session->streams) {
+            if (stream.joined) {
+                erase_key(stream.key, session);
+            }
+        }
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        auto it = connections_.find(session->connection_id);
+        if (it != connections_.end() && it->second == session) {
+            connections_.erase(it);
+        }
+        auto transfer = transfers_.find(session->transfer_id);
+        if (transfer != transfers_.end() && transfer->second == session) {
+            transfers_.erase(transfer);
+        }
+    }
+
+    // 复制出所有会话，调用者可以逐个加锁处理，不必持有分片锁
+    std::vector<std::shared_ptr<Session>> snapshot() {
+        std::vector<std::shared_ptr<Session>> all;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& entry : shard.sessions) {
+                all.push_back(entry.second);
+            }
+        }
+        // 条带传输的会话有多个键，去掉重复
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+        return all;
+    }
+
+    // 表中的键数，条带传输的会话每个流占一个
+    size_t size() {
+        size_t total = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.sessions.size();
+        }
+        return total;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<SessionKey, std::shared_ptr<Session>, SessionKeyHash> sessions;
+    };
+
+    Shard& shard_for(const SessionKey& key) {
+        return shards_[SessionKeyHash()(key) % SESSION_SHARDS];
+    }
+
+    // 表中该键仍然对应这个会话时才删除
+    void erase_key(const SessionKey& key, const std::shared_ptr<Session>& session) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(key);
+        if (it != shard.sessions.end() && it->second == session) {
+            shard.sessions.erase(it);
+        }
+    }
+
+    Shard shards_[SESSION_SHARDS];
+    std::mutex connections_mutex_;  // 同时保护下面两个索引
+    std::unordered_map<uint32_t, std::shared_ptr<Session>> connections_;  // 连接ID -> 会话
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> transfers_;    // 传输ID -> 会话
+};